@@ -45,6 +45,7 @@ static const char rcsid[] = "$Id: os_unix.c,v 1.38 2003/06/22 00:16:43 robs Exp
 #include <sys/time.h>
 #include <sys/un.h>
 #include <signal.h>
+#include <poll.h>
 
 #ifdef HAVE_NETDB_H
 #include <netdb.h>
@@ -1176,6 +1177,18 @@ int OS_Accept(int listen_sock, int fail_on_intr, const char *webServerAddrs)
                      && ! shutdownPending);
 
             if (socket < 0) {
+                if ((errno == EAGAIN || errno == EWOULDBLOCK) && ! shutdownPending) {
+                    /* The listening socket is shared with a non-blocking
+                     * worker engine: wait until it is readable again. */
+                    struct pollfd pfd;
+                    pfd.fd = listen_sock;
+                    pfd.events = POLLIN;
+                    pfd.revents = 0;
+                    if (poll(&pfd, 1, -1) >= 0 || errno == EINTR) {
+                        errno = 0;
+                        continue;
+                    }
+                }
                 if (shutdownPending || ! is_reasonable_accept_errno(errno)) {
                     int errnoSave = errno;
 
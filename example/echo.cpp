@@ -1,6 +1,7 @@
 // An example program of ncserver
 #include <stdlib.h>
 #include "ncserver/ncserver.h"
+#include "ncserver/async_query.h"
 #include "ncserver/nc_log.h"
 
 using namespace std;
@@ -38,6 +39,25 @@ protected:
 		}
 		io->flush();
 	}
+
+	// "delay=100" answers after 100ms, while the worker goes on serving other requests
+	virtual void queryAsync(AsyncQuery* q)
+	{
+		const char* delay = q->request()->parameterForName("delay");
+		if (delay == NULL || q->loop() == NULL)
+		{
+			NcServer::queryAsync(q);
+			return;
+		}
+
+#ifndef WIN32
+		q->loop()->setTimer(atoi(delay), [this, q]() {
+			if (!q->isCancelled())
+				query(q->io(), q->request());
+			q->finish();
+		});
+#endif
+	}
 };
 
 int main(int argc, char* argv[])
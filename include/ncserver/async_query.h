@@ -0,0 +1,160 @@
+/*
+MIT License
+
+Copyright (c) 2019 GIS Core R&D Department, NavInfo Co., Ltd
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+
+#include "ncserver.h"
+
+#ifndef WIN32
+#	include <functional>
+#	include <map>
+#	include <vector>
+#	include <pthread.h>
+#	include <stdint.h>
+#endif
+
+namespace ncserver
+{
+	class AsyncLoop;
+
+#ifndef WIN32
+
+	/**
+		Event loop of a serving thread of a worker. Asynchronous queries wait on it
+		for timers and file descriptors, while the thread goes on serving the
+		other requests.
+
+		Except post(), the methods must be called on the serving thread, which is
+		also the thread all the callbacks are called on.
+	 */
+	class AsyncLoop
+	{
+	public:
+		typedef std::function<void()> Callback;
+		typedef std::function<void(uint32_t events)> FdCallback;
+		typedef uint64_t TimerId;
+
+		AsyncLoop();
+		~AsyncLoop();
+
+		/**
+			Call callback once after delayMs milliseconds.
+		 */
+		TimerId setTimer(int delayMs, const Callback& callback);
+
+		/**
+			@return
+				false if the timer has been fired or cancelled.
+		 */
+		bool cancelTimer(TimerId timer);
+
+		/**
+			Call callback once when fd becomes ready for any of events, e.g. EPOLLIN
+			when the response of an outbound non-blocking socket arrives.
+			EPOLLERR and EPOLLHUP are always reported.
+
+			@note
+				Each fd has at most one wait. cancelFd() must be called before a
+				waited fd is closed.
+		 */
+		bool waitFd(int fd, uint32_t events, const FdCallback& callback);
+		void cancelFd(int fd);
+
+		/**
+			Call callback on the serving thread. Unlike the other methods, it may be
+			called from any thread, e.g. to hand the result of a background job
+			back to the query waiting for it.
+		 */
+		void post(const Callback& callback);
+
+		/**
+			Wait at most timeoutMs milliseconds and call the callbacks which are due.
+			The engines call it when fd() is readable.
+		 */
+		void runOnce(int timeoutMs);
+
+		/**
+			An epoll file descriptor which is readable when a callback is due.
+		 */
+		int fd() { return m_epollFd; }
+
+	private:
+		AsyncLoop(const AsyncLoop&);
+		AsyncLoop& operator=(const AsyncLoop&);
+
+		void runTimers();
+		void runPosted();
+		void armTimerFd();
+
+		int m_epollFd;
+		int m_timerFd;
+		int m_eventFd;
+
+		TimerId m_lastTimerId;
+		std::map<std::pair<long long, TimerId>, Callback> m_timers;	// by deadline
+		std::map<TimerId, long long> m_timerDeadlines;
+		long long m_armedDeadline;
+
+		std::map<int, FdCallback> m_fdWaits;
+
+		pthread_mutex_t m_postMutex;
+		std::vector<Callback> m_posted;
+	};
+
+#endif
+
+	/**
+		An inbound request served by NcServer::queryAsync().
+
+		The request is open until finish() is called, which may happen long after
+		queryAsync() returns, e.g. in a callback of loop().
+	 */
+	class AsyncQuery
+	{
+	public:
+		virtual ServiceIo* io() = 0;
+		virtual Request* request() = 0;
+
+		/**
+			The event loop of the serving thread which received the request.
+			NULL on Windows, where the request must be finished before queryAsync() returns.
+		 */
+		virtual AsyncLoop* loop() = 0;
+
+		/**
+			Flush the output and end the request. The query, its io() and request()
+			must not be used afterwards.
+		 */
+		virtual void finish() = 0;
+
+		/**
+			True after the client closed the connection. The output is discarded,
+			but finish() must still be called.
+		 */
+		virtual bool isCancelled() = 0;
+
+	protected:
+		virtual ~AsyncQuery() {}
+	};
+}
+
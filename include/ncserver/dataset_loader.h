@@ -0,0 +1,104 @@
+/*
+MIT License
+
+Copyright (c) 2019 GIS Core R&D Department, NavInfo Co., Ltd
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace ncserver
+{
+	struct DatasetLoadTime
+	{
+		std::string name;
+		bool loaded;			// false if it failed, or was skipped for a dependency which did
+		double startMs;			// since run() was called
+		double durationMs;
+	};
+
+	/**
+		Runs the steps of prepareProcess() which build independent data in parallel.
+
+		Each step is declared with the names of the steps it needs, and runs as soon
+		as they have loaded, on a TaskPool created by run(). Its threads have exited
+		when run() returns, so the manager still forks with a single thread.
+
+		@code
+		DatasetLoader loader;
+		loader.add("roads", [this]() { m_roads = datasets()->addFile("roads", "roads.bin"); return m_roads >= 0; });
+		loader.add("names", [this]() { return loadNames("names.txt"); });
+		loader.add("index", { "roads", "names" }, [this]() { return buildIndex(); });
+		return loader.run();
+		@endcode
+
+		@remarks
+			The steps run on several threads at once, so what they share must be thread
+			safe. DatasetRegistry is.
+	 */
+	class DatasetLoader
+	{
+	public:
+		/**
+			@return
+				false if it failed, and the steps depending on it are skipped.
+		 */
+		typedef std::function<bool()> Load;
+
+		DatasetLoader();
+		~DatasetLoader();
+
+		void add(const char* name, const Load& load);
+		void add(const char* name, const std::vector<std::string>& dependencies, const Load& load);
+
+		/**
+			Run all the steps added, on @a threadCount threads including the calling
+			one, 0 for as many as the CPUs the process may use.
+
+			@return
+				false if a step failed or was skipped, or if a dependency is unknown or
+				circular, in which case none runs.
+		 */
+		bool run(int threadCount = 0);
+
+		/**
+			The steps of the last run(), in the order they were added. run() logs them
+			from the slowest one as well.
+		 */
+		const std::vector<DatasetLoadTime>& loadTimes() const { return m_loadTimes; }
+
+	private:
+		DatasetLoader(const DatasetLoader&);
+		DatasetLoader& operator=(const DatasetLoader&);
+
+		struct Step;
+
+		/**
+			Indexes of the dependencies of each step, false if one is unknown or circular.
+		 */
+		bool resolve();
+
+		std::vector<Step*> m_steps;
+		std::vector<DatasetLoadTime> m_loadTimes;
+	};
+}
@@ -0,0 +1,222 @@
+/*
+MIT License
+
+Copyright (c) 2019 GIS Core R&D Department, NavInfo Co., Ltd
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace ncserver
+{
+	struct DatasetStats
+	{
+		std::string name;
+		size_t size;					// bytes of one replica
+		std::vector<int> nodes;			// NUMA node of each replica, -1 if unknown
+		long long lookups;				// get() of all the workers
+		long long remoteLookups;		// get() from a CPU of another node than the replica returned
+		std::string version;			// given to add(), empty if none
+		bool inherited;					// taken over from the former generation by a zygote reload
+	};
+
+	/**
+		Read-only datasets loaded in prepareProcess(), with one replica on every
+		NUMA node if placement.replicateDatasets is set.
+
+		A dataset is a block of memory filled once for every replica, so it must not
+		contain pointers, only offsets into itself. After fork(), get() of a worker
+		returns the replica on its own node.
+
+		@remarks
+			Call add() in prepareProcess() only, and get() once per request rather
+			than per element, as it counts the lookups. add(), restore() and find()
+			may be called from the threads of a DatasetLoader, whose fillers then run
+			in parallel, and get() of the datasets added before as well.
+
+			With server.zygoteReload, the manager of a reload is forked from the former
+			one and prepareProcess() runs again. A dataset added with the same name and
+			version as in the former generation is then taken over as it is, without
+			calling the Filler. The others are built anew, and those not added again are
+			dropped once prepareProcess() returns.
+
+			With server.snapshotFile, the versioned datasets are saved into a snapshot
+			after prepareProcess(), and the next start maps those of the same name and
+			version from it rather than building them again. Use restore() to skip the
+			parsing which tells the size of a dataset as well, and OffsetPtr of
+			ncserver/offset_ptr.h for pointers inside a dataset.
+	 */
+	class DatasetRegistry
+	{
+	public:
+		/**
+			Fill the @a size bytes at @a memory. It is called for every replica and
+			must write the same content each time.
+		 */
+		typedef std::function<void(void* memory, size_t size)> Filler;
+
+		DatasetRegistry();
+		~DatasetRegistry();
+
+		/**
+			@return
+				The id of the dataset for get(), -1 on failure.
+		 */
+		int add(const char* name, size_t size, const Filler& fill);
+
+		/**
+			Like add() above, with a @a version key such as fileVersion() or a checksum
+			of the source, so that a zygote reload can take the dataset over.
+		 */
+		int add(const char* name, const char* version, size_t size, const Filler& fill);
+
+		/**
+			Copy @a size bytes of @a data into the replicas.
+		 */
+		int add(const char* name, const void* data, size_t size);
+
+		/**
+			Load the file at @a path, versioned by fileVersion().
+		 */
+		int addFile(const char* name, const char* path);
+
+		/**
+			A version key of the file at @a path made of its inode, size and modification
+			time, empty if it doesn't exist.
+		 */
+		static std::string fileVersion(const char* path);
+
+		/**
+			The dataset of @a name and @a version taken over from the former generation
+			or from the snapshot, without building it.
+
+			@return
+				-1 if neither has it, for the caller to build it and add() it.
+		 */
+		int restore(const char* name, const char* version);
+
+		/**
+			Map the snapshot at @a path for add() and restore(). The header and the
+			directory of the datasets are checked against their checksum; the data is
+			paged in only as it is read, and checked when it is copied into replicas.
+
+			@return
+				false if there is no valid snapshot at @a path.
+		 */
+		bool openSnapshot(const char* path);
+
+		/**
+			Write the datasets which have a version into a snapshot at @a path, with
+			a temporary file renamed at last.
+		 */
+		bool saveSnapshot(const char* path) const;
+
+		/**
+			Whether the versioned datasets differ from those of the snapshot opened,
+			so that it is worth saving again.
+		 */
+		bool snapshotChanged() const;
+
+		void closeSnapshot();
+
+		/**
+			@return
+				The id of the dataset of @a name, -1 if there is none.
+		 */
+		int find(const char* name) const;
+
+		/**
+			The replica local to the calling worker.
+		 */
+		const void* get(int id);
+
+		size_t sizeOf(int id) const;
+
+		std::vector<DatasetStats> stats() const;
+
+		/**
+			Drop all the datasets, and count the lookups of @a workerCount workers from now on.
+		 */
+		void init(int workerCount, bool replicate);
+
+		/**
+			Like init(), but keep the datasets for add() of the next generation to take
+			over. They are all dropped if @a replicate has changed.
+		 */
+		void renew(int workerCount, bool replicate);
+
+		/**
+			Drop the datasets of the former generation which haven't been added again
+			since renew().
+		 */
+		void prune();
+
+		/**
+			Called by the worker of @a index after fork() to choose its replicas.
+			@a node is the node it is bound to, -1 to take that of the CPU it runs on.
+		 */
+		void bindWorker(int index, int node);
+
+	private:
+		DatasetRegistry(const DatasetRegistry&);
+		DatasetRegistry& operator=(const DatasetRegistry&);
+
+		struct Dataset;
+
+		/**
+			A dataset in the directory of a snapshot file.
+		 */
+		struct SnapshotEntry
+		{
+			char name[128];
+			char version[128];
+			unsigned long long offset;		// in the file, aligned to pages
+			unsigned long long size;
+			unsigned long long checksum;	// of the data
+		};
+
+		void clear();
+		void setWorkerCount(int workerCount, bool replicate);
+		Dataset* create(const char* name, size_t size, const Filler& fill);
+		Dataset* createFromSnapshot(const SnapshotEntry& entry);
+		const SnapshotEntry* findSnapshotEntry(const char* name, const char* version) const;
+		int insert(int id, Dataset* dataset);
+		int indexOf(const char* name) const;
+
+		std::vector<Dataset*> m_datasets;
+		// m_datasets.data(), which get() reads while add() may grow m_datasets on
+		// another thread. The tables grown out of are kept until prune() or clear().
+		std::atomic<Dataset**> m_table;
+		std::vector<std::vector<Dataset*> > m_formerTables;
+		mutable std::mutex m_mutex;		// of add() and restore() running in parallel
+		std::vector<int> m_cpuNodes;	// NUMA node of each CPU
+		int m_workerCount;
+		bool m_replicate;
+		int m_slot;						// counters of this process, the worker index or m_workerCount
+		int m_generation;				// renew() calls
+		std::vector<SnapshotEntry> m_snapshot;
+		int m_snapshotFd;				// -1 if no snapshot is open
+	};
+}
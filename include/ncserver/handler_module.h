@@ -0,0 +1,91 @@
+/*
+MIT License
+
+Copyright (c) 2019 GIS Core R&D Department, NavInfo Co., Ltd
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+
+namespace ncserver
+{
+	class NcServer;
+	class ServiceIo;
+	class Request;
+
+	/**
+		The interface version a module is built against, given to the factory
+		NCSERVER_HANDLER_MODULE() exports. Raised whenever HandlerModule changes.
+	 */
+	enum { HANDLER_MODULE_INTERFACE_VERSION = 1 };
+
+	/**
+		The handler of the requests, in a shared library of its own which each worker
+		loads with dlopen(), so that new code is deployed by restarting the workers
+		rather than by a reload which prepares the data again.
+
+		@remarks
+			Set server.handlerModule to the path of the library. Each worker loads it
+			after startService(), and its query() takes the place of NcServer::query()
+			and queryAsync(). The manager never loads it, so a worker forked by
+			reforkAllChildren() or `ncserverctl reload_handler` loads the file which
+			is at the path at that time.
+
+			The module reaches the data of the server through the NcServer given to
+			start(), e.g. datasets(). The executable has to export the symbols of
+			ncserver for it, e.g. linked with -rdynamic.
+	 */
+	class HandlerModule
+	{
+	public:
+		virtual ~HandlerModule() {}
+
+		/**
+			Called in the worker once it has loaded the module. The worker exits if it
+			returns false, and a former worker keeps serving in its place.
+		 */
+		virtual bool start(NcServer* server) { return true; }
+
+		/**
+			Called from any of the server.threadCount threads of the worker.
+		 */
+		virtual void query(ServiceIo* io, Request* request) = 0;
+
+		/**
+			Called before the worker exits.
+		 */
+		virtual void stop() {}
+
+		/**
+			Written to the log when a worker loads the module, e.g. a build number.
+		 */
+		virtual const char* version() { return ""; }
+	};
+
+	typedef HandlerModule* (*HandlerModuleFactory)(int interfaceVersion);
+}
+
+/**
+	Export the factory of the HandlerModule @a ClassName, once in the library.
+ */
+#define NCSERVER_HANDLER_MODULE(ClassName) \
+	extern "C" ncserver::HandlerModule* ncserver_createHandlerModule(int interfaceVersion) \
+	{ \
+		return interfaceVersion == ncserver::HANDLER_MODULE_INTERFACE_VERSION ? new ClassName() : nullptr; \
+	}
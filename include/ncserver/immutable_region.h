@@ -0,0 +1,150 @@
+/*
+MIT License
+
+Copyright (c) 2019 GIS Core R&D Department, NavInfo Co., Ltd
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+
+#include <new>
+#include <stddef.h>
+#include <utility>
+
+namespace ncserver
+{
+	/**
+		Memory for the data built in prepareProcess(), which the workers only read.
+
+		The workers share the pages of the manager by copy-on-write, and a single write,
+		e.g. a reference count, a lazy initialization or the bookkeeping of malloc()
+		next to the data, copies a page into every worker. Data allocated from the
+		region lives in a mapping of its own, made of huge pages if possible, which
+		lessens the TLB misses of the lookups as well. The manager seals it read-only
+		before it forks the workers, so such a write crashes at once rather than
+		taking memory silently.
+
+		Objects in the region are never destroyed: the memory is given back as a
+		whole, without calling their destructors.
+	 */
+	class ImmutableRegion
+	{
+	public:
+		enum HugePages
+		{
+			HugePages_none,
+			HugePages_transparent,	// madvise(MADV_HUGEPAGE), small pages where no huge page is free
+			HugePages_explicit,		// MAP_HUGETLB from the pool reserved by vm.nr_hugepages,
+									// transparent ones if it is too small
+		};
+
+		ImmutableRegion();
+		~ImmutableRegion();
+
+		/**
+			Map @a capacity bytes, rounded up to whole huge pages.
+
+			@param prefault
+				Touch every page at once, e.g. to get the huge pages before the memory
+				is fragmented, rather than on first use.
+			@param lock
+				mlock() the pages in the manager, which keeps those the workers share
+				in memory as well. Failing for RLIMIT_MEMLOCK is logged only.
+		 */
+		bool init(size_t capacity, HugePages hugePages = HugePages_transparent, bool prefault = false, bool lock = false);
+
+		/**
+			@return
+				NULL if the region is full, sealed or not initialized.
+		 */
+		void* allocate(size_t size, size_t alignment = sizeof(void*) * 2);
+
+		template<class T, class... Args>
+		T* create(Args&&... args)
+		{
+			void* memory = allocate(sizeof(T), alignof(T));
+			return memory == NULL ? NULL : new (memory) T(std::forward<Args>(args)...);
+		}
+
+		/**
+			Give back the huge pages not used, and make the others read-only.
+			The manager calls it after initUnforkableResources().
+		 */
+		bool seal();
+
+		bool isSealed() const { return m_sealed; }
+		bool contains(const void* p) const { return (const char*)p >= m_base && (const char*)p < m_base + m_mappedSize; }
+		size_t used() const { return m_used; }
+		size_t capacity() const { return m_capacity; }
+
+		/**
+			Bytes of the region backed by huge pages, from /proc/self/smaps for
+			transparent ones.
+		 */
+		size_t hugePageBytes() const;
+
+	private:
+		ImmutableRegion(const ImmutableRegion&);
+		ImmutableRegion& operator=(const ImmutableRegion&);
+		void release();
+
+		char* m_base;
+		size_t m_mappedSize;
+		size_t m_capacity;
+		size_t m_used;
+		size_t m_pageSize;		// unit m_mappedSize is a multiple of
+		HugePages m_hugePages;	// what it got, which may be less than asked for
+		bool m_sealed;
+	};
+
+	/**
+		An allocator for the containers of the standard library, e.g.
+		std::vector<int, RegionAllocator<int> > v(RegionAllocator<int>(region)).
+		Memory of a container which grows is not reused, so reserve() first.
+	 */
+	template<class T>
+	class RegionAllocator
+	{
+	public:
+		typedef T value_type;
+
+		RegionAllocator(ImmutableRegion* region) : m_region(region) {}
+		template<class U>
+		RegionAllocator(const RegionAllocator<U>& r) : m_region(r.region()) {}
+
+		T* allocate(size_t n)
+		{
+			void* memory = m_region->allocate(n * sizeof(T), alignof(T));
+			if (memory == NULL)
+				throw std::bad_alloc();
+			return (T*)memory;
+		}
+		void deallocate(T* p, size_t n) {}
+
+		ImmutableRegion* region() const { return m_region; }
+
+		template<class U>
+		bool operator==(const RegionAllocator<U>& r) const { return m_region == r.region(); }
+		template<class U>
+		bool operator!=(const RegionAllocator<U>& r) const { return m_region != r.region(); }
+
+	private:
+		ImmutableRegion* m_region;
+	};
+}
@@ -0,0 +1,148 @@
+/*
+MIT License
+
+Copyright (c) 2019 GIS Core R&D Department, NavInfo Co., Ltd
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+
+#include <functional>
+#include <stddef.h>
+
+namespace ncserver
+{
+	/**
+		A dataset which changes while the workers run, e.g. traffic speeds refreshed
+		every minute, without a reload.
+
+		The versions are kept in memory shared by the manager and the workers. A loader
+		thread of the manager, e.g. started in initUnforkableResources(), publishes a
+		new version into a buffer no reader holds, and the readers switch to it with
+		the next acquire(). Nothing is forked or copied on write, and a reader never
+		waits for the loader.
+
+		@remarks
+			Call init() before the workers are forked, i.e. in prepareProcess(). Take
+			a View once per request rather than per element: it holds its version
+			until it is destroyed, and the buffer of a version is reused only when no
+			View holds it any more. A version must not contain pointers, only offsets
+			into itself, like the datasets of DatasetRegistry.
+	 */
+	class LiveDataset
+	{
+	public:
+		/**
+			Fill the @a size bytes of a new version at @a memory.
+		 */
+		typedef std::function<void(void* memory, size_t size)> Filler;
+
+		/**
+			The version taken by acquire(), held until the View is destroyed.
+		 */
+		class View
+		{
+		public:
+			View() : m_owner(NULL), m_reader(-1), m_data(NULL), m_size(0), m_version(0) {}
+			View(View&& other);
+			View& operator=(View&& other);
+			~View() { release(); }
+
+			/**
+				NULL if nothing has been published yet.
+			 */
+			const void* data() const { return m_data; }
+			size_t size() const { return m_size; }
+
+			/**
+				Counts the publish() calls, 0 if nothing has been published yet.
+			 */
+			unsigned long long version() const { return m_version; }
+
+			void release();
+
+		private:
+			friend class LiveDataset;
+			View(const View&);
+			View& operator=(const View&);
+
+			LiveDataset* m_owner;
+			int m_reader;
+			const void* m_data;
+			size_t m_size;
+			unsigned long long m_version;
+		};
+
+		LiveDataset();
+		~LiveDataset();
+
+		/**
+			Map @a bufferCount buffers of @a capacity bytes, so that up to
+			@a bufferCount - 1 versions may be held at once besides the latest one,
+			and @a readerCount slots for the Views held at a time.
+		 */
+		bool init(size_t capacity, int bufferCount = 3, int readerCount = 1024);
+
+		/**
+			Fill a buffer no View holds with @a fill and make it the latest version.
+
+			@return
+				false if @a size exceeds the capacity, or all the buffers are held.
+		 */
+		bool publish(size_t size, const Filler& fill);
+
+		/**
+			Copy @a size bytes of @a data as the latest version.
+		 */
+		bool publish(const void* data, size_t size);
+
+		/**
+			The latest version, for the calling thread to read.
+		 */
+		View acquire();
+
+		/**
+			Counts the publish() calls.
+		 */
+		unsigned long long version() const;
+
+		size_t capacity() const { return m_capacity; }
+
+	private:
+		LiveDataset(const LiveDataset&);
+		LiveDataset& operator=(const LiveDataset&);
+
+		struct Header;
+		struct Reader;
+		void clear();
+		void release(int reader);
+		int freeBuffer();
+
+		void* m_memory;
+		size_t m_mappedSize;
+		Header* m_header;
+		Reader* m_readers;
+		size_t* m_sizes;
+		char* m_buffers;
+		size_t m_stride;
+		size_t m_capacity;
+		int m_bufferCount;
+		int m_readerCount;
+	};
+}
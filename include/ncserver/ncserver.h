@@ -54,6 +54,18 @@ void RequestParameterIterator_free(RequestParameterIterator* o);
 namespace ncserver
 {
 	class NcServerConfig;
+	class AsyncQuery;
+	class TaskPool;
+	class DatasetRegistry;
+	class ImmutableRegion;
+	class SharedCache;
+	class ResponseCache;
+	class WorkerScaler;
+	class SignalFd;
+	class WorkerScoreboard;
+	class HandlerModule;
+	class HandlerLibrary;
+	struct ReloadState;
 
 	class ServiceIo
 	{
@@ -77,6 +89,7 @@ namespace ncserver
 		FINALIZE_PROCESS_ERROR,
 		FCGI_ERROR,
 		MEMORY_ERROR,
+		LISTEN_ERROR,
 		UNKNOWN_ERROR
 	};
 
@@ -161,6 +174,15 @@ namespace ncserver
 
 		void setQueryString(const char* queryString);
 
+		/**
+			@note
+				Bind the request to a FastCGI parameter array("NAME=VALUE" strings terminated by NULL).
+				Each serving thread owns its own request, so the headers are read from this array
+				instead of the process wide environment.
+				If envp is NULL, headers are read from the environment of FCGI_Accept().
+		 */
+		void setEnvironment(char** envp);
+
 		RequestParameterIterator* getParameterIterator();
 
 	private:
@@ -168,6 +190,7 @@ namespace ncserver
 		char m_queryString[URL_MAX_LENGTH];
 		StaticStringMap* m_params;
 		RequestParameterIterator* m_paramIter;
+		char** m_envp;
 	};
 
 	class NcServer
@@ -176,6 +199,15 @@ namespace ncserver
 		NcServer();
 		virtual ~NcServer();
 
+		/**
+			Replace every worker, server.maxRestartingWorkers at a time.
+
+			@remarks
+				Called in the manager, e.g. by a thread started in initUnforkableResources().
+				A worker is stopped only after its replacement is ready to accept requests,
+				and has server.drainTimeout seconds to finish its requests. The standby
+				workers of server.standbyWorkerCount are replaced as well.
+		 */
 		void reforkAllChildren();
 
 		/**
@@ -227,6 +259,11 @@ namespace ncserver
 
 		/**
 			Clean up resources that is initialized in initUnforkableResources()
+
+			@remarks
+				With server.zygoteReload, also called before the manager forks the
+				next one, and initUnforkableResources() again afterwards. The threads
+				it has started must be stopped and joined.
 		 */
 		virtual bool cleanupUnforkableResources(void) { return true; }
 
@@ -246,26 +283,223 @@ namespace ncserver
 		 */
 		virtual void query(ServiceIo *io, Request *request) = 0;
 
+		/**
+			Asynchronous variant of query(), see ncserver/async_query.h.
+
+			@remarks
+				The request is ended by query->finish(), which may be called after this
+				method returns, e.g. in a timer or file descriptor callback of query->loop().
+				Meanwhile the serving thread of the epoll and http engines goes on with
+				the other requests, while the fcgi engine waits on the loop.
+				The default implementation calls query() and finishes the request, so
+				an override can pass the requests it doesn't handle asynchronously here.
+		 */
+		virtual void queryAsync(AsyncQuery* query);
+
 		ServerState serve();
 
 		void loadConfigFile();
 
+		/**
+			The TaskPool of the worker process, see ncserver/task_pool.h.
+
+			@remarks
+				It is shared by all the serving threads of the worker, e.g. to split
+				a large request among several cores with parallelFor(). It exists from
+				startService() to stopService(), and has server.taskThreadCount threads.
+		 */
+		TaskPool* taskPool() { return m_taskPool; }
+
+		/**
+			The read-only datasets shared by the workers, see ncserver/dataset_registry.h.
+
+			@remarks
+				Add datasets in prepareProcess(). They are replicated on every NUMA
+				node if placement.replicateDatasets is set.
+		 */
+		DatasetRegistry* datasets() { return m_datasets; }
+
+		/**
+			Memory for the data built in prepareProcess(), see ncserver/immutable_region.h.
+
+			@remarks
+				It has immutableRegion.size megabytes, and none if that is 0. The manager
+				makes it read-only after initUnforkableResources().
+		 */
+		ImmutableRegion* immutableRegion() { return m_immutableRegion; }
+
+		/**
+			The key/value cache shared by all the workers, see ncserver/shared_cache.h.
+
+			@remarks
+				It has sharedCache.size megabytes, and none if that is 0. Each generation
+				of a reload starts with an empty one, unless it is mapped from
+				sharedCache.file, whose entries put with a dataset of the same version
+				are kept, see SharedCache::setVersion().
+		 */
+		SharedCache* sharedCache() { return m_sharedCache; }
+
 	private:
 		NcServerConfig* m_config;
+		TaskPool* m_taskPool;
+		DatasetRegistry* m_datasets;
+		ImmutableRegion* m_immutableRegion;
+		SharedCache* m_sharedCache;
+		ResponseCache* m_responseCache;
+		HandlerLibrary* m_handlerLibrary;
+		HandlerModule* m_handlerModule;	// of server.handlerModule, loaded by each worker
 		void reset();
 
+		/**
+			Load server.handlerModule in the worker, see ncserver/handler_module.h.
+		 */
+		bool startHandlerModule();
+		void stopHandlerModule();
+
+		/**
+			Accept and process requests until the server exits.
+			Every serving thread of a worker runs this loop with its own
+			FastCGI request, Request and ServiceIo.
+		 */
+		void serveLoop();
+
+		/**
+			Parse the query string of an accepted request and pass it to queryAsync(),
+			or to the HandlerModule if there is one.
+		 */
+		void handleRequest(AsyncQuery* query);
+
 #ifndef WIN32
 		pid_t* m_children;
 		enum ChildState {
 			CHILDSTATE_INVALID = 0,
 			CHILDSTATE_LIVING = 1,
 			CHILDSTATE_WAIT_FOR_RELOAD = 2,
+			CHILDSTATE_STARTING = 3,	// forked, not ready yet
 		}* m_childrenStates;
+		pid_t* m_predecessors;	// worker a STARTING slot replaces, serving until then, -1 if none
+		long long* m_forkTimes;	// monotonicTimeMs() of the last fork of each slot
+		int* m_startFailures;	// workers of each slot in a row which exited before they were ready
 		pthread_mutex_t m_mutex;
+		int* m_listenSockets;	// SO_REUSEPORT socket of each worker slot, -1 if shared
+		int m_activeWorkerCount;	// slots in use, between server.minWorkerCount and maxWorkerCount
+		WorkerScaler* m_scaler;
+		SignalFd* m_signals;	// of the manager
+		WorkerScoreboard* m_scoreboard;
+		int m_workerIndex;	// slot of the worker, -1 in the manager
+		pid_t m_manager;
+		pid_t* m_standbys;	// of each server.standbyWorkerCount, -1 if none
+		long long* m_standbyForkTimes;
+		int* m_standbyChannels;	// socket to each standby worker, for the listen socket of its slot, -1 if none
+		int m_standbyIndex;	// of a standby worker until it takes a slot, -1 otherwise
+		int m_standbyChannel;	// of a standby worker to the manager, -1 otherwise
+		ReloadState* m_reloadState;	// shared by the boss and all the managers
+		int m_unstagedWorkerCount;	// worker count before a staged reload retired some, -1 if none
+
+		/**
+			Tell the manager that the worker accepts requests.
+		 */
+		void reportReady();
+
+		/**
+			Whether every slot in use has a ready worker.
+		 */
+		bool allWorkersReady();
 
+		/**
+			Slots whose worker, or the predecessor of the worker, accepts requests.
+		 */
+		int servingWorkerCount();
+
+		/**
+			Slots replacing a worker which still serves.
+		 */
+		int restartingWorkerCount();
+
+		bool openListenSockets();
 		bool forkOne(int index);
 		bool forkChildren();
 		bool checkChildrenStateAndRefork();
+
+		/**
+			In a worker forked for slot @a index or taking it over as a standby:
+			keep the listen socket of the slot only, and apply its placement.
+		 */
+		void becomeWorker(int index);
+
+		/**
+			Fork the standby worker @a index. Returns false in the child.
+		 */
+		bool forkStandby(int index);
+
+		/**
+			Close the manager's end of the channel to each standby worker.
+		 */
+		void closeStandbyChannels();
+
+		/**
+			Hand slot @a index to a ready standby worker, if there is one.
+		 */
+		bool promoteStandby(int index);
+
+		/**
+			In a standby worker: wait until the manager hands it a slot.
+			Returns false if it is stopped instead.
+		 */
+		bool waitForPromotion();
+
+		/**
+			Standby workers which have run startService().
+		 */
+		int readyStandbyCount();
+
+		/**
+			Write the pid and placement of every worker slot to ".workers".
+		 */
+		void recordWorkers();
+
+		/**
+			Write the statistics of datasets() to ".datasets".
+		 */
+		void recordDatasets();
+
+		/**
+			Give the caches the versions of datasets(), so that they keep the entries
+			of a former generation computed from the same data.
+		 */
+		void tagCacheVersions();
+
+		/**
+			Sample the load of the workers, add or retire workers as WorkerScaler
+			decides, and write ".metrics". Called by the manager every second.
+		 */
+		void scaleWorkers();
+
+		/**
+			Add workers up to @a target slots, or retire those from @a target on.
+		 */
+		void resizeWorkers(int target);
+
+		/**
+			Follow the steps of a reload within server.reloadMemoryBudget, as the
+			former manager which retires workers or the new one which adds them.
+		 */
+		void stageWorkers();
+
+		/**
+			The slots the manager may fork workers for.
+		 */
+		int workerQuota();
+
+		/**
+			Connections waiting in the accept queues of the workers, -1 if unknown.
+		 */
+		int listenQueueLength();
+
+		/**
+			Write the worker count and load to ".metrics".
+		 */
+		void recordMetrics();
 #endif
 	};
 }
@@ -0,0 +1,61 @@
+/*
+MIT License
+
+Copyright (c) 2019 GIS Core R&D Department, NavInfo Co., Ltd
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace ncserver
+{
+	/**
+		A pointer kept as the distance from itself to its target, so that a structure
+		of them stays valid wherever its memory is mapped, e.g. inside a dataset mapped
+		from a snapshot at another address than the one it was built at. A null
+		OffsetPtr keeps 0, i.e. it can't point to itself.
+
+		Copying it keeps the target rather than the distance.
+	 */
+	template<class T>
+	class OffsetPtr
+	{
+	public:
+		OffsetPtr() : m_offset(0) {}
+		OffsetPtr(T* p) { set(p); }
+		OffsetPtr(const OffsetPtr& r) { set(r.get()); }
+
+		OffsetPtr& operator=(const OffsetPtr& r) { set(r.get()); return *this; }
+		OffsetPtr& operator=(T* p) { set(p); return *this; }
+
+		T* get() const { return m_offset == 0 ? NULL : (T*)((char*)this + m_offset); }
+		T* operator->() const { return get(); }
+		T& operator*() const { return *get(); }
+		T& operator[](ptrdiff_t i) const { return get()[i]; }
+		explicit operator bool() const { return m_offset != 0; }
+
+	private:
+		void set(T* p) { m_offset = p == NULL ? 0 : (int64_t)((char*)p - (char*)this); }
+
+		int64_t m_offset;
+	};
+}
@@ -0,0 +1,170 @@
+/*
+MIT License
+
+Copyright (c) 2019 GIS Core R&D Department, NavInfo Co., Ltd
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+
+#include <stddef.h>
+#include <string>
+
+namespace ncserver
+{
+	struct SharedCacheStats
+	{
+		long long hits;
+		long long misses;
+		long long insertions;
+		long long evictions;		// entries replaced by CLOCK to make room for others
+		long long contentions;		// reads retried and writes which waited for another writer
+		long long invalidations;	// entries dropped as their dataset has another version
+		long long entries;
+		long long slots;
+	};
+
+	/**
+		A key/value cache shared by all the workers, e.g. for results which are costly
+		to compute and asked for again and again, so that what one worker has computed
+		serves the others, and the memory doesn't grow with the worker count.
+
+		The entries live in a fixed number of slots of MAP_SHARED memory, mapped before
+		the workers are forked. A key is hashed to a bucket of 8 slots, where an entry
+		read since the last pass of the CLOCK hand is kept and another one is evicted.
+		get() doesn't lock: it copies the entry and retries if a writer of the same
+		bucket has changed it meanwhile. Writers lock the bucket, and take over the lock
+		of a thread which has died while holding it.
+
+		Mapped from a file, the entries outlive the processes, so that a restart or a
+		reload starts with the cache of the former run. An entry put with a dataset is
+		tagged with the version setVersion() gave it in this process, and is only found
+		by processes with the same version, so entries computed from data which has
+		changed are dropped while the others are kept.
+
+		@remarks
+			Call init() before the workers are forked, e.g. in prepareProcess(), or use
+			sharedCache() of NcServer with sharedCache.size set. get() and put() may be
+			called from any thread of any worker. Being a cache, it may miss: a read
+			which keeps colliding with writers gives up.
+	 */
+	class SharedCache
+	{
+	public:
+		SharedCache();
+		~SharedCache();
+
+		/**
+			Map about @a capacity bytes of slots of @a slotSize bytes each, which hold
+			the key, the value and 32 bytes of bookkeeping.
+
+			@param path
+				File to map, NULL for anonymous memory. The entries of a file of the
+				same layout are adopted, otherwise it is replaced by an empty one. The
+				locks of its buckets are reset if no other process maps it.
+				Not supported on Windows, which falls back to anonymous memory.
+		 */
+		bool init(size_t capacity, size_t slotSize = 256, const char* path = NULL);
+
+		/**
+			Tag the entries this process and the workers forked from now on put with
+			@a dataset with @a version, and drop those of any other version. An entry
+			of a dataset without a version in this process isn't found.
+
+			@param version
+				Empty if unknown, which matches no entry put before.
+			@remarks
+				Called in the manager, before the workers are forked. NcServer calls it
+				for every dataset of datasets() with a version after prepareProcess().
+		 */
+		bool setVersion(const char* dataset, const char* version);
+
+		/**
+			@return
+				false if there is no entry of @a key.
+		 */
+		bool get(const void* key, size_t keySize, std::string* value);
+		bool get(const std::string& key, std::string* value) { return get(key.data(), key.size(), value); }
+
+		/**
+			@param dataset
+				The dataset the value is computed from, see setVersion(). An entry
+				without one is kept until it is evicted, even by a file.
+			@return
+				false if the key and the value don't fit into a slot, or the dataset
+				has no version.
+		 */
+		bool put(const void* key, size_t keySize, const void* value, size_t valueSize, const char* dataset = NULL);
+		bool put(const std::string& key, const std::string& value, const char* dataset = NULL)
+		{
+			return put(key.data(), key.size(), value.data(), value.size(), dataset);
+		}
+
+		void remove(const void* key, size_t keySize);
+		void remove(const std::string& key) { remove(key.data(), key.size()); }
+
+		/**
+			Counted by all the processes together.
+		 */
+		SharedCacheStats stats() const;
+
+		/**
+			Bytes of a key and a value together which fit into a slot.
+		 */
+		size_t maxEntrySize() const;
+
+		size_t slotCount() const { return m_bucketCount * WAY_COUNT; }
+
+	private:
+		SharedCache(const SharedCache&);
+		SharedCache& operator=(const SharedCache&);
+
+		enum { WAY_COUNT = 8, COUNTER_STRIPES = 64, MAX_DATASETS = 63 };
+
+		struct Header;
+		struct Counters;
+		struct Bucket;
+		struct Slot;
+
+		void clear();
+		static void initHeader(void* memory, size_t slotSize, size_t bucketCount);
+		void* mapFile(const char* path, size_t size, size_t slotSize, size_t bucketCount, bool* adopted);
+		void recover();
+		Slot* slotAt(size_t bucket, int way) const;
+		int findWay(size_t bucket, unsigned long long hash, const void* key, size_t keySize) const;
+		int findDataset(const char* dataset) const;
+		bool isCurrent(const Slot* slot) const;
+		void lock(Bucket& bucket, size_t index, Counters& counters);
+		void unlock(Bucket& bucket);
+		void clearBucket(size_t index, Counters& counters);
+
+		void* m_memory;
+		size_t m_mappedSize;
+		bool m_fileMapped;
+		int m_fd;								// of the file, locked shared while it is mapped
+		Header* m_header;
+		// of this process, by the index of the dataset in m_header, 0 if none
+		unsigned long long m_versions[MAX_DATASETS];
+		Counters* m_counters;
+		Bucket* m_buckets;
+		char* m_slots;
+		size_t m_bucketCount;
+		size_t m_slotSize;
+	};
+}
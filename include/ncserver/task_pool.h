@@ -0,0 +1,148 @@
+/*
+MIT License
+
+Copyright (c) 2019 GIS Core R&D Department, NavInfo Co., Ltd
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ncserver
+{
+	class TaskPool;
+
+	/**
+		Tasks spawned into a TaskPool and waited for together.
+
+		@note
+			Tasks may spawn more tasks into the group they belong to, or join
+			groups of their own. A task which throws still counts as done, and
+			join() rethrows the first exception of the group.
+	 */
+	class TaskGroup
+	{
+	public:
+		explicit TaskGroup(TaskPool* pool);
+
+		/**
+			Joins the tasks not yet waited for, and drops their exception.
+		 */
+		~TaskGroup();
+
+		void spawn(const std::function<void()>& task);
+
+		/**
+			Wait until all the spawned tasks are done. Meanwhile the calling thread
+			runs queued tasks itself, so a join never waits for a busy pool
+			and nested joins inside tasks can't deadlock.
+
+			@throw
+				The first exception thrown by a task since the last join.
+		 */
+		void join();
+
+	private:
+		TaskGroup(const TaskGroup&);
+		TaskGroup& operator=(const TaskGroup&);
+
+		friend class TaskPool;
+
+		std::exception_ptr wait();
+
+		TaskPool* m_pool;
+		int m_pending;	// guarded by m_mutex
+		std::exception_ptr m_exception;	// guarded by m_mutex
+		std::mutex m_mutex;
+		std::condition_variable m_done;
+	};
+
+	/**
+		Work-stealing thread pool, which splits the CPU heavy work of one request
+		among several cores.
+
+		Each thread of the pool runs the tasks it spawned itself in LIFO order,
+		and takes the oldest tasks of the other threads when it runs out of work.
+		Tasks spawned by other threads, e.g. the serving threads, are shared by all.
+	 */
+	class TaskPool
+	{
+	public:
+		/**
+			@param threadCount
+				Threads of the pool, 0 to run the tasks in the threads joining them.
+		 */
+		explicit TaskPool(int threadCount);
+		~TaskPool();
+
+		int threadCount() { return (int)m_threads.size(); }
+
+		/**
+			Call body on consecutive subranges of [begin, end) which have at most
+			grainSize elements, in parallel, and return when all are done.
+		 */
+		void parallelFor(size_t begin, size_t end, size_t grainSize, const std::function<void(size_t begin, size_t end)>& body);
+
+	private:
+		TaskPool(const TaskPool&);
+		TaskPool& operator=(const TaskPool&);
+
+		friend class TaskGroup;
+
+		struct Task
+		{
+			std::function<void()> function;
+			TaskGroup* group;
+		};
+
+		struct Queue
+		{
+			std::mutex mutex;
+			std::deque<Task> tasks;
+		};
+
+		void push(const Task& task);
+
+		/**
+			Take a task for the calling thread: its own newest task first, then the
+			oldest shared task, then the oldest task of another thread.
+		 */
+		bool pop(Task& task);
+		bool take(int queueIndex, bool newest, Task& task);
+
+		void run(Task& task);
+		void threadMain(int index);
+
+		std::vector<std::thread> m_threads;
+		std::vector<Queue*> m_queues;	// one for each thread, and the last one is shared
+
+		std::atomic<int> m_queuedCount;
+		bool m_stopping;
+		std::mutex m_idleMutex;
+		std::condition_variable m_idle;
+	};
+}
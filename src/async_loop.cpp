@@ -0,0 +1,206 @@
+/*
+MIT License
+
+Copyright (c) 2019 GIS Core R&D Department, NavInfo Co., Ltd
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "stdafx.h"
+
+#ifndef WIN32
+
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include "ncserver/async_query.h"
+#include "util.h"
+
+namespace ncserver
+{
+	AsyncLoop::AsyncLoop()
+	{
+		m_epollFd = epoll_create1(EPOLL_CLOEXEC);
+		m_timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+		m_eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		m_lastTimerId = 0;
+		m_armedDeadline = 0;
+		pthread_mutex_init(&m_postMutex, NULL);
+
+		struct epoll_event ev;
+		ev.events = EPOLLIN;
+		ev.data.fd = m_timerFd;
+		epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_timerFd, &ev);
+		ev.data.fd = m_eventFd;
+		epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_eventFd, &ev);
+	}
+
+	AsyncLoop::~AsyncLoop()
+	{
+		close(m_eventFd);
+		close(m_timerFd);
+		close(m_epollFd);
+		pthread_mutex_destroy(&m_postMutex);
+	}
+
+	AsyncLoop::TimerId AsyncLoop::setTimer(int delayMs, const Callback& callback)
+	{
+		TimerId timer = ++m_lastTimerId;
+		long long deadline = monotonicTimeMs() + (delayMs > 0 ? delayMs : 0);
+		m_timers[std::make_pair(deadline, timer)] = callback;
+		m_timerDeadlines[timer] = deadline;
+		armTimerFd();
+		return timer;
+	}
+
+	bool AsyncLoop::cancelTimer(TimerId timer)
+	{
+		std::map<TimerId, long long>::iterator iter = m_timerDeadlines.find(timer);
+		if (iter == m_timerDeadlines.end())
+			return false;
+
+		m_timers.erase(std::make_pair(iter->second, timer));
+		m_timerDeadlines.erase(iter);
+		return true;
+	}
+
+	bool AsyncLoop::waitFd(int fd, uint32_t events, const FdCallback& callback)
+	{
+		struct epoll_event ev;
+		ev.events = events | EPOLLONESHOT;
+		ev.data.fd = fd;
+		int op = m_fdWaits.count(fd) != 0 ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+		if (epoll_ctl(m_epollFd, op, fd, &ev) != 0)
+			return false;
+
+		m_fdWaits[fd] = callback;
+		return true;
+	}
+
+	void AsyncLoop::cancelFd(int fd)
+	{
+		if (m_fdWaits.erase(fd) == 0)
+			return;
+
+		struct epoll_event ev;
+		epoll_ctl(m_epollFd, EPOLL_CTL_DEL, fd, &ev);
+	}
+
+	void AsyncLoop::post(const Callback& callback)
+	{
+		pthread_mutex_lock(&m_postMutex);
+		m_posted.push_back(callback);
+		pthread_mutex_unlock(&m_postMutex);
+
+		uint64_t one = 1;
+		ssize_t n = write(m_eventFd, &one, sizeof(one));
+		(void)n;
+	}
+
+	void AsyncLoop::runOnce(int timeoutMs)
+	{
+		struct epoll_event events[64];
+		int n = epoll_wait(m_epollFd, events, 64, timeoutMs);
+
+		for (int i = 0; i < n; i++)
+		{
+			int fd = events[i].data.fd;
+			if (fd == m_timerFd)
+			{
+				runTimers();
+			}
+			else if (fd == m_eventFd)
+			{
+				runPosted();
+			}
+			else
+			{
+				// an earlier callback of this round may have cancelled the wait
+				std::map<int, FdCallback>::iterator iter = m_fdWaits.find(fd);
+				if (iter == m_fdWaits.end())
+					continue;
+
+				FdCallback callback;
+				callback.swap(iter->second);
+				m_fdWaits.erase(iter);
+				struct epoll_event ev;
+				epoll_ctl(m_epollFd, EPOLL_CTL_DEL, fd, &ev);
+
+				callback(events[i].events);
+			}
+		}
+	}
+
+	void AsyncLoop::runTimers()
+	{
+		uint64_t expirations;
+		ssize_t n = read(m_timerFd, &expirations, sizeof(expirations));
+		(void)n;
+		m_armedDeadline = 0;
+
+		long long now = monotonicTimeMs();
+		while (!m_timers.empty() && m_timers.begin()->first.first <= now)
+		{
+			// the callback may set or cancel timers
+			Callback callback;
+			callback.swap(m_timers.begin()->second);
+			m_timerDeadlines.erase(m_timers.begin()->first.second);
+			m_timers.erase(m_timers.begin());
+			callback();
+		}
+		armTimerFd();
+	}
+
+	void AsyncLoop::runPosted()
+	{
+		uint64_t count;
+		ssize_t n = read(m_eventFd, &count, sizeof(count));
+		(void)n;
+
+		std::vector<Callback> posted;
+		pthread_mutex_lock(&m_postMutex);
+		posted.swap(m_posted);
+		pthread_mutex_unlock(&m_postMutex);
+
+		for (size_t i = 0; i < posted.size(); i++)
+			posted[i]();
+	}
+
+	void AsyncLoop::armTimerFd()
+	{
+		// Cancelled timers are not disarmed, the timer fd just fires for nothing.
+		if (m_timers.empty())
+			return;
+
+		long long deadline = m_timers.begin()->first.first;
+		if (m_armedDeadline != 0 && m_armedDeadline <= deadline)
+			return;
+
+		struct itimerspec spec;
+		memset(&spec, 0, sizeof(spec));
+		spec.it_value.tv_sec = deadline / 1000;
+		spec.it_value.tv_nsec = (deadline % 1000) * 1000000;
+		if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0)
+			spec.it_value.tv_nsec = 1;	// zero disarms the timer
+		timerfd_settime(m_timerFd, TFD_TIMER_ABSTIME, &spec, NULL);
+		m_armedDeadline = deadline;
+	}
+}
+
+#endif
@@ -0,0 +1,134 @@
+/*
+MIT License
+
+Copyright (c) 2019 GIS Core R&D Department, NavInfo Co., Ltd
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "stdafx.h"
+
+#include <stdio.h>
+#include <stdarg.h>
+#include "buffered_service_io.h"
+
+namespace ncserver
+{
+	static int _appendFormatV(std::string& output, const char* format, va_list argptr)
+	{
+		char buffer[4096];
+		va_list argcopy;
+
+		va_copy(argcopy, argptr);
+		int count = vsnprintf(buffer, sizeof(buffer), format, argcopy);
+		va_end(argcopy);
+
+		if (count < 0)
+			return count;
+
+		if ((size_t)count < sizeof(buffer))
+		{
+			output.append(buffer, count);
+		}
+		else
+		{
+			size_t oldSize = output.size();
+			output.resize(oldSize + count + 1);
+			vsnprintf(&output[oldSize], count + 1, format, argptr);
+			output.resize(oldSize + count);
+		}
+		return count;
+	}
+
+	BufferedServiceIo::BufferedServiceIo()
+	{
+		m_input = NULL;
+		m_inputSize = 0;
+		m_inputOffset = 0;
+		m_delegate = NULL;
+	}
+
+	BufferedServiceIo::~BufferedServiceIo()
+	{
+	}
+
+	void BufferedServiceIo::read(void *buffer, size_t size)
+	{
+		size_t remaining = m_inputSize - m_inputOffset;
+		if (size > remaining)
+			size = remaining;
+
+		memcpy(buffer, m_input + m_inputOffset, size);
+		m_inputOffset += size;
+	}
+
+	void BufferedServiceIo::write(void* buffer, size_t size)
+	{
+		m_output.append((const char*)buffer, size);
+	}
+
+	int BufferedServiceIo::print(const char* format, ...)
+	{
+		va_list argptr;
+
+		va_start(argptr, format);
+		int count = _appendFormatV(m_output, format, argptr);
+		va_end(argptr);
+
+		return count;
+	}
+
+	int BufferedServiceIo::addHeaderField(const char* format, ...)
+	{
+		va_list argptr;
+
+		va_start(argptr, format);
+		int count = _appendFormatV(m_output, format, argptr);
+		va_end(argptr);
+
+		if (count >= 0)
+			m_output.append("\r\n", 2);
+
+		return count;
+	}
+
+	void BufferedServiceIo::endHeaderField(void)
+	{
+		m_output.append("\r\n", 2);
+	}
+
+	void BufferedServiceIo::flush(void)
+	{
+		if (m_delegate != NULL)
+			m_delegate->bufferedServiceIoWillFlush(this);
+	}
+
+	void BufferedServiceIo::reset(const char* input, size_t inputSize)
+	{
+		m_input = input;
+		m_inputSize = inputSize;
+		m_inputOffset = 0;
+		m_output.clear();
+	}
+
+	void BufferedServiceIo::takeOutput(std::string& output)
+	{
+		output.swap(m_output);
+		m_output.clear();
+	}
+}
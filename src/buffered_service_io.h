@@ -0,0 +1,86 @@
+/*
+MIT License
+
+Copyright (c) 2019 GIS Core R&D Department, NavInfo Co., Ltd
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+
+#include <string>
+#include "ncserver/ncserver.h"
+
+namespace ncserver
+{
+	class BufferedServiceIo;
+
+	class BufferedServiceIoDelegate
+	{
+	public:
+		/**
+			Called by flush(). The delegate may take the output with takeOutput().
+		 */
+		virtual void bufferedServiceIoWillFlush(BufferedServiceIo* io) = 0;
+	};
+
+	/**
+		ServiceIo used by the event driven engines.
+		The input is taken from memory and the output is accumulated in memory,
+		so query() never blocks on the connection.
+	 */
+	class BufferedServiceIo : public ServiceIo
+	{
+	public:
+		BufferedServiceIo();
+		virtual ~BufferedServiceIo();
+
+		virtual void read(void *buffer, size_t size);
+
+		virtual void write(void* buffer, size_t size);
+
+		virtual int print(const char* format, ...);
+
+		virtual int addHeaderField(const char* format, ...);
+
+		virtual void endHeaderField(void);
+
+		virtual void flush(void);
+
+		/**
+			Start a new request. The input is not copied and must outlive the request.
+		 */
+		void reset(const char* input, size_t inputSize);
+
+		void setDelegate(BufferedServiceIoDelegate* delegate) { m_delegate = delegate; }
+
+		std::string& output() { return m_output; }
+
+		/**
+			Move the accumulated output into output and clear the buffer.
+		 */
+		void takeOutput(std::string& output);
+
+	private:
+		const char* m_input;
+		size_t m_inputSize;
+		size_t m_inputOffset;
+		std::string m_output;
+		BufferedServiceIoDelegate* m_delegate;
+	};
+}
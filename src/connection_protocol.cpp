@@ -0,0 +1,59 @@
+/*
+MIT License
+
+Copyright (c) 2019 GIS Core R&D Department, NavInfo Co., Ltd
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "stdafx.h"
+
+#include "connection_protocol.h"
+
+namespace ncserver
+{
+	void ConnectionProtocol::consumeOutput(size_t size)
+	{
+		m_outputOffset += size;
+		if (m_outputOffset == m_output.size())
+		{
+			m_output.clear();
+			m_outputOffset = 0;
+		}
+		else if (m_outputOffset > 64 * 1024 && m_outputOffset * 2 > m_output.size())
+		{
+			m_output.erase(0, m_outputOffset);
+			m_outputOffset = 0;
+		}
+	}
+
+	void ConnectionProtocol::takeOutput(std::string& output)
+	{
+		if (m_outputOffset == 0)
+		{
+			output.swap(m_output);
+			m_output.clear();
+		}
+		else
+		{
+			output.assign(m_output, m_outputOffset, std::string::npos);
+			m_output.clear();
+			m_outputOffset = 0;
+		}
+	}
+}
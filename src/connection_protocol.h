@@ -0,0 +1,105 @@
+/*
+MIT License
+
+Copyright (c) 2019 GIS Core R&D Department, NavInfo Co., Ltd
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+
+#include <string>
+
+namespace ncserver
+{
+	/**
+		A request received completely by a ConnectionProtocol.
+	 */
+	class ProtocolRequest
+	{
+	public:
+		virtual ~ProtocolRequest() {}
+
+		/**
+			"NAME=VALUE" strings terminated by NULL, which can be passed to Request::setEnvironment().
+		 */
+		virtual char** envp() = 0;
+
+		virtual const char* stdinData() = 0;
+		virtual size_t stdinSize() = 0;
+	};
+
+	/**
+		Wire protocol of one connection of the event driven engines.
+
+		It does no I/O by itself. Bytes read from the socket are fed with feed(),
+		and the bytes to be sent are accumulated in the output buffer.
+	 */
+	class ConnectionProtocol
+	{
+	public:
+		ConnectionProtocol() : m_outputOffset(0) {}
+		virtual ~ConnectionProtocol() {}
+
+		/**
+			@return
+				false on protocol error, in which case the connection should be closed.
+		 */
+		virtual bool feed(const char* data, size_t size) = 0;
+
+		/**
+			Queue the output of query(), which starts with CGI header fields.
+		 */
+		virtual void writeStdout(ProtocolRequest* request, const char* data, size_t size) = 0;
+
+		/**
+			Finish the response of the request. The request is released.
+		 */
+		virtual void endRequest(ProtocolRequest* request, int appStatus) = 0;
+
+		/**
+			Whether the connection should be closed once the output is sent.
+		 */
+		virtual bool closeAfterOutput() = 0;
+
+		/**
+			No request is in progress and nothing is left to be sent.
+			A kept-alive connection waiting for its next request is idle.
+		 */
+		virtual bool isIdle() = 0;
+
+		/**
+			A request has been handed to the delegate and isn't ended yet. The
+			connection is quiet while its query runs, but it isn't idle.
+		 */
+		virtual bool isServing() = 0;
+
+		const char* output() { return m_output.data() + m_outputOffset; }
+		size_t outputSize() { return m_output.size() - m_outputOffset; }
+		void consumeOutput(size_t size);
+
+		/**
+			Move all the output into output, which stays untouched while it is being sent.
+		 */
+		void takeOutput(std::string& output);
+
+	protected:
+		std::string m_output;
+		size_t m_outputOffset;
+	};
+}
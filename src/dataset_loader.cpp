@@ -0,0 +1,240 @@
+/*
+MIT License
+
+Copyright (c) 2019 GIS Core R&D Department, NavInfo Co., Ltd
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "stdafx.h"
+#include "ncserver/dataset_loader.h"
+#include "ncserver/task_pool.h"
+#include "ncserver/nc_log.h"
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <thread>
+
+#ifndef WIN32
+#include "worker_scaler.h"
+#endif
+
+namespace ncserver
+{
+	struct DatasetLoader::Step
+	{
+		std::string name;
+		std::vector<std::string> dependencyNames;
+		Load load;
+		std::vector<int> dependents;
+		int waitingCount;		// dependencies not loaded yet
+		bool skipped;			// for a dependency which failed
+	};
+
+	DatasetLoader::DatasetLoader()
+	{
+	}
+
+	DatasetLoader::~DatasetLoader()
+	{
+		for (size_t i = 0; i < m_steps.size(); i++)
+			delete m_steps[i];
+	}
+
+	void DatasetLoader::add(const char* name, const Load& load)
+	{
+		add(name, std::vector<std::string>(), load);
+	}
+
+	void DatasetLoader::add(const char* name, const std::vector<std::string>& dependencies, const Load& load)
+	{
+		Step* step = new Step();
+		step->name = name;
+		step->dependencyNames = dependencies;
+		step->load = load;
+		m_steps.push_back(step);
+	}
+
+	bool DatasetLoader::resolve()
+	{
+		for (size_t i = 0; i < m_steps.size(); i++)
+		{
+			m_steps[i]->dependents.clear();
+			m_steps[i]->waitingCount = (int)m_steps[i]->dependencyNames.size();
+			m_steps[i]->skipped = false;
+		}
+
+		for (size_t i = 0; i < m_steps.size(); i++)
+		{
+			for (size_t j = 0; j < m_steps[i]->dependencyNames.size(); j++)
+			{
+				const std::string& dependency = m_steps[i]->dependencyNames[j];
+				size_t k = 0;
+				while (k < m_steps.size() && m_steps[k]->name != dependency)
+					k++;
+				if (k == m_steps.size())
+				{
+					ASYNC_LOG_ERR("Step %s of the loader depends on %s, which doesn't exist", m_steps[i]->name.c_str(), dependency.c_str());
+					return false;
+				}
+				m_steps[k]->dependents.push_back((int)i);
+			}
+		}
+
+		// Kahn's algorithm: the steps left over wait for each other
+		std::vector<int> waitingCounts(m_steps.size());
+		std::vector<int> ready;
+		for (size_t i = 0; i < m_steps.size(); i++)
+		{
+			waitingCounts[i] = m_steps[i]->waitingCount;
+			if (waitingCounts[i] == 0)
+				ready.push_back((int)i);
+		}
+		size_t orderedCount = 0;
+		while (!ready.empty())
+		{
+			Step* step = m_steps[ready.back()];
+			ready.pop_back();
+			orderedCount++;
+			for (size_t j = 0; j < step->dependents.size(); j++)
+			{
+				if (--waitingCounts[step->dependents[j]] == 0)
+					ready.push_back(step->dependents[j]);
+			}
+		}
+		if (orderedCount < m_steps.size())
+		{
+			for (size_t i = 0; i < m_steps.size(); i++)
+			{
+				if (waitingCounts[i] > 0)
+					ASYNC_LOG_ERR("Step %s of the loader has circular dependencies", m_steps[i]->name.c_str());
+			}
+			return false;
+		}
+		return true;
+	}
+
+	bool DatasetLoader::run(int threadCount)
+	{
+		m_loadTimes.clear();
+		if (!resolve())
+			return false;
+
+		if (threadCount <= 0)
+		{
+#ifndef WIN32
+			threadCount = affordableWorkerCount(readCgroupLimits(), 1, 0);
+#else
+			threadCount = (int)std::thread::hardware_concurrency();
+#endif
+		}
+		threadCount = std::max(1, std::min(threadCount, (int)m_steps.size()));
+
+		m_loadTimes.resize(m_steps.size());
+		for (size_t i = 0; i < m_steps.size(); i++)
+		{
+			m_loadTimes[i].name = m_steps[i]->name;
+			m_loadTimes[i].loaded = false;
+			m_loadTimes[i].startMs = 0;
+			m_loadTimes[i].durationMs = 0;
+		}
+
+		typedef std::chrono::steady_clock Clock;
+		Clock::time_point start = Clock::now();
+		std::mutex mutex;
+		{
+			// the joining thread runs steps as well
+			TaskPool pool(threadCount - 1);
+			TaskGroup group(&pool);
+			std::function<void(int)> runStep = [&](int index) {
+				Step* step = m_steps[index];
+				DatasetLoadTime& time = m_loadTimes[index];
+				Clock::time_point stepStart = Clock::now();
+				bool loaded = false;
+				if (!step->skipped)
+				{
+					try
+					{
+						loaded = step->load();
+					}
+					catch (...)
+					{
+						ASYNC_LOG_ERR("Step %s of the loader threw an exception", step->name.c_str());
+					}
+				}
+				Clock::time_point stepEnd = Clock::now();
+
+				std::lock_guard<std::mutex> lock(mutex);
+				time.loaded = loaded;
+				time.startMs = std::chrono::duration<double, std::milli>(stepStart - start).count();
+				time.durationMs = std::chrono::duration<double, std::milli>(stepEnd - stepStart).count();
+				for (size_t i = 0; i < step->dependents.size(); i++)
+				{
+					Step* dependent = m_steps[step->dependents[i]];
+					dependent->skipped = dependent->skipped || !loaded;
+					if (--dependent->waitingCount == 0)
+					{
+						int dependentIndex = step->dependents[i];
+						group.spawn([&runStep, dependentIndex]() { runStep(dependentIndex); });
+					}
+				}
+			};
+
+			// chosen before any runs, as a step finishing makes others ready
+			std::vector<int> ready;
+			for (size_t i = 0; i < m_steps.size(); i++)
+			{
+				if (m_steps[i]->waitingCount == 0)
+					ready.push_back((int)i);
+			}
+			for (size_t i = 0; i < ready.size(); i++)
+			{
+				int index = ready[i];
+				group.spawn([&runStep, index]() { runStep(index); });
+			}
+			group.join();
+			// and the threads of the pool exit here, before anything is forked
+		}
+		double totalMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+		std::vector<const DatasetLoadTime*> slowest;
+		double workMs = 0;
+		bool allLoaded = true;
+		for (size_t i = 0; i < m_loadTimes.size(); i++)
+		{
+			slowest.push_back(&m_loadTimes[i]);
+			workMs += m_loadTimes[i].durationMs;
+			allLoaded = allLoaded && m_loadTimes[i].loaded;
+		}
+		std::sort(slowest.begin(), slowest.end(), [](const DatasetLoadTime* a, const DatasetLoadTime* b) {
+			return a->durationMs > b->durationMs;
+		});
+		ASYNC_LOG_NOTICE("Loader ran %zu steps in %.1fms on %d threads, %.1fms of work", m_steps.size(), totalMs, threadCount, workMs);
+		for (size_t i = 0; i < slowest.size(); i++)
+		{
+			const DatasetLoadTime* time = slowest[i];
+			if (time->loaded)
+				ASYNC_LOG_INFO("Step %s loaded in %.1fms, started at %.1fms", time->name.c_str(), time->durationMs, time->startMs);
+			else if (m_steps[time - &m_loadTimes[0]]->skipped)
+				ASYNC_LOG_ERR("Step %s is skipped, as a dependency failed", time->name.c_str());
+			else
+				ASYNC_LOG_ERR("Step %s failed in %.1fms", time->name.c_str(), time->durationMs);
+		}
+		return allLoaded;
+	}
+}
@@ -0,0 +1,851 @@
+/*
+MIT License
+
+Copyright (c) 2019 GIS Core R&D Department, NavInfo Co., Ltd
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "stdafx.h"
+#include "ncserver/dataset_registry.h"
+#include "ncserver/nc_log.h"
+#include "placement.h"
+#include <atomic>
+#include <errno.h>
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+namespace ncserver
+{
+	/**
+		Lookups of one process, a cache line each so that workers don't share one.
+	 */
+	struct alignas(64) LookupCounter
+	{
+		std::atomic<long long> lookups;
+		std::atomic<long long> remoteLookups;
+	};
+
+	static void* _allocReplica(size_t size)
+	{
+#ifndef WIN32
+		void* memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		return memory == MAP_FAILED ? NULL : memory;
+#else
+		return malloc(size);
+#endif
+	}
+
+	static void _freeReplica(void* memory, size_t size)
+	{
+#ifndef WIN32
+		munmap(memory, size);
+#else
+		free(memory);
+#endif
+	}
+
+	static const char SNAPSHOT_MAGIC[8] = { 'N', 'C', 'S', 'N', 'A', 'P', 0, 0 };
+	// raised whenever SnapshotHeader or SnapshotEntry changes
+	static const unsigned int SNAPSHOT_FORMAT_VERSION = 1;
+
+	/**
+		At the start of a snapshot file, followed by the entries of its datasets
+		and then their data, each at a page boundary. Written in the byte order
+		and the layout of the host, for the same build to read back.
+	 */
+	struct SnapshotHeader
+	{
+		char magic[8];
+		unsigned int formatVersion;
+		unsigned int datasetCount;
+		unsigned long long fileSize;
+		unsigned long long checksum;	// of the header with 0 here, and of the entries
+	};
+
+	/**
+		FNV-1a over 64-bit words, continuing from @a seed.
+	 */
+	static unsigned long long _checksum(const void* data, size_t size, unsigned long long seed = 14695981039346656037ULL)
+	{
+		const unsigned long long prime = 1099511628211ULL;
+		const unsigned char* bytes = (const unsigned char*)data;
+		unsigned long long hash = seed;
+		size_t i = 0;
+		for (; i + 8 <= size; i += 8)
+		{
+			unsigned long long word;
+			memcpy(&word, bytes + i, 8);
+			hash = (hash ^ word) * prime;
+		}
+		for (; i < size; i++)
+			hash = (hash ^ bytes[i]) * prime;
+		return hash;
+	}
+
+	static size_t _pageSize()
+	{
+#ifndef WIN32
+		return (size_t)sysconf(_SC_PAGESIZE);
+#else
+		return 4096;
+#endif
+	}
+
+	static unsigned long long _alignToPage(unsigned long long size)
+	{
+		unsigned long long pageSize = _pageSize();
+		return (size + pageSize - 1) / pageSize * pageSize;
+	}
+
+#ifndef WIN32
+	static bool _readAt(int fd, void* buffer, size_t size, unsigned long long offset)
+	{
+		size_t done = 0;
+		while (done < size)
+		{
+			ssize_t n = pread(fd, (char*)buffer + done, size - done, (off_t)(offset + done));
+			if (n <= 0)
+				return false;
+			done += (size_t)n;
+		}
+		return true;
+	}
+#endif
+
+	static LookupCounter* _allocCounters(int count)
+	{
+		size_t size = sizeof(LookupCounter) * count;
+#ifndef WIN32
+		// shared, so that the manager sees the counts of the workers
+		void* memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+		if (memory == MAP_FAILED)
+			return NULL;
+#else
+		void* memory = _aligned_malloc(size, 64);
+		if (memory == NULL)
+			return NULL;
+#endif
+		LookupCounter* counters = (LookupCounter*)memory;
+		for (int i = 0; i < count; i++)
+		{
+			new (&counters[i].lookups) std::atomic<long long>(0);
+			new (&counters[i].remoteLookups) std::atomic<long long>(0);
+		}
+		return counters;
+	}
+
+	static void _freeCounters(LookupCounter* counters, int count)
+	{
+#ifndef WIN32
+		munmap(counters, sizeof(LookupCounter) * count);
+#else
+		_aligned_free(counters);
+#endif
+	}
+
+	struct DatasetRegistry::Dataset
+	{
+		struct Replica
+		{
+			void* memory;
+			int node;
+		};
+
+		std::string name;
+		std::string version;
+		int generation;				// of the last add()
+		bool inherited;
+		size_t size;
+		size_t mappedSize;
+		std::vector<Replica> replicas;
+		size_t localReplica;
+		LookupCounter* counters;	// shared by the manager and all the workers
+		int counterCount;
+
+		~Dataset()
+		{
+			for (size_t i = 0; i < replicas.size(); i++)
+				_freeReplica(replicas[i].memory, mappedSize);
+			if (counters != NULL)
+				_freeCounters(counters, counterCount);
+		}
+	};
+
+	DatasetRegistry::DatasetRegistry()
+	{
+		m_workerCount = 0;
+		m_replicate = false;
+		m_slot = 0;
+		m_generation = 0;
+		m_snapshotFd = -1;
+		m_table = NULL;
+	}
+
+	DatasetRegistry::~DatasetRegistry()
+	{
+		clear();
+		closeSnapshot();
+	}
+
+	void DatasetRegistry::clear()
+	{
+		for (size_t i = 0; i < m_datasets.size(); i++)
+			delete m_datasets[i];
+		m_datasets.clear();
+		m_formerTables.clear();
+	}
+
+	void DatasetRegistry::init(int workerCount, bool replicate)
+	{
+		clear();
+		setWorkerCount(workerCount, replicate);
+	}
+
+	void DatasetRegistry::renew(int workerCount, bool replicate)
+	{
+		// the replicas would be on the wrong nodes
+		if (replicate != m_replicate)
+			clear();
+		m_generation++;
+		setWorkerCount(workerCount, replicate);
+
+		// The counters are shared with the workers of the former generation.
+		for (size_t i = 0; i < m_datasets.size(); i++)
+		{
+			Dataset* dataset = m_datasets[i];
+			if (dataset == NULL)
+				continue;
+			_freeCounters(dataset->counters, dataset->counterCount);
+			dataset->counterCount = m_workerCount + 1;
+			dataset->counters = _allocCounters(dataset->counterCount);
+			dataset->inherited = false;
+			if (dataset->counters == NULL)
+			{
+				delete dataset;
+				m_datasets[i] = NULL;
+			}
+		}
+	}
+
+	void DatasetRegistry::prune()
+	{
+		for (size_t i = 0; i < m_datasets.size(); i++)
+		{
+			Dataset* dataset = m_datasets[i];
+			if (dataset != NULL && dataset->generation != m_generation)
+			{
+				ASYNC_LOG_INFO("Dataset %s is dropped", dataset->name.c_str());
+				delete dataset;
+				// ids are indexes, which have to stay the same
+				m_datasets[i] = NULL;
+			}
+		}
+		m_formerTables.clear();
+	}
+
+	void DatasetRegistry::setWorkerCount(int workerCount, bool replicate)
+	{
+		m_workerCount = workerCount > 0 ? workerCount : 0;
+		m_replicate = replicate;
+		m_slot = m_workerCount;
+
+		m_cpuNodes.clear();
+#ifndef WIN32
+		std::vector<int> nodes = numaNodes();
+		for (size_t i = 0; i < nodes.size(); i++)
+		{
+			std::vector<int> cpus = numaNodeCpus(nodes[i]);
+			for (size_t j = 0; j < cpus.size(); j++)
+			{
+				if (cpus[j] >= (int)m_cpuNodes.size())
+					m_cpuNodes.resize(cpus[j] + 1, -1);
+				m_cpuNodes[cpus[j]] = nodes[i];
+			}
+		}
+#endif
+	}
+
+	int DatasetRegistry::add(const char* name, size_t size, const Filler& fill)
+	{
+		return add(name, "", size, fill);
+	}
+
+	int DatasetRegistry::add(const char* name, const char* version, size_t size, const Filler& fill)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		int id = indexOf(name);
+		Dataset* former = id >= 0 ? m_datasets[id] : NULL;
+		if (size == 0 || (former != NULL && former->generation == m_generation))
+		{
+			ASYNC_LOG_ERR("Dataset %s is empty or added twice", name);
+			return -1;
+		}
+
+		if (former != NULL)
+		{
+			if (version[0] != 0 && former->version == version && former->size == size)
+			{
+				former->generation = m_generation;
+				former->inherited = true;
+				ASYNC_LOG_INFO("Dataset %s of version %s is inherited", name, version);
+				return id;
+			}
+			delete former;
+			m_datasets[id] = NULL;
+		}
+
+		// filled without the lock, in parallel with those of other threads
+		lock.unlock();
+		const SnapshotEntry* entry = version[0] != 0 ? findSnapshotEntry(name, version) : NULL;
+		Dataset* dataset = entry != NULL && entry->size == size ? createFromSnapshot(*entry) : NULL;
+		if (dataset == NULL)
+			dataset = create(name, size, fill);
+		if (dataset == NULL)
+			return -1;
+		dataset->version = version;
+		lock.lock();
+		return insert(id, dataset);
+	}
+
+	int DatasetRegistry::restore(const char* name, const char* version)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		int id = indexOf(name);
+		Dataset* former = id >= 0 ? m_datasets[id] : NULL;
+		if (version[0] == 0 || (former != NULL && former->generation == m_generation))
+			return -1;
+
+		if (former != NULL && former->version == version)
+		{
+			former->generation = m_generation;
+			former->inherited = true;
+			ASYNC_LOG_INFO("Dataset %s of version %s is inherited", name, version);
+			return id;
+		}
+
+		const SnapshotEntry* entry = findSnapshotEntry(name, version);
+		if (entry == NULL)
+			return -1;
+		lock.unlock();
+		Dataset* dataset = createFromSnapshot(*entry);
+		if (dataset == NULL)
+			return -1;
+		dataset->version = version;
+		lock.lock();
+		id = indexOf(name);
+		if (id >= 0 && m_datasets[id]->generation == m_generation)
+		{
+			ASYNC_LOG_ERR("Dataset %s is added twice", name);
+			delete dataset;
+			return -1;
+		}
+		if (id >= 0)
+		{
+			delete m_datasets[id];
+			m_datasets[id] = NULL;
+		}
+		return insert(id, dataset);
+	}
+
+	int DatasetRegistry::insert(int id, Dataset* dataset)
+	{
+		// the same name added by two threads at once
+		int added = indexOf(dataset->name.c_str());
+		if (added >= 0 && added != id)
+		{
+			ASYNC_LOG_ERR("Dataset %s is added twice", dataset->name.c_str());
+			delete dataset;
+			return -1;
+		}
+
+		if (id >= 0)
+		{
+			m_datasets[id] = dataset;
+			return id;
+		}
+		if (m_datasets.size() == m_datasets.capacity())
+		{
+			// not freed by push_back(), as get() may be reading it
+			std::vector<Dataset*> grown;
+			grown.reserve(m_datasets.empty() ? 16 : m_datasets.size() * 2);
+			grown.assign(m_datasets.begin(), m_datasets.end());
+			m_formerTables.push_back(std::vector<Dataset*>());
+			m_formerTables.back().swap(m_datasets);
+			m_datasets.swap(grown);
+		}
+		m_datasets.push_back(dataset);
+		m_table.store(m_datasets.data(), std::memory_order_release);
+		return (int)m_datasets.size() - 1;
+	}
+
+	DatasetRegistry::Dataset* DatasetRegistry::create(const char* name, size_t size, const Filler& fill)
+	{
+		Dataset* dataset = new Dataset();
+		dataset->name = name;
+		dataset->generation = m_generation;
+		dataset->inherited = false;
+		dataset->size = size;
+		dataset->mappedSize = size;
+		dataset->localReplica = 0;
+		dataset->counterCount = m_workerCount + 1;
+		dataset->counters = _allocCounters(dataset->counterCount);
+
+#ifndef WIN32
+		long pageSize = sysconf(_SC_PAGESIZE);
+		dataset->mappedSize = (size + pageSize - 1) / pageSize * pageSize;
+
+		std::vector<int> nodes;
+		if (m_replicate)
+			nodes = numaNodes();
+		if (nodes.size() > 1)
+		{
+			for (size_t i = 0; i < nodes.size(); i++)
+			{
+				void* memory = _allocReplica(dataset->mappedSize);
+				if (memory == NULL)
+					break;
+				// A node without memory can't hold a replica.
+				if (!bindMemoryToNode(memory, dataset->mappedSize, nodes[i]))
+				{
+					_freeReplica(memory, dataset->mappedSize);
+					continue;
+				}
+				Dataset::Replica replica = { memory, nodes[i] };
+				dataset->replicas.push_back(replica);
+			}
+		}
+#endif
+		if (dataset->replicas.empty())
+		{
+			Dataset::Replica replica = { _allocReplica(dataset->mappedSize), -1 };
+			if (replica.memory != NULL)
+				dataset->replicas.push_back(replica);
+		}
+
+		if (dataset->replicas.empty() || dataset->counters == NULL)
+		{
+			ASYNC_LOG_ERR("Out of memory for dataset %s of %zu bytes", name, size);
+			delete dataset;
+			return NULL;
+		}
+
+		for (size_t i = 0; i < dataset->replicas.size(); i++)
+		{
+			Dataset::Replica& replica = dataset->replicas[i];
+			fill(replica.memory, size);
+#ifndef WIN32
+			mprotect(replica.memory, dataset->mappedSize, PROT_READ);
+			// where the pages really are, the policy of an unbound replica included
+			replica.node = numaNodeOfMemory(replica.memory);
+#endif
+		}
+		return dataset;
+	}
+
+	DatasetRegistry::Dataset* DatasetRegistry::createFromSnapshot(const SnapshotEntry& entry)
+	{
+#ifndef WIN32
+		int fd = m_snapshotFd;
+		unsigned long long offset = entry.offset;
+		std::vector<int> nodes;
+		if (m_replicate)
+			nodes = numaNodes();
+		if (nodes.size() > 1)
+		{
+			// copied into the replica of every node, and checked on the way
+			bool intact = true;
+			Dataset* dataset = create(entry.name, (size_t)entry.size, [fd, offset, &entry, &intact](void* memory, size_t size) {
+				intact = intact && _readAt(fd, memory, size, offset) && _checksum(memory, size) == entry.checksum;
+			});
+			if (dataset != NULL && !intact)
+			{
+				ASYNC_LOG_ERR("Dataset %s of the snapshot is corrupt, it is built anew", entry.name);
+				delete dataset;
+				return NULL;
+			}
+			return dataset;
+		}
+
+		// Mapped rather than read, so that its pages are those of the page cache,
+		// read from the disk only as they are used.
+		size_t mappedSize = (size_t)_alignToPage(entry.size);
+		void* memory = mmap(NULL, mappedSize, PROT_READ, MAP_PRIVATE, fd, (off_t)offset);
+		if (memory == MAP_FAILED)
+		{
+			ASYNC_LOG_ERR("Failed to map dataset %s of the snapshot: %s", entry.name, strerror(errno));
+			return NULL;
+		}
+
+		Dataset* dataset = new Dataset();
+		dataset->name = entry.name;
+		dataset->generation = m_generation;
+		dataset->inherited = false;
+		dataset->size = (size_t)entry.size;
+		dataset->mappedSize = mappedSize;
+		dataset->localReplica = 0;
+		dataset->counterCount = m_workerCount + 1;
+		dataset->counters = _allocCounters(dataset->counterCount);
+		Dataset::Replica replica = { memory, -1 };
+		dataset->replicas.push_back(replica);
+		if (dataset->counters == NULL)
+		{
+			delete dataset;
+			return NULL;
+		}
+		ASYNC_LOG_INFO("Dataset %s of version %s is mapped from the snapshot", entry.name, entry.version);
+		return dataset;
+#else
+		return NULL;
+#endif
+	}
+
+	const DatasetRegistry::SnapshotEntry* DatasetRegistry::findSnapshotEntry(const char* name, const char* version) const
+	{
+		for (size_t i = 0; i < m_snapshot.size(); i++)
+		{
+			if (strcmp(m_snapshot[i].name, name) == 0 && strcmp(m_snapshot[i].version, version) == 0)
+				return &m_snapshot[i];
+		}
+		return NULL;
+	}
+
+	bool DatasetRegistry::openSnapshot(const char* path)
+	{
+		closeSnapshot();
+#ifndef WIN32
+		int fd = open(path, O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+		{
+			ASYNC_LOG_INFO("No snapshot at %s, the datasets are built", path);
+			return false;
+		}
+
+		struct stat s;
+		SnapshotHeader header;
+		bool valid = fstat(fd, &s) == 0 && _readAt(fd, &header, sizeof(header), 0)
+			&& memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) == 0
+			&& header.formatVersion == SNAPSHOT_FORMAT_VERSION
+			&& header.fileSize == (unsigned long long)s.st_size
+			&& sizeof(header) + (unsigned long long)header.datasetCount * sizeof(SnapshotEntry) <= header.fileSize;
+
+		std::vector<SnapshotEntry> entries;
+		if (valid)
+		{
+			entries.resize(header.datasetCount);
+			valid = entries.empty() || _readAt(fd, &entries[0], sizeof(SnapshotEntry) * entries.size(), sizeof(header));
+		}
+		if (valid)
+		{
+			unsigned long long checksum = header.checksum;
+			header.checksum = 0;
+			unsigned long long computed = _checksum(&header, sizeof(header));
+			if (!entries.empty())
+				computed = _checksum(&entries[0], sizeof(SnapshotEntry) * entries.size(), computed);
+			valid = computed == checksum;
+		}
+		for (size_t i = 0; i < entries.size() && valid; i++)
+		{
+			const SnapshotEntry& entry = entries[i];
+			valid = memchr(entry.name, 0, sizeof(entry.name)) != NULL && memchr(entry.version, 0, sizeof(entry.version)) != NULL
+				&& entry.offset % _pageSize() == 0 && entry.offset + entry.size <= header.fileSize;
+		}
+
+		if (!valid)
+		{
+			ASYNC_LOG_WARNING("Snapshot %s is invalid, the datasets are built anew", path);
+			close(fd);
+			return false;
+		}
+
+		m_snapshot = entries;
+		m_snapshotFd = fd;
+		ASYNC_LOG_INFO("Snapshot %s has %zu datasets", path, entries.size());
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	bool DatasetRegistry::saveSnapshot(const char* path) const
+	{
+#ifndef WIN32
+		std::vector<SnapshotEntry> entries;
+		std::vector<const Dataset*> datasets;
+		for (size_t i = 0; i < m_datasets.size(); i++)
+		{
+			const Dataset* dataset = m_datasets[i];
+			if (dataset == NULL || dataset->version.empty())
+				continue;
+
+			SnapshotEntry entry;
+			memset(&entry, 0, sizeof(entry));
+			if (dataset->name.size() >= sizeof(entry.name) || dataset->version.size() >= sizeof(entry.version))
+			{
+				ASYNC_LOG_WARNING("Dataset %s is left out of the snapshot, its name or version is too long", dataset->name.c_str());
+				continue;
+			}
+			memcpy(entry.name, dataset->name.c_str(), dataset->name.size());
+			memcpy(entry.version, dataset->version.c_str(), dataset->version.size());
+			entry.size = dataset->size;
+			entry.checksum = _checksum(dataset->replicas[0].memory, dataset->size);
+			entries.push_back(entry);
+			datasets.push_back(dataset);
+		}
+
+		unsigned long long offset = _alignToPage(sizeof(SnapshotHeader) + sizeof(SnapshotEntry) * entries.size());
+		for (size_t i = 0; i < entries.size(); i++)
+		{
+			entries[i].offset = offset;
+			offset += _alignToPage(entries[i].size);
+		}
+
+		SnapshotHeader header;
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+		header.formatVersion = SNAPSHOT_FORMAT_VERSION;
+		header.datasetCount = (unsigned int)entries.size();
+		header.fileSize = offset;
+		header.checksum = _checksum(&header, sizeof(header));
+		if (!entries.empty())
+			header.checksum = _checksum(&entries[0], sizeof(SnapshotEntry) * entries.size(), header.checksum);
+
+		// renamed at last, so that a crash never leaves half a snapshot at the path
+		std::string temporaryPath = std::string(path) + ".tmp";
+		FILE* file = fopen(temporaryPath.c_str(), "wb");
+		if (file == NULL)
+		{
+			ASYNC_LOG_ERR("Failed to write snapshot %s: %s", temporaryPath.c_str(), strerror(errno));
+			return false;
+		}
+
+		std::vector<char> zeros(_pageSize(), 0);
+		bool written = fwrite(&header, sizeof(header), 1, file) == 1
+			&& (entries.empty() || fwrite(&entries[0], sizeof(SnapshotEntry), entries.size(), file) == entries.size());
+		for (size_t i = 0; i <= entries.size() && written; i++)
+		{
+			// up to the page of the next dataset, or to the end of the file
+			unsigned long long next = i < entries.size() ? entries[i].offset : header.fileSize;
+			long position = ftell(file);
+			written = position >= 0 && fwrite(&zeros[0], 1, (size_t)(next - position), file) == (size_t)(next - position);
+			if (written && i < entries.size())
+				written = fwrite(datasets[i]->replicas[0].memory, 1, (size_t)entries[i].size, file) == (size_t)entries[i].size;
+		}
+		written = written && fflush(file) == 0 && fsync(fileno(file)) == 0;
+		fclose(file);
+
+		if (!written || rename(temporaryPath.c_str(), path) != 0)
+		{
+			ASYNC_LOG_ERR("Failed to write snapshot %s: %s", path, strerror(errno));
+			unlink(temporaryPath.c_str());
+			return false;
+		}
+		ASYNC_LOG_NOTICE("Snapshot %s of %zu datasets is written", path, entries.size());
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	bool DatasetRegistry::snapshotChanged() const
+	{
+		size_t count = 0;
+		for (size_t i = 0; i < m_datasets.size(); i++)
+		{
+			const Dataset* dataset = m_datasets[i];
+			if (dataset == NULL || dataset->version.empty())
+				continue;
+			const SnapshotEntry* entry = findSnapshotEntry(dataset->name.c_str(), dataset->version.c_str());
+			if (entry == NULL || entry->size != dataset->size)
+				return true;
+			count++;
+		}
+		return count != m_snapshot.size();
+	}
+
+	void DatasetRegistry::closeSnapshot()
+	{
+#ifndef WIN32
+		// the datasets mapped from it stay
+		if (m_snapshotFd >= 0)
+			close(m_snapshotFd);
+#endif
+		m_snapshotFd = -1;
+		m_snapshot.clear();
+	}
+
+	int DatasetRegistry::add(const char* name, const void* data, size_t size)
+	{
+		return add(name, size, [data](void* memory, size_t size) { memcpy(memory, data, size); });
+	}
+
+	int DatasetRegistry::addFile(const char* name, const char* path)
+	{
+		struct stat s;
+		std::string version = fileVersion(path);
+		if (version.empty() || stat(path, &s) != 0)
+		{
+			ASYNC_LOG_ERR("Failed to stat %s of dataset %s", path, name);
+			return -1;
+		}
+
+		std::string filePath = path;
+		return add(name, version.c_str(), (size_t)s.st_size, [name, filePath](void* memory, size_t size) {
+			size_t loaded = 0;
+			FILE* file = fopen(filePath.c_str(), "rb");
+			if (file != NULL)
+			{
+				loaded = fread(memory, 1, size, file);
+				fclose(file);
+			}
+			if (loaded < size)
+			{
+				ASYNC_LOG_ERR("Dataset %s is truncated, %s has %zu of %zu bytes", name, filePath.c_str(), loaded, size);
+				memset((char*)memory + loaded, 0, size - loaded);
+			}
+		});
+	}
+
+	std::string DatasetRegistry::fileVersion(const char* path)
+	{
+		struct stat s;
+		if (stat(path, &s) != 0)
+			return std::string();
+
+		char version[128];
+#ifndef WIN32
+		snprintf(version, sizeof(version), "%llx-%llx-%lld.%09ld", (unsigned long long)s.st_ino,
+			(unsigned long long)s.st_size, (long long)s.st_mtim.tv_sec, (long)s.st_mtim.tv_nsec);
+#else
+		snprintf(version, sizeof(version), "%llx-%lld", (unsigned long long)s.st_size, (long long)s.st_mtime);
+#endif
+		return version;
+	}
+
+	int DatasetRegistry::find(const char* name) const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return indexOf(name);
+	}
+
+	int DatasetRegistry::indexOf(const char* name) const
+	{
+		for (size_t i = 0; i < m_datasets.size(); i++)
+		{
+			if (m_datasets[i] != NULL && m_datasets[i]->name == name)
+				return (int)i;
+		}
+		return -1;
+	}
+
+	static int _currentCpu()
+	{
+#ifndef WIN32
+		return sched_getcpu();
+#else
+		return -1;
+#endif
+	}
+
+	const void* DatasetRegistry::get(int id)
+	{
+		Dataset* dataset = m_table.load(std::memory_order_acquire)[id];
+		const Dataset::Replica& replica = dataset->replicas[dataset->localReplica];
+
+		LookupCounter& counter = dataset->counters[m_slot];
+		counter.lookups.fetch_add(1, std::memory_order_relaxed);
+		int cpu = _currentCpu();
+		if (replica.node >= 0 && cpu >= 0 && cpu < (int)m_cpuNodes.size()
+			&& m_cpuNodes[cpu] >= 0 && m_cpuNodes[cpu] != replica.node)
+		{
+			counter.remoteLookups.fetch_add(1, std::memory_order_relaxed);
+		}
+		return replica.memory;
+	}
+
+	size_t DatasetRegistry::sizeOf(int id) const
+	{
+		return m_table.load(std::memory_order_acquire)[id]->size;
+	}
+
+	void DatasetRegistry::bindWorker(int index, int node)
+	{
+		if (index >= 0 && index < m_workerCount)
+			m_slot = index;
+
+		if (node < 0)
+		{
+			int cpu = _currentCpu();
+			if (cpu >= 0 && cpu < (int)m_cpuNodes.size())
+				node = m_cpuNodes[cpu];
+		}
+
+		for (size_t i = 0; i < m_datasets.size(); i++)
+		{
+			Dataset* dataset = m_datasets[i];
+			if (dataset == NULL)
+				continue;
+			dataset->localReplica = 0;
+			for (size_t j = 0; j < dataset->replicas.size(); j++)
+			{
+				if (dataset->replicas[j].node == node)
+				{
+					dataset->localReplica = j;
+					break;
+				}
+			}
+		}
+	}
+
+	std::vector<DatasetStats> DatasetRegistry::stats() const
+	{
+		std::vector<DatasetStats> result;
+		for (size_t i = 0; i < m_datasets.size(); i++)
+		{
+			const Dataset* dataset = m_datasets[i];
+			if (dataset == NULL)
+				continue;
+			DatasetStats stats;
+			stats.name = dataset->name;
+			stats.size = dataset->size;
+			stats.version = dataset->version;
+			stats.inherited = dataset->inherited;
+			for (size_t j = 0; j < dataset->replicas.size(); j++)
+				stats.nodes.push_back(dataset->replicas[j].node);
+			stats.lookups = 0;
+			stats.remoteLookups = 0;
+			for (int j = 0; j < dataset->counterCount; j++)
+			{
+				stats.lookups += dataset->counters[j].lookups.load(std::memory_order_relaxed);
+				stats.remoteLookups += dataset->counters[j].remoteLookups.load(std::memory_order_relaxed);
+			}
+			result.push_back(stats);
+		}
+		return result;
+	}
+}
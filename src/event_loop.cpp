@@ -0,0 +1,81 @@
+/*
+MIT License
+
+Copyright (c) 2019 GIS Core R&D Department, NavInfo Co., Ltd
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "stdafx.h"
+
+#ifndef WIN32
+
+#include <errno.h>
+#include "event_loop.h"
+
+namespace ncserver
+{
+	EventLoop::EventLoop()
+	{
+		m_epollFd = epoll_create1(EPOLL_CLOEXEC);
+	}
+
+	EventLoop::~EventLoop()
+	{
+		if (m_epollFd >= 0)
+			close(m_epollFd);
+	}
+
+	bool EventLoop::add(int fd, uint32_t events, EventHandler* handler)
+	{
+		struct epoll_event ev;
+		ev.events = events;
+		ev.data.ptr = handler;
+		return epoll_ctl(m_epollFd, EPOLL_CTL_ADD, fd, &ev) == 0;
+	}
+
+	bool EventLoop::modify(int fd, uint32_t events, EventHandler* handler)
+	{
+		struct epoll_event ev;
+		ev.events = events;
+		ev.data.ptr = handler;
+		return epoll_ctl(m_epollFd, EPOLL_CTL_MOD, fd, &ev) == 0;
+	}
+
+	void EventLoop::remove(int fd)
+	{
+		struct epoll_event ev;
+		epoll_ctl(m_epollFd, EPOLL_CTL_DEL, fd, &ev);
+	}
+
+	int EventLoop::runOnce(int timeoutMs)
+	{
+		int n = epoll_wait(m_epollFd, m_events, MAX_EVENTS, timeoutMs);
+		if (n < 0)
+			return -1;
+
+		for (int i = 0; i < n; i++)
+		{
+			EventHandler* handler = (EventHandler*)m_events[i].data.ptr;
+			handler->handleEvents(m_events[i].events);
+		}
+		return n;
+	}
+}
+
+#endif
@@ -0,0 +1,74 @@
+/*
+MIT License
+
+Copyright (c) 2019 GIS Core R&D Department, NavInfo Co., Ltd
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+
+#ifndef WIN32
+
+#include <stdint.h>
+#include <sys/epoll.h>
+
+namespace ncserver
+{
+	class EventHandler
+	{
+	public:
+		virtual ~EventHandler() {}
+
+		/**
+			@param events
+				EPOLLIN, EPOLLOUT, EPOLLERR, EPOLLHUP... reported for the watched fd.
+		 */
+		virtual void handleEvents(uint32_t events) = 0;
+	};
+
+	/**
+		A thin wrapper of epoll. Every serving thread owns its own loop.
+	 */
+	class EventLoop
+	{
+	public:
+		EventLoop();
+		~EventLoop();
+
+		bool add(int fd, uint32_t events, EventHandler* handler);
+		bool modify(int fd, uint32_t events, EventHandler* handler);
+		void remove(int fd);
+
+		/**
+			Wait for at most timeoutMs milliseconds and dispatch the ready events.
+
+			@return
+				Number of dispatched events, -1 if interrupted by a signal or on error.
+		 */
+		int runOnce(int timeoutMs);
+
+	private:
+		enum { MAX_EVENTS = 256 };
+
+		int m_epollFd;
+		struct epoll_event m_events[MAX_EVENTS];
+	};
+}
+
+#endif
@@ -0,0 +1,429 @@
+/*
+MIT License
+
+Copyright (c) 2019 GIS Core R&D Department, NavInfo Co., Ltd
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "stdafx.h"
+
+#ifndef WIN32
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include "event_server.h"
+#include "util.h"
+
+namespace ncserver
+{
+	class EventServer::Connection : public EventHandler, public FcgiConnectionDelegate, public HttpConnectionDelegate
+	{
+	public:
+		Connection(EventServer* server, int fd)
+		{
+			if (server->m_http)
+				m_protocol = new HttpConnection(this);
+			else
+				m_protocol = new FcgiConnection(this, &server->m_capacity);
+			m_server = server;
+			m_fd = fd;
+			m_index = 0;
+			m_closed = false;
+			m_waitingForWrite = false;
+			m_lastActive = 0;
+			m_prevActive = NULL;
+			m_nextActive = NULL;
+		}
+
+		~Connection()
+		{
+			if (m_fd >= 0)
+				::close(m_fd);
+			delete m_protocol;
+		}
+
+		virtual void handleEvents(uint32_t events)
+		{
+			if (events & EPOLLERR)
+			{
+				m_server->closeConnection(this);
+				return;
+			}
+
+			if (events & (EPOLLIN | EPOLLHUP))
+				readInput();
+
+			if (!m_closed && (events & EPOLLOUT))
+				flushOutput();
+		}
+
+		virtual void fcgiConnectionDidReceiveRequest(FcgiConnection* connection, FcgiRequestState* request)
+		{
+			m_server->dispatch(this, request);
+		}
+
+		virtual void httpConnectionDidReceiveRequest(HttpConnection* connection, HttpRequestState* request)
+		{
+			m_server->dispatch(this, request);
+		}
+
+		/**
+			Only one read is done on each wakeup, so that a busy connection can't
+			starve the others. The remaining data is reported by epoll again.
+		 */
+		void readInput()
+		{
+			char buffer[64 * 1024];
+			ssize_t n;
+			do
+			{
+				n = ::read(m_fd, buffer, sizeof(buffer));
+			} while (n < 0 && errno == EINTR);
+
+			if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+				return;
+
+			if (n <= 0 || !m_protocol->feed(buffer, n))
+			{
+				m_server->closeConnection(this);
+				return;
+			}
+
+			m_server->touch(this);
+			if (!m_closed)
+				flushOutput();
+		}
+
+		void flushOutput()
+		{
+			while (m_protocol->outputSize() > 0)
+			{
+				ssize_t n = ::write(m_fd, m_protocol->output(), m_protocol->outputSize());
+				if (n > 0)
+				{
+					m_protocol->consumeOutput(n);
+					m_server->touch(this);
+				}
+				else if (n < 0 && errno == EINTR)
+				{
+					continue;
+				}
+				else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+				{
+					if (!m_waitingForWrite)
+					{
+						m_waitingForWrite = true;
+						m_server->m_loop.modify(m_fd, EPOLLIN | EPOLLOUT, this);
+					}
+					return;
+				}
+				else
+				{
+					m_server->closeConnection(this);
+					return;
+				}
+			}
+
+			if (m_protocol->closeAfterOutput())
+			{
+				m_server->closeConnection(this);
+				return;
+			}
+
+			if (m_waitingForWrite)
+			{
+				m_waitingForWrite = false;
+				m_server->m_loop.modify(m_fd, EPOLLIN, this);
+			}
+		}
+
+		/**
+			Send the pending output in blocking mode. Used when the server exits.
+		 */
+		void drainOutput()
+		{
+			int flags = fcntl(m_fd, F_GETFL, 0);
+			fcntl(m_fd, F_SETFL, flags & ~O_NONBLOCK);
+			while (m_protocol->outputSize() > 0)
+			{
+				ssize_t n = ::write(m_fd, m_protocol->output(), m_protocol->outputSize());
+				if (n > 0)
+					m_protocol->consumeOutput(n);
+				else if (!(n < 0 && errno == EINTR))
+					break;
+			}
+		}
+
+		EventServer* m_server;
+		ConnectionProtocol* m_protocol;
+		int m_fd;
+		size_t m_index;
+		bool m_closed;
+		bool m_waitingForWrite;
+
+		long long m_lastActive;
+		Connection* m_prevActive;
+		Connection* m_nextActive;
+	};
+
+	//////////////////////////////////////////////////////////////////////////
+
+	EventServer::EventServer(int listenSocket, const NcServerConfig::ServerConfig& config, const RequestHandler& handler)
+		: m_asyncLoopHandler(&m_asyncLoop),
+		m_dispatcher(&m_asyncLoop, handler, [this](void* context) { outputDidQueue((Connection*)context); })
+	{
+		m_listenSocket = listenSocket;
+		m_http = config.engine == NcServerConfig::Engine_http;
+		m_idleTimeoutMs = (long long)config.keepAliveTimeout * 1000;
+		m_drainTimeoutMs = (long long)config.drainTimeout * 1000;
+		m_maxConnections = config.maxConnections > 0 ? (size_t)config.maxConnections : (size_t)-1;
+		m_accepting = false;
+		m_now = monotonicTimeMs();
+		m_activityHead = NULL;
+		m_activityTail = NULL;
+
+		m_capacity = capacityOf(config);
+	}
+
+	FcgiCapacity EventServer::capacityOf(const NcServerConfig::ServerConfig& config)
+	{
+		int connectionsPerThread = config.maxConnections;
+		if (connectionsPerThread <= 0)
+		{
+			// bounded by the file descriptors a process can open
+			struct rlimit limit;
+			connectionsPerThread = 1024;
+			if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY)
+				connectionsPerThread = (int)limit.rlim_cur;
+		}
+
+		FcgiCapacity capacity;
+		capacity.maxRequestsPerConnection = config.maxRequestsPerConnection > 1 ? config.maxRequestsPerConnection : 1;
+		capacity.maxConnections = connectionsPerThread * config.threadCount;
+		capacity.maxRequests = capacity.maxConnections * capacity.maxRequestsPerConnection;
+		return capacity;
+	}
+
+	EventServer::~EventServer()
+	{
+		for (size_t i = 0; i < m_connections.size(); i++)
+			delete m_connections[i];
+		releaseClosedConnections();
+	}
+
+	void EventServer::run(const bool& exitRequested)
+	{
+		int flags = fcntl(m_listenSocket, F_GETFL, 0);
+		fcntl(m_listenSocket, F_SETFL, flags | O_NONBLOCK);
+
+		setAccepting(true);
+		m_loop.add(m_asyncLoop.fd(), EPOLLIN, &m_asyncLoopHandler);
+
+		long long nextSweep = m_now + 1000;
+		while (!exitRequested)
+		{
+			m_loop.runOnce(1000);
+			releaseClosedConnections();
+
+			m_now = monotonicTimeMs();
+			if (m_now >= nextSweep)
+			{
+				closeIdleConnections();
+				releaseClosedConnections();
+				nextSweep = m_now + 1000;
+			}
+
+			if (!m_accepting && m_connections.size() < m_maxConnections)
+				setAccepting(true);
+		}
+
+		setAccepting(false);
+
+		long long deadline = monotonicTimeMs() + m_drainTimeoutMs;
+		while (m_dispatcher.pendingCount() > 0 && monotonicTimeMs() < deadline)
+			m_asyncLoop.runOnce(100);
+
+		while (!m_connections.empty())
+		{
+			Connection* connection = m_connections.back();
+			connection->drainOutput();
+			closeConnection(connection);
+		}
+		releaseClosedConnections();
+	}
+
+	void EventServer::handleEvents(uint32_t events)
+	{
+		acceptConnections();
+	}
+
+	void EventServer::setAccepting(bool accepting)
+	{
+		if (accepting == m_accepting)
+			return;
+
+		m_accepting = accepting;
+		if (accepting)
+		{
+			// EPOLLEXCLUSIVE wakes up only one of the threads and workers waiting on the socket
+			if (!m_loop.add(m_listenSocket, EPOLLIN | EPOLLEXCLUSIVE, this))
+				m_loop.add(m_listenSocket, EPOLLIN, this);
+		}
+		else
+		{
+			m_loop.remove(m_listenSocket);
+		}
+	}
+
+	void EventServer::acceptConnections()
+	{
+		// New connections are accepted in batches between the reads of the
+		// existing connections, so that neither side can starve the other.
+		for (int i = 0; i < MAX_ACCEPTS_PER_WAKEUP; i++)
+		{
+			if (m_connections.size() >= m_maxConnections && !evictIdleConnection())
+			{
+				// stop polling the socket until a connection is closed
+				setAccepting(false);
+				break;
+			}
+
+			struct sockaddr_storage addr;
+			socklen_t addrLen = sizeof(addr);
+			int fd = accept4(m_listenSocket, (struct sockaddr*)&addr, &addrLen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+			if (fd < 0)
+			{
+				if (errno == EINTR || errno == ECONNABORTED)
+					continue;
+				break;
+			}
+
+			Connection* connection = new Connection(this, fd);
+			if (m_http)
+				static_cast<HttpConnection*>(connection->m_protocol)->setRemoteAddress((struct sockaddr*)&addr);
+			if (!m_loop.add(fd, EPOLLIN, connection))
+			{
+				delete connection;
+				continue;
+			}
+			connection->m_index = m_connections.size();
+			m_connections.push_back(connection);
+			touch(connection);
+		}
+	}
+
+	void EventServer::dispatch(Connection* connection, ProtocolRequest* request)
+	{
+		m_dispatcher.dispatch(connection->m_protocol, request, connection);
+	}
+
+	void EventServer::outputDidQueue(Connection* connection)
+	{
+		if (!connection->m_closed)
+			connection->flushOutput();
+	}
+
+	void EventServer::closeConnection(Connection* connection)
+	{
+		if (connection->m_closed)
+			return;
+
+		connection->m_closed = true;
+		m_dispatcher.cancel(connection);
+		unlinkActivity(connection);
+		m_loop.remove(connection->m_fd);
+		::close(connection->m_fd);
+		connection->m_fd = -1;
+
+		// swap-remove from the living connections
+		Connection* last = m_connections.back();
+		m_connections[connection->m_index] = last;
+		last->m_index = connection->m_index;
+		m_connections.pop_back();
+
+		m_closedConnections.push_back(connection);
+	}
+
+	void EventServer::touch(Connection* connection)
+	{
+		connection->m_lastActive = m_now;
+		if (connection == m_activityTail)
+			return;
+
+		unlinkActivity(connection);
+		connection->m_prevActive = m_activityTail;
+		if (m_activityTail != NULL)
+			m_activityTail->m_nextActive = connection;
+		else
+			m_activityHead = connection;
+		m_activityTail = connection;
+	}
+
+	void EventServer::unlinkActivity(Connection* connection)
+	{
+		if (connection->m_prevActive != NULL)
+			connection->m_prevActive->m_nextActive = connection->m_nextActive;
+		else if (m_activityHead == connection)
+			m_activityHead = connection->m_nextActive;
+
+		if (connection->m_nextActive != NULL)
+			connection->m_nextActive->m_prevActive = connection->m_prevActive;
+		else if (m_activityTail == connection)
+			m_activityTail = connection->m_prevActive;
+
+		connection->m_prevActive = NULL;
+		connection->m_nextActive = NULL;
+	}
+
+	void EventServer::closeIdleConnections()
+	{
+		while (m_activityHead != NULL && m_now - m_activityHead->m_lastActive >= m_idleTimeoutMs)
+		{
+			// One waiting for a query is looked at again after another timeout, so
+			// that the ones behind it are reached. Partial input and output the
+			// client doesn't read aren't waited for.
+			Connection* connection = m_activityHead;
+			if (connection->m_protocol->isServing())
+				touch(connection);
+			else
+				closeConnection(connection);
+		}
+	}
+
+	bool EventServer::evictIdleConnection()
+	{
+		Connection* connection = m_activityHead;
+		if (connection == NULL || !connection->m_protocol->isIdle())
+			return false;
+
+		closeConnection(connection);
+		return true;
+	}
+
+	void EventServer::releaseClosedConnections()
+	{
+		for (size_t i = 0; i < m_closedConnections.size(); i++)
+			delete m_closedConnections[i];
+		m_closedConnections.clear();
+	}
+}
+
+#endif
@@ -0,0 +1,135 @@
+/*
+MIT License
+
+Copyright (c) 2019 GIS Core R&D Department, NavInfo Co., Ltd
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+
+#ifndef WIN32
+
+#include <functional>
+#include <vector>
+#include <sys/socket.h>
+#include "event_loop.h"
+#include "fcgi_connection.h"
+#include "http_connection.h"
+#include "request_dispatcher.h"
+#include "ncserver_config.h"
+
+namespace ncserver
+{
+	/**
+		Non-blocking engine of a serving thread.
+
+		One epoll loop accepts connections, reads requests and writes
+		responses for all the connections of the thread, which speak either
+		FastCGI or HTTP/1.1 according to the engine. query() is only called
+		after a request is received completely, so a slow client never
+		blocks the worker.
+	 */
+	class EventServer : public EventHandler
+	{
+	public:
+		typedef RequestDispatcher::RequestHandler RequestHandler;
+
+		EventServer(int listenSocket, const NcServerConfig::ServerConfig& config, const RequestHandler& handler);
+		~EventServer();
+
+		/**
+			Serve until exitRequested becomes true.
+		 */
+		void run(const bool& exitRequested);
+
+		// listening socket
+		virtual void handleEvents(uint32_t events);
+
+		/**
+			Capacity of a worker reported in FCGI_GET_VALUES_RESULT.
+		 */
+		static FcgiCapacity capacityOf(const NcServerConfig::ServerConfig& config);
+
+	private:
+		class Connection;
+		friend class Connection;
+
+		enum
+		{
+			MAX_ACCEPTS_PER_WAKEUP = 64,
+		};
+
+		class AsyncLoopHandler : public EventHandler
+		{
+		public:
+			AsyncLoopHandler(AsyncLoop* loop) : m_asyncLoop(loop) {}
+			virtual void handleEvents(uint32_t events) { m_asyncLoop->runOnce(0); }
+
+		private:
+			AsyncLoop* m_asyncLoop;
+		};
+
+		void acceptConnections();
+		void setAccepting(bool accepting);
+		void dispatch(Connection* connection, ProtocolRequest* request);
+		void outputDidQueue(Connection* connection);
+		void closeConnection(Connection* connection);
+		void releaseClosedConnections();
+
+		/**
+			Move the connection to the tail of the activity list.
+		 */
+		void touch(Connection* connection);
+		void unlinkActivity(Connection* connection);
+
+		/**
+			Close connections without traffic for longer than the keep-alive timeout.
+		 */
+		void closeIdleConnections();
+
+		/**
+			Make room for a new connection by closing the least recently active one,
+			if it is an idle kept-alive connection.
+		 */
+		bool evictIdleConnection();
+
+		int m_listenSocket;
+		bool m_http;
+		AsyncLoop m_asyncLoop;
+		AsyncLoopHandler m_asyncLoopHandler;
+		RequestDispatcher m_dispatcher;
+		EventLoop m_loop;
+		std::vector<Connection*> m_connections;
+		std::vector<Connection*> m_closedConnections;
+
+		long long m_idleTimeoutMs;
+		long long m_drainTimeoutMs;	// how long the unfinished queries are waited for on exit
+		size_t m_maxConnections;
+		bool m_accepting;
+		long long m_now;
+
+		// connections ordered by the time of their last traffic, the least recent first
+		Connection* m_activityHead;
+		Connection* m_activityTail;
+
+		FcgiCapacity m_capacity;
+	};
+}
+
+#endif
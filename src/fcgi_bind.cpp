@@ -24,12 +24,35 @@ SOFTWARE.
 #include "stdafx.h"
 
 #include "fcgi_stdio.h"
+#include "fastcgi.h"
 #include "fcgi_bind.h"
 
+#ifndef WIN32
+#	include <errno.h>
+#	include <netdb.h>
+#	include <netinet/in.h>
+#	include <netinet/tcp.h>
+#	include <sys/socket.h>
+#	include <sys/stat.h>
+#	include <sys/un.h>
+#endif
+
 namespace ncserver
 {
 #undef printf
 
+	static int g_listenSocket = FCGI_LISTENSOCK_FILENO;
+
+	int fcgi_listenSocket()
+	{
+		return g_listenSocket;
+	}
+
+	void fcgi_setListenSocket(int socket)
+	{
+		g_listenSocket = socket;
+	}
+
 #ifdef WIN32
 
 	void fcgi_init(const int port)
@@ -42,6 +65,7 @@ namespace ncserver
 
 		if (err != -1)
 		{
+			g_listenSocket = err;
 			printf("Listening on port : %d\n", port);
 		}
 	}
@@ -62,5 +86,140 @@ namespace ncserver
 	{
 	}
 
+	static const char* _unixPath(const std::string& address)
+	{
+		if (address.compare(0, 5, "unix:") == 0)
+			return address.c_str() + 5;
+		if (address.find('/') != std::string::npos)
+			return address.c_str();
+		return NULL;
+	}
+
+	bool fcgi_isTcpAddress(const std::string& address)
+	{
+		return !address.empty() && _unixPath(address) == NULL;
+	}
+
+	static int _setOption(int fd, int level, int name, int value)
+	{
+		return setsockopt(fd, level, name, &value, sizeof(value));
+	}
+
+	static int _openUnixSocket(const char* path)
+	{
+		struct sockaddr_un addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		if (strlen(path) >= sizeof(addr.sun_path))
+		{
+			errno = ENAMETOOLONG;
+			return -1;
+		}
+		strcpy(addr.sun_path, path);
+
+		// a socket file left by the previous run refuses bind()
+		struct stat s;
+		if (stat(path, &s) == 0 && S_ISSOCK(s.st_mode))
+			unlink(path);
+
+		int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (fd < 0)
+			return -1;
+
+		if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0)
+		{
+			int err = errno;
+			close(fd);
+			errno = err;
+			return -1;
+		}
+		// same as "spawn-fcgi -M 0666", the web server may run as another user
+		chmod(path, 0666);
+		return fd;
+	}
+
+	static int _openTcpSocket(const std::string& address, const NcServerConfig::ListenConfig& config)
+	{
+		std::string hostAndPort = address.compare(0, 4, "tcp:") == 0 ? address.substr(4) : address;
+		size_t colon = hostAndPort.rfind(':');
+		if (colon == std::string::npos)
+		{
+			errno = EINVAL;
+			return -1;
+		}
+		std::string host = hostAndPort.substr(0, colon);
+		std::string port = hostAndPort.substr(colon + 1);
+		if (host.size() >= 2 && host[0] == '[' && host[host.size() - 1] == ']')
+			host = host.substr(1, host.size() - 2);
+
+		struct addrinfo hints;
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		hints.ai_flags = AI_PASSIVE;
+
+		struct addrinfo* addrs = NULL;
+		if (getaddrinfo(host.empty() || host == "*" ? NULL : host.c_str(), port.c_str(), &hints, &addrs) != 0)
+		{
+			errno = EINVAL;
+			return -1;
+		}
+
+		int fd = -1;
+		int err = EADDRNOTAVAIL;
+		for (struct addrinfo* ai = addrs; ai != NULL && fd < 0; ai = ai->ai_next)
+		{
+			fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+			if (fd < 0)
+			{
+				err = errno;
+				continue;
+			}
+
+			_setOption(fd, SOL_SOCKET, SO_REUSEADDR, 1);
+			if (config.reusePort)
+				_setOption(fd, SOL_SOCKET, SO_REUSEPORT, 1);
+			if (config.noDelay)
+				_setOption(fd, IPPROTO_TCP, TCP_NODELAY, 1);	// inherited by the accepted sockets
+			if (config.deferAccept > 0)
+				_setOption(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, config.deferAccept);
+
+			if (bind(fd, ai->ai_addr, ai->ai_addrlen) != 0)
+			{
+				err = errno;
+				close(fd);
+				fd = -1;
+			}
+		}
+		freeaddrinfo(addrs);
+
+		if (fd < 0)
+			errno = err;
+		return fd;
+	}
+
+	int fcgi_openListenSocket(const NcServerConfig::ListenConfig& config)
+	{
+		const char* path = _unixPath(config.address);
+		int fd = path != NULL ? _openUnixSocket(path) : _openTcpSocket(config.address, config);
+		if (fd < 0)
+			return -1;
+
+		// set before listen() so that they apply to the window of the accepted sockets
+		if (config.receiveBuffer > 0)
+			_setOption(fd, SOL_SOCKET, SO_RCVBUF, config.receiveBuffer);
+		if (config.sendBuffer > 0)
+			_setOption(fd, SOL_SOCKET, SO_SNDBUF, config.sendBuffer);
+
+		if (listen(fd, config.backlog) != 0)
+		{
+			int err = errno;
+			close(fd);
+			errno = err;
+			return -1;
+		}
+		return fd;
+	}
+
 #endif
 }
\ No newline at end of file
@@ -22,10 +22,35 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 SOFTWARE.
 */
 #include "stdafx.h"
+#include "ncserver_config.h"
 
 namespace ncserver
 {
 	void fcgi_init(const int port);
 
 	void fcgi_cleanup();
+
+	/**
+		The socket which FCGX_Accept_r() should accept connections from.
+	 */
+	int fcgi_listenSocket();
+
+	/**
+		Make fcgi_listenSocket() return @a socket instead of the one spawn-fcgi passes in.
+	 */
+	void fcgi_setListenSocket(int socket);
+
+#ifndef WIN32
+	/**
+		Bind and listen on config.address.
+
+		@return
+			The listening socket, or -1 on failure.
+		@note
+			An existing Unix socket file of the same path is removed first.
+	 */
+	int fcgi_openListenSocket(const NcServerConfig::ListenConfig& config);
+
+	bool fcgi_isTcpAddress(const std::string& address);
+#endif
 }
\ No newline at end of file
@@ -0,0 +1,377 @@
+/*
+MIT License
+
+Copyright (c) 2019 GIS Core R&D Department, NavInfo Co., Ltd
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "stdafx.h"
+
+#include <stdio.h>
+#include "fastcgi.h"
+#include "fcgi_connection.h"
+
+namespace ncserver
+{
+	static bool _readLength(const unsigned char*& p, const unsigned char* end, size_t& length)
+	{
+		if (p >= end)
+			return false;
+
+		if ((*p & 0x80) == 0)
+		{
+			length = *p++;
+			return true;
+		}
+
+		if (end - p < 4)
+			return false;
+
+		length = ((size_t)(p[0] & 0x7f) << 24) | ((size_t)p[1] << 16) | ((size_t)p[2] << 8) | p[3];
+		p += 4;
+		return true;
+	}
+
+	static void _appendLength(std::string& buffer, size_t length)
+	{
+		if (length < 0x80)
+		{
+			buffer.push_back((char)length);
+		}
+		else
+		{
+			buffer.push_back((char)(((length >> 24) & 0x7f) | 0x80));
+			buffer.push_back((char)((length >> 16) & 0xff));
+			buffer.push_back((char)((length >> 8) & 0xff));
+			buffer.push_back((char)(length & 0xff));
+		}
+	}
+
+	//////////////////////////////////////////////////////////////////////////
+
+	FcgiRequestState::FcgiRequestState(int requestId, bool keepConnection)
+	{
+		m_requestId = requestId;
+		m_keepConnection = keepConnection;
+		m_paramsCompleted = false;
+		m_stdinCompleted = false;
+		m_dispatched = false;
+		m_envp.push_back(NULL);
+	}
+
+	bool FcgiRequestState::decodeParams()
+	{
+		static const char roleStr[] = "FCGI_ROLE=RESPONDER";
+		std::vector<size_t> offsets;
+
+		m_envBuffer.clear();
+		m_envBuffer.reserve(m_params.size() + sizeof(roleStr) + 64);
+		offsets.push_back(0);
+		m_envBuffer.append(roleStr, sizeof(roleStr));
+
+		const unsigned char* p = (const unsigned char*)m_params.data();
+		const unsigned char* end = p + m_params.size();
+		while (p < end)
+		{
+			size_t nameLength, valueLength;
+			if (!_readLength(p, end, nameLength) || !_readLength(p, end, valueLength))
+				return false;
+			if ((size_t)(end - p) < nameLength + valueLength)
+				return false;
+
+			offsets.push_back(m_envBuffer.size());
+			m_envBuffer.append((const char*)p, nameLength);
+			m_envBuffer.push_back('=');
+			m_envBuffer.append((const char*)p + nameLength, valueLength);
+			m_envBuffer.push_back('\0');
+			p += nameLength + valueLength;
+		}
+
+		// pointers are taken after the buffer stops growing
+		m_envp.clear();
+		for (size_t i = 0; i < offsets.size(); i++)
+			m_envp.push_back(&m_envBuffer[offsets[i]]);
+		m_envp.push_back(NULL);
+
+		std::string().swap(m_params);
+		return true;
+	}
+
+	//////////////////////////////////////////////////////////////////////////
+
+	static const FcgiCapacity g_defaultCapacity;
+
+	FcgiConnection::FcgiConnection(FcgiConnectionDelegate* delegate, const FcgiCapacity* capacity)
+	{
+		m_delegate = delegate;
+		m_capacity = capacity != NULL ? capacity : &g_defaultCapacity;
+		m_closing = false;
+	}
+
+	FcgiConnection::~FcgiConnection()
+	{
+		for (RequestMap::iterator iter = m_requests.begin(); iter != m_requests.end(); ++iter)
+			delete iter->second;
+	}
+
+	bool FcgiConnection::feed(const char* data, size_t size)
+	{
+		m_input.append(data, size);
+
+		size_t offset = 0;
+		bool succeeded = true;
+		while (succeeded && !closeAfterOutput() && m_input.size() - offset >= FCGI_HEADER_LEN)
+		{
+			const FCGI_Header* header = (const FCGI_Header*)(m_input.data() + offset);
+			size_t contentLength = (header->contentLengthB1 << 8) | header->contentLengthB0;
+			size_t recordLength = FCGI_HEADER_LEN + contentLength + header->paddingLength;
+			if (m_input.size() - offset < recordLength)
+				break;
+
+			if (header->version != FCGI_VERSION_1)
+			{
+				succeeded = false;
+				break;
+			}
+
+			int type = header->type;
+			int requestId = (header->requestIdB1 << 8) | header->requestIdB0;
+			const char* content = m_input.data() + offset + FCGI_HEADER_LEN;
+			offset += recordLength;
+
+			succeeded = processRecord(type, requestId, content, contentLength);
+		}
+
+		m_input.erase(0, offset);
+		return succeeded;
+	}
+
+	bool FcgiConnection::processRecord(int type, int requestId, const char* content, size_t contentLength)
+	{
+		if (requestId == FCGI_NULL_REQUEST_ID)
+		{
+			processManagementRecord(type, content, contentLength);
+			return true;
+		}
+
+		if (type == FCGI_BEGIN_REQUEST)
+		{
+			if (contentLength != sizeof(FCGI_BeginRequestBody))
+				return false;
+
+			const FCGI_BeginRequestBody* body = (const FCGI_BeginRequestBody*)content;
+			int role = (body->roleB1 << 8) | body->roleB0;
+			bool keepConnection = (body->flags & FCGI_KEEP_CONN) != 0;
+
+			if (m_closing)
+			{
+				// the connection is going to be closed, no new request is taken
+			}
+			else if (m_requests.count(requestId) != 0)
+			{
+				// the request id is in use, the record is ignored
+			}
+			else if ((int)m_requests.size() >= m_capacity->maxRequestsPerConnection)
+			{
+				writeEndRequest(requestId, 0, m_capacity->maxRequestsPerConnection > 1 ? FCGI_OVERLOADED : FCGI_CANT_MPX_CONN);
+			}
+			else if (role != FCGI_RESPONDER)
+			{
+				writeEndRequest(requestId, 0, FCGI_UNKNOWN_ROLE);
+				if (!keepConnection)
+					m_closing = true;
+			}
+			else
+			{
+				m_requests[requestId] = new FcgiRequestState(requestId, keepConnection);
+			}
+			return true;
+		}
+
+		// records of unknown or finished requests are ignored
+		RequestMap::iterator iter = m_requests.find(requestId);
+		if (iter == m_requests.end() || iter->second->m_dispatched)
+			return true;
+		FcgiRequestState* request = iter->second;
+
+		switch (type)
+		{
+		case FCGI_ABORT_REQUEST:
+			endRequest(request, 0);
+			return true;
+		case FCGI_PARAMS:
+			if (request->m_paramsCompleted)
+				return false;
+			if (contentLength == 0)
+			{
+				if (!request->decodeParams())
+					return false;
+				request->m_paramsCompleted = true;
+			}
+			else
+			{
+				if (request->m_params.size() + contentLength > MAX_PARAMS_SIZE)
+					return false;
+				request->m_params.append(content, contentLength);
+			}
+			break;
+		case FCGI_STDIN:
+			if (request->m_stdinCompleted)
+				return false;
+			if (contentLength == 0)
+			{
+				request->m_stdinCompleted = true;
+			}
+			else if (request->m_stdin.size() + contentLength > MAX_STDIN_SIZE)
+			{
+				// answered without the application, the rest of the stream is ignored
+				static const char response[] = "Status: 413 Payload Too Large\r\nContent-Type: text/plain\r\n\r\n";
+				writeStdout(request, response, sizeof(response) - 1);
+				endRequest(request, 0);
+				return true;
+			}
+			else
+			{
+				request->m_stdin.append(content, contentLength);
+			}
+			break;
+		default:
+			// FCGI_DATA is only used by the FILTER role
+			return true;
+		}
+
+		if (request->m_paramsCompleted && request->m_stdinCompleted)
+		{
+			request->m_dispatched = true;
+			m_delegate->fcgiConnectionDidReceiveRequest(this, request);
+		}
+		return true;
+	}
+
+	void FcgiConnection::processManagementRecord(int type, const char* content, size_t contentLength)
+	{
+		if (type == FCGI_GET_VALUES)
+		{
+			std::string result;
+			const unsigned char* p = (const unsigned char*)content;
+			const unsigned char* end = p + contentLength;
+			while (p < end)
+			{
+				size_t nameLength, valueLength;
+				if (!_readLength(p, end, nameLength) || !_readLength(p, end, valueLength))
+					break;
+				if ((size_t)(end - p) < nameLength + valueLength)
+					break;
+
+				std::string name((const char*)p, nameLength);
+				p += nameLength + valueLength;
+
+				char value[32];
+				if (name == FCGI_MAX_CONNS)
+					sprintf(value, "%d", m_capacity->maxConnections);
+				else if (name == FCGI_MAX_REQS)
+					sprintf(value, "%d", m_capacity->maxRequests);
+				else if (name == FCGI_MPXS_CONNS)
+					sprintf(value, "%d", m_capacity->maxRequestsPerConnection > 1 ? 1 : 0);
+				else
+					continue;
+
+				_appendLength(result, name.size());
+				_appendLength(result, strlen(value));
+				result.append(name);
+				result.append(value);
+			}
+			writeRecord(FCGI_GET_VALUES_RESULT, FCGI_NULL_REQUEST_ID, result.data(), result.size());
+		}
+		else
+		{
+			FCGI_UnknownTypeBody body;
+			memset(&body, 0, sizeof(body));
+			body.type = (unsigned char)type;
+			writeRecord(FCGI_UNKNOWN_TYPE, FCGI_NULL_REQUEST_ID, (const char*)&body, sizeof(body));
+		}
+	}
+
+	bool FcgiConnection::isServing()
+	{
+		for (RequestMap::iterator iter = m_requests.begin(); iter != m_requests.end(); ++iter)
+		{
+			if (iter->second->m_dispatched)
+				return true;
+		}
+		return false;
+	}
+
+	void FcgiConnection::writeStdout(ProtocolRequest* protocolRequest, const char* data, size_t size)
+	{
+		FcgiRequestState* request = static_cast<FcgiRequestState*>(protocolRequest);
+		while (size > 0)
+		{
+			size_t chunk = size > FCGI_MAX_LENGTH ? FCGI_MAX_LENGTH : size;
+			writeRecord(FCGI_STDOUT, request->m_requestId, data, chunk);
+			data += chunk;
+			size -= chunk;
+		}
+	}
+
+	void FcgiConnection::endRequest(ProtocolRequest* protocolRequest, int appStatus)
+	{
+		FcgiRequestState* request = static_cast<FcgiRequestState*>(protocolRequest);
+		writeRecord(FCGI_STDOUT, request->m_requestId, NULL, 0);
+		writeEndRequest(request->m_requestId, appStatus, FCGI_REQUEST_COMPLETE);
+
+		if (!request->m_keepConnection)
+			m_closing = true;
+
+		m_requests.erase(request->m_requestId);
+		delete request;
+	}
+
+	void FcgiConnection::writeRecord(int type, int requestId, const char* content, size_t contentLength)
+	{
+		size_t paddingLength = (8 - (contentLength & 7)) & 7;
+
+		FCGI_Header header;
+		header.version = FCGI_VERSION_1;
+		header.type = (unsigned char)type;
+		header.requestIdB1 = (unsigned char)((requestId >> 8) & 0xff);
+		header.requestIdB0 = (unsigned char)(requestId & 0xff);
+		header.contentLengthB1 = (unsigned char)((contentLength >> 8) & 0xff);
+		header.contentLengthB0 = (unsigned char)(contentLength & 0xff);
+		header.paddingLength = (unsigned char)paddingLength;
+		header.reserved = 0;
+
+		m_output.append((const char*)&header, FCGI_HEADER_LEN);
+		if (contentLength > 0)
+			m_output.append(content, contentLength);
+		m_output.append(paddingLength, '\0');
+	}
+
+	void FcgiConnection::writeEndRequest(int requestId, int appStatus, int protocolStatus)
+	{
+		FCGI_EndRequestBody body;
+		memset(&body, 0, sizeof(body));
+		body.appStatusB3 = (unsigned char)((appStatus >> 24) & 0xff);
+		body.appStatusB2 = (unsigned char)((appStatus >> 16) & 0xff);
+		body.appStatusB1 = (unsigned char)((appStatus >> 8) & 0xff);
+		body.appStatusB0 = (unsigned char)(appStatus & 0xff);
+		body.protocolStatus = (unsigned char)protocolStatus;
+		writeRecord(FCGI_END_REQUEST, requestId, (const char*)&body, sizeof(body));
+	}
+}
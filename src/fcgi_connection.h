@@ -0,0 +1,150 @@
+/*
+MIT License
+
+Copyright (c) 2019 GIS Core R&D Department, NavInfo Co., Ltd
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+#include "connection_protocol.h"
+
+namespace ncserver
+{
+	class FcgiConnection;
+
+	/**
+		State of one FastCGI request while its PARAMS and STDIN streams are received.
+	 */
+	class FcgiRequestState : public ProtocolRequest
+	{
+	public:
+		FcgiRequestState(int requestId, bool keepConnection);
+
+		int requestId() { return m_requestId; }
+		bool keepConnection() { return m_keepConnection; }
+
+		/**
+			Only valid after the PARAMS stream is completed.
+		 */
+		virtual char** envp() { return &m_envp[0]; }
+
+		virtual const char* stdinData() { return m_stdin.data(); }
+		virtual size_t stdinSize() { return m_stdin.size(); }
+
+	private:
+		friend class FcgiConnection;
+
+		bool decodeParams();
+
+		int m_requestId;
+		bool m_keepConnection;
+		bool m_paramsCompleted;
+		bool m_stdinCompleted;
+		bool m_dispatched;
+		std::string m_params;
+		std::string m_stdin;
+		std::string m_envBuffer;
+		std::vector<char*> m_envp;
+	};
+
+	/**
+		Capacity reported in FCGI_GET_VALUES_RESULT.
+	 */
+	struct FcgiCapacity
+	{
+		int maxConnections;				// FCGI_MAX_CONNS
+		int maxRequests;				// FCGI_MAX_REQS
+		int maxRequestsPerConnection;	// FCGI_MPXS_CONNS is 1 if it's greater than 1
+
+		FcgiCapacity() : maxConnections(1), maxRequests(1), maxRequestsPerConnection(1) {}
+	};
+
+	class FcgiConnectionDelegate
+	{
+	public:
+		/**
+			Called when both the PARAMS and STDIN streams of a request are completed.
+			The delegate must finish the request with FcgiConnection::endRequest().
+		 */
+		virtual void fcgiConnectionDidReceiveRequest(FcgiConnection* connection, FcgiRequestState* request) = 0;
+	};
+
+	/**
+		FastCGI protocol state machine of one connection.
+	 */
+	class FcgiConnection : public ConnectionProtocol
+	{
+	public:
+		/**
+			@param capacity
+				Limits of the connection. The default capacity doesn't multiplex requests.
+				It must outlive the connection.
+		 */
+		FcgiConnection(FcgiConnectionDelegate* delegate, const FcgiCapacity* capacity = NULL);
+		~FcgiConnection();
+
+		virtual bool feed(const char* data, size_t size);
+
+		/**
+			Queue content of FCGI_STDOUT stream.
+		 */
+		virtual void writeStdout(ProtocolRequest* request, const char* data, size_t size);
+
+		/**
+			Close the FCGI_STDOUT stream and queue FCGI_END_REQUEST.
+		 */
+		virtual void endRequest(ProtocolRequest* request, int appStatus);
+
+		/**
+			Which is the case after a request without FCGI_KEEP_CONN is ended
+			and no other request is in progress on the connection.
+		 */
+		virtual bool closeAfterOutput() { return m_closing && m_requests.empty(); }
+
+		virtual bool isIdle() { return m_requests.empty() && m_input.empty() && outputSize() == 0; }
+		virtual bool isServing();
+
+		size_t requestCount() { return m_requests.size(); }
+
+	private:
+		enum
+		{
+			MAX_PARAMS_SIZE = 1024 * 1024,
+			// as HttpConnection::MAX_BODY_SIZE
+			MAX_STDIN_SIZE = 64 * 1024 * 1024
+		};
+
+		bool processRecord(int type, int requestId, const char* content, size_t contentLength);
+		void processManagementRecord(int type, const char* content, size_t contentLength);
+		void writeRecord(int type, int requestId, const char* content, size_t contentLength);
+		void writeEndRequest(int requestId, int appStatus, int protocolStatus);
+
+		typedef std::map<int, FcgiRequestState*> RequestMap;
+
+		FcgiConnectionDelegate* m_delegate;
+		const FcgiCapacity* m_capacity;
+		RequestMap m_requests;
+		std::string m_input;
+		bool m_closing;
+	};
+}
@@ -28,9 +28,9 @@ SOFTWARE.
 
 namespace ncserver
 {
-	FCgiServiceIo::FCgiServiceIo(FCGI_FILE* file)
+	FCgiServiceIo::FCgiServiceIo(FCGX_Request* request)
 	{
-		m_file = file;
+		m_request = request;
 	}
 
 	FCgiServiceIo::~FCgiServiceIo(void)
@@ -40,12 +40,12 @@ namespace ncserver
 
 	void FCgiServiceIo::read(void *buffer, size_t size)
 	{
-		fread(buffer, size, 1, FCGI_stdin);
+		FCGX_GetStr((char*)buffer, (int)size, m_request->in);
 	}
 
 	void FCgiServiceIo::write(void* buffer, size_t size)
 	{
-		FCGI_fwrite(buffer, 1, size, m_file);
+		FCGX_PutStr((const char*)buffer, (int)size, m_request->out);
 	}
 
 	int FCgiServiceIo::print(const char* format, ...)
@@ -54,7 +54,7 @@ namespace ncserver
 		va_list argptr;
 
 		va_start(argptr, format);
-		count = FCGI_vprintf(format, argptr);
+		count = FCGX_VFPrintF(m_request->out, format, argptr);
 		va_end(argptr);
 
 		return count;
@@ -72,7 +72,7 @@ namespace ncserver
 
 		if (cnt >= 0)
 		{
-			FCGI_printf("%s\r\n", buffer);
+			FCGX_FPrintF(m_request->out, "%s\r\n", buffer);
 		}
 
 		return cnt;
@@ -80,11 +80,11 @@ namespace ncserver
 
 	void FCgiServiceIo::endHeaderField(void)
 	{
-		FCGI_printf("\r\n");
+		FCGX_PutS("\r\n", m_request->out);
 	}
 
 	void FCgiServiceIo::flush(void)
 	{
-		FCGI_fflush(m_file);
+		FCGX_FFlush(m_request->out);
 	}
 }
\ No newline at end of file
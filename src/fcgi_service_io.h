@@ -33,7 +33,7 @@ namespace ncserver
 	class FCgiServiceIo : public ServiceIo
 	{
 	public:
-		FCgiServiceIo(FCGI_FILE* file);
+		FCgiServiceIo(FCGX_Request* request);
 
 		~FCgiServiceIo(void);
 
@@ -50,6 +50,6 @@ namespace ncserver
 		virtual void flush(void);
 
 	private:
-		FCGI_FILE* m_file;
+		FCGX_Request* m_request;
 	};
 }
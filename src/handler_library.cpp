@@ -0,0 +1,81 @@
+/*
+MIT License
+
+Copyright (c) 2019 GIS Core R&D Department, NavInfo Co., Ltd
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "stdafx.h"
+#include "handler_library.h"
+#include "ncserver/handler_module.h"
+
+#ifndef WIN32
+#include <dlfcn.h>
+#endif
+
+namespace ncserver
+{
+	HandlerLibrary::HandlerLibrary()
+	{
+		m_handle = NULL;
+	}
+
+	HandlerLibrary::~HandlerLibrary()
+	{
+#ifndef WIN32
+		if (m_handle != NULL)
+			dlclose(m_handle);
+#endif
+	}
+
+	HandlerModule* HandlerLibrary::open(const char* path)
+	{
+#ifndef WIN32
+		if (m_handle != NULL)
+		{
+			m_error = "a module is loaded already";
+			return NULL;
+		}
+
+		// RTLD_LOCAL, so that two versions never resolve to each other's symbols
+		m_handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+		if (m_handle == NULL)
+		{
+			const char* error = dlerror();
+			m_error = error != NULL ? error : path;
+			return NULL;
+		}
+
+		HandlerModuleFactory create = (HandlerModuleFactory)dlsym(m_handle, "ncserver_createHandlerModule");
+		if (create == NULL)
+		{
+			m_error = std::string(path) + " doesn't export ncserver_createHandlerModule, see NCSERVER_HANDLER_MODULE()";
+			return NULL;
+		}
+
+		HandlerModule* module = create(HANDLER_MODULE_INTERFACE_VERSION);
+		if (module == NULL)
+			m_error = std::string(path) + " is built against another version of ncserver/handler_module.h";
+		return module;
+#else
+		m_error = "handler modules are not supported on Windows";
+		return NULL;
+#endif
+	}
+}
@@ -0,0 +1,58 @@
+/*
+MIT License
+
+Copyright (c) 2019 GIS Core R&D Department, NavInfo Co., Ltd
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+
+#include <string>
+
+namespace ncserver
+{
+	class HandlerModule;
+
+	/**
+		The shared library of a HandlerModule, loaded by a worker.
+	 */
+	class HandlerLibrary
+	{
+	public:
+		HandlerLibrary();
+		~HandlerLibrary();
+
+		/**
+			Load the library at @a path and create its module.
+
+			@return
+				NULL on failure, see error().
+		 */
+		HandlerModule* open(const char* path);
+
+		const std::string& error() const { return m_error; }
+
+	private:
+		HandlerLibrary(const HandlerLibrary&);
+		HandlerLibrary& operator=(const HandlerLibrary&);
+
+		void* m_handle;
+		std::string m_error;
+	};
+}
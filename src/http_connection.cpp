@@ -0,0 +1,749 @@
+/*
+MIT License
+
+Copyright (c) 2019 GIS Core R&D Department, NavInfo Co., Ltd
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "stdafx.h"
+
+#ifndef WIN32
+
+#include <ctype.h>
+#include <stdio.h>
+#include <strings.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include "http_connection.h"
+
+namespace ncserver
+{
+	static bool _equalsIgnoreCase(const char* s, size_t length, const char* literal)
+	{
+		return strlen(literal) == length && strncasecmp(s, literal, length) == 0;
+	}
+
+	static bool _isSpace(char c)
+	{
+		return c == ' ' || c == '\t';
+	}
+
+	/**
+		Whether the comma separated list of tokens contains the token.
+	 */
+	static bool _containsToken(const char* s, size_t length, const char* token)
+	{
+		const char* end = s + length;
+		while (s < end)
+		{
+			const char* comma = (const char*)memchr(s, ',', end - s);
+			const char* tokenEnd = comma != NULL ? comma : end;
+			const char* tokenBegin = s;
+			while (tokenBegin < tokenEnd && _isSpace(*tokenBegin))
+				tokenBegin++;
+			const char* trimmedEnd = tokenEnd;
+			while (trimmedEnd > tokenBegin && _isSpace(trimmedEnd[-1]))
+				trimmedEnd--;
+			if (_equalsIgnoreCase(tokenBegin, trimmedEnd - tokenBegin, token))
+				return true;
+			s = tokenEnd + 1;
+		}
+		return false;
+	}
+
+	static const char* _reasonPhrase(int status)
+	{
+		switch (status)
+		{
+		case 100: return "Continue";
+		case 200: return "OK";
+		case 201: return "Created";
+		case 202: return "Accepted";
+		case 204: return "No Content";
+		case 206: return "Partial Content";
+		case 301: return "Moved Permanently";
+		case 302: return "Found";
+		case 303: return "See Other";
+		case 304: return "Not Modified";
+		case 307: return "Temporary Redirect";
+		case 308: return "Permanent Redirect";
+		case 400: return "Bad Request";
+		case 401: return "Unauthorized";
+		case 403: return "Forbidden";
+		case 404: return "Not Found";
+		case 405: return "Method Not Allowed";
+		case 408: return "Request Timeout";
+		case 409: return "Conflict";
+		case 411: return "Length Required";
+		case 413: return "Payload Too Large";
+		case 414: return "URI Too Long";
+		case 415: return "Unsupported Media Type";
+		case 429: return "Too Many Requests";
+		case 431: return "Request Header Fields Too Large";
+		case 500: return "Internal Server Error";
+		case 501: return "Not Implemented";
+		case 502: return "Bad Gateway";
+		case 503: return "Service Unavailable";
+		case 504: return "Gateway Timeout";
+		case 505: return "HTTP Version Not Supported";
+		default: return "";
+		}
+	}
+
+	/**
+		"Date: ..." header field of the current second, formatted once per second by each thread.
+	 */
+	static const char* _dateHeaderField()
+	{
+		static __thread time_t cachedTime = 0;
+		static __thread char field[64];
+
+		time_t now = time(NULL);
+		if (now != cachedTime)
+		{
+			struct tm tm;
+			gmtime_r(&now, &tm);
+			strftime(field, sizeof(field), "Date: %a, %d %b %Y %H:%M:%S GMT\r\n", &tm);
+			cachedTime = now;
+		}
+		return field;
+	}
+
+	//////////////////////////////////////////////////////////////////////////
+
+	HttpRequestState::HttpRequestState()
+	{
+		m_keepAlive = true;
+		m_http10 = false;
+		m_headRequest = false;
+		m_envp.push_back(NULL);
+	}
+
+	void HttpRequestState::addVariable(const char* name, size_t nameLength, const char* value, size_t valueLength)
+	{
+		m_offsets.push_back(m_envBuffer.size());
+		m_envBuffer.append(name, nameLength);
+		m_envBuffer.push_back('=');
+		m_envBuffer.append(value, valueLength);
+		m_envBuffer.push_back('\0');
+	}
+
+	void HttpRequestState::addHeaderVariable(const char* name, size_t nameLength, const char* value, size_t valueLength)
+	{
+		m_offsets.push_back(m_envBuffer.size());
+		if (_equalsIgnoreCase(name, nameLength, "Content-Type"))
+		{
+			m_envBuffer.append("CONTENT_TYPE");
+		}
+		else
+		{
+			// User-Agent is passed as HTTP_USER_AGENT
+			m_envBuffer.append("HTTP_");
+			for (size_t i = 0; i < nameLength; i++)
+			{
+				char c = name[i];
+				m_envBuffer.push_back(c == '-' ? '_' : (char)toupper((unsigned char)c));
+			}
+		}
+		m_envBuffer.push_back('=');
+		m_envBuffer.append(value, valueLength);
+		m_envBuffer.push_back('\0');
+	}
+
+	void HttpRequestState::buildEnvp()
+	{
+		// pointers are taken after the buffer stops growing
+		m_envp.clear();
+		for (size_t i = 0; i < m_offsets.size(); i++)
+			m_envp.push_back(&m_envBuffer[m_offsets[i]]);
+		m_envp.push_back(NULL);
+	}
+
+	//////////////////////////////////////////////////////////////////////////
+
+	HttpConnection::HttpConnection(HttpConnectionDelegate* delegate)
+	{
+		m_delegate = delegate;
+		m_inputOffset = 0;
+		m_scanOffset = 0;
+		m_state = State_header;
+		m_remaining = 0;
+		m_hasBody = false;
+		m_request = NULL;
+		m_closing = false;
+		m_processing = false;
+	}
+
+	HttpConnection::~HttpConnection()
+	{
+		delete m_request;
+	}
+
+	void HttpConnection::setRemoteAddress(const char* address, int port)
+	{
+		char portStr[16];
+		sprintf(portStr, "%d", port);
+		m_remoteAddress = address;
+		m_remotePort = portStr;
+	}
+
+	void HttpConnection::setRemoteAddress(const struct sockaddr* addr)
+	{
+		char address[INET6_ADDRSTRLEN];
+		if (addr->sa_family == AF_INET)
+		{
+			const struct sockaddr_in* in = (const struct sockaddr_in*)addr;
+			if (inet_ntop(AF_INET, &in->sin_addr, address, sizeof(address)) != NULL)
+				setRemoteAddress(address, ntohs(in->sin_port));
+		}
+		else if (addr->sa_family == AF_INET6)
+		{
+			const struct sockaddr_in6* in6 = (const struct sockaddr_in6*)addr;
+			if (inet_ntop(AF_INET6, &in6->sin6_addr, address, sizeof(address)) != NULL)
+				setRemoteAddress(address, ntohs(in6->sin6_port));
+		}
+	}
+
+	bool HttpConnection::feed(const char* data, size_t size)
+	{
+		if (m_closing)
+			return true;
+
+		if (m_inputOffset == m_input.size())
+		{
+			m_input.clear();
+			m_inputOffset = 0;
+		}
+		else if (m_inputOffset > 64 * 1024)
+		{
+			m_input.erase(0, m_inputOffset);
+			m_inputOffset = 0;
+		}
+		m_input.append(data, size);
+
+		processInput();
+		return true;
+	}
+
+	void HttpConnection::processInput()
+	{
+		// endRequest() called by the delegate returns here instead of recursing
+		if (m_processing)
+			return;
+		m_processing = true;
+
+		while (!m_closing && m_state != State_dispatched)
+		{
+			if (m_state == State_header)
+			{
+				// empty lines before a request are ignored (RFC 7230, 3.5)
+				if (m_scanOffset == 0)
+				{
+					while (m_inputOffset < m_input.size() && (m_input[m_inputOffset] == '\r' || m_input[m_inputOffset] == '\n'))
+						m_inputOffset++;
+				}
+
+				// memchr() is vectorized by the C library, which makes it
+				// the fastest way to walk the lines of the header.
+				const char* begin = m_input.data() + m_inputOffset;
+				size_t available = m_input.size() - m_inputOffset;
+				size_t headerSize = 0;
+				while (m_scanOffset < available)
+				{
+					const char* lf = (const char*)memchr(begin + m_scanOffset, '\n', available - m_scanOffset);
+					if (lf == NULL)
+					{
+						m_scanOffset = available;
+						break;
+					}
+
+					size_t i = lf - begin;
+					if (i + 1 < available && begin[i + 1] == '\n')
+					{
+						headerSize = i + 2;
+						break;
+					}
+					if (i + 2 < available && begin[i + 1] == '\r' && begin[i + 2] == '\n')
+					{
+						headerSize = i + 3;
+						break;
+					}
+					if (i + 2 >= available)
+					{
+						// not enough to tell whether the next line is empty
+						m_scanOffset = i;
+						break;
+					}
+					m_scanOffset = i + 1;
+				}
+
+				if (headerSize == 0)
+				{
+					if (available > MAX_HEADER_SIZE)
+						writeError(431);
+					break;
+				}
+
+				m_scanOffset = 0;
+				m_inputOffset += headerSize;
+				if (!parseHeader(begin, headerSize))
+					break;
+			}
+
+			if (!readBody())
+				break;
+
+			dispatch();
+		}
+
+		m_processing = false;
+	}
+
+	bool HttpConnection::parseHeader(const char* header, size_t size)
+	{
+		const char* end = header + size;
+
+		// request line
+		const char* lineEnd = (const char*)memchr(header, '\n', size);
+		const char* trimmedEnd = (lineEnd > header && lineEnd[-1] == '\r') ? lineEnd - 1 : lineEnd;
+		const char* method = header;
+		const char* methodEnd = (const char*)memchr(method, ' ', trimmedEnd - method);
+		if (methodEnd == NULL || methodEnd == method)
+		{
+			writeError(400);
+			return false;
+		}
+		const char* target = methodEnd + 1;
+		const char* targetEnd = (const char*)memchr(target, ' ', trimmedEnd - target);
+		if (targetEnd == NULL || targetEnd == target)
+		{
+			writeError(400);
+			return false;
+		}
+		const char* version = targetEnd + 1;
+		size_t versionLength = trimmedEnd - version;
+		bool http10 = versionLength == 8 && memcmp(version, "HTTP/1.0", 8) == 0;
+		bool http11 = versionLength == 8 && memcmp(version, "HTTP/1.1", 8) == 0;
+		if (!http10 && !http11)
+		{
+			writeError(versionLength > 5 && memcmp(version, "HTTP/", 5) == 0 ? 505 : 400);
+			return false;
+		}
+
+		m_request = new HttpRequestState();
+		HttpRequestState* request = m_request;
+		request->m_http10 = http10;
+		request->m_keepAlive = http11;
+		request->m_headRequest = _equalsIgnoreCase(method, methodEnd - method, "HEAD");
+
+		// absolute-form "http://host/path?query" is reduced to the path
+		const char* path = target;
+		if (*path != '/')
+		{
+			const char* scheme = (const char*)memchr(target, ':', targetEnd - target);
+			if (scheme != NULL && targetEnd - scheme > 3 && memcmp(scheme, "://", 3) == 0)
+			{
+				path = (const char*)memchr(scheme + 3, '/', targetEnd - scheme - 3);
+				if (path == NULL)
+					path = targetEnd;
+			}
+		}
+		const char* question = (const char*)memchr(path, '?', targetEnd - path);
+		const char* pathEnd = question != NULL ? question : targetEnd;
+		const char* query = question != NULL ? question + 1 : targetEnd;
+		const char* queryEnd = (const char*)memchr(query, '#', targetEnd - query);
+		if (queryEnd == NULL)
+			queryEnd = targetEnd;
+		if (path == pathEnd)
+			path = pathEnd = "/";
+
+		request->addVariable("REQUEST_METHOD", 14, method, methodEnd - method);
+		request->addVariable("REQUEST_URI", 11, target, targetEnd - target);
+		request->addVariable("DOCUMENT_URI", 12, path, pathEnd - path);
+		request->addVariable("SCRIPT_NAME", 11, path, pathEnd - path);
+		request->addVariable("QUERY_STRING", 12, query, queryEnd - query);
+		request->addVariable("SERVER_PROTOCOL", 15, version, versionLength);
+		if (!m_remoteAddress.empty())
+		{
+			request->addVariable("REMOTE_ADDR", 11, m_remoteAddress.data(), m_remoteAddress.size());
+			request->addVariable("REMOTE_PORT", 11, m_remotePort.data(), m_remotePort.size());
+		}
+
+		// header fields
+		bool chunked = false;
+		bool expectContinue = false;
+		long long contentLength = -1;
+		for (const char* line = lineEnd + 1; line < end; line = lineEnd + 1)
+		{
+			lineEnd = (const char*)memchr(line, '\n', end - line);
+			trimmedEnd = (lineEnd > line && lineEnd[-1] == '\r') ? lineEnd - 1 : lineEnd;
+			if (trimmedEnd == line)
+				break;		// the empty line ending the header
+
+			const char* colon = (const char*)memchr(line, ':', trimmedEnd - line);
+			// obsolete line folding and spaces before the colon are rejected (RFC 7230, 3.2.4)
+			if (colon == NULL || colon == line || _isSpace(*line) || _isSpace(colon[-1]))
+			{
+				writeError(400);
+				return false;
+			}
+
+			const char* value = colon + 1;
+			const char* valueEnd = trimmedEnd;
+			while (value < valueEnd && _isSpace(*value))
+				value++;
+			while (valueEnd > value && _isSpace(valueEnd[-1]))
+				valueEnd--;
+
+			const char* name = line;
+			size_t nameLength = colon - line;
+			size_t valueLength = valueEnd - value;
+			if (_equalsIgnoreCase(name, nameLength, "Content-Length"))
+			{
+				long long length = 0;
+				for (const char* p = value; p < valueEnd; p++)
+				{
+					if (*p < '0' || *p > '9' || length > MAX_BODY_SIZE)
+					{
+						length = -1;
+						break;
+					}
+					length = length * 10 + (*p - '0');
+				}
+				if (valueLength == 0 || length < 0 || (contentLength >= 0 && length != contentLength))
+				{
+					writeError(400);
+					return false;
+				}
+				contentLength = length;
+				continue;
+			}
+			else if (_equalsIgnoreCase(name, nameLength, "Transfer-Encoding"))
+			{
+				if (!_equalsIgnoreCase(value, valueLength, "chunked"))
+				{
+					writeError(501);
+					return false;
+				}
+				chunked = true;
+				continue;
+			}
+			else if (_equalsIgnoreCase(name, nameLength, "Connection"))
+			{
+				if (_containsToken(value, valueLength, "close"))
+					request->m_keepAlive = false;
+				else if (_containsToken(value, valueLength, "keep-alive"))
+					request->m_keepAlive = true;
+			}
+			else if (_equalsIgnoreCase(name, nameLength, "Expect"))
+			{
+				expectContinue = _equalsIgnoreCase(value, valueLength, "100-continue");
+			}
+
+			request->addHeaderVariable(name, nameLength, value, valueLength);
+		}
+
+		// A proxy in front may take the body by the other one, the rest would
+		// be read as the next request (RFC 7230, 3.3.3).
+		if (chunked && contentLength >= 0)
+		{
+			writeError(400);
+			return false;
+		}
+
+		if (contentLength > MAX_BODY_SIZE)
+		{
+			writeError(413);
+			return false;
+		}
+
+		m_hasBody = chunked || contentLength >= 0;
+		if (chunked)
+		{
+			m_state = State_chunkSize;
+		}
+		else
+		{
+			m_state = State_body;
+			m_remaining = contentLength > 0 ? (size_t)contentLength : 0;
+			request->m_body.reserve(m_remaining);
+		}
+
+		if (expectContinue && http11 && (chunked || contentLength > 0))
+			m_output.append("HTTP/1.1 100 Continue\r\n\r\n");
+		return true;
+	}
+
+	bool HttpConnection::readBody()
+	{
+		std::string& body = m_request->m_body;
+		for (;;)
+		{
+			const char* begin = m_input.data() + m_inputOffset;
+			size_t available = m_input.size() - m_inputOffset;
+
+			switch (m_state)
+			{
+			case State_body:
+			case State_chunkData:
+			{
+				size_t n = available < m_remaining ? available : m_remaining;
+				body.append(begin, n);
+				m_inputOffset += n;
+				m_remaining -= n;
+				if (m_remaining > 0)
+					return false;
+				if (m_state == State_body)
+					return true;
+				m_state = State_chunkDataEnd;
+				break;
+			}
+			case State_chunkDataEnd:
+				if (available >= 1 && begin[0] == '\n')
+				{
+					m_inputOffset += 1;
+				}
+				else if (available >= 2 && begin[0] == '\r' && begin[1] == '\n')
+				{
+					m_inputOffset += 2;
+				}
+				else if (available >= 2 || (available == 1 && begin[0] != '\r'))
+				{
+					writeError(400);
+					return false;
+				}
+				else
+				{
+					return false;
+				}
+				m_state = State_chunkSize;
+				break;
+			case State_chunkSize:
+			case State_trailer:
+			{
+				const char* lf = (const char*)memchr(begin, '\n', available);
+				if (lf == NULL)
+				{
+					if (available > 1024)
+						writeError(400);
+					return false;
+				}
+				size_t lineLength = lf - begin;
+				m_inputOffset += lineLength + 1;
+				if (lineLength > 0 && begin[lineLength - 1] == '\r')
+					lineLength--;
+
+				if (m_state == State_trailer)
+				{
+					// trailer fields are dropped
+					if (lineLength == 0)
+						return true;
+					break;
+				}
+
+				// chunk extensions after ';' are ignored
+				size_t size = 0;
+				size_t digits = 0;
+				for (; digits < lineLength && isxdigit((unsigned char)begin[digits]); digits++)
+				{
+					if (size > MAX_BODY_SIZE)
+						break;
+					char c = begin[digits];
+					size = size * 16 + (c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10);
+				}
+				if (digits == 0 || (digits < lineLength && begin[digits] != ';' && !_isSpace(begin[digits])))
+				{
+					writeError(400);
+					return false;
+				}
+				if (body.size() + size > MAX_BODY_SIZE)
+				{
+					writeError(413);
+					return false;
+				}
+
+				if (size == 0)
+				{
+					m_state = State_trailer;
+				}
+				else
+				{
+					m_remaining = size;
+					m_state = State_chunkData;
+				}
+				break;
+			}
+			default:
+				return false;
+			}
+		}
+	}
+
+	void HttpConnection::dispatch()
+	{
+		HttpRequestState* request = m_request;
+		if (m_hasBody)
+		{
+			char length[32];
+			int n = sprintf(length, "%d", (int)request->m_body.size());
+			request->addVariable("CONTENT_LENGTH", 14, length, n);
+		}
+		request->buildEnvp();
+
+		m_state = State_dispatched;
+		m_delegate->httpConnectionDidReceiveRequest(this, request);
+	}
+
+	void HttpConnection::writeStdout(ProtocolRequest* request, const char* data, size_t size)
+	{
+		static_cast<HttpRequestState*>(request)->m_response.append(data, size);
+	}
+
+	void HttpConnection::endRequest(ProtocolRequest* protocolRequest, int appStatus)
+	{
+		HttpRequestState* request = static_cast<HttpRequestState*>(protocolRequest);
+		const std::string& response = request->m_response;
+
+		// CGI header fields end with an empty line
+		int status = 200;
+		std::string reason;
+		std::string fields;
+		bool statusGiven = false;
+		bool hasLocation = false;
+		size_t bodyOffset = std::string::npos;
+		size_t offset = 0;
+		while (offset < response.size())
+		{
+			size_t lf = response.find('\n', offset);
+			if (lf == std::string::npos)
+				break;
+			size_t lineLength = lf - offset;
+			if (lineLength > 0 && response[lf - 1] == '\r')
+				lineLength--;
+			const char* line = response.data() + offset;
+			offset = lf + 1;
+
+			if (lineLength == 0)
+			{
+				bodyOffset = offset;
+				break;
+			}
+
+			const char* colon = (const char*)memchr(line, ':', lineLength);
+			if (colon == NULL)
+				break;
+			size_t nameLength = colon - line;
+			const char* value = colon + 1;
+			while (value < line + lineLength && _isSpace(*value))
+				value++;
+			size_t valueLength = line + lineLength - value;
+
+			if (_equalsIgnoreCase(line, nameLength, "Status"))
+			{
+				// "Status: 404 Not Found"
+				status = atoi(value);
+				const char* space = (const char*)memchr(value, ' ', valueLength);
+				if (space != NULL)
+					reason.assign(space + 1, line + lineLength - space - 1);
+				statusGiven = true;
+				continue;
+			}
+			if (_equalsIgnoreCase(line, nameLength, "Content-Length")
+				|| _equalsIgnoreCase(line, nameLength, "Connection")
+				|| _equalsIgnoreCase(line, nameLength, "Keep-Alive")
+				|| _equalsIgnoreCase(line, nameLength, "Transfer-Encoding"))
+			{
+				continue;
+			}
+			if (_equalsIgnoreCase(line, nameLength, "Location"))
+				hasLocation = true;
+
+			fields.append(line, lineLength);
+			fields.append("\r\n", 2);
+		}
+
+		if (bodyOffset == std::string::npos)
+		{
+			// same as nginx when the upstream sends an invalid header
+			status = 502;
+			statusGiven = false;
+			fields.clear();
+			bodyOffset = response.size();
+		}
+		else if (!statusGiven && hasLocation)
+		{
+			status = 302;
+		}
+		if (status < 100 || status > 999)
+			status = 500;
+		if (reason.empty())
+			reason = _reasonPhrase(status);
+
+		if (!request->m_keepAlive)
+			m_closing = true;
+
+		bool hasBody = !(status < 200 || status == 204 || status == 304);
+		size_t bodySize = hasBody ? response.size() - bodyOffset : 0;
+
+		char statusLine[64];
+		int n = snprintf(statusLine, sizeof(statusLine), "HTTP/1.1 %d ", status);
+		m_output.reserve(m_output.size() + n + reason.size() + fields.size() + 128 + (request->m_headRequest ? 0 : bodySize));
+		m_output.append(statusLine, n);
+		m_output.append(reason);
+		m_output.append("\r\n", 2);
+		m_output.append(_dateHeaderField());
+		m_output.append(fields);
+		if (hasBody)
+		{
+			char contentLength[48];
+			n = sprintf(contentLength, "Content-Length: %d\r\n", (int)bodySize);
+			m_output.append(contentLength, n);
+		}
+		if (m_closing)
+			m_output.append("Connection: close\r\n");
+		else if (request->m_http10)
+			m_output.append("Connection: keep-alive\r\n");
+		m_output.append("\r\n", 2);
+		if (!request->m_headRequest)
+			m_output.append(response, bodyOffset, bodySize);
+
+		delete request;
+		m_request = NULL;
+		m_hasBody = false;
+		m_state = State_header;
+
+		// continue with the pipelined requests
+		processInput();
+	}
+
+	void HttpConnection::writeError(int status)
+	{
+		char response[256];
+		int n = snprintf(response, sizeof(response), "HTTP/1.1 %d %s\r\n%sContent-Length: 0\r\nConnection: close\r\n\r\n",
+			status, _reasonPhrase(status), _dateHeaderField());
+		m_output.append(response, n);
+
+		delete m_request;
+		m_request = NULL;
+		m_closing = true;
+	}
+}
+
+#endif
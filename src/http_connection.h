@@ -0,0 +1,152 @@
+/*
+MIT License
+
+Copyright (c) 2019 GIS Core R&D Department, NavInfo Co., Ltd
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+
+#ifndef WIN32
+
+#include <string>
+#include <vector>
+#include <sys/socket.h>
+#include "connection_protocol.h"
+
+namespace ncserver
+{
+	class HttpConnection;
+
+	/**
+		One HTTP/1.x request, presented as the CGI variables nginx passes to a
+		FastCGI server, so that Request works the same behind both front-ends.
+	 */
+	class HttpRequestState : public ProtocolRequest
+	{
+	public:
+		HttpRequestState();
+
+		virtual char** envp() { return &m_envp[0]; }
+		virtual const char* stdinData() { return m_body.data(); }
+		virtual size_t stdinSize() { return m_body.size(); }
+
+		bool keepAlive() { return m_keepAlive; }
+
+	private:
+		friend class HttpConnection;
+
+		void addVariable(const char* name, size_t nameLength, const char* value, size_t valueLength);
+		void addHeaderVariable(const char* name, size_t nameLength, const char* value, size_t valueLength);
+		void buildEnvp();
+
+		std::string m_envBuffer;
+		std::vector<size_t> m_offsets;
+		std::vector<char*> m_envp;
+		std::string m_body;
+		std::string m_response;
+		bool m_keepAlive;
+		bool m_http10;
+		bool m_headRequest;
+	};
+
+	class HttpConnectionDelegate
+	{
+	public:
+		/**
+			Called when the header and the body of a request are received.
+			The delegate must finish the request with HttpConnection::endRequest().
+		 */
+		virtual void httpConnectionDidReceiveRequest(HttpConnection* connection, HttpRequestState* request) = 0;
+	};
+
+	/**
+		HTTP/1.1 server side of one connection.
+
+		Requests are parsed in the order they arrive, so pipelined requests are
+		answered in order. The next request is not parsed before the previous
+		one is ended. The CGI header fields written by query() are translated
+		into the status line, and Content-Length is added.
+	 */
+	class HttpConnection : public ConnectionProtocol
+	{
+	public:
+		HttpConnection(HttpConnectionDelegate* delegate);
+		~HttpConnection();
+
+		/**
+			Address of the client reported as REMOTE_ADDR and REMOTE_PORT.
+		 */
+		void setRemoteAddress(const char* address, int port);
+		void setRemoteAddress(const struct sockaddr* addr);
+
+		virtual bool feed(const char* data, size_t size);
+
+		/**
+			The output is held until the request is ended, when its length is known.
+		 */
+		virtual void writeStdout(ProtocolRequest* request, const char* data, size_t size);
+
+		virtual void endRequest(ProtocolRequest* request, int appStatus);
+
+		virtual bool closeAfterOutput() { return m_closing && m_request == NULL; }
+
+		virtual bool isIdle() { return m_request == NULL && m_input.size() == m_inputOffset && outputSize() == 0; }
+		virtual bool isServing() { return m_request != NULL && m_state == State_dispatched; }
+
+	private:
+		enum
+		{
+			MAX_HEADER_SIZE = 64 * 1024,
+			MAX_BODY_SIZE = 64 * 1024 * 1024,
+		};
+
+		enum State
+		{
+			State_header,
+			State_body,				// Content-Length bytes
+			State_chunkSize,
+			State_chunkData,
+			State_chunkDataEnd,		// CRLF after the data of a chunk
+			State_trailer,
+			State_dispatched,		// waiting for endRequest()
+		};
+
+		void processInput();
+		bool parseHeader(const char* header, size_t size);
+		bool readBody();
+		void dispatch();
+		void writeError(int status);
+
+		HttpConnectionDelegate* m_delegate;
+		std::string m_remoteAddress;
+		std::string m_remotePort;
+		std::string m_input;
+		size_t m_inputOffset;
+		size_t m_scanOffset;		// where to continue to look for the end of the header
+		State m_state;
+		size_t m_remaining;			// bytes left of the body or the current chunk
+		bool m_hasBody;				// Content-Length or chunked body, CONTENT_LENGTH is passed
+		HttpRequestState* m_request;
+		bool m_closing;
+		bool m_processing;
+	};
+}
+
+#endif
@@ -0,0 +1,234 @@
+/*
+MIT License
+
+Copyright (c) 2019 GIS Core R&D Department, NavInfo Co., Ltd
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "stdafx.h"
+#include "ncserver/immutable_region.h"
+#include "ncserver/nc_log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef WIN32
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+namespace ncserver
+{
+	static size_t _roundUp(size_t size, size_t unit)
+	{
+		return (size + unit - 1) / unit * unit;
+	}
+
+#ifndef WIN32
+	/**
+		Hugepagesize of /proc/meminfo, 2MB if it can't be read.
+	 */
+	static size_t _hugePageSize()
+	{
+		size_t size = 2 << 20;
+		FILE* file = fopen("/proc/meminfo", "r");
+		if (file == NULL)
+			return size;
+		char line[256];
+		unsigned long kb;
+		while (fgets(line, sizeof(line), file) != NULL)
+		{
+			if (sscanf(line, "Hugepagesize: %lu kB", &kb) == 1)
+			{
+				size = (size_t)kb << 10;
+				break;
+			}
+		}
+		fclose(file);
+		return size;
+	}
+#endif
+
+	ImmutableRegion::ImmutableRegion()
+	{
+		m_base = NULL;
+		m_mappedSize = 0;
+		m_capacity = 0;
+		m_used = 0;
+		m_pageSize = 0;
+		m_hugePages = HugePages_none;
+		m_sealed = false;
+	}
+
+	ImmutableRegion::~ImmutableRegion()
+	{
+		release();
+	}
+
+	void ImmutableRegion::release()
+	{
+		if (m_base != NULL)
+		{
+#ifndef WIN32
+			if (m_mappedSize > 0)
+				munmap(m_base, m_mappedSize);
+#else
+			free(m_base);
+#endif
+		}
+		m_base = NULL;
+		m_mappedSize = 0;
+		m_capacity = 0;
+		m_used = 0;
+		m_sealed = false;
+	}
+
+	bool ImmutableRegion::init(size_t capacity, HugePages hugePages, bool prefault, bool lock)
+	{
+		release();
+		if (capacity == 0)
+			return false;
+
+#ifndef WIN32
+		size_t hugePageSize = _hugePageSize();
+		size_t mappedSize = _roundUp(capacity, hugePageSize);
+		void* memory = MAP_FAILED;
+		if (hugePages == HugePages_explicit)
+		{
+			memory = mmap(NULL, mappedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (prefault ? MAP_POPULATE : 0), -1, 0);
+			if (memory == MAP_FAILED)
+			{
+				ASYNC_LOG_WARNING("Not enough huge pages reserved for the immutable region of %zu bytes, transparent ones are used", mappedSize);
+				hugePages = HugePages_transparent;
+			}
+		}
+
+		if (memory == MAP_FAILED)
+		{
+			// aligned to a huge page, or the kernel can't back its first and last
+			// pieces with huge pages
+			size_t slack = hugePages == HugePages_transparent ? hugePageSize : 0;
+			void* mapped = mmap(NULL, mappedSize + slack, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (mapped == MAP_FAILED)
+			{
+				ASYNC_LOG_ERR("Failed to map the immutable region of %zu bytes: %s", mappedSize, strerror(errno));
+				return false;
+			}
+			char* start = (char*)mapped;
+			char* aligned = (char*)_roundUp((size_t)start, slack > 0 ? slack : 1);
+			if (aligned > start)
+				munmap(start, aligned - start);
+			if (start + slack > aligned)
+				munmap(aligned + mappedSize, start + slack - aligned);
+			memory = aligned;
+
+			if (hugePages == HugePages_transparent && madvise(memory, mappedSize, MADV_HUGEPAGE) != 0)
+				ASYNC_LOG_WARNING("No transparent huge pages for the immutable region: %s", strerror(errno));
+			if (prefault)
+			{
+				// written rather than read, which would map the zero page only
+				long pageSize = sysconf(_SC_PAGESIZE);
+				for (size_t offset = 0; offset < mappedSize; offset += pageSize)
+					((volatile char*)memory)[offset] = 0;
+			}
+		}
+
+		m_base = (char*)memory;
+		m_mappedSize = mappedSize;
+		m_pageSize = hugePages == HugePages_none ? (size_t)sysconf(_SC_PAGESIZE) : hugePageSize;
+		if (lock && mlock(m_base, m_mappedSize) != 0)
+			ASYNC_LOG_WARNING("Failed to lock the immutable region of %zu bytes: %s", m_mappedSize, strerror(errno));
+#else
+		m_base = (char*)malloc(capacity);
+		if (m_base == NULL)
+			return false;
+		m_mappedSize = capacity;
+		m_pageSize = 1;
+#endif
+		m_capacity = m_mappedSize;
+		m_hugePages = hugePages;
+		return true;
+	}
+
+	void* ImmutableRegion::allocate(size_t size, size_t alignment)
+	{
+		if (m_base == NULL || m_sealed)
+			return NULL;
+		size_t offset = _roundUp(m_used, alignment);
+		if (offset > m_capacity || size > m_capacity - offset)
+			return NULL;
+		m_used = offset + size;
+		return m_base + offset;
+	}
+
+	bool ImmutableRegion::seal()
+	{
+		if (m_base == NULL || m_sealed)
+			return m_sealed;
+
+#ifndef WIN32
+		size_t keptSize = _roundUp(m_used, m_pageSize);
+		if (keptSize < m_mappedSize)
+		{
+			munmap(m_base + keptSize, m_mappedSize - keptSize);
+			m_mappedSize = keptSize;
+		}
+		if (m_mappedSize > 0 && mprotect(m_base, m_mappedSize, PROT_READ) != 0)
+		{
+			ASYNC_LOG_ERR("Failed to seal the immutable region: %s", strerror(errno));
+			return false;
+		}
+#endif
+		m_capacity = m_used;
+		m_sealed = true;
+		ASYNC_LOG_INFO("Immutable region of %zu bytes is sealed, %zu bytes of huge pages", m_used, hugePageBytes());
+		return true;
+	}
+
+	size_t ImmutableRegion::hugePageBytes() const
+	{
+#ifndef WIN32
+		if (m_base == NULL || m_hugePages == HugePages_none)
+			return 0;
+		if (m_hugePages == HugePages_explicit)
+			return m_mappedSize;
+
+		FILE* file = fopen("/proc/self/smaps", "r");
+		if (file == NULL)
+			return 0;
+		size_t bytes = 0;
+		bool inRegion = false;
+		char line[512];
+		unsigned long start, end, kb;
+		while (fgets(line, sizeof(line), file) != NULL)
+		{
+			// a mapping starts with its address range, its fields follow
+			if (sscanf(line, "%lx-%lx ", &start, &end) == 2)
+				inRegion = start >= (unsigned long)m_base && start < (unsigned long)(m_base + m_mappedSize);
+			else if (inRegion && sscanf(line, "AnonHugePages: %lu kB", &kb) == 1)
+				bytes += (size_t)kb << 10;
+		}
+		fclose(file);
+		return bytes;
+#else
+		return 0;
+#endif
+	}
+}
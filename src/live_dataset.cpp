@@ -0,0 +1,339 @@
+/*
+MIT License
+
+Copyright (c) 2019 GIS Core R&D Department, NavInfo Co., Ltd
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "stdafx.h"
+#include "ncserver/live_dataset.h"
+#include "ncserver/nc_log.h"
+#include <atomic>
+#include <new>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+
+#ifndef WIN32
+#include <errno.h>
+#include <sched.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+namespace ncserver
+{
+	// the buffer of a version is in its low bits, the publish() count in the others
+	enum { BUFFER_BITS = 8, MAX_BUFFER_COUNT = 1 << BUFFER_BITS };
+
+	struct LiveDataset::Header
+	{
+		std::atomic<unsigned long long> current;	// 0 until the first publish()
+		std::atomic<bool> publishing;
+	};
+
+	/**
+		A View being held, a cache line each so that readers don't share one.
+	 */
+	struct alignas(64) LiveDataset::Reader
+	{
+		std::atomic<long> owner;					// thread which took it, 0 if free
+		std::atomic<unsigned long long> pinned;		// the version it holds, 0 if none
+	};
+
+	static size_t _alignUp(size_t size, size_t alignment)
+	{
+		return (size + alignment - 1) / alignment * alignment;
+	}
+
+	/**
+		Unique among the threads of all the processes. Not cached, as a worker
+		forked from the manager would inherit the id of the manager thread.
+	 */
+	static long _threadId()
+	{
+#ifndef WIN32
+		return (long)syscall(SYS_gettid);
+#else
+		return (long)(std::hash<std::thread::id>()(std::this_thread::get_id()) | 1);
+#endif
+	}
+
+	/**
+		Whether the thread of _threadId() @a id still exists, e.g. not in a crashed worker.
+	 */
+	static bool _threadAlive(long id)
+	{
+#ifndef WIN32
+		return kill((pid_t)id, 0) == 0 || errno != ESRCH;
+#else
+		return true;
+#endif
+	}
+
+	LiveDataset::View::View(View&& other)
+	{
+		m_owner = other.m_owner;
+		m_reader = other.m_reader;
+		m_data = other.m_data;
+		m_size = other.m_size;
+		m_version = other.m_version;
+		other.m_owner = NULL;
+		other.m_data = NULL;
+	}
+
+	LiveDataset::View& LiveDataset::View::operator=(View&& other)
+	{
+		if (this != &other)
+		{
+			release();
+			m_owner = other.m_owner;
+			m_reader = other.m_reader;
+			m_data = other.m_data;
+			m_size = other.m_size;
+			m_version = other.m_version;
+			other.m_owner = NULL;
+			other.m_data = NULL;
+		}
+		return *this;
+	}
+
+	void LiveDataset::View::release()
+	{
+		if (m_owner != NULL)
+			m_owner->release(m_reader);
+		m_owner = NULL;
+		m_reader = -1;
+		m_data = NULL;
+		m_size = 0;
+	}
+
+	LiveDataset::LiveDataset()
+	{
+		m_memory = NULL;
+		m_mappedSize = 0;
+		m_header = NULL;
+		m_readers = NULL;
+		m_sizes = NULL;
+		m_buffers = NULL;
+		m_capacity = 0;
+		m_stride = 0;
+		m_bufferCount = 0;
+		m_readerCount = 0;
+	}
+
+	LiveDataset::~LiveDataset()
+	{
+		clear();
+	}
+
+	void LiveDataset::clear()
+	{
+		if (m_memory != NULL)
+		{
+#ifndef WIN32
+			munmap(m_memory, m_mappedSize);
+#else
+			free(m_memory);
+#endif
+		}
+		m_memory = NULL;
+		m_mappedSize = 0;
+		m_header = NULL;
+		m_readers = NULL;
+		m_sizes = NULL;
+		m_buffers = NULL;
+		m_capacity = 0;
+		m_stride = 0;
+		m_bufferCount = 0;
+		m_readerCount = 0;
+	}
+
+	bool LiveDataset::init(size_t capacity, int bufferCount, int readerCount)
+	{
+		clear();
+		if (capacity == 0 || bufferCount < 2 || bufferCount > MAX_BUFFER_COUNT || readerCount <= 0)
+		{
+			ASYNC_LOG_ERR("Invalid live dataset of %zu bytes, %d buffers and %d readers", capacity, bufferCount, readerCount);
+			return false;
+		}
+
+		size_t readersOffset = _alignUp(sizeof(Header), 64);
+		size_t sizesOffset = readersOffset + sizeof(Reader) * readerCount;
+		size_t buffersOffset = _alignUp(sizesOffset + sizeof(size_t) * bufferCount, 4096);
+		size_t stride = _alignUp(capacity, 4096);
+		size_t mappedSize = buffersOffset + stride * bufferCount;
+
+		// shared with the workers forked from now on, rather than copied on write
+#ifndef WIN32
+		void* memory = mmap(NULL, mappedSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+		if (memory == MAP_FAILED)
+			memory = NULL;
+#else
+		void* memory = calloc(1, mappedSize);
+#endif
+		if (memory == NULL)
+		{
+			ASYNC_LOG_ERR("Failed to map %zu bytes for a live dataset", mappedSize);
+			return false;
+		}
+
+		m_memory = memory;
+		m_mappedSize = mappedSize;
+		m_header = new (memory) Header();
+		m_header->current.store(0);
+		m_header->publishing.store(false);
+		m_readers = (Reader*)((char*)memory + readersOffset);
+		for (int i = 0; i < readerCount; i++)
+		{
+			new (&m_readers[i]) Reader();
+			m_readers[i].owner.store(0);
+			m_readers[i].pinned.store(0);
+		}
+		m_sizes = (size_t*)((char*)memory + sizesOffset);
+		m_buffers = (char*)memory + buffersOffset;
+		m_capacity = capacity;
+		m_stride = stride;
+		m_bufferCount = bufferCount;
+		m_readerCount = readerCount;
+		return true;
+	}
+
+	int LiveDataset::freeBuffer()
+	{
+		unsigned long long current = m_header->current.load();
+		for (int buffer = 0; buffer < m_bufferCount; buffer++)
+		{
+			if (current != 0 && (int)(current & (MAX_BUFFER_COUNT - 1)) == buffer)
+				continue;
+
+			bool held = false;
+			for (int i = 0; i < m_readerCount && !held; i++)
+			{
+				Reader& reader = m_readers[i];
+				unsigned long long pinned = reader.pinned.load();
+				if (pinned == 0 || (int)(pinned & (MAX_BUFFER_COUNT - 1)) != buffer)
+					continue;
+
+				// taken back from a thread which is gone, e.g. with a crashed worker
+				long owner = reader.owner.load();
+				if (owner != 0 && !_threadAlive(owner))
+				{
+					reader.pinned.store(0);
+					reader.owner.compare_exchange_strong(owner, 0);
+					continue;
+				}
+				held = true;
+			}
+			if (!held)
+				return buffer;
+		}
+		return -1;
+	}
+
+	bool LiveDataset::publish(size_t size, const Filler& fill)
+	{
+		if (m_header == NULL || size > m_capacity)
+		{
+			ASYNC_LOG_ERR("Failed to publish %zu bytes into a live dataset of %zu bytes", size, m_capacity);
+			return false;
+		}
+
+		// one publisher at a time, in whichever process
+		while (m_header->publishing.exchange(true))
+			std::this_thread::yield();
+
+		int buffer = freeBuffer();
+		if (buffer >= 0)
+		{
+			fill(m_buffers + m_stride * buffer, size);
+			m_sizes[buffer] = size;
+			// the readers switch with their next acquire()
+			unsigned long long version = (m_header->current.load() >> BUFFER_BITS) + 1;
+			m_header->current.store(version << BUFFER_BITS | (unsigned long long)buffer);
+		}
+		else
+		{
+			ASYNC_LOG_WARNING("All the %d buffers of a live dataset are held, nothing is published", m_bufferCount);
+		}
+
+		m_header->publishing.store(false);
+		return buffer >= 0;
+	}
+
+	bool LiveDataset::publish(const void* data, size_t size)
+	{
+		return publish(size, [data](void* memory, size_t size) { memcpy(memory, data, size); });
+	}
+
+	LiveDataset::View LiveDataset::acquire()
+	{
+		View view;
+		if (m_header == NULL || m_header->current.load() == 0)
+			return view;
+
+		// start from a slot of its own, so that threads rarely compete for one
+		long id = _threadId();
+		int reader = -1;
+		for (int i = 0; i < m_readerCount && reader < 0; i++)
+		{
+			int candidate = (int)(((unsigned long)id + i) % m_readerCount);
+			long expected = 0;
+			if (m_readers[candidate].owner.load() == 0 && m_readers[candidate].owner.compare_exchange_strong(expected, id))
+				reader = candidate;
+		}
+		if (reader < 0)
+		{
+			ASYNC_LOG_ERR("All the %d readers of a live dataset are taken", m_readerCount);
+			return view;
+		}
+
+		// Pinned before it is checked again, so that publish() either sees the pin
+		// or this sees the version which has replaced it.
+		unsigned long long current;
+		do
+		{
+			current = m_header->current.load();
+			m_readers[reader].pinned.store(current);
+		} while (m_header->current.load() != current);
+
+		int buffer = (int)(current & (MAX_BUFFER_COUNT - 1));
+		view.m_owner = this;
+		view.m_reader = reader;
+		view.m_data = m_buffers + m_stride * buffer;
+		view.m_size = m_sizes[buffer];
+		view.m_version = current >> BUFFER_BITS;
+		return view;
+	}
+
+	void LiveDataset::release(int reader)
+	{
+		if (m_readers == NULL || reader < 0 || reader >= m_readerCount)
+			return;
+		m_readers[reader].pinned.store(0);
+		m_readers[reader].owner.store(0);
+	}
+
+	unsigned long long LiveDataset::version() const
+	{
+		return m_header != NULL ? m_header->current.load() >> BUFFER_BITS : 0;
+	}
+}
@@ -24,45 +24,62 @@ SOFTWARE.
 #include "stdafx.h"
 
 #include "fcgi_stdio.h"
+#include <errno.h>
 #include <signal.h>
 #include <sys/stat.h>
 #include "ncserver/ncserver.h"
+#include "ncserver/async_query.h"
+#include "ncserver/task_pool.h"
+#include "ncserver/dataset_registry.h"
+#include "ncserver/immutable_region.h"
+#include "ncserver/shared_cache.h"
+#include "ncserver/handler_module.h"
 #include "fcgi_bind.h"
 #include "fcgi_service_io.h"
+#include "ncserver_config.h"
+#include "event_server.h"
+#include "uring_server.h"
+#include "placement.h"
+#include "worker_scaler.h"
+#include "signal_fd.h"
+#include "worker_scoreboard.h"
+#include "process_memory.h"
+#include "handler_library.h"
+#include "response_cache.h"
 #include "util.h"
 #include "ncserver/nc_log.h"
 #include "yaml-cpp/yaml.h"
 
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <thread>
+#include <vector>
+
 #ifndef WIN32
 #include <sys/wait.h>
 #include <sys/mman.h>
-#include <thread>
-#include <vector>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <pthread.h>
+#include <poll.h>
 #endif
 
 bool g_ncServerExit = false;
 bool g_ncServerReload = false;
+bool g_ncServerRestartWorkers = false;
 
-namespace ncserver
-{
-	class NcServerConfig
-	{
-	public:
-		struct ServerConfig
-		{
-			int workerCount = 4;
-		};
-
-		static NcServerConfig* alloc() { return new NcServerConfig(); }
+// seconds between two updates of ".datasets" by the manager
+static const int DATASET_RECORD_INTERVAL = 10;
 
-		ServerConfig server;
+// a worker which keeps exiting before it is ready is forked again after this long
+static const int RESTART_INTERVAL_MS = 1000;
 
-	protected:
-		NcServerConfig() {}
-		~NcServerConfig() {}
-		friend void release(NcServerConfig* config);
-	};
+// given to a stopping worker beyond server.drainTimeout to close its connections
+static const int DRAIN_KILL_GRACE_MS = 1000;
 
+namespace ncserver
+{
 	void release(NcServerConfig* config)
 	{
 		delete config;
@@ -74,21 +91,22 @@ namespace ncserver
 		m_params = StaticStringMap_alloc();
 		m_paramIter = RequestParameterIterator_alloc();
 		m_paramPool[0] = 0;
+		m_envp = NULL;
 	}
 
 	const char* Request::requestMethod()
 	{
-		return FCGI_getenv("REQUEST_METHOD");
+		return headerForName("REQUEST_METHOD");
 	}
 
 	const char* Request::contentType()
 	{
-		return FCGI_getenv("CONTENT_TYPE");
+		return headerForName("CONTENT_TYPE");
 	}
 
 	const char* Request::documentUri()
 	{
-		return FCGI_getenv("DOCUMENT_URI");
+		return headerForName("DOCUMENT_URI");
 	}
 
 	const char* Request::queryString()
@@ -98,7 +116,7 @@ namespace ncserver
 
 	size_t Request::contentLength()
 	{
-		const char* length = FCGI_getenv("CONTENT_LENGTH");
+		const char* length = headerForName("CONTENT_LENGTH");
 		return strtoull(length, NULL, 10);
 	}
 
@@ -114,9 +132,16 @@ namespace ncserver
 
 	const char* Request::headerForName(const char* name)
 	{
+		if (m_envp != NULL)
+			return FCGX_GetParam(name, m_envp);
 		return FCGI_getenv(name);
 	}
 
+	void Request::setEnvironment(char** envp)
+	{
+		m_envp = envp;
+	}
+
 	const char* Request::parameterForName(const char* name)
 	{
 		return m_params->get(name);
@@ -187,12 +212,282 @@ namespace ncserver
 		g_ncServerReload = true;
 	}
 
+#ifndef WIN32
+	/**
+		For SIGUSR2, which only has to wake up a SignalFd.
+	 */
+	static void handleWakeUpSignal(int sig)
+	{
+	}
+
+	/**
+		What the handlers above do, for the signals read from a SignalFd.
+	 */
+	static void _handleSignalOfSignalFd(int signo)
+	{
+		if (signo == SIGINT || signo == SIGTERM)
+			g_ncServerExit = true;
+		else if (signo == SIGUSR1)
+			g_ncServerReload = true;
+		else if (signo == SIGHUP)
+			g_ncServerRestartWorkers = true;
+	}
+
+	/**
+		Whether the worker @a pid is gone, reaping it if it has exited.
+	 */
+	static bool _hasExited(pid_t pid)
+	{
+		return pid <= 0 || waitpid(pid, NULL, WNOHANG) != 0;
+	}
+
+	/**
+		Reap the stopping @a children, and SIGKILL those still running after @a timeoutMs.
+	 */
+	static void _waitOrKill(const std::vector<pid_t>& children, long long timeoutMs)
+	{
+		std::vector<pid_t> running = children;
+		long long deadline = monotonicTimeMs() + timeoutMs;
+		while (!running.empty() && monotonicTimeMs() < deadline)
+		{
+			usleep(20 * 1000);
+			running.erase(std::remove_if(running.begin(), running.end(), _hasExited), running.end());
+		}
+		for (pid_t child : running)
+		{
+			kill(child, SIGKILL);
+			waitpid(child, NULL, 0);
+		}
+	}
+
+	// Workers retired while the manager goes on, with the time they are killed
+	// at. Reaped by the loop of the manager rather than by a thread, which
+	// a successor forked for server.zygoteReload wouldn't have.
+	static std::vector<std::pair<pid_t, long long>> g_retiring;
+
+	/**
+		Give the workers retired while the manager goes on @a timeoutMs to exit.
+	 */
+	static void _reapLater(const std::vector<pid_t>& children, long long timeoutMs)
+	{
+		long long deadline = monotonicTimeMs() + timeoutMs;
+		for (pid_t child : children)
+			g_retiring.push_back(std::make_pair(child, deadline));
+	}
+
+	/**
+		Reap the workers of _reapLater() which have exited, and kill those past their time.
+	 */
+	static void _reapRetired()
+	{
+		long long now = monotonicTimeMs();
+		size_t kept = 0;
+		for (size_t i = 0; i < g_retiring.size(); i++)
+		{
+			pid_t child = g_retiring[i].first;
+			if (_hasExited(child))
+				continue;
+			if (now >= g_retiring[i].second)
+			{
+				kill(child, SIGKILL);
+				waitpid(child, NULL, 0);
+				continue;
+			}
+			g_retiring[kept++] = g_retiring[i];
+		}
+		g_retiring.resize(kept);
+	}
+
+	/**
+		Hand the listen socket @a fd of a slot, -1 if it has none, to a standby worker over @a channel.
+	 */
+	static bool _sendListenSocket(int channel, int fd)
+	{
+		char byte = fd >= 0 ? 1 : 0;
+		struct iovec iov = { &byte, 1 };
+		char control[CMSG_SPACE(sizeof(int))];
+		memset(control, 0, sizeof(control));
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		if (fd >= 0)
+		{
+			msg.msg_control = control;
+			msg.msg_controllen = sizeof(control);
+			struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+			cmsg->cmsg_level = SOL_SOCKET;
+			cmsg->cmsg_type = SCM_RIGHTS;
+			cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+			memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+		}
+		return sendmsg(channel, &msg, MSG_NOSIGNAL) == 1;
+	}
+
+	/**
+		In a standby worker: the listen socket of _sendListenSocket(), -1 if there is none.
+		@return
+			false if the manager has sent nothing.
+	 */
+	static bool _receiveListenSocket(int channel, int* fd)
+	{
+		char byte = 0;
+		struct iovec iov = { &byte, 1 };
+		char control[CMSG_SPACE(sizeof(int))];
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		if (recvmsg(channel, &msg, MSG_DONTWAIT) != 1)
+			return false;
+
+		*fd = -1;
+		struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+		if (byte != 0 && cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+			memcpy(fd, CMSG_DATA(cmsg), sizeof(int));
+		return byte == 0 || *fd >= 0;
+	}
+#endif
+
+#ifndef WIN32
+	/**
+		Shared by the boss and all the managers.
+	 */
+	struct ReloadState
+	{
+		bool managerFinishedForking;
+		bool successorRequested;	// the boss asks the manager to fork its successor
+		bool successorFailed;		// which has exited before it finished forking
+		pid_t successor;			// the manager which has finished forking
+
+		// a reload within server.reloadMemoryBudget
+		pid_t stagingManager;		// the new manager, once it has prepared
+		int workerQuota;			// workers it may fork, -1 for all
+		int workerTarget;			// workers it is going to have
+		int readyWorkers;
+		pid_t formerManager;
+		int formerWorkerLimit;		// workers the former manager keeps, -1 for all
+		int formerWorkerCount;		// its slots and retired workers still draining, -1 until it tells
+		long long formerLimitTimeMs;	// monotonicTimeMs() of the last change of formerWorkerLimit
+		long long memoryBudgetKb;
+		long long peakMemoryKb;		// of both generations together
+	};
+
+	/**
+		One step of a reload within the memory budget: another worker of the new
+		manager if it fits, or else one worker less of the former manager.
+		Falls back to a reload without the budget if the former manager doesn't
+		get down to its limit within @a drainMs.
+	 */
+	static void _stageReload(ReloadState& state, pid_t formerManager, long long drainMs)
+	{
+		std::vector<pid_t> processes = descendantProcesses(getpid());
+		std::map<pid_t, long long> memoryOf;
+		long long totalKb = 0;
+		for (pid_t process : processes)
+		{
+			long long memory = processMemoryKb(process);
+			memoryOf[process] = memory;
+			totalKb += memory > 0 ? memory : 0;
+		}
+		state.peakMemoryKb = std::max(state.peakMemoryKb, totalKb);
+
+		// still preparing, its last worker isn't ready yet, it is complete, or it has fallen back
+		pid_t newManager = state.stagingManager;
+		if (newManager <= 0 || state.workerQuota < 0 || state.readyWorkers < state.workerQuota || state.workerQuota >= state.workerTarget)
+			return;
+
+		// Standby workers and the helpers of the application are no slots, but
+		// as large as a worker, e.g. with the datasets they have mapped.
+		std::vector<pid_t> newProcesses = descendantProcesses(newManager);
+		newProcesses.push_back(newManager);
+		std::vector<pid_t> formerProcesses;
+		int formerWorkers = 0;
+		if (formerManager > 0)
+		{
+			for (pid_t process : descendantProcesses(formerManager))
+			{
+				if (std::find(newProcesses.begin(), newProcesses.end(), process) == newProcesses.end())
+					formerProcesses.push_back(process);
+			}
+			formerWorkers = state.formerWorkerCount;
+			if (formerWorkers < 0)
+				return;
+		}
+
+		// a retired worker is still draining
+		int formerLimit = state.formerWorkerLimit >= 0 ? state.formerWorkerLimit : formerWorkers;
+		if (formerWorkers > formerLimit)
+		{
+			if (monotonicTimeMs() - state.formerLimitTimeMs <= drainMs)
+				return;
+			ASYNC_LOG_WARNING("Former workers still run %lld ms after they were retired, reloading without the memory budget", drainMs);
+			state.workerQuota = -1;
+			state.formerWorkerLimit = -1;
+			kill(newManager, SIGUSR2);
+			return;
+		}
+
+		// a new worker is going to grow as large as the largest one
+		long long workerKb = 0;
+		for (pid_t process : formerProcesses)
+			workerKb = std::max(workerKb, memoryOf[process]);
+		for (pid_t process : newProcesses)
+		{
+			if (process != newManager)
+				workerKb = std::max(workerKb, memoryOf[process]);
+		}
+
+		// the last former worker stays until a new one serves
+		bool lastServing = formerLimit == 0 || (formerLimit == 1 && state.readyWorkers == 0);
+		if (totalKb + workerKb <= state.memoryBudgetKb || lastServing)
+		{
+			if (totalKb + workerKb > state.memoryBudgetKb)
+				ASYNC_LOG_WARNING("Reload exceeds the memory budget of %lld KB with %lld KB", state.memoryBudgetKb, totalKb + workerKb);
+			state.workerQuota++;
+			kill(newManager, SIGUSR2);
+		}
+		else
+		{
+			state.formerWorkerLimit = formerLimit - 1;
+			state.formerLimitTimeMs = monotonicTimeMs();
+			kill(formerManager, SIGUSR2);
+		}
+	}
+#endif
+
 	NcServer::NcServer()
 	{
 		m_config = NcServerConfig::alloc();
+		m_taskPool = nullptr;
+		m_datasets = new DatasetRegistry();
+		m_immutableRegion = new ImmutableRegion();
+		m_sharedCache = new SharedCache();
+		m_responseCache = new ResponseCache();
+		m_handlerLibrary = nullptr;
+		m_handlerModule = nullptr;
 #ifndef WIN32
 		m_children = nullptr;
 		m_childrenStates = nullptr;
+		m_listenSockets = nullptr;
+		m_activeWorkerCount = 0;
+		m_scaler = new WorkerScaler();
+		m_signals = new SignalFd();
+		m_scoreboard = new WorkerScoreboard();
+		m_predecessors = nullptr;
+		m_forkTimes = nullptr;
+		m_startFailures = nullptr;
+		m_workerIndex = -1;
+		m_manager = -1;
+		m_reloadState = nullptr;
+		m_unstagedWorkerCount = -1;
+		m_standbys = nullptr;
+		m_standbyForkTimes = nullptr;
+		m_standbyChannels = nullptr;
+		m_standbyIndex = -1;
+		m_standbyChannel = -1;
 		m_mutex = PTHREAD_MUTEX_INITIALIZER;
 		pthread_mutex_init(&m_mutex, NULL);
 #endif
@@ -202,11 +497,32 @@ namespace ncserver
 	NcServer::~NcServer()
 	{
 		release(m_config);
+		delete m_datasets;
+		delete m_immutableRegion;
+		delete m_sharedCache;
+		delete m_responseCache;
 #ifndef WIN32
 		delete[] m_children;
 		m_children = nullptr;
 		delete[] m_childrenStates;
 		m_childrenStates = nullptr;
+		delete[] m_listenSockets;
+		m_listenSockets = nullptr;
+		delete[] m_predecessors;
+		m_predecessors = nullptr;
+		delete[] m_forkTimes;
+		m_forkTimes = nullptr;
+		delete[] m_startFailures;
+		m_startFailures = nullptr;
+		delete[] m_standbys;
+		m_standbys = nullptr;
+		delete[] m_standbyForkTimes;
+		m_standbyForkTimes = nullptr;
+		delete[] m_standbyChannels;
+		m_standbyChannels = nullptr;
+		delete m_scaler;
+		delete m_signals;
+		delete m_scoreboard;
 
 		pthread_mutex_destroy(&m_mutex);
 #endif
@@ -215,18 +531,48 @@ namespace ncserver
 	void NcServer::reset()
 	{
 #ifndef WIN32
-		int workerCount = m_config->server.workerCount;
+		resolveWorkerCounts(&m_config->server);
+		m_scaler->init(m_config->server);
+		m_activeWorkerCount = m_config->server.workerCount;
+
+		// a slot for each worker there may be
+		int workerCount = m_config->server.maxWorkerCount;
 
 		if (workerCount > 0)
 		{
 			delete[] m_children;
 			delete[] m_childrenStates;
+			delete[] m_listenSockets;
+			delete[] m_predecessors;
+			delete[] m_forkTimes;
+			delete[] m_startFailures;
+			delete[] m_standbys;
+			delete[] m_standbyForkTimes;
+			delete[] m_standbyChannels;
 
 			m_children = new pid_t[workerCount];
 			m_childrenStates = new ChildState[workerCount];
+			m_listenSockets = new int[workerCount];
+			m_predecessors = new pid_t[workerCount];
+			m_forkTimes = new long long[workerCount];
+			m_startFailures = new int[workerCount];
+			int standbyCount = m_config->server.standbyWorkerCount;
+			m_standbys = new pid_t[standbyCount];
+			m_standbyForkTimes = new long long[standbyCount];
+			m_standbyChannels = new int[standbyCount];
 
 			memset(m_children, -1, sizeof(pid_t) * workerCount);		// set as -1
 			memset(m_childrenStates, 0, sizeof(pid_t) * workerCount);	// set as CHILDSTATE_INVALID
+			memset(m_listenSockets, -1, sizeof(int) * workerCount);		// set as -1
+			memset(m_predecessors, -1, sizeof(pid_t) * workerCount);	// set as -1
+			memset(m_forkTimes, 0, sizeof(long long) * workerCount);
+			memset(m_startFailures, 0, sizeof(int) * workerCount);
+			memset(m_standbys, -1, sizeof(pid_t) * standbyCount);
+			memset(m_standbyForkTimes, 0, sizeof(long long) * standbyCount);
+			memset(m_standbyChannels, -1, sizeof(int) * standbyCount);	// set as -1
+
+			// the standby workers report after the worker slots
+			m_scoreboard->init(workerCount + standbyCount);
 		}
 #endif
 	}
@@ -258,6 +604,330 @@ namespace ncserver
 					{
 						serverCfg.workerCount = workerCountCfg.as<int>();
 					}
+
+					YAML::Node minWorkerCountCfg = serverNode["minWorkerCount"];
+					if (minWorkerCountCfg)
+					{
+						serverCfg.minWorkerCount = minWorkerCountCfg.as<int>();
+					}
+
+					YAML::Node maxWorkerCountCfg = serverNode["maxWorkerCount"];
+					if (maxWorkerCountCfg)
+					{
+						serverCfg.maxWorkerCount = maxWorkerCountCfg.as<int>();
+					}
+
+					YAML::Node workerMemoryCfg = serverNode["workerMemory"];
+					if (workerMemoryCfg)
+					{
+						serverCfg.workerMemory = workerMemoryCfg.as<int>();
+					}
+
+					YAML::Node scaleIntervalCfg = serverNode["scaleInterval"];
+					if (scaleIntervalCfg)
+					{
+						serverCfg.scaleInterval = scaleIntervalCfg.as<int>();
+					}
+
+					YAML::Node scaleUpBusyRatioCfg = serverNode["scaleUpBusyRatio"];
+					if (scaleUpBusyRatioCfg)
+					{
+						serverCfg.scaleUpBusyRatio = scaleUpBusyRatioCfg.as<double>();
+					}
+
+					YAML::Node scaleDownBusyRatioCfg = serverNode["scaleDownBusyRatio"];
+					if (scaleDownBusyRatioCfg)
+					{
+						serverCfg.scaleDownBusyRatio = scaleDownBusyRatioCfg.as<double>();
+					}
+
+					YAML::Node scaleUpQueueLengthCfg = serverNode["scaleUpQueueLength"];
+					if (scaleUpQueueLengthCfg)
+					{
+						serverCfg.scaleUpQueueLength = scaleUpQueueLengthCfg.as<int>();
+					}
+
+					YAML::Node maxRestartingWorkersCfg = serverNode["maxRestartingWorkers"];
+					if (maxRestartingWorkersCfg)
+					{
+						serverCfg.maxRestartingWorkers = maxRestartingWorkersCfg.as<int>();
+					}
+
+					YAML::Node standbyWorkerCountCfg = serverNode["standbyWorkerCount"];
+					if (standbyWorkerCountCfg)
+					{
+						serverCfg.standbyWorkerCount = standbyWorkerCountCfg.as<int>();
+						if (serverCfg.standbyWorkerCount < 0)
+							serverCfg.standbyWorkerCount = 0;
+					}
+
+					YAML::Node zygoteReloadCfg = serverNode["zygoteReload"];
+					if (zygoteReloadCfg)
+					{
+						serverCfg.zygoteReload = zygoteReloadCfg.as<bool>();
+					}
+
+					YAML::Node reloadMemoryBudgetCfg = serverNode["reloadMemoryBudget"];
+					if (reloadMemoryBudgetCfg)
+					{
+						serverCfg.reloadMemoryBudget = reloadMemoryBudgetCfg.as<int>();
+					}
+
+					YAML::Node snapshotFileCfg = serverNode["snapshotFile"];
+					if (snapshotFileCfg)
+					{
+						serverCfg.snapshotFile = snapshotFileCfg.as<std::string>();
+					}
+
+					YAML::Node drainTimeoutCfg = serverNode["drainTimeout"];
+					if (drainTimeoutCfg)
+					{
+						serverCfg.drainTimeout = drainTimeoutCfg.as<int>();
+						if (serverCfg.drainTimeout < 0)
+							serverCfg.drainTimeout = 0;
+					}
+
+					YAML::Node threadCountCfg = serverNode["threadCount"];
+					if (threadCountCfg)
+					{
+						serverCfg.threadCount = threadCountCfg.as<int>();
+						if (serverCfg.threadCount < 1)
+							serverCfg.threadCount = 1;
+					}
+
+					YAML::Node taskThreadCountCfg = serverNode["taskThreadCount"];
+					if (taskThreadCountCfg)
+					{
+						serverCfg.taskThreadCount = taskThreadCountCfg.as<int>();
+						if (serverCfg.taskThreadCount < 0)
+							serverCfg.taskThreadCount = 0;
+					}
+
+					YAML::Node engineCfg = serverNode["engine"];
+					if (engineCfg)
+					{
+						std::string engine = engineCfg.as<std::string>();
+						if (engine == "epoll")
+							serverCfg.engine = NcServerConfig::Engine_epoll;
+						else if (engine == "http")
+							serverCfg.engine = NcServerConfig::Engine_http;
+						else
+							serverCfg.engine = NcServerConfig::Engine_fcgi;
+					}
+
+					YAML::Node handlerModuleCfg = serverNode["handlerModule"];
+					if (handlerModuleCfg)
+					{
+						serverCfg.handlerModule = handlerModuleCfg.as<std::string>();
+					}
+
+					YAML::Node keepAliveTimeoutCfg = serverNode["keepAliveTimeout"];
+					if (keepAliveTimeoutCfg)
+					{
+						int keepAliveTimeout = keepAliveTimeoutCfg.as<int>();
+						if (keepAliveTimeout > 0)
+							serverCfg.keepAliveTimeout = keepAliveTimeout;
+						else
+							ASYNC_LOG_WARNING("server.keepAliveTimeout must be positive, %d is ignored", keepAliveTimeout);
+					}
+
+					YAML::Node maxConnectionsCfg = serverNode["maxConnections"];
+					if (maxConnectionsCfg)
+					{
+						serverCfg.maxConnections = maxConnectionsCfg.as<int>();
+					}
+
+					YAML::Node maxRequestsPerConnectionCfg = serverNode["maxRequestsPerConnection"];
+					if (maxRequestsPerConnectionCfg)
+					{
+						serverCfg.maxRequestsPerConnection = maxRequestsPerConnectionCfg.as<int>();
+					}
+
+					YAML::Node ioUringCfg = serverNode["ioUring"];
+					if (ioUringCfg)
+					{
+						serverCfg.ioUring = ioUringCfg.as<bool>();
+					}
+				}
+
+				YAML::Node listenNode = root["listen"];
+				if (listenNode)
+				{
+					NcServerConfig::ListenConfig& listenCfg = tmpConfig->listen;
+
+					YAML::Node addressCfg = listenNode["address"];
+					if (addressCfg)
+					{
+						listenCfg.address = addressCfg.as<std::string>();
+					}
+
+					YAML::Node backlogCfg = listenNode["backlog"];
+					if (backlogCfg)
+					{
+						listenCfg.backlog = backlogCfg.as<int>();
+					}
+
+					YAML::Node receiveBufferCfg = listenNode["receiveBuffer"];
+					if (receiveBufferCfg)
+					{
+						listenCfg.receiveBuffer = receiveBufferCfg.as<int>();
+					}
+
+					YAML::Node sendBufferCfg = listenNode["sendBuffer"];
+					if (sendBufferCfg)
+					{
+						listenCfg.sendBuffer = sendBufferCfg.as<int>();
+					}
+
+					YAML::Node reusePortCfg = listenNode["reusePort"];
+					if (reusePortCfg)
+					{
+						listenCfg.reusePort = reusePortCfg.as<bool>();
+					}
+
+					YAML::Node deferAcceptCfg = listenNode["deferAccept"];
+					if (deferAcceptCfg)
+					{
+						listenCfg.deferAccept = deferAcceptCfg.as<int>();
+					}
+
+					YAML::Node noDelayCfg = listenNode["noDelay"];
+					if (noDelayCfg)
+					{
+						listenCfg.noDelay = noDelayCfg.as<bool>();
+					}
+				}
+
+				YAML::Node placementNode = root["placement"];
+				if (placementNode)
+				{
+					NcServerConfig::PlacementConfig& placementCfg = tmpConfig->placement;
+
+					YAML::Node workerCpusCfg = placementNode["workerCpus"];
+					if (workerCpusCfg)
+					{
+						placementCfg.workerCpus = workerCpusCfg.as<std::vector<std::string> >();
+					}
+
+					YAML::Node workerNodesCfg = placementNode["workerNodes"];
+					if (workerNodesCfg)
+					{
+						placementCfg.workerNodes = workerNodesCfg.as<std::vector<int> >();
+					}
+
+					YAML::Node housekeepingCpusCfg = placementNode["housekeepingCpus"];
+					if (housekeepingCpusCfg)
+					{
+						placementCfg.housekeepingCpus = housekeepingCpusCfg.as<std::string>();
+					}
+
+					YAML::Node memoryPolicyCfg = placementNode["memoryPolicy"];
+					if (memoryPolicyCfg)
+					{
+						std::string memoryPolicy = memoryPolicyCfg.as<std::string>();
+						if (memoryPolicy == "bind")
+							placementCfg.memoryPolicy = NcServerConfig::MemoryPolicy_bind;
+						else if (memoryPolicy == "preferred")
+							placementCfg.memoryPolicy = NcServerConfig::MemoryPolicy_preferred;
+						else
+							placementCfg.memoryPolicy = NcServerConfig::MemoryPolicy_none;
+					}
+
+					YAML::Node replicateDatasetsCfg = placementNode["replicateDatasets"];
+					if (replicateDatasetsCfg)
+					{
+						placementCfg.replicateDatasets = replicateDatasetsCfg.as<bool>();
+					}
+				}
+
+				YAML::Node immutableRegionNode = root["immutableRegion"];
+				if (immutableRegionNode)
+				{
+					NcServerConfig::ImmutableRegionConfig& immutableRegionCfg = tmpConfig->immutableRegion;
+
+					YAML::Node sizeCfg = immutableRegionNode["size"];
+					if (sizeCfg)
+					{
+						immutableRegionCfg.size = sizeCfg.as<int>();
+					}
+
+					YAML::Node hugePagesCfg = immutableRegionNode["hugePages"];
+					if (hugePagesCfg)
+					{
+						std::string hugePages = hugePagesCfg.as<std::string>();
+						if (hugePages == "explicit")
+							immutableRegionCfg.hugePages = ImmutableRegion::HugePages_explicit;
+						else if (hugePages == "none")
+							immutableRegionCfg.hugePages = ImmutableRegion::HugePages_none;
+						else
+							immutableRegionCfg.hugePages = ImmutableRegion::HugePages_transparent;
+					}
+
+					YAML::Node prefaultCfg = immutableRegionNode["prefault"];
+					if (prefaultCfg)
+					{
+						immutableRegionCfg.prefault = prefaultCfg.as<bool>();
+					}
+
+					YAML::Node lockCfg = immutableRegionNode["lock"];
+					if (lockCfg)
+					{
+						immutableRegionCfg.lock = lockCfg.as<bool>();
+					}
+				}
+
+				YAML::Node sharedCacheNode = root["sharedCache"];
+				if (sharedCacheNode)
+				{
+					NcServerConfig::SharedCacheConfig& sharedCacheCfg = tmpConfig->sharedCache;
+
+					YAML::Node sizeCfg = sharedCacheNode["size"];
+					if (sizeCfg)
+					{
+						sharedCacheCfg.size = sizeCfg.as<int>();
+					}
+
+					YAML::Node slotSizeCfg = sharedCacheNode["slotSize"];
+					if (slotSizeCfg)
+					{
+						sharedCacheCfg.slotSize = slotSizeCfg.as<int>();
+					}
+
+					YAML::Node fileCfg = sharedCacheNode["file"];
+					if (fileCfg)
+					{
+						sharedCacheCfg.file = fileCfg.as<std::string>();
+					}
+				}
+
+				YAML::Node responseCacheNode = root["responseCache"];
+				if (responseCacheNode)
+				{
+					NcServerConfig::ResponseCacheConfig& responseCacheCfg = tmpConfig->responseCache;
+
+					YAML::Node sizeCfg = responseCacheNode["size"];
+					if (sizeCfg)
+					{
+						responseCacheCfg.size = sizeCfg.as<int>();
+					}
+
+					YAML::Node slotSizeCfg = responseCacheNode["slotSize"];
+					if (slotSizeCfg)
+					{
+						responseCacheCfg.slotSize = slotSizeCfg.as<int>();
+					}
+
+					YAML::Node routesCfg = responseCacheNode["routes"];
+					if (routesCfg)
+					{
+						responseCacheCfg.routes = routesCfg.as<std::map<std::string, int> >();
+					}
+
+					YAML::Node fileCfg = responseCacheNode["file"];
+					if (fileCfg)
+					{
+						responseCacheCfg.file = fileCfg.as<std::string>();
+					}
 				}
 
 				release(m_config);
@@ -288,14 +958,50 @@ namespace ncserver
 		signal(SIGTERM, handleExitSignalForNonWorker);
 
 #ifndef WIN32
+		// The shared listening socket is bound once by the boss, so that every
+		// generation of managers and workers inherits it and a reload never
+		// refuses connections. Listen options are therefore not reloadable.
+		loadConfigFile();
+		applyHousekeepingPlacement(m_config->placement);
+		const NcServerConfig::ListenConfig& listenCfg = m_config->listen;
+		if (!listenCfg.address.empty() && !(listenCfg.reusePort && fcgi_isTcpAddress(listenCfg.address)))
+		{
+			int listenSocket = fcgi_openListenSocket(listenCfg);
+			if (listenSocket < 0)
+			{
+				ASYNC_LOG_ERR("Failed to listen on %s: %s", listenCfg.address.c_str(), strerror(errno));
+				return LISTEN_ERROR;
+			}
+			fcgi_setListenSocket(listenSocket);
+		}
+
 		void* sharedMemory = NULL;
-		if ((sharedMemory = mmap(0, sizeof(bool), PROT_READ | PROT_WRITE, MAP_ANON | MAP_SHARED, -1, 0)) == MAP_FAILED)
+		if ((sharedMemory = mmap(0, sizeof(ReloadState), PROT_READ | PROT_WRITE, MAP_ANON | MAP_SHARED, -1, 0)) == MAP_FAILED)
 			return MEMORY_ERROR;
 
-		bool& managerFinishedForking = *(bool*)sharedMemory;
+		ReloadState& reloadState = *(ReloadState*)sharedMemory;
+		bool& managerFinishedForking = reloadState.managerFinishedForking;
+		reloadState.stagingManager = -1;
+		reloadState.workerQuota = -1;
+		reloadState.formerManager = -1;
+		reloadState.formerWorkerLimit = -1;
+		reloadState.formerWorkerCount = -1;
+		m_reloadState = &reloadState;
+
+		// A manager forked by another one for server.zygoteReload is an orphan
+		// once the former has exited, which the boss adopts this way.
+		prctl(PR_SET_CHILD_SUBREAPER, 1);
+
+		// Opened before fork(), so that no signal of the first manager is missed.
+		// SIGUSR2 is sent by a manager which has finished forking its workers.
+		SignalFd bossSignals;
+		bossSignals.open({ SIGINT, SIGTERM, SIGUSR1, SIGUSR2, SIGCHLD, SIGHUP });
+		pid_t boss = getpid();
+
 		pid_t manager = fork();
 		if (manager == 0)
 		{
+			bossSignals.close();
 			identity = Identity::Manager;
 			signal(SIGUSR1, SIG_DFL);
 		}
@@ -306,52 +1012,142 @@ namespace ncserver
 
 			while (!g_ncServerExit)
 			{
-				sleep(1);
-				enum ReloadStatus {
-					ReloadStatus_none = 0,
-					ReloadStatus_reloading = 1,
-					ReloadStatus_succ = 2,
-					ReloadStatus_failed = 3,
-				};
-				auto recordStatus = [](ReloadStatus status) {
-					FILE* file = fopen(".status", "r+");
-					if (file != NULL)
-						fprintf(file, "%d", status);
-					fclose(file);
+				_handleSignalOfSignalFd(bossSignals.wait(1000));
+
+				// the adopted ones included
+				pid_t child;
+				while ((child = waitpid(-1, NULL, WNOHANG)) > 0)
+				{
+					if (child == manager)
+					{
+						ASYNC_LOG_ERR("Manager %d has exited", (int)manager);
+						manager = -1;
+					}
+				}
+
+				// SIGHUP, e.g. from `ncserverctl reload_handler`, restarts the workers only
+				if (g_ncServerRestartWorkers)
+				{
+					g_ncServerRestartWorkers = false;
+					if (manager > 0)
+						kill(manager, SIGHUP);
+				}
+
+				enum ReloadStatus {
+					ReloadStatus_none = 0,
+					ReloadStatus_reloading = 1,
+					ReloadStatus_succ = 2,
+					ReloadStatus_failed = 3,
+				};
+				auto recordStatus = [&reloadState](ReloadStatus status) {
+					FILE* file = fopen(".status", "r+");
+					if (file == NULL)
+						return;
+					fprintf(file, "%d", status);
+					if (status != ReloadStatus_reloading && reloadState.memoryBudgetKb > 0)
+					{
+						fprintf(file, "\nreload_peak_memory_kb %lld\nreload_memory_budget_kb %lld\n",
+							reloadState.peakMemoryKb, reloadState.memoryBudgetKb);
+					}
+					fflush(file);
+					if (ftruncate(fileno(file), ftell(file)) != 0)
+						ASYNC_LOG_WARNING("Failed to truncate .status: %s", strerror(errno));
+					fclose(file);
 				};
 				if (g_ncServerReload)
 				{
 					managerFinishedForking = false;
+					reloadState.successorFailed = false;
 
 					recordStatus(ReloadStatus_reloading);
 
-					pid_t newManager = fork();
-					if (newManager == 0)
+					// only for the reload options, the rest is read by the new manager
+					loadConfigFile();
+
+					long long budgetKb = (long long)m_config->server.reloadMemoryBudget * 1024;
+					reloadState.memoryBudgetKb = budgetKb;
+					reloadState.peakMemoryKb = 0;
+					reloadState.stagingManager = -1;
+					reloadState.workerQuota = budgetKb > 0 ? 0 : -1;
+					reloadState.readyWorkers = 0;
+					reloadState.formerManager = budgetKb > 0 ? manager : -1;
+					reloadState.formerWorkerLimit = -1;
+					reloadState.formerWorkerCount = -1;
+					reloadState.formerLimitTimeMs = monotonicTimeMs();
+					reloadState.successor = -1;
+					// what a retired worker may take to exit, as _reapLater() gives it
+					long long drainMs = (long long)m_config->server.drainTimeout * 1000 + DRAIN_KILL_GRACE_MS + RESTART_INTERVAL_MS;
+
+					pid_t newManager = -1;
+					bool zygote = m_config->server.zygoteReload && manager > 0;
+					if (zygote)
 					{
-						identity = Identity::Manager;
-						signal(SIGUSR1, SIG_DFL);
-						break;
+						// The current manager forks the new one, which inherits its datasets.
+						reloadState.successorRequested = true;
+						kill(manager, SIGUSR1);
 					}
 					else
 					{
-						identity = Identity::Boss;
-						while (!managerFinishedForking)
+						newManager = fork();
+						if (newManager == 0)
 						{
-							if (waitpid(newManager, NULL, WNOHANG))
-								break;
-							sleep(1);
+							bossSignals.close();
+							identity = Identity::Manager;
+							signal(SIGUSR1, SIG_DFL);
+							break;
 						}
-						if (managerFinishedForking)
+					}
+
+					// woken up by SIGUSR2 when all the new workers are ready, or SIGCHLD if the new manager failed
+					while (!managerFinishedForking && !reloadState.successorFailed && !g_ncServerExit)
+					{
+						if (!zygote && (newManager < 0 || waitpid(newManager, NULL, WNOHANG)))
+							break;
+						if (zygote && waitpid(manager, NULL, WNOHANG))
 						{
-							kill(manager, SIGTERM);
-							waitpid(manager, NULL, 0);
-							manager = newManager;
-							recordStatus(ReloadStatus_succ);
+							manager = -1;
+							break;
 						}
-						else
+						if (budgetKb > 0)
+							_stageReload(reloadState, manager, drainMs);
+						_handleSignalOfSignalFd(bossSignals.wait(budgetKb > 0 ? 100 : 1000));
+						// the current manager, asked for a successor before it was ready itself
+						if (zygote && managerFinishedForking && reloadState.successor == manager)
+							managerFinishedForking = false;
+					}
+					reloadState.successorRequested = false;
+					if (zygote)
+						newManager = reloadState.successor;
+
+					reloadState.stagingManager = -1;
+					reloadState.workerQuota = -1;
+					reloadState.formerManager = -1;
+					reloadState.formerWorkerLimit = -1;
+					reloadState.formerWorkerCount = -1;
+					if (budgetKb > 0)
+						ASYNC_LOG_NOTICE("Reloaded with a peak of %lld KB in the budget of %lld KB", reloadState.peakMemoryKb, budgetKb);
+
+					identity = Identity::Boss;
+					if (managerFinishedForking && newManager > 0)
+					{
+						// the last step of a staged reload
+						if (manager > 0)
 						{
-							recordStatus(ReloadStatus_failed);
+							kill(manager, SIGTERM);
+							waitpid(manager, NULL, 0);
 						}
+						manager = newManager;
+						recordStatus(ReloadStatus_succ);
+					}
+					else
+					{
+						// the former workers retired for a staged reload come back
+						if (manager > 0)
+							kill(manager, SIGUSR2);
+						// stopped halfway, the new manager goes as well
+						if (g_ncServerExit && !zygote && newManager > 0)
+							kill(newManager, SIGTERM);
+						recordStatus(ReloadStatus_failed);
 					}
 					g_ncServerReload = false;
 				}
@@ -361,50 +1157,253 @@ namespace ncserver
 		if (identity == Identity::Boss)
 			return SUCCESS;
 
-		loadConfigFile();
+#ifndef WIN32
+		// A crashed worker is replaced as soon as its SIGCHLD arrives, and a
+		// worker sends SIGUSR2 when it is ready. SIGUSR1 comes from the boss,
+		// asking for a successor, and SIGHUP asking for the workers to be
+		// restarted. They are blocked before any code of the application runs,
+		// so that the threads it starts inherit the mask instead of taking them.
+		// The handler keeps SIGUSR2 from killing the manager if it gets through
+		// to a thread which unblocks it.
+		signal(SIGUSR2, handleWakeUpSignal);
+		m_signals->open({ SIGINT, SIGTERM, SIGCHLD, SIGUSR1, SIGUSR2, SIGHUP });
+#endif
 
-		if (!prepareProcess())
+		// A manager forked by the former one for server.zygoteReload runs the
+		// steps below again, on what that one has prepared. It keeps the
+		// signalfd of that one, which reads the signals of its own process.
+		bool inherited = false;
+		bool startOver;
+		do
 		{
-			return PREPAER_PROCESS_ERROR;
-		}
+			startOver = false;
+#ifndef WIN32
+			if (inherited)
+			{
+				// what belongs to the former generation
+				g_retiring.clear();
+				for (int i = 0; i < m_config->server.maxWorkerCount; i++)
+				{
+					if (m_listenSockets[i] >= 0)
+						close(m_listenSockets[i]);
+				}
+				closeStandbyChannels();
+				reset();
+			}
+#endif
 
-		if (!initUnforkableResources())
-		{
-			return INIT_UNFORKABLE_RESOURCES_ERROR;
-		}
+			loadConfigFile();
+#ifndef WIN32
+			// again, as a reload may have changed it
+			applyHousekeepingPlacement(m_config->placement);
+#endif
+#ifndef WIN32
+			if (inherited)
+				m_datasets->renew(m_config->server.maxWorkerCount, m_config->placement.replicateDatasets);
+			else
+				m_datasets->init(m_config->server.maxWorkerCount, m_config->placement.replicateDatasets);
+			const std::string snapshotFile = m_config->server.snapshotFile;
+			if (!snapshotFile.empty())
+				m_datasets->openSnapshot(snapshotFile.c_str());
+#endif
+			// The region of the former generation stays until prepareProcess() has
+			// built its data again, which it may copy from.
+			ImmutableRegion* formerRegion = nullptr;
+			if (inherited)
+			{
+				formerRegion = m_immutableRegion;
+				m_immutableRegion = new ImmutableRegion();
+			}
+			const NcServerConfig::ImmutableRegionConfig& regionCfg = m_config->immutableRegion;
+			if (regionCfg.size > 0)
+				m_immutableRegion->init((size_t)regionCfg.size << 20, regionCfg.hugePages, regionCfg.prefault, regionCfg.lock);
+			// Empty for each generation, whose data may give other results, unless
+			// mapped from a file, whose entries of the same data are kept.
+			const NcServerConfig::SharedCacheConfig& cacheCfg = m_config->sharedCache;
+			if (cacheCfg.size > 0)
+				m_sharedCache->init((size_t)cacheCfg.size << 20, (size_t)cacheCfg.slotSize, cacheCfg.file.empty() ? NULL : cacheCfg.file.c_str());
+			const NcServerConfig::ResponseCacheConfig& responseCfg = m_config->responseCache;
+			if (responseCfg.size > 0 && !responseCfg.routes.empty())
+			{
+				m_responseCache->init((size_t)responseCfg.size << 20, (size_t)responseCfg.slotSize, responseCfg.routes,
+					responseCfg.file.empty() ? NULL : responseCfg.file.c_str());
+			}
+
+			if (!prepareProcess())
+			{
+				return PREPAER_PROCESS_ERROR;
+			}
+			delete formerRegion;
+#ifndef WIN32
+			m_datasets->prune();
+			if (!snapshotFile.empty())
+			{
+				// for the next start, unless it would map the same datasets again
+				if (m_datasets->snapshotChanged())
+					m_datasets->saveSnapshot(snapshotFile.c_str());
+				m_datasets->closeSnapshot();
+			}
+			tagCacheVersions();
+#endif
 
-		fcgi_init(port);
+			if (!initUnforkableResources())
+			{
+				return INIT_UNFORKABLE_RESOURCES_ERROR;
+			}
+			m_immutableRegion->seal();
+
+			fcgi_init(port);
 
 #ifndef WIN32
-		if (forkChildren())
-		{
-			identity = Identity::Manager;
-			managerFinishedForking = true;
-			while (!g_ncServerExit)
+			if (!openListenSockets())
 			{
-				sleep(1);
-				if (checkChildrenStateAndRefork()) {
-					identity = Identity::Manager;
-				} else {
-					identity = Identity::Worker;
-					break;
-				}
+				return LISTEN_ERROR;
 			}
-			if (identity == Identity::Manager)
+
+			// the new manager of a reload within server.reloadMemoryBudget, whose
+			// workers are forked as the boss raises the quota
+			if (reloadState.workerQuota >= 0 && reloadState.stagingManager <= 0)
 			{
-				int workerCount = m_config->server.workerCount;
-				for (int i = 0; i < workerCount; i++)
+				reloadState.workerTarget = m_activeWorkerCount;
+				reloadState.readyWorkers = 0;
+				reloadState.stagingManager = getpid();
+			}
+
+			// before the workers show in .workers, and again once they serve
+			recordDatasets();
+			if (forkChildren())
+			{
+				identity = Identity::Manager;
+				bool reportedReady = false;
+				pid_t successor = -1;
+
+				int ticks = 0;
+				long long nextTick = monotonicTimeMs() + 1000;
+				while (!g_ncServerExit)
+				{
+					long long now = monotonicTimeMs();
+					_handleSignalOfSignalFd(m_signals->wait(nextTick > now ? (int)(nextTick - now) : 0));
+					if (g_ncServerExit)
+						break;
+
+					if (g_ncServerRestartWorkers)
+					{
+						g_ncServerRestartWorkers = false;
+						ASYNC_LOG_NOTICE("Restarting the workers");
+						reforkAllChildren();
+					}
+
+					now = monotonicTimeMs();
+					if (now >= nextTick)
+					{
+						nextTick = now + 1000;
+						// the former generation leaves the file to the one which serves
+						pid_t serving = reloadState.successor;
+						if (++ticks % DATASET_RECORD_INTERVAL == 0 && (serving <= 0 || serving == getpid()))
+							recordDatasets();
+						scaleWorkers();
+					}
+					_reapRetired();
+					stageWorkers();
+					if (checkChildrenStateAndRefork()) {
+						identity = Identity::Manager;
+					} else {
+						identity = Identity::Worker;
+						break;
+					}
+
+					// The boss stops the former generation only when this one serves in full,
+					// unless a successor has been forked already.
+					if (!reportedReady && allWorkersReady())
+					{
+						reportedReady = true;
+						if (successor <= 0)
+						{
+							reloadState.successor = getpid();
+							recordDatasets();
+							managerFinishedForking = true;
+							if (getppid() == boss || inherited)
+								kill(boss, SIGUSR2);
+						}
+					}
+
+					// The successor of server.zygoteReload starts over with everything prepared so far.
+					if (g_ncServerReload)
+					{
+						g_ncServerReload = false;
+						if (reloadState.successorRequested && successor <= 0)
+						{
+							reloadState.successorRequested = false;
+							// The successor has only the thread which forks it. The
+							// others, e.g. those of initUnforkableResources(), are
+							// stopped first, so that it inherits none of their locks.
+							if (!cleanupUnforkableResources())
+							{
+								ASYNC_LOG_ERR("Failed to clean up the unforkable resources before forking the successor");
+							}
+							else
+							{
+								successor = fork();
+								if (successor == 0)
+								{
+									inherited = true;
+									startOver = true;
+									break;
+								}
+							}
+							if (!initUnforkableResources())
+								ASYNC_LOG_ERR("Failed to init the unforkable resources again after forking the successor");
+							if (successor < 0)
+							{
+								reloadState.successorFailed = true;
+								kill(boss, SIGUSR2);
+							}
+						}
+					}
+					if (successor > 0 && _hasExited(successor))
+					{
+						if (!managerFinishedForking)
+						{
+							reloadState.successorFailed = true;
+							kill(boss, SIGUSR2);
+						}
+						successor = -1;
+					}
+				}
+				if (identity == Identity::Manager && !startOver)
 				{
-					kill(m_children[i], SIGTERM);
-					waitpid(m_children[i], NULL, 0);
+					std::vector<pid_t> workers;
+					int workerCount = m_config->server.maxWorkerCount;
+					for (int i = 0; i < workerCount; i++)
+					{
+						if (m_children[i] > 0)
+							workers.push_back(m_children[i]);
+						if (m_predecessors[i] > 0)
+							workers.push_back(m_predecessors[i]);
+					}
+					for (int i = 0; i < m_config->server.standbyWorkerCount; i++)
+					{
+						if (m_standbys[i] > 0)
+							workers.push_back(m_standbys[i]);
+					}
+					for (pid_t worker : workers)
+						kill(worker, SIGTERM);
+					// those retired before are still given their time
+					for (size_t i = 0; i < g_retiring.size(); i++)
+						workers.push_back(g_retiring[i].first);
+					g_retiring.clear();
+					_waitOrKill(workers, (long long)m_config->server.drainTimeout * 1000 + DRAIN_KILL_GRACE_MS);
+					// unless the file is already that of the next generation
+					if (reloadState.successor == getpid())
+						recordDatasets();
 				}
 			}
-		}
-		else
-		{
-			identity = Identity::Worker;
-		}
+			else
+			{
+				identity = Identity::Worker;
+			}
 #endif
+		} while (startOver);
 
 		if (identity == Identity::Worker)
 		{
@@ -439,39 +1438,283 @@ namespace ncserver
 	{
 		signal(SIGINT, handleExitSignalForWorker);
 		signal(SIGTERM, handleExitSignalForWorker);
+
+		// threads don't survive fork(), so each worker creates its own pool
+		m_taskPool = new TaskPool(m_config->server.taskThreadCount);
+
 		if (!startService())
 		{
+			delete m_taskPool;
+			m_taskPool = nullptr;
 			return START_SERVICE_ERROR;
 		}
 
-		Request request;
-		ServiceIo* io = new FCgiServiceIo(FCGI_stdout);
+		// before a standby waits, so that it is ready to serve at once
+		if (!m_config->server.handlerModule.empty() && !startHandlerModule())
+		{
+			stopService();
+			delete m_taskPool;
+			m_taskPool = nullptr;
+			return START_SERVICE_ERROR;
+		}
+
+#ifndef WIN32
+		if (m_standbyIndex >= 0 && !waitForPromotion())
+		{
+			stopHandlerModule();
+			bool stopped = stopService();
+			delete m_taskPool;
+			m_taskPool = nullptr;
+			return stopped ? SUCCESS : STOP_SERVICE_ERROR;
+		}
+#endif
 
-		while (!g_ncServerExit && FCGI_Accept() >= 0)
+		FCGX_Init();
+
+		// The extra threads share everything loaded before fork() in the same
+		// address space. The calling thread serves as well.
+		int threadCount = m_config->server.threadCount;
+		std::vector<std::thread> threads;
+		std::vector<std::atomic<bool>*> threadFinished;
+		for (int i = 1; i < threadCount; i++)
 		{
-			const char* qs = FCGI_getenv("QUERY_STRING");
+			std::atomic<bool>* finished = new std::atomic<bool>(false);
+			threadFinished.push_back(finished);
+			threads.push_back(std::thread([this, finished]() {
+				serveLoop();
+				*finished = true;
+			}));
+		}
 
-			if (strlen(qs) >= URL_MAX_LENGTH)
+#ifndef WIN32
+		reportReady();
+#endif
+		serveLoop();
+
+		// A thread blocked in accept() is only woken up by a signal delivered to
+		// itself, whose handler is installed without SA_RESTART. One which is
+		// still busy after server.drainTimeout, e.g. with a query which never
+		// finishes, isn't waited for forever.
+		long long deadline = monotonicTimeMs() + (long long)m_config->server.drainTimeout * 1000;
+		size_t abandoned = 0;
+		for (size_t i = 0; i < threads.size(); i++)
+		{
+#ifndef WIN32
+			while (!*threadFinished[i] && monotonicTimeMs() < deadline)
 			{
-				io->addHeaderField("Status: 414 Request-URI Too Long");
-				io->endHeaderField();
+				pthread_kill(threads[i].native_handle(), SIGTERM);
+				usleep(10 * 1000);
+			}
+			if (!*threadFinished[i])
+			{
+				// its flag is still written by it
+				threads[i].detach();
+				abandoned++;
 				continue;
 			}
+#endif
+			threads[i].join();
+			delete threadFinished[i];
+		}
+#ifndef WIN32
+		if (abandoned > 0)
+		{
+			// The service and the globals the destructors would tear down may
+			// still be in use by them, so the worker exits on the spot.
+			ASYNC_LOG_ERR("%zu serving threads haven't finished in %d seconds, exiting without stopping the service",
+				abandoned, m_config->server.drainTimeout);
+			_exit(STOP_SERVICE_ERROR);
+		}
+#endif
+
+		stopHandlerModule();
+		bool stopped = stopService();
+		delete m_taskPool;
+		m_taskPool = nullptr;
+		if (!stopped)
+		{
+			return STOP_SERVICE_ERROR;
+		}
+		return (g_ncServerExit) ? SUCCESS : FCGI_ERROR;
+	}
+
+	/**
+		Query of the fcgi engine, which finishes one request before it accepts the next.
+	 */
+	class BlockingQuery : public AsyncQuery
+	{
+	public:
+		BlockingQuery(ServiceIo* io, Request* request, AsyncLoop* loop)
+		{
+			m_io = io;
+			m_request = request;
+			m_loop = loop;
+			m_finished = true;
+		}
 
-			request.setQueryString(qs);
+		virtual ~BlockingQuery() {}
 
-			query(io, &request);
+		void start() { m_finished = false; }
+		bool isFinished() { return m_finished; }
 
-			io->flush();
-			FCGI_Finish();
+		virtual ServiceIo* io() { return m_io; }
+		virtual Request* request() { return m_request; }
+		virtual AsyncLoop* loop() { return m_loop; }
+
+		virtual void finish()
+		{
+			m_io->flush();
+			m_finished = true;
 		}
-		delete io;
 
-		if (!stopService())
+		virtual bool isCancelled() { return false; }
+
+	private:
+		ServiceIo* m_io;
+		Request* m_request;
+		AsyncLoop* m_loop;
+		bool m_finished;
+	};
+
+	void NcServer::serveLoop()
+	{
+#ifndef WIN32
+		if (m_config->server.engine == NcServerConfig::Engine_epoll || m_config->server.engine == NcServerConfig::Engine_http)
 		{
-			return STOP_SERVICE_ERROR;
+			EventServer::RequestHandler handler = [this](AsyncQuery* query) {
+				handleRequest(query);
+			};
+#ifdef NC_HAS_IO_URING
+			if (m_config->server.ioUring)
+			{
+				UringServer server(fcgi_listenSocket(), m_config->server, handler);
+				if (server.init())
+				{
+					server.run(g_ncServerExit);
+					return;
+				}
+				ASYNC_LOG_WARNING("io_uring is not supported by the kernel, fall back to epoll");
+			}
+#endif
+			EventServer server(fcgi_listenSocket(), m_config->server, handler);
+			server.run(g_ncServerExit);
+			return;
 		}
-		return (g_ncServerExit) ? SUCCESS : FCGI_ERROR;
+#endif
+
+		FCGX_Request fcgiRequest;
+		FCGX_InitRequest(&fcgiRequest, fcgi_listenSocket(), 0);
+
+		Request request;
+		FCgiServiceIo io(&fcgiRequest);
+#ifndef WIN32
+		AsyncLoop loop;
+		BlockingQuery query(&io, &request, &loop);
+#else
+		BlockingQuery query(&io, &request, NULL);
+#endif
+
+		while (!g_ncServerExit && FCGX_Accept_r(&fcgiRequest) >= 0)
+		{
+			request.setEnvironment(fcgiRequest.envp);
+			query.start();
+			handleRequest(&query);
+#ifndef WIN32
+			// the connection is served by this thread alone, nothing else to do meanwhile
+			while (!query.isFinished())
+				loop.runOnce(1000);
+#endif
+			FCGX_Finish_r(&fcgiRequest);
+		}
+		request.setEnvironment(NULL);
+		FCGX_Finish_r(&fcgiRequest);
+	}
+
+	void NcServer::handleRequest(AsyncQuery* query)
+	{
+		ServiceIo* io = query->io();
+		Request* request = query->request();
+		const char* qs = request->headerForName("QUERY_STRING");
+
+		if (qs == NULL)
+			qs = "";
+
+		if (strlen(qs) >= URL_MAX_LENGTH)
+		{
+			io->addHeaderField("Status: 414 Request-URI Too Long");
+			io->endHeaderField();
+			query->finish();
+			return;
+		}
+
+		request->setQueryString(qs);
+
+		int ttl = m_responseCache->isEnabled() ? m_responseCache->ttlForUri(request->documentUri()) : 0;
+		if (ttl > 0 && request->isGet())
+		{
+			long long startUs = monotonicTimeUs();
+			std::string key = ResponseCache::keyOf(request);
+			if (m_responseCache->replay(key, io))
+			{
+				query->finish();
+				m_responseCache->recordHit(monotonicTimeUs() - startUs);
+				return;
+			}
+			// stores the response once query() has finished it
+			query = new CachingQuery(query, m_responseCache, key, ttl, startUs);
+		}
+
+		if (m_handlerModule != nullptr)
+		{
+			m_handlerModule->query(query->io(), request);
+			query->finish();
+			return;
+		}
+		queryAsync(query);
+	}
+
+	bool NcServer::startHandlerModule()
+	{
+		const char* path = m_config->server.handlerModule.c_str();
+		m_handlerLibrary = new HandlerLibrary();
+		m_handlerModule = m_handlerLibrary->open(path);
+		if (m_handlerModule == nullptr)
+		{
+			ASYNC_LOG_ERR("Failed to load handler module %s: %s", path, m_handlerLibrary->error().c_str());
+			stopHandlerModule();
+			return false;
+		}
+
+		if (!m_handlerModule->start(this))
+		{
+			ASYNC_LOG_ERR("Handler module %s failed to start", path);
+			delete m_handlerModule;
+			m_handlerModule = nullptr;
+			stopHandlerModule();
+			return false;
+		}
+
+		ASYNC_LOG_NOTICE("Handler module %s %s is loaded", path, m_handlerModule->version());
+		return true;
+	}
+
+	void NcServer::stopHandlerModule()
+	{
+		// the module is deleted before its code is unloaded
+		if (m_handlerModule != nullptr)
+		{
+			m_handlerModule->stop();
+			delete m_handlerModule;
+			m_handlerModule = nullptr;
+		}
+		delete m_handlerLibrary;
+		m_handlerLibrary = nullptr;
+	}
+
+	void NcServer::queryAsync(AsyncQuery* query)
+	{
+		this->query(query->io(), query->request());
+		query->finish();
 	}
 
 	void NcServer::exit()
@@ -485,31 +1728,73 @@ namespace ncserver
 		if (m_children == nullptr)
 			return;
 
-		int workerCount = m_config->server.workerCount;
+		int workerCount = m_activeWorkerCount;
 		for (int i = 0; i < workerCount; i++)
 		{
 			pthread_mutex_lock(&m_mutex);
 			m_childrenStates[i] = CHILDSTATE_WAIT_FOR_RELOAD;
 			pthread_mutex_unlock(&m_mutex);
 		}
+
+		// started again once the restart is over
+		for (int i = 0; i < m_config->server.standbyWorkerCount; i++)
+		{
+			pid_t pid = m_standbys[i];
+			if (pid > 0)
+				kill(pid, SIGTERM);
+		}
 #endif
 	}
 
 #ifndef WIN32
+	bool NcServer::openListenSockets()
+	{
+		const NcServerConfig::ListenConfig& listenCfg = m_config->listen;
+		if (!listenCfg.reusePort || listenCfg.address.empty())
+			return true;
+
+		// SO_REUSEPORT only balances TCP. Workers of a Unix socket share one
+		// and rely on EPOLLEXCLUSIVE of the epoll engine instead.
+		if (!fcgi_isTcpAddress(listenCfg.address))
+		{
+			ASYNC_LOG_WARNING("reusePort is ignored by Unix socket %s", listenCfg.address.c_str());
+			return true;
+		}
+
+		// Opened by the manager rather than the workers, so that connections
+		// queued on the socket of a crashed worker wait for its replacement.
+		int workerCount = m_activeWorkerCount;
+		for (int i = 0; i < workerCount; i++)
+		{
+			m_listenSockets[i] = fcgi_openListenSocket(listenCfg);
+			if (m_listenSockets[i] < 0)
+			{
+				ASYNC_LOG_ERR("Failed to listen on %s: %s", listenCfg.address.c_str(), strerror(errno));
+				return false;
+			}
+		}
+		return true;
+	}
+
 	bool NcServer::forkOne(int index)
 	{
+		pid_t manager = getpid();
 		pid_t pid = fork();
 		if (pid == 0)			// child
 		{
+			m_signals->close();
+			m_manager = manager;
+			becomeWorker(index);
 			return false;
 		}
 		else					// parent
 		{
 			pthread_mutex_lock(&m_mutex);
+			m_forkTimes[index] = monotonicTimeMs();
 			if (pid > 0)		// fork succeed
 			{
 				m_children[index] = pid;
-				m_childrenStates[index] = CHILDSTATE_LIVING;
+				m_childrenStates[index] = CHILDSTATE_STARTING;
 			}
 			else				// fork fails
 			{
@@ -521,63 +1806,656 @@ namespace ncserver
 		return true;
 	}
 
+	void NcServer::becomeWorker(int index)
+	{
+		m_workerIndex = index;
+		closeStandbyChannels();
+		if (m_listenSockets[index] >= 0)
+		{
+			int workerCount = m_config->server.maxWorkerCount;
+			for (int i = 0; i < workerCount; i++)
+			{
+				if (i != index && m_listenSockets[i] >= 0)
+					close(m_listenSockets[i]);
+			}
+			fcgi_setListenSocket(m_listenSockets[index]);
+		}
+
+		// before the worker allocates anything, so that its memory is local
+		WorkerPlacement placement = placementOfWorker(m_config->placement, index);
+		applyWorkerPlacement(placement);
+		m_datasets->bindWorker(index, placement.nodes.size() == 1 ? placement.nodes[0] : -1);
+		ASYNC_LOG_INFO("Worker %d is placed on %s", index, placement.description().c_str());
+	}
+
+	bool NcServer::forkStandby(int index)
+	{
+		// over which it is handed the listen socket of its slot
+		int channel[2];
+		if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, channel) != 0)
+		{
+			ASYNC_LOG_ERR("Failed to create the channel of standby worker %d: %s", index, strerror(errno));
+			m_standbys[index] = -1;
+			m_standbyForkTimes[index] = monotonicTimeMs();
+			return true;
+		}
+
+		pid_t manager = getpid();
+		pid_t pid = fork();
+		if (pid == 0)			// child
+		{
+			// Placed and given a listen socket only when it takes a slot. Until
+			// then it keeps none of the slots in their SO_REUSEPORT group.
+			m_signals->close();
+			m_manager = manager;
+			m_standbyIndex = index;
+			close(channel[0]);
+			closeStandbyChannels();
+			for (int i = 0; i < m_config->server.maxWorkerCount; i++)
+			{
+				if (m_listenSockets[i] >= 0)
+				{
+					close(m_listenSockets[i]);
+					m_listenSockets[i] = -1;
+				}
+			}
+			m_standbyChannel = channel[1];
+			return false;
+		}
+
+		close(channel[1]);
+		if (m_standbyChannels[index] >= 0)
+			close(m_standbyChannels[index]);
+		m_standbyChannels[index] = channel[0];
+		if (pid < 0)
+		{
+			close(channel[0]);
+			m_standbyChannels[index] = -1;
+		}
+		m_standbys[index] = pid > 0 ? pid : -1;
+		m_standbyForkTimes[index] = monotonicTimeMs();
+		return true;
+	}
+
+	void NcServer::closeStandbyChannels()
+	{
+		if (m_standbyChannels == nullptr)
+			return;
+
+		for (int i = 0; i < m_config->server.standbyWorkerCount; i++)
+		{
+			if (m_standbyChannels[i] >= 0)
+			{
+				close(m_standbyChannels[i]);
+				m_standbyChannels[i] = -1;
+			}
+		}
+	}
+
+	bool NcServer::promoteStandby(int index)
+	{
+		int standbyCount = m_config->server.standbyWorkerCount;
+		int firstSlot = m_config->server.maxWorkerCount;
+		for (int i = 0; i < standbyCount; i++)
+		{
+			pid_t pid = m_standbys[i];
+			if (!m_scoreboard->isReady(firstSlot + i, pid) || _hasExited(pid))
+				continue;
+
+			// before the slot, so that the socket is there once the standby sees it
+			bool sent = _sendListenSocket(m_standbyChannels[i], m_listenSockets[index]);
+			close(m_standbyChannels[i]);
+			m_standbyChannels[i] = -1;
+			if (!sent)
+			{
+				ASYNC_LOG_ERR("Failed to hand slot %d to standby worker %d: %s", index, (int)pid, strerror(errno));
+				kill(pid, SIGTERM);
+				continue;
+			}
+
+			m_scoreboard->assign(firstSlot + i, index);
+			m_standbys[i] = -1;
+			pthread_mutex_lock(&m_mutex);
+			m_children[index] = pid;
+			m_childrenStates[index] = CHILDSTATE_STARTING;
+			m_forkTimes[index] = monotonicTimeMs();
+			pthread_mutex_unlock(&m_mutex);
+			kill(pid, SIGUSR2);
+			ASYNC_LOG_INFO("Standby worker %d takes slot %d", (int)pid, index);
+			return true;
+		}
+		return false;
+	}
+
+	bool NcServer::waitForPromotion()
+	{
+		int standbySlot = m_config->server.maxWorkerCount + m_standbyIndex;
+
+		// SIGUSR2 is let through only while waiting, so that it isn't lost in between
+		sigset_t wakeUp, waiting;
+		sigemptyset(&wakeUp);
+		sigaddset(&wakeUp, SIGUSR2);
+		pthread_sigmask(SIG_BLOCK, &wakeUp, &waiting);
+		sigset_t original = waiting;
+		sigdelset(&waiting, SIGUSR2);
+
+		m_scoreboard->setReady(standbySlot, getpid());
+		if (getppid() == m_manager)
+			kill(m_manager, SIGUSR2);
+
+		int slot = -1;
+		while (!g_ncServerExit && getppid() == m_manager && (slot = m_scoreboard->assignedSlot(standbySlot)) < 0)
+		{
+			struct timespec timeout = { 1, 0 };
+			ppoll(NULL, 0, &timeout, &waiting);
+		}
+		pthread_sigmask(SIG_SETMASK, &original, NULL);
+		if (slot < 0)
+			return false;
+
+		int listenSocket;
+		bool received = _receiveListenSocket(m_standbyChannel, &listenSocket);
+		close(m_standbyChannel);
+		m_standbyChannel = -1;
+		if (!received)
+		{
+			ASYNC_LOG_ERR("Standby worker %d got no listen socket for slot %d", (int)getpid(), slot);
+			return false;
+		}
+
+		m_standbyIndex = -1;
+		m_listenSockets[slot] = listenSocket;
+		becomeWorker(slot);
+		return true;
+	}
+
+	int NcServer::readyStandbyCount()
+	{
+		int count = 0;
+		int firstSlot = m_config->server.maxWorkerCount;
+		for (int i = 0; i < m_config->server.standbyWorkerCount; i++)
+		{
+			if (m_scoreboard->isReady(firstSlot + i, m_standbys[i]))
+				count++;
+		}
+		return count;
+	}
+
 	bool NcServer::forkChildren()
 	{
-		int workerCount = m_config->server.workerCount;
+		int workerCount = workerQuota();
 		for (int i = 0; i < workerCount; i++)
 		{
 			if (!forkOne(i))
 				return false;
 		}
+		recordWorkers();
 		return true;
 	}
 
+	void NcServer::recordWorkers()
+	{
+		// written aside and renamed, so that a reader never sees half of it
+		FILE* file = fopen(".workers.tmp", "w");
+		if (file == NULL)
+			return;
+
+		fprintf(file, "# index pid placement\n");
+		int workerCount = m_activeWorkerCount;
+		for (int i = 0; i < workerCount; i++)
+		{
+			pthread_mutex_lock(&m_mutex);
+			pid_t pid = m_children[i];
+			pthread_mutex_unlock(&m_mutex);
+			WorkerPlacement placement = placementOfWorker(m_config->placement, i);
+			fprintf(file, "%d %d %s\n", i, (int)pid, placement.description().c_str());
+		}
+		for (int i = 0; i < m_config->server.standbyWorkerCount; i++)
+		{
+			if (m_standbys[i] > 0)
+				fprintf(file, "s%d %d standby\n", i, (int)m_standbys[i]);
+		}
+		fclose(file);
+		rename(".workers.tmp", ".workers");
+	}
+
+	static std::string _formatNodes(const std::vector<int>& nodes)
+	{
+		std::string text;
+		for (size_t i = 0; i < nodes.size(); i++)
+		{
+			if (i > 0)
+				text += ',';
+			text += nodes[i] < 0 ? std::string("?") : std::to_string(nodes[i]);
+		}
+		return text;
+	}
+
+	int NcServer::listenQueueLength()
+	{
+		int length = -1;
+		for (int i = 0; i < m_activeWorkerCount; i++)
+		{
+			int queued = m_listenSockets[i] >= 0 ? acceptQueueLength(m_listenSockets[i]) : -1;
+			if (queued >= 0)
+				length = (length < 0 ? 0 : length) + queued;
+		}
+		return length >= 0 ? length : acceptQueueLength(fcgi_listenSocket());
+	}
+
+	void NcServer::scaleWorkers()
+	{
+		std::vector<pid_t> workers;
+		pthread_mutex_lock(&m_mutex);
+		for (int i = 0; i < m_activeWorkerCount; i++)
+		{
+			if (m_children[i] > 0)
+				workers.push_back(m_children[i]);
+		}
+		pthread_mutex_unlock(&m_mutex);
+
+		m_scaler->sample(workers, listenQueueLength());
+		// the boss decides on the workers during a staged reload
+		if (m_unstagedWorkerCount >= 0 || workerQuota() < m_activeWorkerCount)
+		{
+			recordMetrics();
+			return;
+		}
+
+		int target = m_scaler->decide(m_activeWorkerCount);
+		if (target != m_activeWorkerCount)
+		{
+			ASYNC_LOG_NOTICE("Scaling workers from %d to %d: busy ratio %.2f, accept queue %d",
+				m_activeWorkerCount, target, m_scaler->busyRatio(), m_scaler->queueLength());
+		}
+		resizeWorkers(target);
+		recordMetrics();
+	}
+
+	void NcServer::resizeWorkers(int target)
+	{
+		// Slot 0 is always in use, and has a socket of its own if they all do.
+		bool reusePort = m_listenSockets[0] >= 0;
+		for (int i = m_activeWorkerCount; i < target; i++)
+		{
+			if (reusePort)
+			{
+				m_listenSockets[i] = fcgi_openListenSocket(m_config->listen);
+				if (m_listenSockets[i] < 0)
+				{
+					ASYNC_LOG_ERR("Failed to listen on %s: %s", m_config->listen.address.c_str(), strerror(errno));
+					target = i;
+					break;
+				}
+			}
+			// forked by checkChildrenStateAndRefork()
+			pthread_mutex_lock(&m_mutex);
+			m_childrenStates[i] = CHILDSTATE_INVALID;
+			pthread_mutex_unlock(&m_mutex);
+		}
+
+		std::vector<pid_t> retired;
+		for (int i = target; i < m_activeWorkerCount; i++)
+		{
+			pthread_mutex_lock(&m_mutex);
+			pid_t pid = m_children[i];
+			pid_t predecessor = m_predecessors[i];
+			m_children[i] = -1;
+			m_predecessors[i] = -1;
+			m_childrenStates[i] = CHILDSTATE_INVALID;
+			pthread_mutex_unlock(&m_mutex);
+
+			// The worker keeps accepting from its copy until it exits.
+			if (m_listenSockets[i] >= 0)
+			{
+				close(m_listenSockets[i]);
+				m_listenSockets[i] = -1;
+			}
+			if (pid > 0)
+			{
+				kill(pid, SIGTERM);
+				retired.push_back(pid);
+			}
+			if (predecessor > 0)
+			{
+				kill(predecessor, SIGTERM);
+				retired.push_back(predecessor);
+			}
+		}
+
+		bool shrunk = target < m_activeWorkerCount;
+		m_activeWorkerCount = target;
+		if (shrunk)
+		{
+			_reapLater(retired, (long long)m_config->server.drainTimeout * 1000 + DRAIN_KILL_GRACE_MS);
+			recordWorkers();
+		}
+	}
+
+	void NcServer::stageWorkers()
+	{
+		ReloadState& state = *m_reloadState;
+		pid_t self = getpid();
+		if (state.formerManager == self && state.formerWorkerLimit >= 0)
+		{
+			if (state.formerWorkerLimit < m_activeWorkerCount)
+			{
+				if (m_unstagedWorkerCount < 0)
+					m_unstagedWorkerCount = m_activeWorkerCount;
+				ASYNC_LOG_INFO("Retiring workers from %d to %d for the reload", m_activeWorkerCount, state.formerWorkerLimit);
+				resizeWorkers(state.formerWorkerLimit);
+				recordMetrics();
+			}
+		}
+		else if (m_unstagedWorkerCount >= 0 && state.formerManager != self)
+		{
+			// the reload has failed, the retired workers come back
+			ASYNC_LOG_INFO("Restoring workers from %d to %d", m_activeWorkerCount, m_unstagedWorkerCount);
+			resizeWorkers(m_unstagedWorkerCount);
+			m_unstagedWorkerCount = -1;
+			recordMetrics();
+		}
+
+		// its standby workers left out, which never take a slot during a reload
+		if (state.formerManager == self)
+			state.formerWorkerCount = m_activeWorkerCount + (int)g_retiring.size();
+
+		if (state.stagingManager == self)
+		{
+			int ready = 0;
+			for (int i = 0; i < m_activeWorkerCount; i++)
+			{
+				if (m_childrenStates[i] == CHILDSTATE_LIVING)
+					ready++;
+			}
+			state.readyWorkers = ready;
+		}
+	}
+
+	int NcServer::workerQuota()
+	{
+		const ReloadState& state = *m_reloadState;
+		if (state.stagingManager == getpid() && state.workerQuota >= 0)
+			return std::min(state.workerQuota, m_activeWorkerCount);
+		return m_activeWorkerCount;
+	}
+
+	void NcServer::recordMetrics()
+	{
+		FILE* file = fopen(".metrics.tmp", "w");
+		if (file == NULL)
+			return;
+
+		const NcServerConfig::ServerConfig& serverCfg = m_config->server;
+		// the text format of Prometheus, e.g. for the textfile collector of node_exporter
+		fprintf(file, "# TYPE ncserver_workers gauge\nncserver_workers %d\n", m_activeWorkerCount);
+		// less than ncserver_workers while a worker starts without a predecessor serving in its place
+		fprintf(file, "# TYPE ncserver_workers_serving gauge\nncserver_workers_serving %d\n", servingWorkerCount());
+		fprintf(file, "# TYPE ncserver_workers_restarting gauge\nncserver_workers_restarting %d\n", restartingWorkerCount());
+		fprintf(file, "# TYPE ncserver_workers_standby gauge\nncserver_workers_standby %d\n", readyStandbyCount());
+		fprintf(file, "# TYPE ncserver_workers_min gauge\nncserver_workers_min %d\n", serverCfg.minWorkerCount);
+		fprintf(file, "# TYPE ncserver_workers_max gauge\nncserver_workers_max %d\n", serverCfg.maxWorkerCount);
+		fprintf(file, "# TYPE ncserver_busy_ratio gauge\nncserver_busy_ratio %.3f\n", m_scaler->busyRatio());
+		fprintf(file, "# TYPE ncserver_accept_queue_length gauge\nncserver_accept_queue_length %d\n", m_scaler->queueLength());
+		fprintf(file, "# TYPE ncserver_worker_scale_ups_total counter\nncserver_worker_scale_ups_total %d\n", m_scaler->scaleUpCount());
+		fprintf(file, "# TYPE ncserver_worker_scale_downs_total counter\nncserver_worker_scale_downs_total %d\n", m_scaler->scaleDownCount());
+		if (m_reloadState->memoryBudgetKb > 0)
+		{
+			// of the last reload, both generations together
+			fprintf(file, "# TYPE ncserver_reload_memory_budget_bytes gauge\nncserver_reload_memory_budget_bytes %lld\n", m_reloadState->memoryBudgetKb * 1024);
+			fprintf(file, "# TYPE ncserver_reload_peak_memory_bytes gauge\nncserver_reload_peak_memory_bytes %lld\n", m_reloadState->peakMemoryKb * 1024);
+		}
+		if (m_sharedCache->slotCount() > 0)
+		{
+			// of all the workers together
+			SharedCacheStats cache = m_sharedCache->stats();
+			long long lookups = cache.hits + cache.misses;
+			fprintf(file, "# TYPE ncserver_shared_cache_hits_total counter\nncserver_shared_cache_hits_total %lld\n", cache.hits);
+			fprintf(file, "# TYPE ncserver_shared_cache_misses_total counter\nncserver_shared_cache_misses_total %lld\n", cache.misses);
+			fprintf(file, "# TYPE ncserver_shared_cache_hit_ratio gauge\nncserver_shared_cache_hit_ratio %.3f\n", lookups > 0 ? (double)cache.hits / lookups : 0.0);
+			fprintf(file, "# TYPE ncserver_shared_cache_insertions_total counter\nncserver_shared_cache_insertions_total %lld\n", cache.insertions);
+			fprintf(file, "# TYPE ncserver_shared_cache_evictions_total counter\nncserver_shared_cache_evictions_total %lld\n", cache.evictions);
+			fprintf(file, "# TYPE ncserver_shared_cache_contentions_total counter\nncserver_shared_cache_contentions_total %lld\n", cache.contentions);
+			fprintf(file, "# TYPE ncserver_shared_cache_invalidations_total counter\nncserver_shared_cache_invalidations_total %lld\n", cache.invalidations);
+			fprintf(file, "# TYPE ncserver_shared_cache_entries gauge\nncserver_shared_cache_entries %lld\n", cache.entries);
+			fprintf(file, "# TYPE ncserver_shared_cache_slots gauge\nncserver_shared_cache_slots %lld\n", cache.slots);
+		}
+		if (m_responseCache->isEnabled())
+		{
+			// latency from the start of a request to its finish(), hits and misses apart
+			ResponseCacheStats responses = m_responseCache->stats();
+			fprintf(file, "# TYPE ncserver_response_cache_hit_seconds summary\nncserver_response_cache_hit_seconds_sum %.6f\nncserver_response_cache_hit_seconds_count %lld\n",
+				responses.hitMicros / 1e6, responses.hits);
+			fprintf(file, "# TYPE ncserver_response_cache_miss_seconds summary\nncserver_response_cache_miss_seconds_sum %.6f\nncserver_response_cache_miss_seconds_count %lld\n",
+				responses.missMicros / 1e6, responses.misses);
+			fprintf(file, "# TYPE ncserver_response_cache_stores_total counter\nncserver_response_cache_stores_total %lld\n", responses.stores);
+			fprintf(file, "# TYPE ncserver_response_cache_evictions_total counter\nncserver_response_cache_evictions_total %lld\n", responses.evictions);
+			fprintf(file, "# TYPE ncserver_response_cache_entries gauge\nncserver_response_cache_entries %lld\n", responses.entries);
+		}
+		fclose(file);
+		rename(".metrics.tmp", ".metrics");
+	}
+
+	void NcServer::recordDatasets()
+	{
+		std::vector<DatasetStats> stats = m_datasets->stats();
+		if (stats.empty())
+			return;
+
+		FILE* file = fopen(".datasets.tmp", "w");
+		if (file == NULL)
+			return;
+
+		fprintf(file, "# name bytes nodes lookups remoteLookups version inherited\n");
+		for (size_t i = 0; i < stats.size(); i++)
+		{
+			fprintf(file, "%s %zu %s %lld %lld %s %d\n", stats[i].name.c_str(), stats[i].size,
+				_formatNodes(stats[i].nodes).c_str(), stats[i].lookups, stats[i].remoteLookups,
+				stats[i].version.empty() ? "-" : stats[i].version.c_str(), stats[i].inherited ? 1 : 0);
+		}
+		fclose(file);
+		rename(".datasets.tmp", ".datasets");
+	}
+
+	void NcServer::tagCacheVersions()
+	{
+		std::vector<DatasetStats> stats = m_datasets->stats();
+		std::vector<std::string> versions;
+		bool allVersioned = !stats.empty();
+		for (size_t i = 0; i < stats.size(); i++)
+		{
+			if (stats[i].version.empty())
+			{
+				allVersioned = false;
+				continue;
+			}
+			if (m_sharedCache->slotCount() > 0)
+				m_sharedCache->setVersion(stats[i].name.c_str(), stats[i].version.c_str());
+			versions.push_back(stats[i].name + "=" + stats[i].version);
+		}
+
+		// A response may depend on any dataset, so it is kept only if none has
+		// changed, and none is without a version.
+		if (m_responseCache->isEnabled())
+		{
+			std::sort(versions.begin(), versions.end());
+			std::string version;
+			for (size_t i = 0; i < versions.size() && allVersioned; i++)
+				version += versions[i] + "\n";
+			m_responseCache->setVersion(version.c_str());
+		}
+	}
+
+	void NcServer::reportReady()
+	{
+		// serve() called by the application itself
+		if (m_workerIndex < 0)
+			return;
+
+		m_scoreboard->setReady(m_workerIndex, getpid());
+		if (getppid() == m_manager)
+			kill(m_manager, SIGUSR2);
+	}
+
+	bool NcServer::allWorkersReady()
+	{
+		for (int i = 0; i < m_activeWorkerCount; i++)
+		{
+			if (m_childrenStates[i] != CHILDSTATE_LIVING && m_childrenStates[i] != CHILDSTATE_WAIT_FOR_RELOAD)
+				return false;
+		}
+		return true;
+	}
+
+	int NcServer::servingWorkerCount()
+	{
+		int count = 0;
+		for (int i = 0; i < m_activeWorkerCount; i++)
+		{
+			bool ready = m_childrenStates[i] == CHILDSTATE_LIVING || m_childrenStates[i] == CHILDSTATE_WAIT_FOR_RELOAD;
+			if ((ready && m_children[i] > 0) || m_predecessors[i] > 0)
+				count++;
+		}
+		return count;
+	}
+
+	int NcServer::restartingWorkerCount()
+	{
+		int count = 0;
+		for (int i = 0; i < m_activeWorkerCount; i++)
+		{
+			if (m_predecessors[i] > 0)
+				count++;
+		}
+		return count;
+	}
+
 	bool NcServer::checkChildrenStateAndRefork()
 	{
 		bool isManager = true;
+		bool changed = false;
 		std::vector<pid_t> childrenToKill;
-		int workerCount = m_config->server.workerCount;
+		int workerCount = m_activeWorkerCount;
+		int quota = workerQuota();
+		int maxRestarting = m_config->server.maxRestartingWorkers;
+		int restarting = restartingWorkerCount();
+		long long now = monotonicTimeMs();
 		for (int i = 0; i < workerCount && isManager && !g_ncServerExit; i++)
 		{
-			pid_t pidToKill = -1;
 			switch (m_childrenStates[i])
 			{
 			case CHILDSTATE_WAIT_FOR_RELOAD:
-				pidToKill = m_children[i];
+				if (m_predecessors[i] > 0)
+				{
+					// restarted again before the new worker was ready, the predecessor goes on serving
+					if (m_children[i] > 0)
+					{
+						kill(m_children[i], SIGTERM);
+						childrenToKill.push_back(m_children[i]);
+					}
+				}
+				else if (!_hasExited(m_children[i]))
+				{
+					// the others have to finish first
+					if (maxRestarting > 0 && restarting >= maxRestarting)
+						break;
+					pthread_mutex_lock(&m_mutex);
+					m_predecessors[i] = m_children[i];
+					pthread_mutex_unlock(&m_mutex);
+					restarting++;
+				}
 				isManager = forkOne(i);
-				if (isManager)
+				changed = true;
+				break;
+			case CHILDSTATE_STARTING:
+				if (m_predecessors[i] > 0 && _hasExited(m_predecessors[i]))
 				{
-					kill(pidToKill, SIGTERM);
-					childrenToKill.push_back(pidToKill);
+					m_predecessors[i] = -1;
+					changed = true;
+				}
+				if (_hasExited(m_children[i]))
+				{
+					// replaced at once, unless it keeps failing in startService()
+					if (++m_startFailures[i] > 1)
+					{
+						pthread_mutex_lock(&m_mutex);
+						m_children[i] = -1;
+						m_childrenStates[i] = CHILDSTATE_INVALID;
+						pthread_mutex_unlock(&m_mutex);
+					}
+					else
+					{
+						isManager = promoteStandby(i) || forkOne(i);
+					}
+					changed = true;
+				}
+				else if (m_scoreboard->isReady(i, m_children[i]))
+				{
+					// the predecessor drains only now, so that the slot is never without a worker
+					pid_t predecessor = m_predecessors[i];
+					pthread_mutex_lock(&m_mutex);
+					m_childrenStates[i] = CHILDSTATE_LIVING;
+					m_predecessors[i] = -1;
+					pthread_mutex_unlock(&m_mutex);
+					m_startFailures[i] = 0;
+					if (predecessor > 0)
+					{
+						kill(predecessor, SIGTERM);
+						childrenToKill.push_back(predecessor);
+					}
+					changed = true;
 				}
 				break;
 			case CHILDSTATE_LIVING:
-				if (waitpid(m_children[i], NULL, WNOHANG))
+				if (_hasExited(m_children[i]))
 				{
-					isManager = forkOne(i);
+					isManager = promoteStandby(i) || forkOne(i);
+					changed = true;
 				}
 				break;
 			case CHILDSTATE_INVALID:
+				if (i >= quota)
+					break;
+				if (promoteStandby(i))
+				{
+					changed = true;
+					break;
+				}
+				// once a second at most
+				if (m_startFailures[i] > 1 && now - m_forkTimes[i] < RESTART_INTERVAL_MS)
+					break;
 				isManager = forkOne(i);
+				changed = true;
 				break;
 			}
 		}
 
-		if (isManager && !childrenToKill.empty())
+		// Standby workers start only when every slot serves, so that they never
+		// hold up a worker, e.g. during a reload.
+		int standbyCount = m_config->server.standbyWorkerCount;
+		if (isManager && standbyCount > 0 && quota == workerCount && allWorkersReady())
 		{
-			std::thread t([childrenToKill]() {
-				sleep(15);
-				for (pid_t child : childrenToKill)
-				{
-					if (waitpid(child, NULL, WNOHANG) == 0)
-					{
-						kill(child, SIGKILL);
-						waitpid(child, NULL, 0);
-					}
-				}
-			});
-			t.detach();
+			for (int i = 0; i < standbyCount && isManager && !g_ncServerExit; i++)
+			{
+				pid_t pid = m_standbys[i];
+				if (pid > 0 && !_hasExited(pid))
+					continue;
+				// one which exited before it took a slot, once a second at most
+				if (pid > 0 && now - m_standbyForkTimes[i] < RESTART_INTERVAL_MS)
+					continue;
+				isManager = forkStandby(i);
+				changed = true;
+			}
 		}
+
+		if (isManager && changed)
+		{
+			recordWorkers();
+			recordMetrics();
+		}
+
+		if (isManager && !childrenToKill.empty())
+			_reapLater(childrenToKill, (long long)m_config->server.drainTimeout * 1000 + DRAIN_KILL_GRACE_MS);
 		return isManager;
 	}
 
@@ -0,0 +1,181 @@
+/*
+MIT License
+
+Copyright (c) 2019 GIS Core R&D Department, NavInfo Co., Ltd
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+
+#include "ncserver/immutable_region.h"
+#include <map>
+#include <string>
+#include <vector>
+
+namespace ncserver
+{
+	class NcServerConfig
+	{
+	public:
+		enum Engine
+		{
+			Engine_fcgi,	// blocking accept/read/write of libfcgi
+			Engine_epoll,	// non-blocking event loop multiplexing connections
+			Engine_http,	// the event loop of Engine_epoll speaking HTTP/1.1 instead of FastCGI
+		};
+
+		enum MemoryPolicy
+		{
+			MemoryPolicy_none,		// allocate from wherever the kernel likes
+			MemoryPolicy_preferred,	// try the nodes of the worker first
+			MemoryPolicy_bind,		// only the nodes of the worker
+		};
+
+		struct ServerConfig
+		{
+			// 0 to run one worker per threadCount CPUs the cgroup and the affinity mask
+			// allow, no more than workerMemory fits into the cgroup memory limit
+			int workerCount = 0;
+			// the manager adds workers up to maxWorkerCount when they are busy and removes
+			// them down to minWorkerCount when idle. 0 for workerCount.
+			int minWorkerCount = 0;
+			int maxWorkerCount = 0;
+			// megabytes each worker needs, 0 to size by CPU only
+			int workerMemory = 0;
+			// seconds of load averaged for each scaling decision
+			int scaleInterval = 10;
+			// CPU time of the workers per serving thread, above which workers are added
+			double scaleUpBusyRatio = 0.8;
+			// and below which one is removed if no connection waits
+			double scaleDownBusyRatio = 0.3;
+			// connections waiting in the accept queue which add a worker, 0 to ignore
+			int scaleUpQueueLength = 16;
+			// workers a restart by reforkAllChildren() replaces at a time, 0 for all at once
+			int maxRestartingWorkers = 1;
+			// seconds a stopping worker finishes its requests in, before it is killed
+			int drainTimeout = 15;
+			// workers which have run startService() and wait to replace one which exits
+			int standbyWorkerCount = 0;
+			// shared library of a HandlerModule which the workers load, empty for none
+			std::string handlerModule;
+			// a reload forks the new manager from the current one, which keeps the
+			// datasets whose version hasn't changed, see DatasetRegistry
+			bool zygoteReload = false;
+			// megabytes both generations may use together during a reload, 0 for unlimited.
+			// The new workers are then started as the former ones are retired.
+			int reloadMemoryBudget = 0;
+			// snapshot of the versioned datasets, mapped at the next start, empty for none
+			std::string snapshotFile;
+			int threadCount = 1;
+			// threads of the TaskPool of each worker, 0 to run the tasks in the threads joining them
+			int taskThreadCount = 0;
+			Engine engine = Engine_fcgi;
+			// epoll and http engines: seconds a connection may stay without any traffic,
+			// unless a query of it runs, positive
+			int keepAliveTimeout = 60;
+			// epoll and http engines: maximum connections of each serving thread, 0 for unlimited
+			int maxConnections = 0;
+			// epoll engine: concurrent request ids on one connection, greater than 1 enables FCGI_MPXS_CONNS
+			int maxRequestsPerConnection = 1;
+			// epoll and http engines: do the socket I/O with io_uring, falling back to epoll if unsupported
+			bool ioUring = false;
+		};
+
+		struct ListenConfig
+		{
+			// "unix:/path/to.sock", "host:port" or ":port". Empty to accept on the
+			// socket spawn-fcgi passes in as file descriptor 0.
+			std::string address;
+			int backlog = 1024;
+			// SO_RCVBUF/SO_SNDBUF of the listening socket, 0 for the system default
+			int receiveBuffer = 0;
+			int sendBuffer = 0;
+			// TCP only: every worker listens on its own SO_REUSEPORT socket
+			bool reusePort = false;
+			// TCP only: seconds TCP_DEFER_ACCEPT waits for the first data, 0 to disable
+			int deferAccept = 0;
+			// TCP only: TCP_NODELAY of the accepted connections
+			bool noDelay = true;
+		};
+
+		struct PlacementConfig
+		{
+			// CPU lists like "0-3,8-11", the worker of index i runs on workerCpus[i % size]
+			std::vector<std::string> workerCpus;
+			// NUMA nodes, the worker of index i runs on the CPUs of workerNodes[i % size].
+			// Takes precedence over workerCpus.
+			std::vector<int> workerNodes;
+			// CPU list of the boss and the manager. Workers without a placement get the other CPUs.
+			std::string housekeepingCpus;
+			// memory allocation of each worker after fork(), restricted to the nodes of its CPUs
+			MemoryPolicy memoryPolicy = MemoryPolicy_none;
+			// one replica of each dataset of DatasetRegistry on every NUMA node
+			bool replicateDatasets = false;
+		};
+
+		struct ImmutableRegionConfig
+		{
+			// megabytes of the ImmutableRegion of prepareProcess(), 0 for none
+			int size = 0;
+			ImmutableRegion::HugePages hugePages = ImmutableRegion::HugePages_transparent;
+			// touch all the pages before prepareProcess()
+			bool prefault = false;
+			// mlock() the pages in the manager
+			bool lock = false;
+		};
+
+		struct SharedCacheConfig
+		{
+			// megabytes of sharedCache(), 0 for none
+			int size = 0;
+			// bytes of an entry, its key and value included
+			int slotSize = 256;
+			// file of the entries kept by the next generation, empty for memory only
+			std::string file;
+		};
+
+		struct ResponseCacheConfig
+		{
+			// megabytes of the responses cached, 0 for none
+			int size = 0;
+			// bytes of a response, its key and header fields included
+			int slotSize = 4096;
+			// seconds a response is kept by DOCUMENT_URI, or by a prefix ending with '*'
+			std::map<std::string, int> routes;
+			// file of the responses kept by the next generation, empty for memory only
+			std::string file;
+		};
+
+		static NcServerConfig* alloc() { return new NcServerConfig(); }
+
+		ServerConfig server;
+		ListenConfig listen;
+		PlacementConfig placement;
+		ImmutableRegionConfig immutableRegion;
+		SharedCacheConfig sharedCache;
+		ResponseCacheConfig responseCache;
+
+	protected:
+		NcServerConfig() {}
+		~NcServerConfig() {}
+		friend void release(NcServerConfig* config);
+	};
+
+	void release(NcServerConfig* config);
+}
@@ -0,0 +1,335 @@
+/*
+MIT License
+
+Copyright (c) 2019 GIS Core R&D Department, NavInfo Co., Ltd
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "stdafx.h"
+#include "placement.h"
+#include "ncserver/nc_log.h"
+#include <algorithm>
+#include <ctype.h>
+#include <errno.h>
+#include <iterator>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef WIN32
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#endif
+
+namespace ncserver
+{
+	// far beyond any CPU or node id, but keeps a typo like "0-99999999" cheap
+	static const int MAX_ID = 65535;
+
+	static void _skipSpaces(const char** p)
+	{
+		while (isspace((unsigned char)**p))
+			(*p)++;
+	}
+
+	static bool _parseId(const char** p, int* id)
+	{
+		if (!isdigit((unsigned char)**p))
+			return false;
+		char* end;
+		long value = strtol(*p, &end, 10);
+		if (value > MAX_ID)
+			return false;
+		*p = end;
+		*id = (int)value;
+		return true;
+	}
+
+	bool parseIdList(const std::string& text, std::vector<int>* ids)
+	{
+		ids->clear();
+		const char* p = text.c_str();
+		_skipSpaces(&p);
+		if (*p == 0)
+			return true;
+
+		for (;;)
+		{
+			int first, last;
+			_skipSpaces(&p);
+			if (!_parseId(&p, &first))
+				break;
+			last = first;
+			_skipSpaces(&p);
+			if (*p == '-')
+			{
+				p++;
+				_skipSpaces(&p);
+				if (!_parseId(&p, &last) || last < first)
+					break;
+				_skipSpaces(&p);
+			}
+			for (int id = first; id <= last; id++)
+				ids->push_back(id);
+
+			if (*p == 0)
+			{
+				std::sort(ids->begin(), ids->end());
+				ids->erase(std::unique(ids->begin(), ids->end()), ids->end());
+				return true;
+			}
+			if (*p != ',')
+				break;
+			p++;
+		}
+
+		ids->clear();
+		return false;
+	}
+
+	std::string formatIdList(const std::vector<int>& ids)
+	{
+		std::string text;
+		char buffer[32];
+		size_t i = 0;
+		while (i < ids.size())
+		{
+			size_t last = i;
+			while (last + 1 < ids.size() && ids[last + 1] == ids[last] + 1)
+				last++;
+
+			if (last == i)
+				snprintf(buffer, sizeof(buffer), "%d", ids[i]);
+			else
+				snprintf(buffer, sizeof(buffer), "%d-%d", ids[i], ids[last]);
+			if (!text.empty())
+				text += ',';
+			text += buffer;
+			i = last + 1;
+		}
+		return text;
+	}
+
+#ifndef WIN32
+	// The nodemask of set_mempolicy(). Nodes beyond are ignored.
+	static const int MAX_NODES = 1024;
+
+	static bool _readIdListFile(const char* path, std::vector<int>* ids)
+	{
+		FILE* file = fopen(path, "r");
+		if (file == NULL)
+			return false;
+		char buffer[4096];
+		size_t size = fread(buffer, 1, sizeof(buffer) - 1, file);
+		fclose(file);
+		buffer[size] = 0;
+		return parseIdList(buffer, ids);
+	}
+
+	std::vector<int> numaNodeCpus(int node)
+	{
+		char path[128];
+		snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+		std::vector<int> cpus;
+		_readIdListFile(path, &cpus);
+		return cpus;
+	}
+
+	std::vector<int> numaNodes()
+	{
+		std::vector<int> nodes;
+		_readIdListFile("/sys/devices/system/node/online", &nodes);
+		return nodes;
+	}
+
+	static std::vector<int> _onlineCpus()
+	{
+		std::vector<int> cpus;
+		if (!_readIdListFile("/sys/devices/system/cpu/online", &cpus) || cpus.empty())
+		{
+			long count = sysconf(_SC_NPROCESSORS_ONLN);
+			for (long i = 0; i < count; i++)
+				cpus.push_back((int)i);
+		}
+		return cpus;
+	}
+
+	static const char* _memoryPolicyName(NcServerConfig::MemoryPolicy policy)
+	{
+		switch (policy)
+		{
+		case NcServerConfig::MemoryPolicy_preferred:
+			return "preferred";
+		case NcServerConfig::MemoryPolicy_bind:
+			return "bind";
+		default:
+			return "none";
+		}
+	}
+
+	std::string WorkerPlacement::description() const
+	{
+		std::string text = "cpus ";
+		text += cpus.empty() ? "inherited" : formatIdList(cpus);
+		text += ", memory ";
+		text += _memoryPolicyName(nodes.empty() ? NcServerConfig::MemoryPolicy_none : memoryPolicy);
+		if (!nodes.empty() && memoryPolicy != NcServerConfig::MemoryPolicy_none)
+		{
+			text += ' ';
+			text += formatIdList(nodes);
+		}
+		return text;
+	}
+
+	WorkerPlacement placementOfWorker(const NcServerConfig::PlacementConfig& config, int index)
+	{
+		WorkerPlacement placement;
+		placement.memoryPolicy = config.memoryPolicy;
+
+		if (!config.workerNodes.empty())
+		{
+			int node = config.workerNodes[index % config.workerNodes.size()];
+			placement.cpus = numaNodeCpus(node);
+			if (placement.cpus.empty())
+				ASYNC_LOG_WARNING("NUMA node %d of worker %d has no CPU", node, index);
+			else
+				placement.nodes.push_back(node);
+		}
+		else if (!config.workerCpus.empty())
+		{
+			const std::string& text = config.workerCpus[index % config.workerCpus.size()];
+			if (!parseIdList(text, &placement.cpus))
+				ASYNC_LOG_ERR("Malformed CPU list \"%s\" of worker %d", text.c_str(), index);
+		}
+		else if (!config.housekeepingCpus.empty())
+		{
+			// Workers without a placement of their own would inherit the
+			// housekeeping CPUs from the manager. Give them the rest instead.
+			std::vector<int> housekeeping;
+			if (parseIdList(config.housekeepingCpus, &housekeeping))
+			{
+				std::vector<int> online = _onlineCpus();
+				std::set_difference(online.begin(), online.end(), housekeeping.begin(), housekeeping.end(),
+					std::back_inserter(placement.cpus));
+				if (placement.cpus.empty())
+					placement.cpus = online;
+			}
+		}
+
+		// The local memory of CPUs is that of the nodes they belong to.
+		if (placement.nodes.empty() && !placement.cpus.empty() && placement.memoryPolicy != NcServerConfig::MemoryPolicy_none)
+		{
+			std::vector<int> nodes = numaNodes();
+			for (size_t i = 0; i < nodes.size(); i++)
+			{
+				std::vector<int> cpus = numaNodeCpus(nodes[i]);
+				std::vector<int> common;
+				std::set_intersection(cpus.begin(), cpus.end(), placement.cpus.begin(), placement.cpus.end(),
+					std::back_inserter(common));
+				if (!common.empty())
+					placement.nodes.push_back(nodes[i]);
+			}
+		}
+
+		return placement;
+	}
+
+	static bool _setAffinity(const std::vector<int>& cpus)
+	{
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		for (size_t i = 0; i < cpus.size(); i++)
+		{
+			if (cpus[i] < CPU_SETSIZE)
+				CPU_SET(cpus[i], &set);
+		}
+		if (sched_setaffinity(0, sizeof(set), &set) != 0)
+		{
+			ASYNC_LOG_ERR("Failed to run on CPUs %s: %s", formatIdList(cpus).c_str(), strerror(errno));
+			return false;
+		}
+		return true;
+	}
+
+	bool applyWorkerPlacement(const WorkerPlacement& placement)
+	{
+		bool succeeded = true;
+		if (!placement.cpus.empty())
+			succeeded = _setAffinity(placement.cpus);
+
+		if (placement.memoryPolicy != NcServerConfig::MemoryPolicy_none && !placement.nodes.empty())
+		{
+			const int bitsPerLong = 8 * sizeof(unsigned long);
+			unsigned long nodemask[MAX_NODES / bitsPerLong];
+			memset(nodemask, 0, sizeof(nodemask));
+			for (size_t i = 0; i < placement.nodes.size(); i++)
+			{
+				int node = placement.nodes[i];
+				if (node < MAX_NODES)
+					nodemask[node / bitsPerLong] |= 1UL << (node % bitsPerLong);
+			}
+
+			// MPOL_PREFERRED takes the first node of the mask.
+			int mode = placement.memoryPolicy == NcServerConfig::MemoryPolicy_bind ? MPOL_BIND : MPOL_PREFERRED;
+			// the kernel reads maxnode - 1 bits
+			if (syscall(__NR_set_mempolicy, mode, nodemask, (unsigned long)MAX_NODES + 1) != 0)
+			{
+				ASYNC_LOG_ERR("Failed to allocate memory from NUMA nodes %s: %s",
+					formatIdList(placement.nodes).c_str(), strerror(errno));
+				succeeded = false;
+			}
+		}
+		return succeeded;
+	}
+
+	bool applyHousekeepingPlacement(const NcServerConfig::PlacementConfig& config)
+	{
+		if (config.housekeepingCpus.empty())
+			return true;
+
+		std::vector<int> cpus;
+		if (!parseIdList(config.housekeepingCpus, &cpus) || cpus.empty())
+		{
+			ASYNC_LOG_ERR("Malformed housekeeping CPU list \"%s\"", config.housekeepingCpus.c_str());
+			return false;
+		}
+		return _setAffinity(cpus);
+	}
+
+	bool bindMemoryToNode(void* memory, size_t size, int node)
+	{
+		if (node < 0 || node >= MAX_NODES)
+			return false;
+		const int bitsPerLong = 8 * sizeof(unsigned long);
+		unsigned long nodemask[MAX_NODES / bitsPerLong];
+		memset(nodemask, 0, sizeof(nodemask));
+		nodemask[node / bitsPerLong] = 1UL << (node % bitsPerLong);
+		return syscall(__NR_mbind, memory, size, MPOL_BIND, nodemask, (unsigned long)MAX_NODES + 1, 0) == 0;
+	}
+
+	int numaNodeOfMemory(const void* memory)
+	{
+		int node = -1;
+		if (syscall(__NR_get_mempolicy, &node, NULL, 0, memory, MPOL_F_NODE | MPOL_F_ADDR) != 0)
+			return -1;
+		return node;
+	}
+#endif
+}
@@ -0,0 +1,94 @@
+/*
+MIT License
+
+Copyright (c) 2019 GIS Core R&D Department, NavInfo Co., Ltd
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+
+#include "ncserver_config.h"
+#include <string>
+#include <vector>
+
+namespace ncserver
+{
+	/**
+		Parse a list of ids in the "0-3,8,10-11" notation of taskset and sysfs.
+
+		@return
+			false if @a text is malformed. The ids are sorted and unique.
+	 */
+	bool parseIdList(const std::string& text, std::vector<int>* ids);
+
+	/**
+		The reverse of parseIdList(), "" for no id.
+	 */
+	std::string formatIdList(const std::vector<int>& ids);
+
+#ifndef WIN32
+	/**
+		Where a worker runs and allocates memory. Empty lists leave it as inherited.
+	 */
+	struct WorkerPlacement
+	{
+		std::vector<int> cpus;
+		std::vector<int> nodes;
+		NcServerConfig::MemoryPolicy memoryPolicy = NcServerConfig::MemoryPolicy_none;
+
+		std::string description() const;
+	};
+
+	/**
+		The placement of the worker of @a index by config.
+	 */
+	WorkerPlacement placementOfWorker(const NcServerConfig::PlacementConfig& config, int index);
+
+	/**
+		Bind the calling process, which must not have started any thread yet.
+
+		@return
+			false if the kernel refuses any part of it, which is logged.
+	 */
+	bool applyWorkerPlacement(const WorkerPlacement& placement);
+
+	/**
+		Move the calling boss or manager onto config.housekeepingCpus if set.
+	 */
+	bool applyHousekeepingPlacement(const NcServerConfig::PlacementConfig& config);
+
+	/**
+		The online NUMA nodes, empty if the kernel doesn't report any.
+	 */
+	std::vector<int> numaNodes();
+
+	std::vector<int> numaNodeCpus(int node);
+
+	/**
+		Make the pages of [memory, memory + size), which must not have been touched
+		yet, come from @a node.
+	 */
+	bool bindMemoryToNode(void* memory, size_t size, int node);
+
+	/**
+		The node of the page at @a memory, -1 if unknown.
+	 */
+	int numaNodeOfMemory(const void* memory);
+#endif
+}
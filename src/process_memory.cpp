@@ -0,0 +1,144 @@
+/*
+MIT License
+
+Copyright (c) 2019 GIS Core R&D Department, NavInfo Co., Ltd
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "stdafx.h"
+#include "process_memory.h"
+#include <map>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef WIN32
+#include <dirent.h>
+#include <unistd.h>
+
+namespace ncserver
+{
+	static long long _pssKb(pid_t pid)
+	{
+		char path[64];
+		snprintf(path, sizeof(path), "/proc/%d/smaps_rollup", (int)pid);
+		FILE* file = fopen(path, "r");
+		if (file == NULL)
+			return -1;
+
+		long long pss = -1;
+		char line[256];
+		while (fgets(line, sizeof(line), file) != NULL)
+		{
+			if (strncmp(line, "Pss:", 4) == 0)
+			{
+				pss = strtoll(line + 4, NULL, 10);
+				break;
+			}
+		}
+		fclose(file);
+		return pss;
+	}
+
+	static long long _rssKb(pid_t pid)
+	{
+		char path[64];
+		snprintf(path, sizeof(path), "/proc/%d/statm", (int)pid);
+		FILE* file = fopen(path, "r");
+		if (file == NULL)
+			return -1;
+
+		long long size, resident;
+		bool read = fscanf(file, "%lld %lld", &size, &resident) == 2;
+		fclose(file);
+		return read ? resident * (sysconf(_SC_PAGESIZE) / 1024) : -1;
+	}
+
+	long long processMemoryKb(pid_t pid)
+	{
+		long long pss = _pssKb(pid);
+		return pss >= 0 ? pss : _rssKb(pid);
+	}
+
+	static pid_t _parentOf(pid_t pid)
+	{
+		char path[64];
+		snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+		FILE* file = fopen(path, "r");
+		if (file == NULL)
+			return -1;
+		char line[1024];
+		bool read = fgets(line, sizeof(line), file) != NULL;
+		fclose(file);
+
+		// the command in parentheses may contain anything, the fields follow the last ')'
+		char* fields = read ? strrchr(line, ')') : NULL;
+		int parent;
+		if (fields == NULL || sscanf(fields + 1, " %*c %d", &parent) != 1)
+			return -1;
+		return parent;
+	}
+
+	std::vector<pid_t> descendantProcesses(pid_t pid)
+	{
+		std::multimap<pid_t, pid_t> children;
+		DIR* dir = opendir("/proc");
+		if (dir != NULL)
+		{
+			struct dirent* entry;
+			while ((entry = readdir(dir)) != NULL)
+			{
+				pid_t child = (pid_t)atoi(entry->d_name);
+				if (child <= 0)
+					continue;
+				pid_t parent = _parentOf(child);
+				if (parent > 0)
+					children.insert(std::make_pair(parent, child));
+			}
+			closedir(dir);
+		}
+
+		std::vector<pid_t> result;
+		std::vector<pid_t> parents(1, pid);
+		while (!parents.empty())
+		{
+			pid_t parent = parents.back();
+			parents.pop_back();
+			std::pair<std::multimap<pid_t, pid_t>::iterator, std::multimap<pid_t, pid_t>::iterator> range = children.equal_range(parent);
+			for (std::multimap<pid_t, pid_t>::iterator it = range.first; it != range.second; ++it)
+			{
+				result.push_back(it->second);
+				parents.push_back(it->second);
+			}
+		}
+		return result;
+	}
+
+	long long totalMemoryKb(const std::vector<pid_t>& processes)
+	{
+		long long total = 0;
+		for (size_t i = 0; i < processes.size(); i++)
+		{
+			long long memory = processMemoryKb(processes[i]);
+			if (memory > 0)
+				total += memory;
+		}
+		return total;
+	}
+}
+#endif
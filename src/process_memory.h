@@ -0,0 +1,49 @@
+/*
+MIT License
+
+Copyright (c) 2019 GIS Core R&D Department, NavInfo Co., Ltd
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+
+#ifndef WIN32
+#include <sys/types.h>
+#include <vector>
+
+namespace ncserver
+{
+	/**
+		Memory of @a pid in kilobytes: the proportional set size of /proc/<pid>/smaps_rollup,
+		which counts a page shared by several processes once among them, or the resident
+		set size of /proc/<pid>/statm if the kernel has no smaps_rollup. -1 if it is gone.
+	 */
+	long long processMemoryKb(pid_t pid);
+
+	/**
+		The children of @a pid, their children and so on, from the parents in /proc/<pid>/stat.
+	 */
+	std::vector<pid_t> descendantProcesses(pid_t pid);
+
+	/**
+		processMemoryKb() of all @a processes.
+	 */
+	long long totalMemoryKb(const std::vector<pid_t>& processes);
+}
+#endif
@@ -0,0 +1,178 @@
+/*
+MIT License
+
+Copyright (c) 2019 GIS Core R&D Department, NavInfo Co., Ltd
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "stdafx.h"
+
+#include "request_dispatcher.h"
+
+namespace ncserver
+{
+	/**
+		Request and ServiceIo of one request. With FastCGI multiplexing, every
+		request id of a connection has its own exchange.
+	 */
+	class RequestDispatcher::Exchange : public AsyncQuery, public BufferedServiceIoDelegate
+	{
+	public:
+		Exchange(RequestDispatcher* dispatcher)
+		{
+			m_dispatcher = dispatcher;
+			m_protocol = NULL;
+			m_state = NULL;
+			m_context = NULL;
+			m_pendingIndex = 0;
+			m_inHandler = false;
+			m_cancelled = false;
+			m_io.setDelegate(this);
+		}
+
+		virtual ~Exchange() {}
+
+		virtual ServiceIo* io() { return &m_io; }
+		virtual Request* request() { return &m_request; }
+		virtual AsyncLoop* loop() { return m_dispatcher->m_loop; }
+		virtual void finish() { m_dispatcher->finishExchange(this); }
+		virtual bool isCancelled() { return m_cancelled; }
+
+		virtual void bufferedServiceIoWillFlush(BufferedServiceIo* io)
+		{
+			m_dispatcher->flushExchange(this);
+		}
+
+		RequestDispatcher* m_dispatcher;
+		ConnectionProtocol* m_protocol;
+		ProtocolRequest* m_state;
+		void* m_context;
+		size_t m_pendingIndex;
+		bool m_inHandler;
+		bool m_cancelled;
+		Request m_request;
+		BufferedServiceIo m_io;
+	};
+
+	RequestDispatcher::RequestDispatcher(AsyncLoop* loop, const RequestHandler& handler, const OutputHandler& outputHandler)
+	{
+		m_loop = loop;
+		m_handler = handler;
+		m_outputHandler = outputHandler;
+	}
+
+	RequestDispatcher::~RequestDispatcher()
+	{
+		for (size_t i = 0; i < m_freeExchanges.size(); i++)
+			delete m_freeExchanges[i];
+		for (size_t i = 0; i < m_pendingExchanges.size(); i++)
+			delete m_pendingExchanges[i];
+	}
+
+	void RequestDispatcher::dispatch(ConnectionProtocol* protocol, ProtocolRequest* request, void* context)
+	{
+		Exchange* exchange;
+		if (m_freeExchanges.empty())
+		{
+			exchange = new Exchange(this);
+		}
+		else
+		{
+			exchange = m_freeExchanges.back();
+			m_freeExchanges.pop_back();
+		}
+
+		exchange->m_protocol = protocol;
+		exchange->m_state = request;
+		exchange->m_context = context;
+		exchange->m_cancelled = false;
+		exchange->m_io.reset(request->stdinData(), request->stdinSize());
+		exchange->m_request.setEnvironment(request->envp());
+		exchange->m_pendingIndex = m_pendingExchanges.size();
+		m_pendingExchanges.push_back(exchange);
+
+		exchange->m_inHandler = true;
+		m_handler(exchange);
+		exchange->m_inHandler = false;
+	}
+
+	void RequestDispatcher::cancel(void* context)
+	{
+		for (size_t i = 0; i < m_pendingExchanges.size(); i++)
+		{
+			Exchange* exchange = m_pendingExchanges[i];
+			if (exchange->m_context != context)
+				continue;
+
+			// the input and the environment belong to the protocol, which is going away
+			exchange->m_protocol = NULL;
+			exchange->m_state = NULL;
+			exchange->m_cancelled = true;
+			exchange->m_io.reset(NULL, 0);
+			exchange->m_request.setEnvironment(NULL);
+		}
+	}
+
+	void RequestDispatcher::flushExchange(Exchange* exchange)
+	{
+		std::string& output = exchange->m_io.output();
+		if (exchange->m_protocol == NULL)
+		{
+			output.clear();
+			return;
+		}
+		if (output.empty())
+			return;
+
+		exchange->m_protocol->writeStdout(exchange->m_state, output.data(), output.size());
+		output.clear();
+
+		m_outputHandler(exchange->m_context);
+	}
+
+	void RequestDispatcher::finishExchange(Exchange* exchange)
+	{
+		Exchange* last = m_pendingExchanges.back();
+		m_pendingExchanges[exchange->m_pendingIndex] = last;
+		last->m_pendingIndex = exchange->m_pendingIndex;
+		m_pendingExchanges.pop_back();
+
+		ConnectionProtocol* protocol = exchange->m_protocol;
+		ProtocolRequest* state = exchange->m_state;
+		void* context = exchange->m_context;
+		bool inHandler = exchange->m_inHandler;
+
+		exchange->m_request.setEnvironment(NULL);
+		flushExchange(exchange);
+		exchange->m_protocol = NULL;
+		exchange->m_state = NULL;
+		exchange->m_context = NULL;
+		exchange->m_inHandler = false;
+		m_freeExchanges.push_back(exchange);
+
+		if (protocol == NULL)
+			return;
+
+		// May dispatch the next pipelined request, which can take the exchange just freed.
+		// Inside the handler, the engine sends the output after the input is processed.
+		protocol->endRequest(state, 0);
+		if (!inHandler)
+			m_outputHandler(context);
+	}
+}
@@ -0,0 +1,87 @@
+/*
+MIT License
+
+Copyright (c) 2019 GIS Core R&D Department, NavInfo Co., Ltd
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+
+#include <functional>
+#include <vector>
+#include "ncserver/async_query.h"
+#include "connection_protocol.h"
+#include "buffered_service_io.h"
+
+namespace ncserver
+{
+	/**
+		Calls the request handler of the event driven engines.
+
+		The Request and ServiceIo of finished requests are reused by the next
+		ones. The output of query() is queued to the protocol of its connection
+		on every flush() and when the query is finished.
+	 */
+	class RequestDispatcher
+	{
+	public:
+		/**
+			The handler must call AsyncQuery::finish(), either before it returns
+			or later on the serving thread.
+		 */
+		typedef std::function<void(AsyncQuery*)> RequestHandler;
+
+		/**
+			Called after output is queued to the protocol, with the context passed to dispatch().
+		 */
+		typedef std::function<void(void* context)> OutputHandler;
+
+		RequestDispatcher(AsyncLoop* loop, const RequestHandler& handler, const OutputHandler& outputHandler);
+		~RequestDispatcher();
+
+		/**
+			Run the handler, which ends the request now or later.
+		 */
+		void dispatch(ConnectionProtocol* protocol, ProtocolRequest* request, void* context);
+
+		/**
+			Called before the connection of context is closed, the queries still
+			running on it are cancelled.
+		 */
+		void cancel(void* context);
+
+		/**
+			Count of the queries not yet finished.
+		 */
+		size_t pendingCount() { return m_pendingExchanges.size(); }
+
+	private:
+		class Exchange;
+		friend class Exchange;
+
+		void flushExchange(Exchange* exchange);
+		void finishExchange(Exchange* exchange);
+
+		AsyncLoop* m_loop;
+		RequestHandler m_handler;
+		OutputHandler m_outputHandler;
+		std::vector<Exchange*> m_freeExchanges;
+		std::vector<Exchange*> m_pendingExchanges;
+	};
+}
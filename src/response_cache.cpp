@@ -0,0 +1,372 @@
+/*
+MIT License
+
+Copyright (c) 2019 GIS Core R&D Department, NavInfo Co., Ltd
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "stdafx.h"
+#include "response_cache.h"
+#include "util.h"
+#include <algorithm>
+#include <chrono>
+#include <new>
+#include <stdarg.h>
+#include <string.h>
+#include <utility>
+#include <vector>
+
+#ifndef WIN32
+#include <strings.h>
+#include <sys/mman.h>
+#else
+#define strncasecmp _strnicmp
+#endif
+
+namespace ncserver
+{
+	/**
+		Shared by the workers like the entries.
+	 */
+	struct ResponseCache::Counters
+	{
+		std::atomic<long long> hits;
+		std::atomic<long long> misses;
+		std::atomic<long long> stores;
+		std::atomic<long long> hitMicros;
+		std::atomic<long long> missMicros;
+	};
+
+	// the dataset of SharedCache all the responses are tagged with
+	static const char* RESPONSES_DATASET = "responses";
+
+	/**
+		Of the wall clock, as the expiry of a response of a file outlives a reboot,
+		unlike the monotonic clock.
+	 */
+	static long long _wallTimeMs()
+	{
+		return std::chrono::duration_cast<std::chrono::milliseconds>(
+			std::chrono::system_clock::now().time_since_epoch()).count();
+	}
+
+	ResponseCache::ResponseCache()
+	{
+		m_stats = NULL;
+	}
+
+	ResponseCache::~ResponseCache()
+	{
+		clear();
+	}
+
+	void ResponseCache::clear()
+	{
+		if (m_stats != NULL)
+		{
+#ifndef WIN32
+			munmap(m_stats, sizeof(Counters));
+#else
+			free(m_stats);
+#endif
+		}
+		m_stats = NULL;
+	}
+
+	bool ResponseCache::init(size_t capacity, size_t slotSize, const std::map<std::string, int>& routes, const char* path)
+	{
+		m_exactRoutes.clear();
+		m_prefixRoutes.clear();
+		for (std::map<std::string, int>::const_iterator it = routes.begin(); it != routes.end(); ++it)
+		{
+			const std::string& path = it->first;
+			if (!path.empty() && path[path.size() - 1] == '*')
+				m_prefixRoutes[path.substr(0, path.size() - 1)] = it->second;
+			else
+				m_exactRoutes[path] = it->second;
+		}
+
+		// a mapping of its own, rather than that of the workers of a former generation
+		clear();
+		// nothing to adopt in memory, whereas a file waits for setVersion()
+		if (!m_cache.init(capacity, slotSize, path) || (path == NULL && !m_cache.setVersion(RESPONSES_DATASET, "")))
+			return false;
+#ifndef WIN32
+		void* memory = mmap(NULL, sizeof(Counters), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+		if (memory == MAP_FAILED)
+			memory = NULL;
+#else
+		void* memory = calloc(1, sizeof(Counters));
+#endif
+		if (memory == NULL)
+			return false;
+		m_stats = new (memory) Counters();
+		return true;
+	}
+
+	bool ResponseCache::setVersion(const char* version)
+	{
+		return m_cache.setVersion(RESPONSES_DATASET, version);
+	}
+
+	int ResponseCache::ttlForUri(const char* uri) const
+	{
+		if (uri == NULL)
+			return 0;
+
+		std::map<std::string, int>::const_iterator exact = m_exactRoutes.find(uri);
+		if (exact != m_exactRoutes.end())
+			return exact->second;
+
+		// the longest prefix, which sorts last of those matching
+		int ttl = 0;
+		for (std::map<std::string, int>::const_iterator it = m_prefixRoutes.begin(); it != m_prefixRoutes.end(); ++it)
+		{
+			if (strncmp(uri, it->first.c_str(), it->first.size()) == 0)
+				ttl = it->second;
+		}
+		return ttl;
+	}
+
+	std::string ResponseCache::keyOf(Request* request)
+	{
+		std::vector<std::pair<std::string, std::string> > params;
+		RequestParameterIterator* iter = request->getParameterIterator();
+		iter->reset();
+		while (iter->next())
+			params.push_back(std::make_pair(std::string(iter->name), std::string(iter->value)));
+		iter->reset();
+		std::sort(params.begin(), params.end());
+
+		// NUL can't be a part of a decoded parameter, so the fields are unambiguous
+		const char* uri = request->documentUri();
+		std::string key = uri != NULL ? uri : "";
+		for (size_t i = 0; i < params.size(); i++)
+		{
+			key.push_back('\0');
+			key += params[i].first;
+			key.push_back('\0');
+			key += params[i].second;
+		}
+		return key;
+	}
+
+	bool ResponseCache::replay(const std::string& key, ServiceIo* io)
+	{
+		std::string value;
+		if (!m_cache.get(key, &value) || value.size() < sizeof(long long))
+			return false;
+
+		long long expiresMs;
+		memcpy(&expiresMs, value.data(), sizeof(expiresMs));
+		if (_wallTimeMs() >= expiresMs)
+			return false;
+
+		size_t pos = sizeof(expiresMs);
+		for (;;)
+		{
+			size_t end = value.find("\r\n", pos);
+			if (end == std::string::npos)
+				return false;
+			if (end == pos)
+				break;
+			io->addHeaderField("%s", value.substr(pos, end - pos).c_str());
+			pos = end + 2;
+		}
+		io->endHeaderField();
+		pos += 2;
+		if (pos < value.size())
+			io->write(&value[pos], value.size() - pos);
+		return true;
+	}
+
+	void ResponseCache::store(const std::string& key, const std::string& response, int ttl)
+	{
+		long long expiresMs = _wallTimeMs() + ttl * 1000LL;
+		std::string value((const char*)&expiresMs, sizeof(expiresMs));
+		value += response;
+		if (m_cache.put(key, value, RESPONSES_DATASET))
+			m_stats->stores++;
+	}
+
+	void ResponseCache::recordHit(long long micros)
+	{
+		m_stats->hits++;
+		m_stats->hitMicros += micros;
+	}
+
+	void ResponseCache::recordMiss(long long micros)
+	{
+		m_stats->misses++;
+		m_stats->missMicros += micros;
+	}
+
+	ResponseCacheStats ResponseCache::stats() const
+	{
+		ResponseCacheStats stats;
+		memset(&stats, 0, sizeof(stats));
+		if (m_stats == NULL)
+			return stats;
+
+		stats.hits = m_stats->hits;
+		stats.misses = m_stats->misses;
+		stats.stores = m_stats->stores;
+		stats.hitMicros = m_stats->hitMicros;
+		stats.missMicros = m_stats->missMicros;
+		SharedCacheStats cache = m_cache.stats();
+		stats.evictions = cache.evictions;
+		stats.entries = cache.entries;
+		return stats;
+	}
+
+	size_t ResponseCache::maxResponseSize() const
+	{
+		size_t size = m_cache.maxEntrySize();
+		return size > sizeof(long long) ? size - sizeof(long long) : 0;
+	}
+
+	//////////////////////////////////////////////////////////////////////////
+
+	ResponseRecorder::ResponseRecorder(ServiceIo* io, size_t limit)
+	{
+		m_io = io;
+		m_limit = limit;
+		m_overflow = false;
+		m_headerEnded = false;
+		m_ok = true;
+	}
+
+	void ResponseRecorder::read(void* buffer, size_t size)
+	{
+		m_io->read(buffer, size);
+	}
+
+	void ResponseRecorder::write(void* buffer, size_t size)
+	{
+		m_io->write(buffer, size);
+		append((const char*)buffer, size);
+	}
+
+	static std::string _format(const char* format, va_list args)
+	{
+		char buffer[4096];
+		va_list copy;
+		va_copy(copy, args);
+		int count = vsnprintf(buffer, sizeof(buffer), format, copy);
+		va_end(copy);
+		if (count < 0)
+			return std::string();
+		if ((size_t)count < sizeof(buffer))
+			return std::string(buffer, count);
+
+		std::vector<char> large(count + 1);
+		vsnprintf(&large[0], large.size(), format, args);
+		return std::string(&large[0], count);
+	}
+
+	int ResponseRecorder::print(const char* format, ...)
+	{
+		va_list args;
+		va_start(args, format);
+		std::string text = _format(format, args);
+		va_end(args);
+
+		if (!text.empty())
+			m_io->write(&text[0], text.size());
+		append(text.data(), text.size());
+		return (int)text.size();
+	}
+
+	int ResponseRecorder::addHeaderField(const char* format, ...)
+	{
+		va_list args;
+		va_start(args, format);
+		std::string field = _format(format, args);
+		va_end(args);
+
+		int count = m_io->addHeaderField("%s", field.c_str());
+		if (strncasecmp(field.c_str(), "Status:", 7) == 0)
+		{
+			const char* status = field.c_str() + 7;
+			while (*status == ' ')
+				status++;
+			m_ok = m_ok && strncmp(status, "200", 3) == 0;
+		}
+		append(field.data(), field.size());
+		append("\r\n", 2);
+		return count;
+	}
+
+	void ResponseRecorder::endHeaderField(void)
+	{
+		m_io->endHeaderField();
+		m_headerEnded = true;
+		append("\r\n", 2);
+	}
+
+	void ResponseRecorder::flush(void)
+	{
+		m_io->flush();
+	}
+
+	bool ResponseRecorder::response(std::string* response) const
+	{
+		if (m_overflow || !m_headerEnded || !m_ok)
+			return false;
+		*response = m_response;
+		return true;
+	}
+
+	void ResponseRecorder::append(const char* data, size_t size)
+	{
+		if (m_overflow)
+			return;
+		if (m_response.size() + size > m_limit)
+		{
+			// too large to be stored anyway
+			m_overflow = true;
+			std::string().swap(m_response);
+			return;
+		}
+		m_response.append(data, size);
+	}
+
+	//////////////////////////////////////////////////////////////////////////
+
+	CachingQuery::CachingQuery(AsyncQuery* query, ResponseCache* cache, const std::string& key, int ttl, long long startUs)
+		: m_recorder(query->io(), cache->maxResponseSize() > key.size() ? cache->maxResponseSize() - key.size() : 0)
+	{
+		m_query = query;
+		m_cache = cache;
+		m_key = key;
+		m_ttl = ttl;
+		m_startUs = startUs;
+	}
+
+	void CachingQuery::finish()
+	{
+		std::string response;
+		if (!m_query->isCancelled() && m_recorder.response(&response))
+			m_cache->store(m_key, response, m_ttl);
+		m_cache->recordMiss(monotonicTimeUs() - m_startUs);
+
+		m_query->finish();
+		delete this;
+	}
+}
@@ -0,0 +1,189 @@
+/*
+MIT License
+
+Copyright (c) 2019 GIS Core R&D Department, NavInfo Co., Ltd
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+
+#include "ncserver/async_query.h"
+#include "ncserver/shared_cache.h"
+#include <atomic>
+#include <map>
+#include <string>
+
+namespace ncserver
+{
+	struct ResponseCacheStats
+	{
+		long long hits;
+		long long misses;
+		long long stores;			// responses of misses put into the cache
+		long long hitMicros;		// spent on hits, replaying the responses
+		long long missMicros;		// spent on misses, query() included
+		long long evictions;
+		long long entries;
+	};
+
+	/**
+		Responses of GET requests cached by the URI and the sorted parameters, and
+		replayed without calling query().
+
+		Kept in a SharedCache, so that a response one worker stores is replayed by
+		all of them. A route is either an exact DOCUMENT_URI or a prefix ending with
+		'*', mapped to the seconds its responses are kept, and the longest one
+		matching wins. Only responses without a Status header or with "Status: 200"
+		are stored, and only if they fit into a slot.
+	 */
+	class ResponseCache
+	{
+	public:
+		ResponseCache();
+		~ResponseCache();
+
+		/**
+			Map @a capacity bytes and the counters. Like SharedCache::init(), called
+			before the workers are forked.
+
+			@param path
+				File of the responses, which the next generation adopts if it has the
+				same version, see setVersion(). NULL to keep them in memory only.
+		 */
+		bool init(size_t capacity, size_t slotSize, const std::map<std::string, int>& routes, const char* path = NULL);
+		bool isEnabled() const { return m_stats != NULL; }
+
+		/**
+			Replay only the responses stored with @a version, e.g. the versions of
+			all the datasets, and drop the others. Until it is called, a cache of a
+			file neither stores nor replays anything.
+		 */
+		bool setVersion(const char* version);
+
+		/**
+			@return
+				The TTL in seconds of the route of @a uri, 0 if it isn't cached.
+		 */
+		int ttlForUri(const char* uri) const;
+
+		/**
+			DOCUMENT_URI followed by the decoded parameters sorted by name and value,
+			so that "?b=2&a=1" and "?a=1&b=2" share an entry.
+		 */
+		static std::string keyOf(Request* request);
+
+		/**
+			Write the response cached for @a key into @a io.
+
+			@return
+				false if there is none or it has expired.
+		 */
+		bool replay(const std::string& key, ServiceIo* io);
+
+		/**
+			@param response
+				Header fields each ending with "\r\n", an empty line and the body,
+				as recorded by ResponseRecorder.
+		 */
+		void store(const std::string& key, const std::string& response, int ttl);
+
+		void recordHit(long long micros);
+		void recordMiss(long long micros);
+
+		ResponseCacheStats stats() const;
+
+		/**
+			Bytes of the largest response stored, its key included.
+		 */
+		size_t maxResponseSize() const;
+
+	private:
+		ResponseCache(const ResponseCache&);
+		ResponseCache& operator=(const ResponseCache&);
+
+		struct Counters;
+
+		void clear();
+
+		SharedCache m_cache;
+		Counters* m_stats;
+		std::map<std::string, int> m_exactRoutes;
+		std::map<std::string, int> m_prefixRoutes;	// without the '*'
+	};
+
+	/**
+		ServiceIo which passes everything on to another one and keeps a copy of the
+		response, up to a limit.
+	 */
+	class ResponseRecorder : public ServiceIo
+	{
+	public:
+		ResponseRecorder(ServiceIo* io, size_t limit);
+
+		virtual void read(void* buffer, size_t size);
+		virtual void write(void* buffer, size_t size);
+		virtual int print(const char* format, ...);
+		virtual int addHeaderField(const char* format, ...);
+		virtual void endHeaderField(void);
+		virtual void flush(void);
+
+		/**
+			@return
+				The response in the format of ResponseCache::store(), or false if it
+				exceeded the limit or isn't a "200 OK".
+		 */
+		bool response(std::string* response) const;
+
+	private:
+		void append(const char* data, size_t size);
+
+		ServiceIo* m_io;
+		size_t m_limit;
+		std::string m_response;
+		bool m_overflow;
+		bool m_headerEnded;
+		bool m_ok;
+	};
+
+	/**
+		Stands for a query which missed the cache, and stores its response in the
+		cache when it is finished. Deletes itself in finish().
+	 */
+	class CachingQuery : public AsyncQuery
+	{
+	public:
+		CachingQuery(AsyncQuery* query, ResponseCache* cache, const std::string& key, int ttl, long long startUs);
+
+		virtual ServiceIo* io() { return &m_recorder; }
+		virtual Request* request() { return m_query->request(); }
+		virtual AsyncLoop* loop() { return m_query->loop(); }
+		virtual void finish();
+		virtual bool isCancelled() { return m_query->isCancelled(); }
+
+	private:
+		virtual ~CachingQuery() {}
+
+		AsyncQuery* m_query;
+		ResponseCache* m_cache;
+		std::string m_key;
+		int m_ttl;
+		long long m_startUs;
+		ResponseRecorder m_recorder;
+	};
+}
@@ -0,0 +1,698 @@
+/*
+MIT License
+
+Copyright (c) 2019 GIS Core R&D Department, NavInfo Co., Ltd
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "stdafx.h"
+#include "ncserver/shared_cache.h"
+#include "ncserver/nc_log.h"
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+
+#ifndef WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#endif
+
+namespace ncserver
+{
+	// attempts of get() against writers before it gives up as a miss
+	static const int READ_ATTEMPTS = 64;
+	// spins of a writer before it checks whether the holder of the lock is alive
+	static const int LIVENESS_SPINS = 1 << 16;
+
+	static const char CACHE_MAGIC[8] = "NCCACHE";
+	// of the layout of the file, changed with Header, Counters, Bucket or Slot
+	static const unsigned int CACHE_FORMAT_VERSION = 1;
+
+	/**
+		The head of the mapping, which tells whether a file can be adopted.
+	 */
+	struct alignas(64) SharedCache::Header
+	{
+		char magic[8];
+		unsigned int formatVersion;
+		std::atomic<unsigned int> datasetCount;
+		unsigned long long slotSize;
+		unsigned long long bucketCount;
+		// the tag of an entry is the index of its dataset here, appended by setVersion()
+		char datasets[MAX_DATASETS][64];
+	};
+
+	/**
+		Counted in stripes of a cache line each, by bucket, so that the workers
+		don't all write to the same line.
+	 */
+	struct alignas(64) SharedCache::Counters
+	{
+		std::atomic<long long> hits;
+		std::atomic<long long> misses;
+		std::atomic<long long> insertions;
+		std::atomic<long long> evictions;
+		std::atomic<long long> contentions;
+		std::atomic<long long> invalidations;
+		std::atomic<long long> entries;
+	};
+
+	struct alignas(64) SharedCache::Bucket
+	{
+		std::atomic<unsigned int> sequence;		// odd while a writer changes the slots
+		std::atomic<long> writer;				// thread holding the lock, 0 if none
+		int hand;								// the next way CLOCK looks at
+	};
+
+	/**
+		The head of a slot, followed by the key and the value.
+	 */
+	struct SharedCache::Slot
+	{
+		unsigned long long hash;				// 0 if the slot is empty
+		unsigned int keySize;
+		unsigned int valueSize;
+		std::atomic<unsigned int> referenced;	// read since the CLOCK hand passed
+		unsigned int dataset;					// index in Header + 1, 0 if none
+		unsigned long long version;				// of the dataset when it was put
+
+		// the key and the value, as bytes rather than more slots
+		char* payload() { return (char*)this + sizeof(Slot); }
+		const char* payload() const { return (const char*)this + sizeof(Slot); }
+	};
+
+	static long _threadId()
+	{
+#ifndef WIN32
+		return (long)syscall(SYS_gettid);
+#else
+		return (long)(std::hash<std::thread::id>()(std::this_thread::get_id()) | 1);
+#endif
+	}
+
+	static bool _threadAlive(long id)
+	{
+#ifndef WIN32
+		return kill((pid_t)id, 0) == 0 || errno != ESRCH;
+#else
+		return true;
+#endif
+	}
+
+	/**
+		FNV-1a, never 0, which marks an empty slot.
+	 */
+	static unsigned long long _hash(const void* key, size_t size)
+	{
+		const unsigned char* bytes = (const unsigned char*)key;
+		unsigned long long hash = 14695981039346656037ULL;
+		for (size_t i = 0; i < size; i++)
+			hash = (hash ^ bytes[i]) * 1099511628211ULL;
+		return hash == 0 ? 1 : hash;
+	}
+
+	static size_t _alignUp(size_t size, size_t alignment)
+	{
+		return (size + alignment - 1) / alignment * alignment;
+	}
+
+	void SharedCache::initHeader(void* memory, size_t slotSize, size_t bucketCount)
+	{
+		Header* header = (Header*)memory;
+		header->formatVersion = CACHE_FORMAT_VERSION;
+		header->slotSize = slotSize;
+		header->bucketCount = bucketCount;
+		memcpy(header->magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+	}
+
+	SharedCache::SharedCache()
+	{
+		m_memory = NULL;
+		m_mappedSize = 0;
+		m_fileMapped = false;
+		m_fd = -1;
+		m_header = NULL;
+		memset(m_versions, 0, sizeof(m_versions));
+		m_counters = NULL;
+		m_buckets = NULL;
+		m_slots = NULL;
+		m_bucketCount = 0;
+		m_slotSize = 0;
+	}
+
+	SharedCache::~SharedCache()
+	{
+		clear();
+	}
+
+	void SharedCache::clear()
+	{
+		if (m_memory != NULL)
+		{
+#ifndef WIN32
+			munmap(m_memory, m_mappedSize);
+#else
+			free(m_memory);
+#endif
+		}
+#ifndef WIN32
+		if (m_fd >= 0)
+			close(m_fd);
+#endif
+		m_memory = NULL;
+		m_mappedSize = 0;
+		m_fileMapped = false;
+		m_fd = -1;
+		m_header = NULL;
+		memset(m_versions, 0, sizeof(m_versions));
+		m_counters = NULL;
+		m_buckets = NULL;
+		m_slots = NULL;
+		m_bucketCount = 0;
+		m_slotSize = 0;
+	}
+
+	bool SharedCache::init(size_t capacity, size_t slotSize, const char* path)
+	{
+		clear();
+		slotSize = _alignUp(slotSize > sizeof(Slot) ? slotSize : sizeof(Slot) + 8, sizeof(unsigned long long));
+		size_t bucketCount = capacity / (slotSize * WAY_COUNT);
+		if (bucketCount == 0)
+			bucketCount = 1;
+
+		size_t countersOffset = sizeof(Header);
+		size_t bucketsOffset = countersOffset + sizeof(Counters) * COUNTER_STRIPES;
+		size_t slotsOffset = bucketsOffset + sizeof(Bucket) * bucketCount;
+		size_t mappedSize = slotsOffset + slotSize * WAY_COUNT * bucketCount;
+
+		// shared with the workers forked from now on, rather than copied on write
+		bool adopted = false;
+#ifndef WIN32
+		void* memory = NULL;
+		if (path != NULL)
+		{
+			memory = mapFile(path, mappedSize, slotSize, bucketCount, &adopted);
+			if (memory == NULL)
+				return false;
+		}
+		else
+		{
+			memory = mmap(NULL, mappedSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+			if (memory == MAP_FAILED)
+				memory = NULL;
+		}
+#else
+		if (path != NULL)
+			ASYNC_LOG_WARNING("A shared cache can't be mapped from %s on Windows, it lives in memory only", path);
+		path = NULL;
+		void* memory = calloc(1, mappedSize);
+#endif
+		if (memory == NULL)
+		{
+			ASYNC_LOG_ERR("Failed to map %zu bytes for a shared cache", mappedSize);
+			return false;
+		}
+
+		m_memory = memory;
+		m_mappedSize = mappedSize;
+		m_fileMapped = path != NULL;
+		m_header = (Header*)memory;
+		m_counters = (Counters*)((char*)memory + countersOffset);
+		m_buckets = (Bucket*)((char*)memory + bucketsOffset);
+		m_slots = (char*)memory + slotsOffset;
+		m_bucketCount = bucketCount;
+		m_slotSize = slotSize;
+
+		if (adopted)
+		{
+			recover();
+			ASYNC_LOG_NOTICE("Adopted %lld entries of the shared cache %s", stats().entries, path);
+			return true;
+		}
+
+		// the pages are zero, i.e. the slots are empty
+		if (path == NULL)
+			initHeader(memory, slotSize, bucketCount);
+		for (int i = 0; i < COUNTER_STRIPES; i++)
+			new (&m_counters[i]) Counters();
+		for (size_t i = 0; i < bucketCount; i++)
+			new (&m_buckets[i]) Bucket();
+		return true;
+	}
+
+#ifndef WIN32
+	void* SharedCache::mapFile(const char* path, size_t size, size_t slotSize, size_t bucketCount, bool* adopted)
+	{
+		int fd = open(path, O_RDWR | O_CLOEXEC);
+		if (fd >= 0)
+		{
+			// adopted if it has the same layout, including the sizes of the configuration
+			char raw[sizeof(Header)];
+			const Header* header = (const Header*)raw;
+			struct stat st;
+			if (fstat(fd, &st) == 0 && (size_t)st.st_size == size && pread(fd, raw, sizeof(raw), 0) == (ssize_t)sizeof(raw)
+				&& memcmp(header->magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) == 0 && header->formatVersion == CACHE_FORMAT_VERSION
+				&& header->slotSize == slotSize && header->bucketCount == bucketCount)
+			{
+				void* memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+				if (memory == MAP_FAILED)
+				{
+					ASYNC_LOG_ERR("Failed to map the shared cache %s: %s", path, strerror(errno));
+					close(fd);
+					return NULL;
+				}
+				// locked by recover()
+				m_fd = fd;
+				*adopted = true;
+				return memory;
+			}
+			close(fd);
+			ASYNC_LOG_NOTICE("The shared cache %s has another layout, an empty one replaces it", path);
+		}
+
+		// Renamed into place once it has a header. Processes which have mapped the
+		// former file, e.g. the workers of the former generation, keep theirs.
+		char tmpPath[4096];
+		snprintf(tmpPath, sizeof(tmpPath), "%s.%d.tmp", path, (int)getpid());
+		fd = open(tmpPath, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+		if (fd < 0)
+		{
+			ASYNC_LOG_ERR("Failed to create the shared cache %s: %s", tmpPath, strerror(errno));
+			return NULL;
+		}
+		void* memory = MAP_FAILED;
+		if (ftruncate(fd, (off_t)size) == 0 && flock(fd, LOCK_SH) == 0)
+			memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (memory == MAP_FAILED)
+		{
+			ASYNC_LOG_ERR("Failed to map %zu bytes of the shared cache %s: %s", size, tmpPath, strerror(errno));
+			close(fd);
+			unlink(tmpPath);
+			return NULL;
+		}
+
+		initHeader(memory, slotSize, bucketCount);
+		if (rename(tmpPath, path) != 0)
+		{
+			ASYNC_LOG_ERR("Failed to rename %s to %s: %s", tmpPath, path, strerror(errno));
+			munmap(memory, size);
+			close(fd);
+			unlink(tmpPath);
+			return NULL;
+		}
+		m_fd = fd;
+		return memory;
+	}
+#endif
+
+	void SharedCache::recover()
+	{
+#ifndef WIN32
+		// Every process which maps the file holds a shared lock on it, inherited
+		// by the workers. If nothing else does, the writers recorded are of a
+		// former run, whose thread ids may have been reused since, even by this
+		// one, and the locks of the buckets are reset rather than trusted.
+		if (flock(m_fd, LOCK_EX | LOCK_NB) == 0)
+		{
+			for (size_t i = 0; i < m_bucketCount; i++)
+			{
+				Bucket& bucket = m_buckets[i];
+				if ((bucket.sequence.load(std::memory_order_relaxed) & 1) != 0)
+				{
+					// left half written
+					clearBucket(i, m_counters[i % COUNTER_STRIPES]);
+					bucket.sequence.fetch_add(1, std::memory_order_relaxed);
+				}
+				bucket.writer.store(0, std::memory_order_relaxed);
+			}
+			flock(m_fd, LOCK_SH);
+			return;
+		}
+		// after another generation which adopts it at the same time is done
+		flock(m_fd, LOCK_SH);
+#endif
+
+		// writers of a former generation which died holding the lock of a bucket
+		long self = _threadId();
+		for (size_t i = 0; i < m_bucketCount; i++)
+		{
+			Bucket& bucket = m_buckets[i];
+			long holder = bucket.writer.load(std::memory_order_acquire);
+			if (holder == 0 || _threadAlive(holder) || !bucket.writer.compare_exchange_strong(holder, self, std::memory_order_acquire))
+				continue;
+
+			if ((bucket.sequence.load(std::memory_order_relaxed) & 1) != 0)
+			{
+				clearBucket(i, m_counters[i % COUNTER_STRIPES]);
+				unlock(bucket);
+			}
+			else
+			{
+				bucket.writer.store(0, std::memory_order_release);
+			}
+		}
+	}
+
+	bool SharedCache::setVersion(const char* dataset, const char* version)
+	{
+		if (m_memory == NULL)
+			return false;
+
+		int index = findDataset(dataset);
+		if (index < 0)
+		{
+			unsigned int count = m_header->datasetCount.load(std::memory_order_acquire);
+			if (count >= MAX_DATASETS || strlen(dataset) >= sizeof(m_header->datasets[0]))
+			{
+				ASYNC_LOG_ERR("No room for dataset %s in the shared cache", dataset);
+				return false;
+			}
+			strcpy(m_header->datasets[count], dataset);
+			m_header->datasetCount.store(count + 1, std::memory_order_release);
+			index = (int)count;
+		}
+
+		// an unknown version differs from any other, even that of another unknown one
+		unsigned long long tag = 0;
+		if (version[0] != '\0')
+			tag = _hash(version, strlen(version));
+		else
+			tag = ((unsigned long long)std::chrono::high_resolution_clock::now().time_since_epoch().count() ^ ((unsigned long long)_threadId() << 40)) | 1;
+		m_versions[index] = tag;
+
+		// The stale entries leave room for others at once rather than being evicted
+		// one at a time. Buckets without one aren't locked.
+		unsigned int tagIndex = (unsigned int)index + 1;
+		for (size_t i = 0; i < m_bucketCount; i++)
+		{
+			bool stale = false;
+			for (int way = 0; way < WAY_COUNT && !stale; way++)
+			{
+				const Slot* slot = slotAt(i, way);
+				stale = slot->hash != 0 && slot->dataset == tagIndex && slot->version != tag;
+			}
+			if (!stale)
+				continue;
+
+			Bucket& bucket = m_buckets[i];
+			Counters& counters = m_counters[i % COUNTER_STRIPES];
+			lock(bucket, i, counters);
+			for (int way = 0; way < WAY_COUNT; way++)
+			{
+				Slot* slot = slotAt(i, way);
+				if (slot->hash != 0 && slot->dataset == tagIndex && slot->version != tag)
+				{
+					slot->hash = 0;
+					counters.entries.fetch_sub(1, std::memory_order_relaxed);
+					counters.invalidations.fetch_add(1, std::memory_order_relaxed);
+				}
+			}
+			unlock(bucket);
+		}
+		return true;
+	}
+
+	int SharedCache::findDataset(const char* dataset) const
+	{
+		unsigned int count = m_header->datasetCount.load(std::memory_order_acquire);
+		for (unsigned int i = 0; i < count && i < MAX_DATASETS; i++)
+		{
+			if (strncmp(m_header->datasets[i], dataset, sizeof(m_header->datasets[i])) == 0)
+				return (int)i;
+		}
+		return -1;
+	}
+
+	bool SharedCache::isCurrent(const Slot* slot) const
+	{
+		// read while a writer may change it, hence the range check
+		unsigned int dataset = slot->dataset;
+		if (dataset == 0)
+			return true;
+		return dataset <= MAX_DATASETS && m_versions[dataset - 1] != 0 && slot->version == m_versions[dataset - 1];
+	}
+
+	void SharedCache::clearBucket(size_t index, Counters& counters)
+	{
+		for (int way = 0; way < WAY_COUNT; way++)
+		{
+			Slot* slot = slotAt(index, way);
+			if (slot->hash != 0)
+				counters.entries.fetch_sub(1, std::memory_order_relaxed);
+			slot->hash = 0;
+		}
+	}
+
+	size_t SharedCache::maxEntrySize() const
+	{
+		return m_slotSize > sizeof(Slot) ? m_slotSize - sizeof(Slot) : 0;
+	}
+
+	SharedCache::Slot* SharedCache::slotAt(size_t bucket, int way) const
+	{
+		return (Slot*)(m_slots + (bucket * WAY_COUNT + way) * m_slotSize);
+	}
+
+	int SharedCache::findWay(size_t bucket, unsigned long long hash, const void* key, size_t keySize) const
+	{
+		for (int way = 0; way < WAY_COUNT; way++)
+		{
+			const Slot* slot = slotAt(bucket, way);
+			if (slot->hash == hash && slot->keySize == keySize && memcmp(slot->payload(), key, keySize) == 0)
+				return way;
+		}
+		return -1;
+	}
+
+	bool SharedCache::get(const void* key, size_t keySize, std::string* value)
+	{
+		if (m_memory == NULL)
+			return false;
+
+		unsigned long long hash = _hash(key, keySize);
+		size_t index = hash % m_bucketCount;
+		Bucket& bucket = m_buckets[index];
+		Counters& counters = m_counters[index % COUNTER_STRIPES];
+		size_t maxSize = maxEntrySize();
+
+		for (int attempt = 0; attempt < READ_ATTEMPTS; attempt++)
+		{
+			unsigned int sequence = bucket.sequence.load(std::memory_order_acquire);
+			if ((sequence & 1) == 0)
+			{
+				// A writer may change the slot while it is copied, which the
+				// sequence tells afterwards. The sizes are checked before they
+				// are used, as they may be torn as well.
+				int way = -1;
+				for (int i = 0; i < WAY_COUNT && way < 0; i++)
+				{
+					const Slot* slot = slotAt(index, i);
+					// read once, as the one checked has to be the one copied
+					unsigned int valueSize = *(const volatile unsigned int*)&slot->valueSize;
+					if (slot->hash == hash && slot->keySize == keySize && keySize <= maxSize
+						&& valueSize <= maxSize - keySize && isCurrent(slot) && memcmp(slot->payload(), key, keySize) == 0)
+					{
+						value->assign(slot->payload() + keySize, valueSize);
+						way = i;
+					}
+				}
+				std::atomic_thread_fence(std::memory_order_acquire);
+				if (bucket.sequence.load(std::memory_order_relaxed) == sequence)
+				{
+					if (way < 0)
+					{
+						counters.misses.fetch_add(1, std::memory_order_relaxed);
+						return false;
+					}
+					Slot* slot = slotAt(index, way);
+					if (slot->referenced.load(std::memory_order_relaxed) == 0)
+						slot->referenced.store(1, std::memory_order_relaxed);
+					counters.hits.fetch_add(1, std::memory_order_relaxed);
+					return true;
+				}
+			}
+			counters.contentions.fetch_add(1, std::memory_order_relaxed);
+#ifndef WIN32
+			sched_yield();
+#else
+			std::this_thread::yield();
+#endif
+		}
+		counters.misses.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	void SharedCache::lock(Bucket& bucket, size_t index, Counters& counters)
+	{
+		long self = _threadId();
+		long expected = 0;
+		int spins = 0;
+		while (!bucket.writer.compare_exchange_weak(expected, self, std::memory_order_acquire))
+		{
+			if (expected == 0)
+				continue;
+			if (spins++ == 0)
+				counters.contentions.fetch_add(1, std::memory_order_relaxed);
+			// the holder has died, e.g. with its worker
+			if (spins % LIVENESS_SPINS == 0 && !_threadAlive(expected)
+				&& bucket.writer.compare_exchange_strong(expected, self, std::memory_order_acquire))
+			{
+				break;
+			}
+			expected = 0;
+#ifndef WIN32
+			sched_yield();
+#else
+			std::this_thread::yield();
+#endif
+		}
+
+		if ((bucket.sequence.load(std::memory_order_relaxed) & 1) != 0)
+		{
+			// left half written by the dead holder
+			clearBucket(index, counters);
+		}
+		else
+		{
+			bucket.sequence.fetch_add(1, std::memory_order_relaxed);
+		}
+		std::atomic_thread_fence(std::memory_order_release);
+	}
+
+	void SharedCache::unlock(Bucket& bucket)
+	{
+		bucket.sequence.fetch_add(1, std::memory_order_release);
+		bucket.writer.store(0, std::memory_order_release);
+	}
+
+	bool SharedCache::put(const void* key, size_t keySize, const void* value, size_t valueSize, const char* dataset)
+	{
+		size_t maxSize = maxEntrySize();
+		if (m_memory == NULL || keySize > maxSize || valueSize > maxSize - keySize)
+			return false;
+
+		unsigned int tagIndex = 0;
+		unsigned long long version = 0;
+		if (dataset != NULL)
+		{
+			int index = findDataset(dataset);
+			if (index < 0 || m_versions[index] == 0)
+				return false;
+			tagIndex = (unsigned int)index + 1;
+			version = m_versions[index];
+		}
+
+		unsigned long long hash = _hash(key, keySize);
+		size_t index = hash % m_bucketCount;
+		Bucket& bucket = m_buckets[index];
+		Counters& counters = m_counters[index % COUNTER_STRIPES];
+		lock(bucket, index, counters);
+
+		// the entry of the same key, an empty or stale slot, or the one CLOCK evicts
+		int way = findWay(index, hash, key, keySize);
+		for (int i = 0; i < WAY_COUNT && way < 0; i++)
+		{
+			const Slot* slot = slotAt(index, i);
+			if (slot->hash == 0)
+			{
+				way = i;
+				counters.entries.fetch_add(1, std::memory_order_relaxed);
+			}
+			else if (!isCurrent(slot))
+			{
+				way = i;
+				counters.invalidations.fetch_add(1, std::memory_order_relaxed);
+			}
+		}
+		while (way < 0)
+		{
+			Slot* slot = slotAt(index, bucket.hand);
+			if (slot->referenced.load(std::memory_order_relaxed) == 0)
+			{
+				way = bucket.hand;
+				counters.evictions.fetch_add(1, std::memory_order_relaxed);
+			}
+			slot->referenced.store(0, std::memory_order_relaxed);
+			bucket.hand = (bucket.hand + 1) % WAY_COUNT;
+		}
+
+		Slot* slot = slotAt(index, way);
+		slot->hash = hash;
+		slot->keySize = (unsigned int)keySize;
+		slot->valueSize = (unsigned int)valueSize;
+		slot->referenced.store(0, std::memory_order_relaxed);
+		slot->dataset = tagIndex;
+		slot->version = version;
+		memcpy(slot->payload(), key, keySize);
+		memcpy(slot->payload() + keySize, value, valueSize);
+		counters.insertions.fetch_add(1, std::memory_order_relaxed);
+
+		unlock(bucket);
+		return true;
+	}
+
+	void SharedCache::remove(const void* key, size_t keySize)
+	{
+		if (m_memory == NULL)
+			return;
+
+		unsigned long long hash = _hash(key, keySize);
+		size_t index = hash % m_bucketCount;
+		Bucket& bucket = m_buckets[index];
+		Counters& counters = m_counters[index % COUNTER_STRIPES];
+		lock(bucket, index, counters);
+		int way = findWay(index, hash, key, keySize);
+		if (way >= 0)
+		{
+			slotAt(index, way)->hash = 0;
+			counters.entries.fetch_sub(1, std::memory_order_relaxed);
+		}
+		unlock(bucket);
+	}
+
+	SharedCacheStats SharedCache::stats() const
+	{
+		SharedCacheStats stats;
+		memset(&stats, 0, sizeof(stats));
+		for (int i = 0; m_counters != NULL && i < COUNTER_STRIPES; i++)
+		{
+			stats.hits += m_counters[i].hits.load(std::memory_order_relaxed);
+			stats.misses += m_counters[i].misses.load(std::memory_order_relaxed);
+			stats.insertions += m_counters[i].insertions.load(std::memory_order_relaxed);
+			stats.evictions += m_counters[i].evictions.load(std::memory_order_relaxed);
+			stats.contentions += m_counters[i].contentions.load(std::memory_order_relaxed);
+			stats.invalidations += m_counters[i].invalidations.load(std::memory_order_relaxed);
+			stats.entries += m_counters[i].entries.load(std::memory_order_relaxed);
+		}
+		stats.slots = (long long)slotCount();
+		return stats;
+	}
+}
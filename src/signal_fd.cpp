@@ -0,0 +1,96 @@
+/*
+MIT License
+
+Copyright (c) 2019 GIS Core R&D Department, NavInfo Co., Ltd
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "stdafx.h"
+#include "signal_fd.h"
+
+#ifndef WIN32
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/signalfd.h>
+
+namespace ncserver
+{
+	SignalFd::SignalFd()
+	{
+		m_fd = -1;
+		sigemptyset(&m_oldMask);
+	}
+
+	SignalFd::~SignalFd()
+	{
+		close();
+	}
+
+	bool SignalFd::open(std::initializer_list<int> signals)
+	{
+		close();
+
+		sigset_t mask;
+		sigemptyset(&mask);
+		for (int signo : signals)
+			sigaddset(&mask, signo);
+
+		if (pthread_sigmask(SIG_BLOCK, &mask, &m_oldMask) != 0)
+			return false;
+		m_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+		if (m_fd < 0)
+		{
+			pthread_sigmask(SIG_SETMASK, &m_oldMask, NULL);
+			return false;
+		}
+		return true;
+	}
+
+	void SignalFd::close()
+	{
+		if (m_fd < 0)
+			return;
+		::close(m_fd);
+		m_fd = -1;
+		pthread_sigmask(SIG_SETMASK, &m_oldMask, NULL);
+	}
+
+	int SignalFd::wait(int timeoutMs)
+	{
+		if (m_fd < 0)
+		{
+			// the handlers do the job, just don't spin
+			usleep(timeoutMs * 1000);
+			return 0;
+		}
+
+		struct pollfd pfd;
+		pfd.fd = m_fd;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, timeoutMs) <= 0)
+			return 0;
+
+		struct signalfd_siginfo info;
+		if (read(m_fd, &info, sizeof(info)) != (ssize_t)sizeof(info))
+			return 0;
+		return (int)info.ssi_signo;
+	}
+}
+#endif
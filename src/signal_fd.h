@@ -0,0 +1,74 @@
+/*
+MIT License
+
+Copyright (c) 2019 GIS Core R&D Department, NavInfo Co., Ltd
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+
+#ifndef WIN32
+#include <signal.h>
+#include <initializer_list>
+
+namespace ncserver
+{
+	/**
+		Signals of the boss and the manager, read from a signalfd so that their
+		loops block until something happens rather than poll.
+
+		@note
+			Open it before starting any thread, which would take the signals
+			otherwise. The handlers installed for them stay as a fallback, for a
+			thread which unblocks them.
+	 */
+	class SignalFd
+	{
+	public:
+		SignalFd();
+		~SignalFd();
+
+		/**
+			Block @a signals in the calling thread and queue them to the signalfd.
+			Threads started from now on inherit the mask.
+		 */
+		bool open(std::initializer_list<int> signals);
+
+		/**
+			Restore the signal mask, e.g. in a child just forked.
+		 */
+		void close();
+
+		/**
+			Wait up to @a timeoutMs for a signal.
+
+			@return
+				The signal number, 0 if none arrived.
+		 */
+		int wait(int timeoutMs);
+
+	private:
+		SignalFd(const SignalFd&);
+		SignalFd& operator=(const SignalFd&);
+
+		int m_fd;
+		sigset_t m_oldMask;
+	};
+}
+#endif
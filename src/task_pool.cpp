@@ -0,0 +1,258 @@
+/*
+MIT License
+
+Copyright (c) 2019 GIS Core R&D Department, NavInfo Co., Ltd
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "stdafx.h"
+
+#include "ncserver/task_pool.h"
+
+#ifndef WIN32
+#	include <signal.h>
+#endif
+
+namespace ncserver
+{
+	// the pool and the queue index of the calling thread, if it's a thread of a pool
+	static thread_local TaskPool* t_pool = NULL;
+	static thread_local int t_queueIndex = 0;
+
+	TaskGroup::TaskGroup(TaskPool* pool)
+	{
+		m_pool = pool;
+		m_pending = 0;
+	}
+
+	TaskGroup::~TaskGroup()
+	{
+		wait();
+	}
+
+	void TaskGroup::spawn(const std::function<void()>& task)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_pending++;
+		}
+
+		TaskPool::Task t;
+		t.function = task;
+		t.group = this;
+		m_pool->push(t);
+	}
+
+	void TaskGroup::join()
+	{
+		std::exception_ptr exception = wait();
+		if (exception)
+			std::rethrow_exception(exception);
+	}
+
+	std::exception_ptr TaskGroup::wait()
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		while (m_pending > 0)
+		{
+			lock.unlock();
+			TaskPool::Task task;
+			bool found = m_pool->pop(task);
+			if (found)
+				m_pool->run(task);
+			lock.lock();
+
+			// The tasks left may be running in other threads, or be queued after the pop.
+			// The timeout covers the latter, which no idle thread is woken up for.
+			if (!found && m_pending > 0)
+				m_done.wait_for(lock, std::chrono::milliseconds(1));
+		}
+		// Returning with the lock taken once more, the thread finishing the last
+		// task has left the group before it may be destroyed.
+		std::exception_ptr exception = m_exception;
+		m_exception = nullptr;
+		return exception;
+	}
+
+	//////////////////////////////////////////////////////////////////////////
+
+	TaskPool::TaskPool(int threadCount)
+	{
+		if (threadCount < 0)
+			threadCount = 0;
+
+		for (int i = 0; i <= threadCount; i++)
+			m_queues.push_back(new Queue());
+		m_queuedCount = 0;
+		m_stopping = false;
+
+		for (int i = 0; i < threadCount; i++)
+			m_threads.push_back(std::thread(&TaskPool::threadMain, this, i));
+	}
+
+	TaskPool::~TaskPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_idleMutex);
+			m_stopping = true;
+		}
+		m_idle.notify_all();
+
+		for (size_t i = 0; i < m_threads.size(); i++)
+			m_threads[i].join();
+		for (size_t i = 0; i < m_queues.size(); i++)
+			delete m_queues[i];
+	}
+
+	void TaskPool::parallelFor(size_t begin, size_t end, size_t grainSize, const std::function<void(size_t begin, size_t end)>& body)
+	{
+		if (grainSize == 0)
+			grainSize = 1;
+
+		// declared first, so that a body which throws in this thread leaves it to
+		// the tasks the group still waits for
+		std::function<void(size_t, size_t)> split;
+		TaskGroup group(this);
+		split = [&](size_t first, size_t last) {
+			// keep the lower half, so that the thieves take the biggest pieces
+			while (last - first > grainSize)
+			{
+				size_t middle = first + (last - first) / 2;
+				group.spawn([&split, middle, last]() { split(middle, last); });
+				last = middle;
+			}
+			if (first < last)
+				body(first, last);
+		};
+
+		split(begin, end);
+		group.join();
+	}
+
+	void TaskPool::push(const Task& task)
+	{
+		Queue* queue = t_pool == this ? m_queues[t_queueIndex] : m_queues.back();
+		{
+			std::lock_guard<std::mutex> lock(queue->mutex);
+			queue->tasks.push_back(task);
+		}
+
+		m_queuedCount++;
+		{
+			std::lock_guard<std::mutex> lock(m_idleMutex);
+		}
+		m_idle.notify_one();
+	}
+
+	bool TaskPool::pop(Task& task)
+	{
+		if (m_queuedCount == 0)
+			return false;
+
+		int threadCount = (int)m_threads.size();
+		int shared = threadCount;
+		int own = t_pool == this ? t_queueIndex : shared;
+
+		if (own != shared && take(own, true, task))
+			return true;
+		if (take(shared, false, task))
+			return true;
+
+		// steal, starting from the next thread
+		int first = own != shared ? own + 1 : 0;
+		for (int i = 0; i < threadCount; i++)
+		{
+			int index = (first + i) % threadCount;
+			if (index != own && take(index, false, task))
+				return true;
+		}
+		return false;
+	}
+
+	bool TaskPool::take(int queueIndex, bool newest, Task& task)
+	{
+		Queue* queue = m_queues[queueIndex];
+		std::lock_guard<std::mutex> lock(queue->mutex);
+		if (queue->tasks.empty())
+			return false;
+
+		if (newest)
+		{
+			task = queue->tasks.back();
+			queue->tasks.pop_back();
+		}
+		else
+		{
+			task = queue->tasks.front();
+			queue->tasks.pop_front();
+		}
+		m_queuedCount--;
+		return true;
+	}
+
+	void TaskPool::run(Task& task)
+	{
+		// rethrown by the join, as the group has to be done with the task anyway
+		std::exception_ptr exception;
+		try
+		{
+			task.function();
+		}
+		catch (...)
+		{
+			exception = std::current_exception();
+		}
+		task.function = nullptr;
+
+		TaskGroup* group = task.group;
+		std::lock_guard<std::mutex> lock(group->m_mutex);
+		if (exception && !group->m_exception)
+			group->m_exception = exception;
+		if (--group->m_pending == 0)
+			group->m_done.notify_all();
+	}
+
+	void TaskPool::threadMain(int index)
+	{
+#ifndef WIN32
+		// the signals are for the serving threads, which may be blocked in accept()
+		sigset_t signals;
+		sigfillset(&signals);
+		pthread_sigmask(SIG_BLOCK, &signals, NULL);
+#endif
+		t_pool = this;
+		t_queueIndex = index;
+
+		for (;;)
+		{
+			Task task;
+			if (pop(task))
+			{
+				run(task);
+				continue;
+			}
+
+			std::unique_lock<std::mutex> lock(m_idleMutex);
+			while (m_queuedCount == 0 && !m_stopping)
+				m_idle.wait(lock);
+			if (m_stopping && m_queuedCount == 0)
+				break;
+		}
+	}
+}
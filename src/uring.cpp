@@ -0,0 +1,236 @@
+/*
+MIT License
+
+Copyright (c) 2019 GIS Core R&D Department, NavInfo Co., Ltd
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "stdafx.h"
+
+#include "uring.h"
+
+#ifdef NC_HAS_IO_URING
+
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+
+namespace ncserver
+{
+	static int _setup(unsigned entries, struct io_uring_params* params)
+	{
+		return (int)syscall(__NR_io_uring_setup, entries, params);
+	}
+
+	static int _enter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags, void* arg, size_t argSize)
+	{
+		return (int)syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, arg, argSize);
+	}
+
+	static int _register(int fd, unsigned opcode, void* arg, unsigned argCount)
+	{
+		return (int)syscall(__NR_io_uring_register, fd, opcode, arg, argCount);
+	}
+
+	IoUring::IoUring()
+	{
+		m_fd = -1;
+		m_ring = MAP_FAILED;
+		m_ringSize = 0;
+		m_sqes = (struct io_uring_sqe*)MAP_FAILED;
+		m_sqesSize = 0;
+		m_sqHead = m_sqTail = NULL;
+		m_sqMask = m_sqEntries = m_sqLocalTail = 0;
+		m_cqHead = m_cqTail = NULL;
+		m_cqMask = 0;
+		m_cqes = NULL;
+		m_bufferRing = (struct io_uring_buf_ring*)MAP_FAILED;
+		m_bufferRingSize = 0;
+		m_buffers = (char*)MAP_FAILED;
+		m_bufferSize = 0;
+		m_bufferMask = 0;
+		m_bufferTail = 0;
+	}
+
+	IoUring::~IoUring()
+	{
+		// closing the ring cancels the operations in flight
+		if (m_fd >= 0)
+			close(m_fd);
+		if (m_sqes != MAP_FAILED)
+			munmap(m_sqes, m_sqesSize);
+		if (m_ring != MAP_FAILED)
+			munmap(m_ring, m_ringSize);
+		if (m_bufferRing != MAP_FAILED)
+			munmap(m_bufferRing, m_bufferRingSize);
+		if (m_buffers != MAP_FAILED)
+			munmap(m_buffers, (size_t)(m_bufferMask + 1) * m_bufferSize);
+	}
+
+	bool IoUring::init(unsigned entries)
+	{
+		struct io_uring_params params;
+		memset(&params, 0, sizeof(params));
+		// multishot operations may complete many times for one submission
+		params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_COOP_TASKRUN;
+		params.cq_entries = entries * 8;
+		m_fd = _setup(entries, &params);
+		if (m_fd < 0 && errno == EINVAL)
+		{
+			// before Linux 6.0
+			memset(&params, 0, sizeof(params));
+			params.flags = IORING_SETUP_CQSIZE;
+			params.cq_entries = entries * 8;
+			m_fd = _setup(entries, &params);
+		}
+		if (m_fd < 0)
+			return false;
+
+		// the timeout of io_uring_enter() needs IORING_FEAT_EXT_ARG (Linux 5.11)
+		if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_EXT_ARG))
+			return false;
+
+		size_t sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+		size_t cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+		m_ringSize = sqRingSize > cqRingSize ? sqRingSize : cqRingSize;
+		m_ring = mmap(NULL, m_ringSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+		if (m_ring == MAP_FAILED)
+			return false;
+
+		m_sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+		m_sqes = (struct io_uring_sqe*)mmap(NULL, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+		if (m_sqes == MAP_FAILED)
+			return false;
+
+		char* ring = (char*)m_ring;
+		m_sqHead = (unsigned*)(ring + params.sq_off.head);
+		m_sqTail = (unsigned*)(ring + params.sq_off.tail);
+		m_sqMask = *(unsigned*)(ring + params.sq_off.ring_mask);
+		m_sqEntries = params.sq_entries;
+		m_sqLocalTail = *m_sqTail;
+
+		// the entries are always used in order, so the index array never changes
+		unsigned* sqArray = (unsigned*)(ring + params.sq_off.array);
+		for (unsigned i = 0; i < m_sqEntries; i++)
+			sqArray[i] = i;
+
+		m_cqHead = (unsigned*)(ring + params.cq_off.head);
+		m_cqTail = (unsigned*)(ring + params.cq_off.tail);
+		m_cqMask = *(unsigned*)(ring + params.cq_off.ring_mask);
+		m_cqes = (struct io_uring_cqe*)(ring + params.cq_off.cqes);
+		return true;
+	}
+
+	struct io_uring_sqe* IoUring::getSqe()
+	{
+		if (m_sqLocalTail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE) >= m_sqEntries)
+		{
+			submit(0, 0);
+			if (m_sqLocalTail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE) >= m_sqEntries)
+				return NULL;
+		}
+
+		struct io_uring_sqe* sqe = &m_sqes[m_sqLocalTail & m_sqMask];
+		m_sqLocalTail++;
+		memset(sqe, 0, sizeof(*sqe));
+		return sqe;
+	}
+
+	int IoUring::submitAndWait(int timeoutMs)
+	{
+		// no need to sleep when completions are waiting
+		bool ready = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE) != *m_cqHead;
+		return submit(ready ? 0 : 1, timeoutMs);
+	}
+
+	int IoUring::submit(unsigned waitNr, int timeoutMs)
+	{
+		unsigned toSubmit = m_sqLocalTail - *m_sqTail;
+		__atomic_store_n(m_sqTail, m_sqLocalTail, __ATOMIC_RELEASE);
+
+		struct __kernel_timespec ts;
+		ts.tv_sec = timeoutMs / 1000;
+		ts.tv_nsec = (long long)(timeoutMs % 1000) * 1000000;
+
+		struct io_uring_getevents_arg arg;
+		memset(&arg, 0, sizeof(arg));
+		arg.ts = (uint64_t)(uintptr_t)&ts;
+
+		// all the queued entries are submitted by one system call
+		int ret = _enter(m_fd, toSubmit, waitNr, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+		if (ret < 0 && errno == ETIME)
+			return 0;
+		return ret;
+	}
+
+	struct io_uring_cqe* IoUring::peekCqe()
+	{
+		unsigned head = *m_cqHead;
+		if (head == __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE))
+			return NULL;
+		return &m_cqes[head & m_cqMask];
+	}
+
+	void IoUring::cqeSeen()
+	{
+		__atomic_store_n(m_cqHead, *m_cqHead + 1, __ATOMIC_RELEASE);
+	}
+
+	bool IoUring::setupBufferRing(uint16_t groupId, unsigned count, unsigned size)
+	{
+		m_bufferRingSize = count * sizeof(struct io_uring_buf);
+		m_bufferRing = (struct io_uring_buf_ring*)mmap(NULL, m_bufferRingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (m_bufferRing == MAP_FAILED)
+			return false;
+
+		struct io_uring_buf_reg reg;
+		memset(&reg, 0, sizeof(reg));
+		reg.ring_addr = (uint64_t)(uintptr_t)m_bufferRing;
+		reg.ring_entries = count;
+		reg.bgid = groupId;
+		// Linux 5.19
+		if (_register(m_fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0)
+			return false;
+
+		m_buffers = (char*)mmap(NULL, (size_t)count * size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (m_buffers == MAP_FAILED)
+			return false;
+
+		m_bufferSize = size;
+		m_bufferMask = count - 1;
+		m_bufferTail = 0;
+		for (unsigned i = 0; i < count; i++)
+			recycleBuffer((uint16_t)i);
+		return true;
+	}
+
+	void IoUring::recycleBuffer(uint16_t bufferId)
+	{
+		// not m_bufferRing->bufs, __DECLARE_FLEX_ARRAY moves it to offset 8 in C++
+		struct io_uring_buf* buf = (struct io_uring_buf*)m_bufferRing + (m_bufferTail & m_bufferMask);
+		buf->addr = (uint64_t)(uintptr_t)buffer(bufferId);
+		buf->len = m_bufferSize;
+		buf->bid = bufferId;
+		m_bufferTail++;
+		__atomic_store_n(&m_bufferRing->tail, m_bufferTail, __ATOMIC_RELEASE);
+	}
+}
+
+#endif
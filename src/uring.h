@@ -0,0 +1,123 @@
+/*
+MIT License
+
+Copyright (c) 2019 GIS Core R&D Department, NavInfo Co., Ltd
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+
+#if !defined(WIN32) && defined(__has_include)
+#	if __has_include(<linux/io_uring.h>)
+#		include <linux/io_uring.h>
+#		if defined(IORING_RECV_MULTISHOT)
+#			define NC_HAS_IO_URING 1
+#		endif
+#	endif
+#endif
+
+#ifdef NC_HAS_IO_URING
+
+#include <stdint.h>
+
+namespace ncserver
+{
+	/**
+		A thin wrapper of io_uring made of raw system calls, so that liburing
+		is not required. It is only used by one thread.
+	 */
+	class IoUring
+	{
+	public:
+		IoUring();
+		~IoUring();
+
+		/**
+			@return
+				false if the kernel doesn't support io_uring or a feature the engines rely on.
+		 */
+		bool init(unsigned entries);
+
+		/**
+			Get a zeroed submission entry. The queued entries are submitted when the queue is full.
+		 */
+		struct io_uring_sqe* getSqe();
+
+		/**
+			Submit the queued entries and wait at most timeoutMs milliseconds for a completion.
+
+			@return
+				-1 if interrupted by a signal or on error.
+		 */
+		int submitAndWait(int timeoutMs);
+
+		/**
+			@return
+				The oldest completion not yet seen, NULL if there is none.
+		 */
+		struct io_uring_cqe* peekCqe();
+		void cqeSeen();
+
+		/**
+			Provide count buffers of size bytes to the kernel as buffer group groupId,
+			from which receive operations with IOSQE_BUFFER_SELECT pick buffers.
+
+			@param count
+				Must be a power of 2.
+		 */
+		bool setupBufferRing(uint16_t groupId, unsigned count, unsigned size);
+
+		char* buffer(uint16_t bufferId) { return m_buffers + (size_t)bufferId * m_bufferSize; }
+
+		/**
+			Give the buffer of a completion back to the kernel.
+		 */
+		void recycleBuffer(uint16_t bufferId);
+
+	private:
+		int submit(unsigned waitNr, int timeoutMs);
+
+		int m_fd;
+
+		void* m_ring;
+		size_t m_ringSize;
+		struct io_uring_sqe* m_sqes;
+		size_t m_sqesSize;
+
+		unsigned* m_sqHead;
+		unsigned* m_sqTail;
+		unsigned m_sqMask;
+		unsigned m_sqEntries;
+		unsigned m_sqLocalTail;		// entries before it are queued, maybe not yet published
+
+		unsigned* m_cqHead;
+		unsigned* m_cqTail;
+		unsigned m_cqMask;
+		struct io_uring_cqe* m_cqes;
+
+		struct io_uring_buf_ring* m_bufferRing;
+		size_t m_bufferRingSize;
+		char* m_buffers;
+		unsigned m_bufferSize;
+		unsigned m_bufferMask;
+		uint16_t m_bufferTail;
+	};
+}
+
+#endif
@@ -0,0 +1,475 @@
+/*
+MIT License
+
+Copyright (c) 2019 GIS Core R&D Department, NavInfo Co., Ltd
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "stdafx.h"
+
+#include "uring_server.h"
+
+#ifdef NC_HAS_IO_URING
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include "event_server.h"
+#include "util.h"
+
+namespace ncserver
+{
+	class UringServer::Connection : public FcgiConnectionDelegate, public HttpConnectionDelegate
+	{
+	public:
+		Connection(UringServer* server, int fd)
+		{
+			if (server->m_http)
+				m_protocol = new HttpConnection(this);
+			else
+				m_protocol = new FcgiConnection(this, &server->m_capacity);
+			m_server = server;
+			m_fd = fd;
+			m_index = 0;
+			m_closed = false;
+			m_receiving = false;
+			m_sending = false;
+			m_pendingOperations = 0;
+			m_sendOffset = 0;
+			m_lastActive = 0;
+		}
+
+		virtual ~Connection()
+		{
+			if (m_fd >= 0)
+				::close(m_fd);
+			delete m_protocol;
+		}
+
+		virtual void fcgiConnectionDidReceiveRequest(FcgiConnection* connection, FcgiRequestState* request)
+		{
+			m_server->m_dispatcher.dispatch(m_protocol, request, this);
+		}
+
+		virtual void httpConnectionDidReceiveRequest(HttpConnection* connection, HttpRequestState* request)
+		{
+			m_server->m_dispatcher.dispatch(m_protocol, request, this);
+		}
+
+		bool isIdle() { return !m_sending && m_protocol->isIdle(); }
+
+		uint64_t userData(Operation operation) { return (uint64_t)(uintptr_t)this | operation; }
+
+		UringServer* m_server;
+		ConnectionProtocol* m_protocol;
+		int m_fd;
+		size_t m_index;
+		bool m_closed;
+		bool m_receiving;
+		bool m_sending;
+		// the connection is only deleted after all its operations are completed
+		int m_pendingOperations;
+		// output being sent, which must stay untouched until the send is completed
+		std::string m_sendBuffer;
+		size_t m_sendOffset;
+		long long m_lastActive;
+	};
+
+	//////////////////////////////////////////////////////////////////////////
+
+	UringServer::UringServer(int listenSocket, const NcServerConfig::ServerConfig& config, const RequestHandler& handler)
+		: m_dispatcher(&m_asyncLoop, handler, [this](void* context) { sendOutput((Connection*)context); })
+	{
+		m_listenSocket = listenSocket;
+		m_http = config.engine == NcServerConfig::Engine_http;
+		m_capacity = EventServer::capacityOf(config);
+		m_idleTimeoutMs = (long long)config.keepAliveTimeout * 1000;
+		m_drainTimeoutMs = (long long)config.drainTimeout * 1000;
+		m_maxConnections = config.maxConnections > 0 ? (size_t)config.maxConnections : (size_t)-1;
+		m_acceptArmed = false;
+		m_exiting = false;
+		m_now = monotonicTimeMs();
+	}
+
+	UringServer::~UringServer()
+	{
+		for (size_t i = 0; i < m_connections.size(); i++)
+			delete m_connections[i];
+		for (size_t i = 0; i < m_closedConnections.size(); i++)
+			delete m_closedConnections[i];
+	}
+
+	bool UringServer::init()
+	{
+		// multishot accept and receive need Linux 5.19, the same as the buffer ring
+		return m_ring.init(RING_ENTRIES) && m_ring.setupBufferRing(BUFFER_GROUP, BUFFER_COUNT, BUFFER_SIZE);
+	}
+
+	void UringServer::run(const bool& exitRequested)
+	{
+		// With O_NONBLOCK, accept completes with -EAGAIN instead of waiting.
+		// It may be left by the epoll engine of a previous generation.
+		int flags = fcntl(m_listenSocket, F_GETFL, 0);
+		fcntl(m_listenSocket, F_SETFL, flags & ~O_NONBLOCK);
+
+		armAccept();
+		armAsyncLoopPoll();
+
+		long long nextSweep = m_now + 1000;
+		while (!exitRequested)
+		{
+			m_ring.submitAndWait(1000);
+			m_now = monotonicTimeMs();
+			processCompletions();
+			releaseClosedConnections();
+
+			if (m_now >= nextSweep)
+			{
+				closeIdleConnections();
+				releaseClosedConnections();
+				nextSweep = m_now + 1000;
+			}
+
+			// at the limit, a new connection takes the place of an idle one
+			if (!m_acceptArmed && (m_connections.size() < m_maxConnections || leastActiveIdleConnection() != NULL))
+				armAccept();
+		}
+
+		finishConnections();
+	}
+
+	void UringServer::armAccept()
+	{
+		struct io_uring_sqe* sqe = m_ring.getSqe();
+		if (sqe == NULL)
+			return;
+
+		sqe->opcode = IORING_OP_ACCEPT;
+		sqe->fd = m_listenSocket;
+		// With a limit, accept one at a time: a multishot accept would keep taking
+		// connections until its cancellation reaches the kernel.
+		if (m_maxConnections == (size_t)-1)
+			sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+		sqe->accept_flags = SOCK_CLOEXEC;
+		sqe->user_data = Operation_accept;
+		m_acceptArmed = true;
+	}
+
+	void UringServer::armAsyncLoopPoll()
+	{
+		struct io_uring_sqe* sqe = m_ring.getSqe();
+		if (sqe == NULL)
+			return;
+
+		sqe->opcode = IORING_OP_POLL_ADD;
+		sqe->fd = m_asyncLoop.fd();
+		// one-shot, so that the events runOnce() leaves behind are reported again
+		sqe->poll32_events = POLLIN;
+		sqe->user_data = Operation_asyncLoop;
+	}
+
+	void UringServer::armReceive(Connection* connection)
+	{
+		struct io_uring_sqe* sqe = m_ring.getSqe();
+		if (sqe == NULL)
+		{
+			closeConnection(connection);
+			return;
+		}
+
+		sqe->opcode = IORING_OP_RECV;
+		sqe->fd = connection->m_fd;
+		sqe->ioprio = IORING_RECV_MULTISHOT;
+		sqe->flags = IOSQE_BUFFER_SELECT;
+		sqe->buf_group = BUFFER_GROUP;
+		sqe->user_data = connection->userData(Operation_receive);
+		connection->m_receiving = true;
+		connection->m_pendingOperations++;
+	}
+
+	void UringServer::sendOutput(Connection* connection)
+	{
+		if (connection->m_closed || connection->m_sending)
+			return;
+
+		if (connection->m_sendOffset == connection->m_sendBuffer.size())
+		{
+			if (connection->m_protocol->outputSize() == 0)
+			{
+				if (connection->m_protocol->closeAfterOutput())
+					closeConnection(connection);
+				return;
+			}
+			connection->m_protocol->takeOutput(connection->m_sendBuffer);
+			connection->m_sendOffset = 0;
+		}
+
+		struct io_uring_sqe* sqe = m_ring.getSqe();
+		if (sqe == NULL)
+		{
+			closeConnection(connection);
+			return;
+		}
+
+		sqe->opcode = IORING_OP_SEND;
+		sqe->fd = connection->m_fd;
+		sqe->addr = (uint64_t)(uintptr_t)(connection->m_sendBuffer.data() + connection->m_sendOffset);
+		sqe->len = (uint32_t)(connection->m_sendBuffer.size() - connection->m_sendOffset);
+		sqe->msg_flags = MSG_NOSIGNAL;
+		sqe->user_data = connection->userData(Operation_send);
+		connection->m_sending = true;
+		connection->m_pendingOperations++;
+	}
+
+	void UringServer::processCompletions()
+	{
+		struct io_uring_cqe* cqe;
+		while ((cqe = m_ring.peekCqe()) != NULL)
+		{
+			uint64_t userData = cqe->user_data;
+			int result = cqe->res;
+			uint32_t flags = cqe->flags;
+			m_ring.cqeSeen();
+			handleCompletion(userData, result, flags);
+		}
+	}
+
+	void UringServer::handleCompletion(uint64_t userData, int result, uint32_t flags)
+	{
+		Connection* connection = (Connection*)(uintptr_t)(userData & ~(uint64_t)Operation_mask);
+		switch (userData & Operation_mask)
+		{
+		case Operation_accept:
+			acceptDidComplete(result, flags);
+			break;
+		case Operation_receive:
+			receiveDidComplete(connection, result, flags);
+			break;
+		case Operation_send:
+			sendDidComplete(connection, result);
+			break;
+		case Operation_asyncLoop:
+			m_asyncLoop.runOnce(0);
+			armAsyncLoopPoll();
+			break;
+		}
+	}
+
+	void UringServer::acceptDidComplete(int result, uint32_t flags)
+	{
+		if (!(flags & IORING_CQE_F_MORE))
+			m_acceptArmed = false;	// armed again by the loop
+
+		if (result < 0)
+			return;
+
+		int fd = result;
+		if (m_exiting || (m_connections.size() >= m_maxConnections && !evictIdleConnection()))
+		{
+			::close(fd);
+			return;
+		}
+
+		Connection* connection = new Connection(this, fd);
+		if (m_http)
+		{
+			struct sockaddr_storage addr;
+			socklen_t addrLen = sizeof(addr);
+			if (getpeername(fd, (struct sockaddr*)&addr, &addrLen) == 0)
+				static_cast<HttpConnection*>(connection->m_protocol)->setRemoteAddress((struct sockaddr*)&addr);
+		}
+		connection->m_index = m_connections.size();
+		connection->m_lastActive = m_now;
+		m_connections.push_back(connection);
+		armReceive(connection);
+	}
+
+	void UringServer::receiveDidComplete(Connection* connection, int result, uint32_t flags)
+	{
+		if (!(flags & IORING_CQE_F_MORE))
+		{
+			connection->m_receiving = false;
+			connection->m_pendingOperations--;
+		}
+
+		if (flags & IORING_CQE_F_BUFFER)
+		{
+			uint16_t bufferId = (uint16_t)(flags >> IORING_CQE_BUFFER_SHIFT);
+			if (result > 0 && !connection->m_closed && !m_exiting)
+			{
+				connection->m_lastActive = m_now;
+				if (!connection->m_protocol->feed(m_ring.buffer(bufferId), result))
+					closeConnection(connection);
+			}
+			m_ring.recycleBuffer(bufferId);
+		}
+
+		if (connection->m_closed)
+			return;
+
+		// -ENOBUFS when all the buffers are in use, receive again after they are recycled
+		if (result == 0 || (result < 0 && result != -ENOBUFS && result != -EAGAIN && result != -EINTR))
+		{
+			closeConnection(connection);
+			return;
+		}
+
+		sendOutput(connection);
+		if (!connection->m_closed && !connection->m_receiving)
+			armReceive(connection);
+	}
+
+	void UringServer::sendDidComplete(Connection* connection, int result)
+	{
+		connection->m_sending = false;
+		connection->m_pendingOperations--;
+		if (connection->m_closed)
+			return;
+
+		if (result < 0 && result != -EAGAIN && result != -EINTR)
+		{
+			closeConnection(connection);
+			return;
+		}
+
+		if (result > 0)
+		{
+			connection->m_sendOffset += result;
+			connection->m_lastActive = m_now;
+		}
+		if (connection->m_sendOffset == connection->m_sendBuffer.size())
+		{
+			connection->m_sendBuffer.clear();
+			connection->m_sendOffset = 0;
+		}
+		sendOutput(connection);
+	}
+
+	void UringServer::closeConnection(Connection* connection)
+	{
+		if (connection->m_closed)
+			return;
+
+		connection->m_closed = true;
+		m_dispatcher.cancel(connection);
+		// completes the multishot receive
+		shutdown(connection->m_fd, SHUT_RDWR);
+		::close(connection->m_fd);
+		connection->m_fd = -1;
+
+		// swap-remove from the living connections
+		Connection* last = m_connections.back();
+		m_connections[connection->m_index] = last;
+		last->m_index = connection->m_index;
+		m_connections.pop_back();
+
+		m_closedConnections.push_back(connection);
+	}
+
+	void UringServer::releaseClosedConnections()
+	{
+		size_t kept = 0;
+		for (size_t i = 0; i < m_closedConnections.size(); i++)
+		{
+			Connection* connection = m_closedConnections[i];
+			if (connection->m_pendingOperations == 0)
+				delete connection;
+			else
+				m_closedConnections[kept++] = connection;
+		}
+		m_closedConnections.resize(kept);
+	}
+
+	void UringServer::closeIdleConnections()
+	{
+		for (size_t i = m_connections.size(); i > 0; i--)
+		{
+			Connection* connection = m_connections[i - 1];
+			// not one waiting for a query, while partial input and output the
+			// client doesn't read aren't waited for
+			if (m_now - connection->m_lastActive >= m_idleTimeoutMs && !connection->m_protocol->isServing())
+				closeConnection(connection);
+		}
+	}
+
+	UringServer::Connection* UringServer::leastActiveIdleConnection()
+	{
+		Connection* leastActive = NULL;
+		for (size_t i = 0; i < m_connections.size(); i++)
+		{
+			Connection* connection = m_connections[i];
+			if (connection->isIdle() && (leastActive == NULL || connection->m_lastActive < leastActive->m_lastActive))
+				leastActive = connection;
+		}
+		return leastActive;
+	}
+
+	bool UringServer::evictIdleConnection()
+	{
+		Connection* leastActive = leastActiveIdleConnection();
+		if (leastActive == NULL)
+			return false;
+
+		closeConnection(leastActive);
+		return true;
+	}
+
+	void UringServer::finishConnections()
+	{
+		m_exiting = true;
+
+		// wait for the unfinished queries and the sends in flight, new requests are no longer read
+		long long deadline = monotonicTimeMs() + m_drainTimeoutMs;
+		for (;;)
+		{
+			bool sending = false;
+			for (size_t i = 0; i < m_connections.size() && !sending; i++)
+				sending = m_connections[i]->m_sending;
+			if ((!sending && m_dispatcher.pendingCount() == 0) || monotonicTimeMs() >= deadline)
+				break;
+
+			m_ring.submitAndWait(100);
+			processCompletions();
+		}
+
+		// the rest is sent in blocking mode
+		while (!m_connections.empty())
+		{
+			Connection* connection = m_connections.back();
+			if (!connection->m_sending)
+			{
+				std::string output(connection->m_sendBuffer, connection->m_sendOffset);
+				output.append(connection->m_protocol->output(), connection->m_protocol->outputSize());
+				size_t offset = 0;
+				while (offset < output.size())
+				{
+					ssize_t n = ::send(connection->m_fd, output.data() + offset, output.size() - offset, MSG_NOSIGNAL);
+					if (n > 0)
+						offset += n;
+					else if (!(n < 0 && errno == EINTR))
+						break;
+				}
+			}
+			closeConnection(connection);
+		}
+	}
+}
+
+#endif
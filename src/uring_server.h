@@ -0,0 +1,123 @@
+/*
+MIT License
+
+Copyright (c) 2019 GIS Core R&D Department, NavInfo Co., Ltd
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+
+#include "uring.h"
+
+#ifdef NC_HAS_IO_URING
+
+#include <vector>
+#include "fcgi_connection.h"
+#include "http_connection.h"
+#include "request_dispatcher.h"
+#include "ncserver_config.h"
+
+namespace ncserver
+{
+	/**
+		io_uring engine of a serving thread, an alternative to EventServer.
+
+		Connections are taken by one multishot accept, and each connection
+		has one multishot receive filling the buffers provided to the kernel.
+		The operations issued while the completions are handled are submitted
+		together with the wait for the next completions, so an exchange of
+		a small request costs far fewer system calls than with epoll.
+	 */
+	class UringServer
+	{
+	public:
+		typedef RequestDispatcher::RequestHandler RequestHandler;
+
+		UringServer(int listenSocket, const NcServerConfig::ServerConfig& config, const RequestHandler& handler);
+		~UringServer();
+
+		/**
+			@return
+				false if the kernel lacks a feature of the engine, in which case
+				EventServer should be used instead.
+		 */
+		bool init();
+
+		/**
+			Serve until exitRequested becomes true.
+		 */
+		void run(const bool& exitRequested);
+
+	private:
+		class Connection;
+		friend class Connection;
+
+		enum
+		{
+			RING_ENTRIES = 256,
+			BUFFER_GROUP = 0,
+			BUFFER_COUNT = 256,
+			BUFFER_SIZE = 16 * 1024,
+		};
+
+		// stored in the low bits of the user data of the operations
+		enum Operation
+		{
+			Operation_accept = 0,
+			Operation_receive = 1,
+			Operation_send = 2,
+			Operation_asyncLoop = 3,	// the poll of AsyncLoop::fd()
+			Operation_mask = 3,
+		};
+
+		void armAccept();
+		void armAsyncLoopPoll();
+		void armReceive(Connection* connection);
+		void sendOutput(Connection* connection);
+		void processCompletions();
+		void handleCompletion(uint64_t userData, int result, uint32_t flags);
+		void acceptDidComplete(int result, uint32_t flags);
+		void receiveDidComplete(Connection* connection, int result, uint32_t flags);
+		void sendDidComplete(Connection* connection, int result);
+		void closeConnection(Connection* connection);
+		void releaseClosedConnections();
+		void closeIdleConnections();
+		Connection* leastActiveIdleConnection();
+		bool evictIdleConnection();
+		void finishConnections();
+
+		IoUring m_ring;
+		int m_listenSocket;
+		bool m_http;
+		AsyncLoop m_asyncLoop;
+		RequestDispatcher m_dispatcher;
+		FcgiCapacity m_capacity;
+		std::vector<Connection*> m_connections;
+		std::vector<Connection*> m_closedConnections;
+
+		long long m_idleTimeoutMs;
+		long long m_drainTimeoutMs;
+		size_t m_maxConnections;
+		bool m_acceptArmed;
+		bool m_exiting;
+		long long m_now;
+	};
+}
+
+#endif
@@ -23,6 +23,7 @@ SOFTWARE.
 */
 #include <string.h>
 #include <signal.h>
+#include <chrono>
 #include "util.h"
 
 namespace ncserver
@@ -65,6 +66,18 @@ namespace ncserver
 		return i;
 	}
 
+	long long monotonicTimeMs()
+	{
+		return std::chrono::duration_cast<std::chrono::milliseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	long long monotonicTimeUs()
+	{
+		return std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
 #ifndef WIN32
 	void(*signal(int signo, void(*handler)(int)))(int)
 	{
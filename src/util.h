@@ -26,6 +26,12 @@ SOFTWARE.
 namespace ncserver
 {
 	size_t urlDecode(const char *src, char *dest, size_t destSize);
+
+	/**
+		Milliseconds of a monotonic clock, which is not affected by changes of the system time.
+	 */
+	long long monotonicTimeMs();
+	long long monotonicTimeUs();
 #ifndef WIN32
 	void(*signal(int signo, void(*handler)(int)))(int);
 #endif
@@ -0,0 +1,383 @@
+/*
+MIT License
+
+Copyright (c) 2019 GIS Core R&D Department, NavInfo Co., Ltd
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "stdafx.h"
+#include "worker_scaler.h"
+#include "util.h"
+#include <algorithm>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef WIN32
+#include <sched.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/sock_diag.h>
+#include <linux/unix_diag.h>
+
+namespace ncserver
+{
+	static bool _readFile(const std::string& path, std::string* text)
+	{
+		FILE* file = fopen(path.c_str(), "r");
+		if (file == NULL)
+			return false;
+		char buffer[256];
+		size_t size = fread(buffer, 1, sizeof(buffer) - 1, file);
+		fclose(file);
+		buffer[size] = 0;
+		*text = buffer;
+		return true;
+	}
+
+	double parseCpuMax(const std::string& text)
+	{
+		long long quota, period;
+		if (sscanf(text.c_str(), "%lld %lld", &quota, &period) != 2 || quota <= 0 || period <= 0)
+			return 0;
+		return (double)quota / period;
+	}
+
+	long long parseMemoryMax(const std::string& text)
+	{
+		long long bytes;
+		if (sscanf(text.c_str(), "%lld", &bytes) != 1 || bytes <= 0)
+			return 0;
+		// cgroup v1 reports "unlimited" as a huge number
+		long long physical = (long long)sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGESIZE);
+		if (physical > 0 && bytes >= physical)
+			return 0;
+		return bytes;
+	}
+
+	static void _tighten(double* limit, double value)
+	{
+		if (value > 0 && (*limit == 0 || value < *limit))
+			*limit = value;
+	}
+
+	static void _tighten(long long* limit, long long value)
+	{
+		if (value > 0 && (*limit == 0 || value < *limit))
+			*limit = value;
+	}
+
+	/**
+		Apply @a read to the directory of @a path under @a root and each of its
+		ancestors up to @a root, as a limit of a parent applies to its children.
+		In a cgroup namespace the path may be missing, then only root is read.
+	 */
+	template<typename Reader>
+	static void _forEachCgroup(const std::string& root, std::string path, Reader read)
+	{
+		for (;;)
+		{
+			read(root + path);
+			size_t slash = path.rfind('/');
+			if (path.empty() || slash == std::string::npos)
+				break;
+			path.erase(slash);
+		}
+	}
+
+	CgroupLimits readCgroupLimits()
+	{
+		CgroupLimits limits;
+		FILE* file = fopen("/proc/self/cgroup", "r");
+		if (file == NULL)
+			return limits;
+
+		char line[4096];
+		while (fgets(line, sizeof(line), file) != NULL)
+		{
+			// "hierarchy-id:controller-list:path"
+			char* controllers = strchr(line, ':');
+			char* path = controllers != NULL ? strchr(controllers + 1, ':') : NULL;
+			if (path == NULL)
+				continue;
+			*controllers++ = 0;
+			*path++ = 0;
+			path[strcspn(path, "\n")] = 0;
+			if (strcmp(path, "/") == 0)
+				path[0] = 0;
+
+			if (controllers[0] == 0)
+			{
+				// v2, either the only hierarchy or the unified one of a hybrid setup
+				const char* roots[] = { "/sys/fs/cgroup", "/sys/fs/cgroup/unified" };
+				for (size_t i = 0; i < sizeof(roots) / sizeof(roots[0]); i++)
+				{
+					_forEachCgroup(roots[i], path, [&](const std::string& dir) {
+						std::string text;
+						if (_readFile(dir + "/cpu.max", &text))
+							_tighten(&limits.cpus, parseCpuMax(text));
+						if (_readFile(dir + "/memory.max", &text))
+							_tighten(&limits.memory, parseMemoryMax(text));
+					});
+				}
+				continue;
+			}
+
+			std::string list = std::string(",") + controllers + ",";
+			if (list.find(",cpu,") != std::string::npos)
+			{
+				_forEachCgroup("/sys/fs/cgroup/cpu", path, [&](const std::string& dir) {
+					std::string quota, period;
+					if (_readFile(dir + "/cpu.cfs_quota_us", &quota) && _readFile(dir + "/cpu.cfs_period_us", &period))
+						_tighten(&limits.cpus, parseCpuMax(quota + " " + period));
+				});
+			}
+			if (list.find(",memory,") != std::string::npos)
+			{
+				_forEachCgroup("/sys/fs/cgroup/memory", path, [&](const std::string& dir) {
+					std::string text;
+					if (_readFile(dir + "/memory.limit_in_bytes", &text))
+						_tighten(&limits.memory, parseMemoryMax(text));
+				});
+			}
+		}
+		fclose(file);
+		return limits;
+	}
+
+	int affordableWorkerCount(const CgroupLimits& limits, int threadCount, long long workerMemory)
+	{
+		int cpus = 0;
+		cpu_set_t set;
+		if (sched_getaffinity(0, sizeof(set), &set) == 0)
+			cpus = CPU_COUNT(&set);
+		if (cpus <= 0)
+			cpus = (int)sysconf(_SC_NPROCESSORS_ONLN);
+		if (limits.cpus > 0)
+			cpus = std::min(cpus, (int)ceil(limits.cpus));
+
+		if (threadCount < 1)
+			threadCount = 1;
+		int count = (cpus + threadCount - 1) / threadCount;
+		if (workerMemory > 0 && limits.memory > 0)
+			count = std::min(count, (int)(limits.memory / workerMemory));
+		return std::max(count, 1);
+	}
+
+	void resolveWorkerCounts(NcServerConfig::ServerConfig* config)
+	{
+		if (config->workerCount <= 0)
+		{
+			CgroupLimits limits = readCgroupLimits();
+			config->workerCount = affordableWorkerCount(limits, config->threadCount,
+				(long long)config->workerMemory * 1024 * 1024);
+		}
+		if (config->maxWorkerCount <= 0)
+			config->maxWorkerCount = config->workerCount;
+		if (config->minWorkerCount <= 0)
+			config->minWorkerCount = config->workerCount;
+		config->minWorkerCount = std::min(config->minWorkerCount, config->maxWorkerCount);
+		config->workerCount = std::max(config->minWorkerCount, std::min(config->workerCount, config->maxWorkerCount));
+	}
+
+	static int _unixAcceptQueueLength(int socket)
+	{
+		struct stat s;
+		if (fstat(socket, &s) != 0)
+			return -1;
+		int diag = ::socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_SOCK_DIAG);
+		if (diag < 0)
+			return -1;
+
+		struct
+		{
+			struct nlmsghdr header;
+			struct unix_diag_req request;
+		} message;
+		memset(&message, 0, sizeof(message));
+		message.header.nlmsg_len = sizeof(message);
+		message.header.nlmsg_type = SOCK_DIAG_BY_FAMILY;
+		message.header.nlmsg_flags = NLM_F_REQUEST;
+		message.request.sdiag_family = AF_UNIX;
+		message.request.udiag_states = 1 << TCP_LISTEN;
+		message.request.udiag_ino = (__u32)s.st_ino;
+		message.request.udiag_show = UDIAG_SHOW_RQLEN;
+		message.request.udiag_cookie[0] = message.request.udiag_cookie[1] = ~0U;
+
+		int length = -1;
+		if (send(diag, &message, sizeof(message), 0) == (ssize_t)sizeof(message))
+		{
+			long buffer[256];
+			ssize_t size = recv(diag, buffer, sizeof(buffer), 0);
+			struct nlmsghdr* header = (struct nlmsghdr*)buffer;
+			if (size > 0 && NLMSG_OK(header, (size_t)size) && header->nlmsg_type == SOCK_DIAG_BY_FAMILY)
+			{
+				struct unix_diag_msg* reply = (struct unix_diag_msg*)NLMSG_DATA(header);
+				struct rtattr* attribute = (struct rtattr*)(reply + 1);
+				int attributesLength = (int)header->nlmsg_len - (int)NLMSG_LENGTH(sizeof(*reply));
+				for (; RTA_OK(attribute, attributesLength); attribute = RTA_NEXT(attribute, attributesLength))
+				{
+					// of a listening socket, the pending connections and the backlog
+					if (attribute->rta_type == UNIX_DIAG_RQLEN)
+						length = (int)((struct unix_diag_rqlen*)RTA_DATA(attribute))->udiag_rqueue;
+				}
+			}
+		}
+		close(diag);
+		return length;
+	}
+
+	int acceptQueueLength(int socket)
+	{
+		struct sockaddr_storage address;
+		socklen_t addressLength = sizeof(address);
+		if (getsockname(socket, (struct sockaddr*)&address, &addressLength) != 0)
+			return -1;
+
+		if (address.ss_family == AF_UNIX)
+			return _unixAcceptQueueLength(socket);
+
+		if (address.ss_family == AF_INET || address.ss_family == AF_INET6)
+		{
+			struct tcp_info info;
+			socklen_t size = sizeof(info);
+			if (getsockopt(socket, IPPROTO_TCP, TCP_INFO, &info, &size) != 0 || info.tcpi_state != TCP_LISTEN)
+				return -1;
+			// of a listening socket, the length of the accept queue
+			return (int)info.tcpi_unacked;
+		}
+		return -1;
+	}
+
+	long long processCpuTimeMs(pid_t pid)
+	{
+		char path[64];
+		snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+		FILE* file = fopen(path, "r");
+		if (file == NULL)
+			return -1;
+		char line[1024];
+		bool read = fgets(line, sizeof(line), file) != NULL;
+		fclose(file);
+
+		// the command in parentheses may contain anything, the fields follow the last ')'
+		char* fields = read ? strrchr(line, ')') : NULL;
+		unsigned long utime, stime;
+		if (fields == NULL || sscanf(fields + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2)
+			return -1;
+		return (long long)(utime + stime) * 1000 / sysconf(_SC_CLK_TCK);
+	}
+
+	WorkerScaler::WorkerScaler()
+	{
+		init(NcServerConfig::ServerConfig());
+	}
+
+	void WorkerScaler::init(const NcServerConfig::ServerConfig& config)
+	{
+		m_minWorkerCount = config.minWorkerCount;
+		m_maxWorkerCount = config.maxWorkerCount;
+		m_threadCount = std::max(config.threadCount, 1);
+		m_intervalMs = (long long)std::max(config.scaleInterval, 1) * 1000;
+		m_scaleUpBusyRatio = config.scaleUpBusyRatio;
+		m_scaleDownBusyRatio = config.scaleDownBusyRatio;
+		m_scaleUpQueueLength = config.scaleUpQueueLength;
+
+		m_cpuOfWorker.clear();
+		m_lastSampleMs = 0;
+		m_windowCpuMs = 0;
+		m_windowMs = 0;
+		m_windowQueueLength = 0;
+		m_busyRatio = 0;
+		m_queueLength = 0;
+		m_scaleUpCount = 0;
+		m_scaleDownCount = 0;
+	}
+
+	void WorkerScaler::sample(const std::vector<pid_t>& workers, int queueLength)
+	{
+		long long now = monotonicTimeMs();
+		long long cpuMs = 0;
+		std::map<pid_t, long long> cpuOfWorker;
+		for (size_t i = 0; i < workers.size(); i++)
+		{
+			long long cpu = processCpuTimeMs(workers[i]);
+			if (cpu < 0)
+				continue;
+			// a worker forked since the last sample counts from its start
+			std::map<pid_t, long long>::iterator last = m_cpuOfWorker.find(workers[i]);
+			cpuMs += cpu - (last != m_cpuOfWorker.end() ? last->second : 0);
+			cpuOfWorker[workers[i]] = cpu;
+		}
+		m_cpuOfWorker.swap(cpuOfWorker);
+
+		if (m_lastSampleMs != 0)
+			account(cpuMs, now - m_lastSampleMs, queueLength);
+		m_lastSampleMs = now;
+	}
+
+	void WorkerScaler::account(long long cpuMs, long long elapsedMs, int queueLength)
+	{
+		m_windowCpuMs += std::max(cpuMs, 0LL);
+		m_windowMs += elapsedMs;
+		m_windowQueueLength = std::max(m_windowQueueLength, queueLength);
+	}
+
+	int WorkerScaler::decide(int workerCount)
+	{
+		if (m_windowMs < m_intervalMs || workerCount <= 0)
+			return workerCount;
+
+		m_busyRatio = (double)m_windowCpuMs / ((double)m_windowMs * workerCount * m_threadCount);
+		m_queueLength = m_windowQueueLength;
+		m_windowCpuMs = 0;
+		m_windowMs = 0;
+		m_windowQueueLength = 0;
+
+		int target = workerCount;
+		if (m_busyRatio >= m_scaleUpBusyRatio)
+		{
+			// enough workers to bring the ratio back between the thresholds at once
+			double middle = (m_scaleUpBusyRatio + m_scaleDownBusyRatio) / 2;
+			target = std::max(workerCount + 1, (int)ceil(workerCount * m_busyRatio / middle));
+		}
+		else if (m_scaleUpQueueLength > 0 && m_queueLength >= m_scaleUpQueueLength)
+		{
+			// waiting on something other than CPU
+			target = workerCount + 1;
+		}
+		else if (m_busyRatio <= m_scaleDownBusyRatio && m_queueLength <= 0)
+		{
+			target = workerCount - 1;
+		}
+		target = std::max(m_minWorkerCount, std::min(target, m_maxWorkerCount));
+
+		if (target > workerCount)
+			m_scaleUpCount++;
+		else if (target < workerCount)
+			m_scaleDownCount++;
+		return target;
+	}
+}
+#endif
@@ -0,0 +1,142 @@
+/*
+MIT License
+
+Copyright (c) 2019 GIS Core R&D Department, NavInfo Co., Ltd
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+
+#include "ncserver_config.h"
+#include <string>
+#include <vector>
+#include <map>
+
+#ifndef WIN32
+#include <sys/types.h>
+
+namespace ncserver
+{
+	struct CgroupLimits
+	{
+		double cpus = 0;		// CPU quota, 0 if unlimited
+		long long memory = 0;	// bytes, 0 if unlimited
+	};
+
+	/**
+		The tightest limits of the cgroup of the calling process and its ancestors,
+		of either cgroup v2 or v1.
+	 */
+	CgroupLimits readCgroupLimits();
+
+	/**
+		CPUs of "200000 100000" of cpu.max, 0 for "max 100000".
+	 */
+	double parseCpuMax(const std::string& text);
+
+	/**
+		Bytes of memory.max, 0 for "max" or anything beyond physical memory.
+	 */
+	long long parseMemoryMax(const std::string& text);
+
+	/**
+		The worker count the process is allowed: one worker per threadCount CPUs of
+		the affinity mask and the CPU quota, and no more than workerMemory fits into
+		the memory limit.
+	 */
+	int affordableWorkerCount(const CgroupLimits& limits, int threadCount, long long workerMemory);
+
+	/**
+		Fill in workerCount, minWorkerCount and maxWorkerCount left as 0 by the
+		configuration.
+	 */
+	void resolveWorkerCounts(NcServerConfig::ServerConfig* config);
+
+	/**
+		Connections waiting in the accept queue of a listening TCP or Unix socket,
+		-1 if unknown.
+	 */
+	int acceptQueueLength(int socket);
+
+	/**
+		User and system CPU time of @a pid in milliseconds, -1 if it is gone.
+	 */
+	long long processCpuTimeMs(pid_t pid);
+
+	/**
+		Decides the worker count of the manager from the CPU the workers use and the
+		connections waiting for them, between minWorkerCount and maxWorkerCount.
+	 */
+	class WorkerScaler
+	{
+	public:
+		WorkerScaler();
+
+		void init(const NcServerConfig::ServerConfig& config);
+
+		bool isElastic() const { return m_maxWorkerCount > m_minWorkerCount; }
+
+		/**
+			Account the CPU time of @a workers since the last call and the current
+			accept queue length. Called about once a second.
+		 */
+		void sample(const std::vector<pid_t>& workers, int queueLength);
+
+		/**
+			Account @a cpuMs of CPU time used by all the workers in @a elapsedMs.
+		 */
+		void account(long long cpuMs, long long elapsedMs, int queueLength);
+
+		/**
+			@return
+				The worker count to run from now on, @a workerCount unless a
+				scaleInterval has been sampled since the last decision.
+		 */
+		int decide(int workerCount);
+
+		// of the last decision
+		double busyRatio() const { return m_busyRatio; }
+		int queueLength() const { return m_queueLength; }
+
+		int scaleUpCount() const { return m_scaleUpCount; }
+		int scaleDownCount() const { return m_scaleDownCount; }
+
+	private:
+		int m_minWorkerCount;
+		int m_maxWorkerCount;
+		int m_threadCount;
+		long long m_intervalMs;
+		double m_scaleUpBusyRatio;
+		double m_scaleDownBusyRatio;
+		int m_scaleUpQueueLength;
+
+		std::map<pid_t, long long> m_cpuOfWorker;
+		long long m_lastSampleMs;
+
+		long long m_windowCpuMs;
+		long long m_windowMs;
+		int m_windowQueueLength;
+
+		double m_busyRatio;
+		int m_queueLength;
+		int m_scaleUpCount;
+		int m_scaleDownCount;
+	};
+}
+#endif
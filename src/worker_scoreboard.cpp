@@ -0,0 +1,93 @@
+/*
+MIT License
+
+Copyright (c) 2019 GIS Core R&D Department, NavInfo Co., Ltd
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "stdafx.h"
+#include "worker_scoreboard.h"
+
+#ifndef WIN32
+#include <new>
+#include <sys/mman.h>
+
+namespace ncserver
+{
+	WorkerScoreboard::WorkerScoreboard()
+	{
+		m_slots = NULL;
+		m_slotCount = 0;
+	}
+
+	WorkerScoreboard::~WorkerScoreboard()
+	{
+		if (m_slots != NULL)
+			munmap(m_slots, sizeof(Slot) * m_slotCount);
+	}
+
+	bool WorkerScoreboard::init(int slotCount)
+	{
+		if (m_slots != NULL)
+			munmap(m_slots, sizeof(Slot) * m_slotCount);
+		m_slots = NULL;
+		m_slotCount = 0;
+		if (slotCount <= 0)
+			return true;
+
+		void* memory = mmap(NULL, sizeof(Slot) * slotCount, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+		if (memory == MAP_FAILED)
+			return false;
+
+		m_slots = (Slot*)memory;
+		m_slotCount = slotCount;
+		for (int i = 0; i < slotCount; i++)
+		{
+			new (&m_slots[i].readyPid) std::atomic<pid_t>(0);
+			new (&m_slots[i].assignedSlot) std::atomic<int>(-1);
+		}
+		return true;
+	}
+
+	void WorkerScoreboard::setReady(int slot, pid_t pid)
+	{
+		if (slot >= 0 && slot < m_slotCount)
+		{
+			m_slots[slot].assignedSlot.store(-1);
+			m_slots[slot].readyPid.store(pid);
+		}
+	}
+
+	bool WorkerScoreboard::isReady(int slot, pid_t pid) const
+	{
+		return slot >= 0 && slot < m_slotCount && pid > 0 && m_slots[slot].readyPid.load() == pid;
+	}
+
+	void WorkerScoreboard::assign(int slot, int workerSlot)
+	{
+		if (slot >= 0 && slot < m_slotCount)
+			m_slots[slot].assignedSlot.store(workerSlot);
+	}
+
+	int WorkerScoreboard::assignedSlot(int slot) const
+	{
+		return slot >= 0 && slot < m_slotCount ? m_slots[slot].assignedSlot.load() : -1;
+	}
+}
+#endif
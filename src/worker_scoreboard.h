@@ -0,0 +1,83 @@
+/*
+MIT License
+
+Copyright (c) 2019 GIS Core R&D Department, NavInfo Co., Ltd
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+
+#ifndef WIN32
+#include <atomic>
+#include <sys/types.h>
+
+namespace ncserver
+{
+	/**
+		State the workers report to the manager, in memory shared by both.
+		Mapped by the manager before it forks, so that every worker inherits it.
+	 */
+	class WorkerScoreboard
+	{
+	public:
+		WorkerScoreboard();
+		~WorkerScoreboard();
+
+		/**
+			Map @a slotCount slots, all of them not ready.
+		 */
+		bool init(int slotCount);
+
+		/**
+			Called by the worker of @a slot once it accepts requests.
+		 */
+		void setReady(int slot, pid_t pid);
+
+		/**
+			Whether the worker @a pid of @a slot has called setReady(). A former
+			worker of the slot doesn't count.
+		 */
+		bool isReady(int slot, pid_t pid) const;
+
+		/**
+			Hand the slot @a workerSlot to the standby worker waiting in @a slot.
+			It is reset by setReady().
+		 */
+		void assign(int slot, int workerSlot);
+
+		/**
+			The slot handed to the standby worker of @a slot, -1 if none yet.
+		 */
+		int assignedSlot(int slot) const;
+
+	private:
+		WorkerScoreboard(const WorkerScoreboard&);
+		WorkerScoreboard& operator=(const WorkerScoreboard&);
+
+		struct Slot
+		{
+			std::atomic<pid_t> readyPid;
+			std::atomic<int> assignedSlot;
+		};
+
+		Slot* m_slots;
+		int m_slotCount;
+	};
+}
+#endif
@@ -0,0 +1,151 @@
+#include "stdafx.h"
+#include "gtest.h"
+#include "ncserver/async_query.h"
+#include "src/request_dispatcher.h"
+#include "src/http_connection.h"
+#include "src/util.h"
+
+#ifndef WIN32
+
+#include <sys/epoll.h>
+#include <thread>
+
+using namespace ncserver;
+
+TEST(AsyncLoop, timer)
+{
+	AsyncLoop loop;
+	std::vector<int> fired;
+	loop.setTimer(30, [&]() { fired.push_back(30); });
+	loop.setTimer(10, [&]() { fired.push_back(10); });
+	AsyncLoop::TimerId cancelled = loop.setTimer(20, [&]() { fired.push_back(20); });
+	EXPECT_TRUE(loop.cancelTimer(cancelled));
+	EXPECT_FALSE(loop.cancelTimer(cancelled));
+
+	long long deadline = monotonicTimeMs() + 1000;
+	while (fired.size() < 2 && monotonicTimeMs() < deadline)
+		loop.runOnce(100);
+
+	ASSERT_EQ(2, (int)fired.size());
+	EXPECT_EQ(10, fired[0]);
+	EXPECT_EQ(30, fired[1]);
+}
+
+TEST(AsyncLoop, waitFdAndPost)
+{
+	AsyncLoop loop;
+	int fds[2];
+	ASSERT_EQ(0, pipe(fds));
+
+	uint32_t readyEvents = 0;
+	EXPECT_TRUE(loop.waitFd(fds[0], EPOLLIN, [&](uint32_t events) { readyEvents = events; }));
+
+	// the result of a job of another thread is posted back to the loop
+	bool posted = false;
+	std::thread job([&]() {
+		EXPECT_EQ(1, (int)write(fds[1], "x", 1));
+		loop.post([&]() { posted = true; });
+	});
+	job.join();
+
+	long long deadline = monotonicTimeMs() + 1000;
+	while ((readyEvents == 0 || !posted) && monotonicTimeMs() < deadline)
+		loop.runOnce(100);
+
+	EXPECT_TRUE((readyEvents & EPOLLIN) != 0);
+	EXPECT_TRUE(posted);
+
+	loop.cancelFd(fds[0]);
+	close(fds[0]);
+	close(fds[1]);
+}
+
+class AsyncDispatchTest : public ::testing::Test, public HttpConnectionDelegate
+{
+public:
+	virtual void httpConnectionDidReceiveRequest(HttpConnection* connection, HttpRequestState* request)
+	{
+		m_dispatcher.dispatch(connection, request, connection);
+	}
+
+protected:
+	AsyncDispatchTest()
+		: m_dispatcher(&m_loop, [this](AsyncQuery* query) {
+			// "/sync" is answered at once, the others later
+			query->request()->setQueryString("");
+			if (strcmp(query->request()->documentUri(), "/sync") == 0)
+				answer(query);
+			else
+				m_queries.push_back(query);
+		}, [this](void* context) { m_outputCount++; })
+	{
+		m_outputCount = 0;
+	}
+
+	static void answer(AsyncQuery* query)
+	{
+		ServiceIo* io = query->io();
+		io->addHeaderField("Content-Type: text/plain");
+		io->endHeaderField();
+		io->print("%s", query->request()->documentUri());
+		query->finish();
+	}
+
+	std::string output(HttpConnection& connection)
+	{
+		std::string r(connection.output(), connection.outputSize());
+		connection.consumeOutput(connection.outputSize());
+		return r;
+	}
+
+	AsyncLoop m_loop;
+	RequestDispatcher m_dispatcher;
+	std::vector<AsyncQuery*> m_queries;
+	int m_outputCount;
+};
+
+TEST_F(AsyncDispatchTest, finishLater)
+{
+	HttpConnection connection(this);
+	std::string input = "GET /async HTTP/1.1\r\n\r\nGET /sync HTTP/1.1\r\n\r\n";
+	EXPECT_TRUE(connection.feed(input.data(), input.size()));
+
+	// the pipelined request waits for the one before it
+	ASSERT_EQ(1, (int)m_queries.size());
+	EXPECT_EQ(1u, m_dispatcher.pendingCount());
+	EXPECT_EQ("", output(connection));
+	EXPECT_FALSE(connection.isIdle());
+
+	answer(m_queries[0]);
+	EXPECT_EQ(0u, m_dispatcher.pendingCount());
+	EXPECT_GT(m_outputCount, 0);
+
+	std::string response = output(connection);
+	size_t first = response.find("\r\n\r\n/async");
+	size_t second = response.find("\r\n\r\n/sync");
+	EXPECT_NE(std::string::npos, first);
+	EXPECT_NE(std::string::npos, second);
+	EXPECT_LT(first, second);
+	EXPECT_TRUE(connection.isIdle());
+}
+
+TEST_F(AsyncDispatchTest, cancel)
+{
+	{
+		HttpConnection connection(this);
+		std::string input = "GET /async HTTP/1.1\r\n\r\n";
+		EXPECT_TRUE(connection.feed(input.data(), input.size()));
+		ASSERT_EQ(1, (int)m_queries.size());
+
+		m_dispatcher.cancel(&connection);
+	}
+
+	// the connection is gone, the late answer is discarded
+	EXPECT_TRUE(m_queries[0]->isCancelled());
+	int outputCount = m_outputCount;
+	answer(m_queries[0]);
+	EXPECT_EQ(outputCount, m_outputCount);
+	EXPECT_EQ(0u, m_dispatcher.pendingCount());
+}
+
+#endif
@@ -0,0 +1,119 @@
+#include "stdafx.h"
+#include "gtest.h"
+#include "ncserver/dataset_loader.h"
+#include "ncserver/dataset_registry.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+using namespace ncserver;
+
+#ifndef WIN32
+static int _threadCount()
+{
+	int count = -1;
+	FILE* file = fopen("/proc/self/status", "r");
+	char line[256];
+	while (file != NULL && fgets(line, sizeof(line), file) != NULL)
+	{
+		if (sscanf(line, "Threads: %d", &count) == 1)
+			break;
+	}
+	if (file != NULL)
+		fclose(file);
+	return count;
+}
+#endif
+
+TEST(DatasetLoader, dependencies)
+{
+	DatasetLoader loader;
+	std::atomic<int> doneCount(0);
+	int doneBeforeIndex = -1;
+	auto slow = [&]() {
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+		doneCount++;
+		return true;
+	};
+	loader.add("index", { "roads", "names" }, [&]() { doneBeforeIndex = doneCount; return true; });
+	loader.add("roads", slow);
+	loader.add("names", slow);
+
+#ifndef WIN32
+	int threadCount = _threadCount();
+#endif
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	EXPECT_TRUE(loader.run(2));
+	long long elapsedMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+#ifndef WIN32
+	// nothing is left running for fork()
+	EXPECT_EQ(threadCount, _threadCount());
+#endif
+
+	EXPECT_EQ(2, doneBeforeIndex);
+	EXPECT_LT(elapsedMs, 90);
+	const std::vector<DatasetLoadTime>& times = loader.loadTimes();
+	ASSERT_EQ(3u, times.size());
+	EXPECT_EQ("index", times[0].name);
+	EXPECT_TRUE(times[0].loaded);
+	EXPECT_GE(times[1].durationMs, 45.0);
+	EXPECT_GE(times[0].startMs, times[1].startMs + times[1].durationMs);
+}
+
+TEST(DatasetLoader, failures)
+{
+	int runCount = 0;
+	DatasetLoader failing;
+	failing.add("a", [&]() { runCount++; return false; });
+	failing.add("b", { "a" }, [&]() { runCount++; return true; });
+	failing.add("c", [&]() { runCount++; return true; });
+	EXPECT_FALSE(failing.run());
+	EXPECT_EQ(2, runCount);
+	EXPECT_FALSE(failing.loadTimes()[1].loaded);
+	EXPECT_TRUE(failing.loadTimes()[2].loaded);
+
+	// nothing runs
+	DatasetLoader unknown;
+	unknown.add("a", { "none" }, [&]() { runCount++; return true; });
+	EXPECT_FALSE(unknown.run());
+
+	DatasetLoader circular;
+	circular.add("a", { "c" }, [&]() { runCount++; return true; });
+	circular.add("b", { "a" }, [&]() { runCount++; return true; });
+	circular.add("c", { "b" }, [&]() { runCount++; return true; });
+	circular.add("d", [&]() { runCount++; return true; });
+	EXPECT_FALSE(circular.run());
+	EXPECT_EQ(2, runCount);
+}
+
+TEST(DatasetLoader, registry)
+{
+	DatasetRegistry registry;
+	registry.init(1, false);
+
+	// more datasets than the first table of the registry holds
+	DatasetLoader loader;
+	std::vector<std::string> names;
+	for (int i = 0; i < 40; i++)
+	{
+		names.push_back("part" + std::to_string(i));
+		loader.add(names.back().c_str(), [&registry, i]() {
+			std::string name = "part" + std::to_string(i);
+			return registry.add(name.c_str(), 1 << 16, [i](void* memory, size_t size) { memset(memory, i, size); }) >= 0;
+		});
+	}
+	long long sum = 0;
+	loader.add("sum", names, [&]() {
+		for (int i = 0; i < 40; i++)
+		{
+			int id = registry.find(("part" + std::to_string(i)).c_str());
+			if (id < 0 || registry.sizeOf(id) != 1 << 16)
+				return false;
+			sum += ((const unsigned char*)registry.get(id))[100];
+		}
+		return true;
+	});
+	EXPECT_TRUE(loader.run(8));
+	EXPECT_EQ(40 * 39 / 2, sum);
+}
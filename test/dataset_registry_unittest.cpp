@@ -0,0 +1,219 @@
+#include "stdafx.h"
+#include "gtest.h"
+#include "ncserver/dataset_registry.h"
+#include "ncserver/offset_ptr.h"
+
+#include <chrono>
+#ifndef WIN32
+#include <fcntl.h>
+#endif
+
+using namespace ncserver;
+
+TEST(DatasetRegistry, replicas)
+{
+	DatasetRegistry registry;
+	registry.init(2, true);
+
+	int fillCount = 0;
+	int squares = registry.add("squares", 1000 * sizeof(int), [&](void* memory, size_t size) {
+		int* values = (int*)memory;
+		for (size_t i = 0; i < size / sizeof(int); i++)
+			values[i] = (int)(i * i);
+		fillCount++;
+	});
+	ASSERT_EQ(0, squares);
+
+	const char text[] = "read-only";
+	int copied = registry.add("text", text, sizeof(text));
+	ASSERT_EQ(1, copied);
+	EXPECT_EQ(-1, registry.add("text", text, sizeof(text)));
+	EXPECT_EQ(-1, registry.add("empty", text, 0));
+
+	EXPECT_EQ(copied, registry.find("text"));
+	EXPECT_EQ(-1, registry.find("none"));
+	EXPECT_EQ(sizeof(text), registry.sizeOf(copied));
+
+	std::vector<DatasetStats> stats = registry.stats();
+	ASSERT_EQ(2u, stats.size());
+	// one replica of each node
+	EXPECT_EQ(fillCount, (int)stats[0].nodes.size());
+
+	registry.bindWorker(1, -1);
+	EXPECT_EQ(99 * 99, ((const int*)registry.get(squares))[99]);
+	EXPECT_STREQ(text, (const char*)registry.get(copied));
+	registry.get(copied);
+
+	stats = registry.stats();
+	EXPECT_EQ("squares", stats[0].name);
+	EXPECT_EQ(1000 * sizeof(int), stats[0].size);
+	EXPECT_EQ(1, stats[0].lookups);
+	EXPECT_EQ(2, stats[1].lookups);
+	EXPECT_LE(stats[1].remoteLookups, stats[1].lookups);
+
+	// starts over, e.g. in the manager of a reload
+	registry.init(2, false);
+	EXPECT_TRUE(registry.stats().empty());
+}
+
+TEST(DatasetRegistry, renew)
+{
+	DatasetRegistry registry;
+	registry.init(2, false);
+
+	int fillCount = 0;
+	auto fill = [&](void* memory, size_t size) {
+		memset(memory, 'x', size);
+		fillCount++;
+	};
+	int kept = registry.add("kept", "v1", 100, fill);
+	int changed = registry.add("changed", "v1", 100, fill);
+	int dropped = registry.add("dropped", "v1", 100, fill);
+	ASSERT_EQ(3, fillCount);
+	const void* keptMemory = registry.get(kept);
+
+	// the next generation, e.g. in the manager of a zygote reload
+	registry.renew(3, false);
+	EXPECT_EQ(kept, registry.add("kept", "v1", 100, fill));
+	EXPECT_EQ(changed, registry.add("changed", "v2", 100, fill));
+	EXPECT_EQ(-1, registry.add("changed", "v2", 100, fill));
+	EXPECT_EQ(4, fillCount);
+	registry.prune();
+
+	EXPECT_EQ(keptMemory, registry.get(kept));
+	EXPECT_EQ(-1, registry.find("dropped"));
+	EXPECT_NE(dropped, registry.add("dropped", "v1", 100, fill));
+	EXPECT_EQ(5, fillCount);
+
+	std::vector<DatasetStats> stats = registry.stats();
+	ASSERT_EQ(3u, stats.size());
+	EXPECT_TRUE(stats[0].inherited);
+	// counted anew for the workers of the new generation
+	EXPECT_EQ(1, stats[0].lookups);
+	EXPECT_FALSE(stats[1].inherited);
+	EXPECT_EQ("v2", stats[1].version);
+
+	// replicas on other nodes can't be taken over
+	registry.renew(3, true);
+	EXPECT_TRUE(registry.stats().empty());
+}
+
+#ifndef WIN32
+TEST(DatasetRegistry, addFile)
+{
+	char path[] = "/tmp/ncserver_dataset_XXXXXX";
+	int fd = mkstemp(path);
+	ASSERT_GE(fd, 0);
+	ASSERT_EQ(5, (int)write(fd, "hello", 5));
+	close(fd);
+
+	std::string version = DatasetRegistry::fileVersion(path);
+	EXPECT_FALSE(version.empty());
+	EXPECT_EQ("", DatasetRegistry::fileVersion("/tmp/ncserver_no_such_file"));
+
+	DatasetRegistry registry;
+	registry.init(1, false);
+	int id = registry.addFile("file", path);
+	ASSERT_GE(id, 0);
+	EXPECT_EQ(5u, registry.sizeOf(id));
+	EXPECT_EQ(0, memcmp("hello", registry.get(id), 5));
+	EXPECT_EQ(version, registry.stats()[0].version);
+	EXPECT_EQ(-1, registry.addFile("none", "/tmp/ncserver_no_such_file"));
+
+	unlink(path);
+}
+
+struct SnapshotNode
+{
+	int value;
+	OffsetPtr<SnapshotNode> next;
+};
+
+static long long _elapsedUs(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+TEST(DatasetRegistry, snapshot)
+{
+	char path[] = "/tmp/ncserver_snapshot_XXXXXX";
+	int fd = mkstemp(path);
+	ASSERT_GE(fd, 0);
+	close(fd);
+
+	std::string text;
+	for (int i = 0; i < 1000000; i++)
+		text += std::to_string(i * 7) + "\n";
+
+	// a cold start without a snapshot, which parses the text
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	DatasetRegistry built;
+	built.init(1, false);
+	EXPECT_EQ(-1, built.restore("values", "v1"));
+	std::vector<int> values;
+	for (const char* p = text.c_str(); *p != 0; p++)
+	{
+		char* end;
+		values.push_back((int)strtol(p, &end, 10));
+		p = end;
+	}
+	int id = built.add("values", "v1", values.size() * sizeof(int), [&](void* memory, size_t size) {
+		memcpy(memory, values.data(), size);
+	});
+	long long buildUs = _elapsedUs(start);
+	ASSERT_GE(id, 0);
+
+	built.add("nodes", "v1", 3 * sizeof(SnapshotNode), [](void* memory, size_t size) {
+		SnapshotNode* nodes = (SnapshotNode*)memory;
+		for (int i = 0; i < 3; i++)
+		{
+			nodes[i].value = i + 1;
+			nodes[i].next = i < 2 ? &nodes[i + 1] : NULL;
+		}
+	});
+	built.add("unversioned", "hello", 5);
+	EXPECT_TRUE(built.snapshotChanged());
+	ASSERT_TRUE(built.saveSnapshot(path));
+
+	start = std::chrono::steady_clock::now();
+	DatasetRegistry restored;
+	restored.init(1, false);
+	ASSERT_TRUE(restored.openSnapshot(path));
+	int restoredId = restored.restore("values", "v1");
+	long long restoreUs = _elapsedUs(start);
+	ASSERT_GE(restoredId, 0);
+	ASSERT_EQ(values.size() * sizeof(int), restored.sizeOf(restoredId));
+	EXPECT_EQ(0, memcmp(values.data(), restored.get(restoredId), values.size() * sizeof(int)));
+	printf("built in %lld us, restored from the snapshot in %lld us\n", buildUs, restoreUs);
+	EXPECT_LT(restoreUs, buildUs);
+
+	// the filler of a dataset in the snapshot isn't called
+	int fillCount = 0;
+	int nodes = restored.add("nodes", "v1", 3 * sizeof(SnapshotNode), [&](void* memory, size_t size) { fillCount++; });
+	EXPECT_EQ(0, fillCount);
+	ASSERT_NE(built.get(built.find("nodes")), restored.get(nodes));
+	int sum = 0;
+	for (const SnapshotNode* node = (const SnapshotNode*)restored.get(nodes); node != NULL; node = node->next.get())
+		sum += node->value;
+	EXPECT_EQ(6, sum);
+
+	EXPECT_EQ(-1, restored.restore("values", "v2"));
+	EXPECT_EQ(-1, restored.restore("unversioned", ""));
+	EXPECT_FALSE(restored.snapshotChanged());
+	// still mapped without the file descriptor
+	restored.closeSnapshot();
+	EXPECT_EQ(values.back(), ((const int*)restored.get(restoredId))[values.size() - 1]);
+
+	// a damaged directory
+	fd = open(path, O_WRONLY);
+	ASSERT_GE(fd, 0);
+	EXPECT_EQ(1, (int)pwrite(fd, "x", 1, 40));
+	close(fd);
+	DatasetRegistry damaged;
+	damaged.init(1, false);
+	EXPECT_FALSE(damaged.openSnapshot(path));
+	EXPECT_EQ(-1, damaged.restore("values", "v1"));
+
+	unlink(path);
+}
+#endif
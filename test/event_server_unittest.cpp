@@ -0,0 +1,153 @@
+#include "stdafx.h"
+#include "gtest.h"
+#include "ncserver/async_query.h"
+#include "src/event_server.h"
+#include "src/util.h"
+
+#ifndef WIN32
+
+#include <netinet/in.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+using namespace ncserver;
+
+class EventServerTest : public ::testing::Test
+{
+protected:
+	virtual void SetUp()
+	{
+		m_listenSocket = socket(AF_INET, SOCK_STREAM, 0);
+		ASSERT_GE(m_listenSocket, 0);
+		struct sockaddr_in address;
+		memset(&address, 0, sizeof(address));
+		address.sin_family = AF_INET;
+		address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		ASSERT_EQ(0, bind(m_listenSocket, (struct sockaddr*)&address, sizeof(address)));
+		ASSERT_EQ(0, listen(m_listenSocket, 16));
+		socklen_t length = sizeof(m_address);
+		ASSERT_EQ(0, getsockname(m_listenSocket, (struct sockaddr*)&m_address, &length));
+
+		m_config.engine = NcServerConfig::Engine_http;
+		m_config.keepAliveTimeout = 1;
+		m_exit = false;
+	}
+
+	virtual void TearDown()
+	{
+		m_exit = true;
+		if (m_thread.joinable())
+			m_thread.join();
+		close(m_listenSocket);
+	}
+
+	/**
+		"/slow" is answered after 2.5 seconds, longer than the keep-alive timeout.
+	 */
+	void start()
+	{
+		m_thread = std::thread([this]() {
+			EventServer server(m_listenSocket, m_config, [](AsyncQuery* query) {
+				int delayMs = strcmp(query->request()->documentUri(), "/slow") == 0 ? 2500 : 0;
+				query->loop()->setTimer(delayMs, [query]() {
+					ServiceIo* io = query->io();
+					io->addHeaderField("Content-Type: text/plain");
+					io->endHeaderField();
+					io->print("%s", query->request()->documentUri());
+					query->finish();
+				});
+			});
+			server.run(m_exit);
+		});
+	}
+
+	int connectTo(const char* input)
+	{
+		int fd = socket(AF_INET, SOCK_STREAM, 0);
+		EXPECT_EQ(0, connect(fd, (struct sockaddr*)&m_address, sizeof(m_address)));
+		if (input[0] != 0)
+			EXPECT_EQ((ssize_t)strlen(input), write(fd, input, strlen(input)));
+		return fd;
+	}
+
+	/**
+		What is read until the server closes the connection or timeoutMs passes.
+		@return
+			false on timeout.
+	 */
+	static bool readUntilClosed(int fd, int timeoutMs, std::string* output)
+	{
+		long long deadline = monotonicTimeMs() + timeoutMs;
+		for (;;)
+		{
+			long long now = monotonicTimeMs();
+			struct pollfd pfd;
+			pfd.fd = fd;
+			pfd.events = POLLIN;
+			if (now >= deadline || poll(&pfd, 1, (int)(deadline - now)) <= 0)
+				return false;
+
+			char buffer[4096];
+			ssize_t n = read(fd, buffer, sizeof(buffer));
+			if (n <= 0)
+				return true;
+			output->append(buffer, n);
+		}
+	}
+
+	int m_listenSocket;
+	struct sockaddr_in m_address;
+	NcServerConfig::ServerConfig m_config;
+	bool m_exit;
+	std::thread m_thread;
+};
+
+TEST_F(EventServerTest, keepAliveTimeout)
+{
+	start();
+	long long startMs = monotonicTimeMs();
+	int idle = connectTo("");
+	int partialHeader = connectTo("GET / HTTP/1.1\r\nHost: loc");
+	int partialBody = connectTo("POST / HTTP/1.1\r\nContent-Length: 10\r\n\r\nabc");
+	int served = connectTo("GET /fast HTTP/1.1\r\n\r\n");
+
+	// closed after the timeout, which a sweep each second looks at
+	std::string output;
+	EXPECT_TRUE(readUntilClosed(idle, 4000, &output));
+	EXPECT_EQ("", output);
+	EXPECT_TRUE(readUntilClosed(partialHeader, 1000, &output));
+	EXPECT_EQ("", output);
+	EXPECT_TRUE(readUntilClosed(partialBody, 1000, &output));
+	EXPECT_EQ("", output);
+	EXPECT_TRUE(readUntilClosed(served, 1000, &output));
+	EXPECT_NE(std::string::npos, output.find("\r\n\r\n/fast"));
+	long long closedMs = monotonicTimeMs() - startMs;
+	EXPECT_GE(closedMs, 1000);
+	EXPECT_LT(closedMs, 3500);
+
+	close(idle);
+	close(partialHeader);
+	close(partialBody);
+	close(served);
+}
+
+TEST_F(EventServerTest, queryInFlight)
+{
+	start();
+	int fd = connectTo("GET /slow HTTP/1.1\r\n\r\n");
+
+	// answered although the query takes longer than the timeout
+	std::string output;
+	EXPECT_FALSE(readUntilClosed(fd, 2800, &output));
+	EXPECT_NE(std::string::npos, output.find("HTTP/1.1 200 OK\r\n"));
+	EXPECT_NE(std::string::npos, output.find("\r\n\r\n/slow"));
+
+	// idle afterwards
+	EXPECT_TRUE(readUntilClosed(fd, 3000, &output));
+	close(fd);
+}
+
+#endif
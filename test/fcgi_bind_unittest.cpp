@@ -0,0 +1,74 @@
+#include "stdafx.h"
+#include "gtest.h"
+#include "src/fcgi_bind.h"
+
+#ifndef WIN32
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+TEST(FcgiBind, isTcpAddress)
+{
+	EXPECT_TRUE(ncserver::fcgi_isTcpAddress("127.0.0.1:9000"));
+	EXPECT_TRUE(ncserver::fcgi_isTcpAddress(":9000"));
+	EXPECT_TRUE(ncserver::fcgi_isTcpAddress("tcp:[::1]:9000"));
+	EXPECT_FALSE(ncserver::fcgi_isTcpAddress("unix:.ncserver.sock"));
+	EXPECT_FALSE(ncserver::fcgi_isTcpAddress("/tmp/.ncserver.sock"));
+	EXPECT_FALSE(ncserver::fcgi_isTcpAddress(""));
+}
+
+TEST(FcgiBind, unixSocket)
+{
+	char path[64];
+	sprintf(path, "/tmp/ncserver_test_%d.sock", (int)getpid());
+
+	ncserver::NcServerConfig::ListenConfig config;
+	config.address = std::string("unix:") + path;
+
+	// a socket file left behind is replaced
+	for (int i = 0; i < 2; i++)
+	{
+		int fd = ncserver::fcgi_openListenSocket(config);
+		ASSERT_GE(fd, 0);
+
+		int client = socket(AF_UNIX, SOCK_STREAM, 0);
+		struct sockaddr_un addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		strcpy(addr.sun_path, path);
+		EXPECT_EQ(0, connect(client, (struct sockaddr*)&addr, sizeof(addr)));
+		close(client);
+		close(fd);
+	}
+	unlink(path);
+}
+
+TEST(FcgiBind, reusePort)
+{
+	ncserver::NcServerConfig::ListenConfig config;
+	config.address = "127.0.0.1:0";
+	config.reusePort = true;
+	config.deferAccept = 1;
+
+	int first = ncserver::fcgi_openListenSocket(config);
+	ASSERT_GE(first, 0);
+
+	struct sockaddr_in addr;
+	socklen_t addrLen = sizeof(addr);
+	ASSERT_EQ(0, getsockname(first, (struct sockaddr*)&addr, &addrLen));
+
+	char address[32];
+	sprintf(address, "127.0.0.1:%d", (int)ntohs(addr.sin_port));
+	config.address = address;
+	int second = ncserver::fcgi_openListenSocket(config);
+	EXPECT_GE(second, 0);
+
+	config.reusePort = false;
+	EXPECT_EQ(-1, ncserver::fcgi_openListenSocket(config));
+
+	close(second);
+	close(first);
+}
+
+#endif
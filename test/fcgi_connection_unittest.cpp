@@ -0,0 +1,192 @@
+#include "stdafx.h"
+#include "gtest.h"
+#include "ncserver/ncserver.h"
+#include "fastcgi.h"
+#include "src/fcgi_connection.h"
+
+using namespace ncserver;
+
+static std::string _record(int type, int requestId, const std::string& content)
+{
+	std::string r;
+	r.push_back(FCGI_VERSION_1);
+	r.push_back((char)type);
+	r.push_back((char)(requestId >> 8));
+	r.push_back((char)(requestId & 0xff));
+	r.push_back((char)(content.size() >> 8));
+	r.push_back((char)(content.size() & 0xff));
+	r.push_back(0);
+	r.push_back(0);
+	return r + content;
+}
+
+static std::string _nameValue(const std::string& name, const std::string& value)
+{
+	std::string r;
+	r.push_back((char)name.size());
+	r.push_back((char)value.size());
+	return r + name + value;
+}
+
+static std::string _request(int requestId, bool keepConnection, const std::string& queryString, const std::string& body)
+{
+	std::string begin(8, '\0');
+	begin[1] = FCGI_RESPONDER;
+	begin[2] = keepConnection ? FCGI_KEEP_CONN : 0;
+
+	std::string params = _nameValue("REQUEST_METHOD", "POST") + _nameValue("QUERY_STRING", queryString);
+	std::string r = _record(FCGI_BEGIN_REQUEST, requestId, begin);
+	r += _record(FCGI_PARAMS, requestId, params) + _record(FCGI_PARAMS, requestId, "");
+	if (!body.empty())
+		r += _record(FCGI_STDIN, requestId, body);
+	return r + _record(FCGI_STDIN, requestId, "");
+}
+
+class FcgiConnectionTest : public ::testing::Test, public FcgiConnectionDelegate
+{
+public:
+	virtual void fcgiConnectionDidReceiveRequest(FcgiConnection* connection, FcgiRequestState* request)
+	{
+		Request r;
+		r.setEnvironment(request->envp());
+		m_queryStrings.push_back(r.headerForName("QUERY_STRING"));
+		m_bodies.push_back(std::string(request->stdinData(), request->stdinSize()));
+		connection->writeStdout(request, "hello", 5);
+		connection->endRequest(request, 0);
+	}
+
+protected:
+	std::vector<std::string> m_queryStrings;
+	std::vector<std::string> m_bodies;
+};
+
+TEST_F(FcgiConnectionTest, request)
+{
+	FcgiConnection connection(this);
+	std::string data = _request(1, false, "a=1", "body");
+
+	// feed byte by byte, the request is only dispatched once STDIN is completed
+	for (size_t i = 0; i < data.size(); i++)
+	{
+		EXPECT_TRUE(m_queryStrings.empty());
+		EXPECT_TRUE(connection.feed(&data[i], 1));
+	}
+
+	ASSERT_EQ(m_queryStrings.size(), 1u);
+	EXPECT_EQ(m_queryStrings[0], "a=1");
+	EXPECT_EQ(m_bodies[0], "body");
+	EXPECT_TRUE(connection.closeAfterOutput());
+
+	// STDOUT "hello" + padding, empty STDOUT, END_REQUEST
+	std::string output(connection.output(), connection.outputSize());
+	EXPECT_EQ(output.size(), 16u + 8u + 16u);
+	EXPECT_EQ(output[1], FCGI_STDOUT);
+	EXPECT_EQ(output.substr(8, 5), "hello");
+	EXPECT_EQ(output[16 + 1], FCGI_STDOUT);
+	EXPECT_EQ(output[24 + 1], FCGI_END_REQUEST);
+
+	connection.consumeOutput(connection.outputSize());
+	EXPECT_EQ(connection.outputSize(), 0u);
+}
+
+TEST_F(FcgiConnectionTest, keepConnection)
+{
+	FcgiConnection connection(this);
+	std::string data = _request(1, true, "a=1", "") + _request(2, true, "a=2", "");
+	EXPECT_TRUE(connection.feed(data.data(), data.size()));
+
+	ASSERT_EQ(m_queryStrings.size(), 2u);
+	EXPECT_EQ(m_queryStrings[1], "a=2");
+	EXPECT_FALSE(connection.closeAfterOutput());
+}
+
+TEST_F(FcgiConnectionTest, protocolError)
+{
+	FcgiConnection connection(this);
+	std::string data = _request(1, false, "a=1", "");
+	data[0] = 2;	// unsupported version
+	EXPECT_FALSE(connection.feed(data.data(), data.size()));
+	EXPECT_TRUE(m_queryStrings.empty());
+}
+
+TEST_F(FcgiConnectionTest, stdinTooLarge)
+{
+	FcgiConnection connection(this);
+	std::string data = _request(1, true, "a=1", "");
+	// without the empty STDIN closing the stream
+	data.resize(data.size() - 8);
+	EXPECT_TRUE(connection.feed(data.data(), data.size()));
+
+	std::string chunk = _record(FCGI_STDIN, 1, std::string(65528, 'x'));
+	for (int i = 0; i < 1025; i++)
+		EXPECT_TRUE(connection.feed(chunk.data(), chunk.size()));
+	std::string end = _record(FCGI_STDIN, 1, "");
+	EXPECT_TRUE(connection.feed(end.data(), end.size()));
+
+	EXPECT_TRUE(m_queryStrings.empty());
+	EXPECT_EQ(connection.requestCount(), 0u);
+	std::string output(connection.output(), connection.outputSize());
+	ASSERT_GE(output.size(), 8u);
+	EXPECT_EQ(output[1], FCGI_STDOUT);
+	EXPECT_EQ(output.find("Status: 413 "), 8u);
+	EXPECT_EQ(output[output.size() - 16 + 1], FCGI_END_REQUEST);
+}
+
+TEST_F(FcgiConnectionTest, getValues)
+{
+	FcgiConnection connection(this);
+	std::string data = _record(FCGI_GET_VALUES, 0, _nameValue(FCGI_MPXS_CONNS, ""));
+	EXPECT_TRUE(connection.feed(data.data(), data.size()));
+
+	std::string output(connection.output(), connection.outputSize());
+	ASSERT_GE(output.size(), 8u);
+	EXPECT_EQ(output[1], FCGI_GET_VALUES_RESULT);
+	EXPECT_NE(output.find(FCGI_MPXS_CONNS), std::string::npos);
+}
+
+TEST_F(FcgiConnectionTest, multiplex)
+{
+	FcgiCapacity capacity;
+	capacity.maxConnections = 8;
+	capacity.maxRequests = 32;
+	capacity.maxRequestsPerConnection = 4;
+	FcgiConnection connection(this, &capacity);
+
+	// interleave the records of two requests, right after FCGI_BEGIN_REQUEST of the first one
+	std::string first = _request(1, true, "a=1", "first");
+	std::string second = _request(2, true, "a=2", "second");
+	size_t split = FCGI_HEADER_LEN + sizeof(FCGI_BeginRequestBody);
+	std::string data = first.substr(0, split) + second + first.substr(split);
+	EXPECT_TRUE(connection.feed(data.data(), data.size()));
+
+	ASSERT_EQ(m_queryStrings.size(), 2u);
+	EXPECT_EQ(m_queryStrings[0], "a=2");
+	EXPECT_EQ(m_bodies[0], "second");
+	EXPECT_EQ(m_queryStrings[1], "a=1");
+	EXPECT_EQ(m_bodies[1], "first");
+	EXPECT_EQ(connection.requestCount(), 0u);
+
+	std::string getValues = _record(FCGI_GET_VALUES, 0, _nameValue(FCGI_MPXS_CONNS, "") + _nameValue(FCGI_MAX_REQS, ""));
+	connection.consumeOutput(connection.outputSize());
+	EXPECT_TRUE(connection.feed(getValues.data(), getValues.size()));
+	std::string output(connection.output(), connection.outputSize());
+	EXPECT_EQ(output.substr(8, output[5]), _nameValue(FCGI_MPXS_CONNS, "1") + _nameValue(FCGI_MAX_REQS, "32"));
+}
+
+TEST_F(FcgiConnectionTest, cantMultiplex)
+{
+	FcgiConnection connection(this);
+	std::string begin(8, '\0');
+	begin[1] = FCGI_RESPONDER;
+	begin[2] = FCGI_KEEP_CONN;
+	std::string data = _record(FCGI_BEGIN_REQUEST, 1, begin) + _record(FCGI_BEGIN_REQUEST, 2, begin);
+	EXPECT_TRUE(connection.feed(data.data(), data.size()));
+	EXPECT_EQ(connection.requestCount(), 1u);
+
+	// END_REQUEST of request 2 with FCGI_CANT_MPX_CONN
+	std::string output(connection.output(), connection.outputSize());
+	ASSERT_EQ(output.size(), 16u);
+	EXPECT_EQ(output[1], FCGI_END_REQUEST);
+	EXPECT_EQ(output[3], 2);
+	EXPECT_EQ(output[8 + 4], FCGI_CANT_MPX_CONN);
+}
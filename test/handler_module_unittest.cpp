@@ -0,0 +1,60 @@
+#include "stdafx.h"
+#include "gtest.h"
+#include "ncserver/ncserver.h"
+#include "ncserver/handler_module.h"
+#include "ncserver/mutable_service_io.h"
+#include "src/handler_library.h"
+
+#ifndef WIN32
+
+#include <string>
+#include <unistd.h>
+
+using namespace ncserver;
+
+/**
+	libncserver_test_module.so of test/module, built next to the test.
+ */
+static std::string _modulePath()
+{
+	char path[4096];
+	ssize_t length = readlink("/proc/self/exe", path, sizeof(path) - 1);
+	std::string exe(path, length > 0 ? length : 0);
+	return exe.substr(0, exe.rfind('/') + 1) + "libncserver_test_module.so";
+}
+
+TEST(HandlerLibrary, open)
+{
+	HandlerLibrary library;
+	HandlerModule* module = library.open(_modulePath().c_str());
+	ASSERT_TRUE(module != NULL) << library.error();
+	EXPECT_STREQ("1.0", module->version());
+	EXPECT_TRUE(module->start(NULL));
+
+	Request request;
+	request.setQueryString("x=1");
+	MutableServiceIo io;
+	module->query(&io, &request);
+	std::string output((const char*)io.buffer(), io.bufferSize());
+	EXPECT_NE(std::string::npos, output.find("module started x=1"));
+
+	module->stop();
+	delete module;
+
+	// one module per library
+	EXPECT_TRUE(library.open(_modulePath().c_str()) == NULL);
+}
+
+TEST(HandlerLibrary, failure)
+{
+	HandlerLibrary missing;
+	EXPECT_TRUE(missing.open("/nonexistent/module.so") == NULL);
+	EXPECT_FALSE(missing.error().empty());
+
+	// a library without the factory of NCSERVER_HANDLER_MODULE()
+	HandlerLibrary other;
+	EXPECT_TRUE(other.open("libm.so.6") == NULL);
+	EXPECT_NE(std::string::npos, other.error().find("ncserver_createHandlerModule"));
+}
+
+#endif
@@ -0,0 +1,139 @@
+#include "stdafx.h"
+#include "gtest.h"
+#include "ncserver/ncserver.h"
+#include "src/http_connection.h"
+
+#ifndef WIN32
+
+using namespace ncserver;
+
+class HttpConnectionTest : public ::testing::Test, public HttpConnectionDelegate
+{
+public:
+	virtual void httpConnectionDidReceiveRequest(HttpConnection* connection, HttpRequestState* request)
+	{
+		Request r;
+		r.setEnvironment(request->envp());
+		m_methods.push_back(r.requestMethod());
+		m_uris.push_back(r.documentUri());
+		m_queryStrings.push_back(r.headerForName("QUERY_STRING"));
+		const char* userAgent = r.headerForName("HTTP_USER_AGENT");
+		m_userAgents.push_back(userAgent != NULL ? userAgent : "");
+		m_bodies.push_back(std::string(request->stdinData(), request->stdinSize()));
+		r.setEnvironment(NULL);
+
+		connection->writeStdout(request, m_response.data(), m_response.size());
+		connection->endRequest(request, 0);
+	}
+
+protected:
+	HttpConnectionTest() : m_response("Content-Type: text/plain\r\n\r\nhello") {}
+
+	std::string output(HttpConnection& connection)
+	{
+		std::string r(connection.output(), connection.outputSize());
+		connection.consumeOutput(connection.outputSize());
+		return r;
+	}
+
+	std::string m_response;
+	std::vector<std::string> m_methods;
+	std::vector<std::string> m_uris;
+	std::vector<std::string> m_queryStrings;
+	std::vector<std::string> m_userAgents;
+	std::vector<std::string> m_bodies;
+};
+
+TEST_F(HttpConnectionTest, request)
+{
+	HttpConnection connection(this);
+	std::string input = "GET /geocoding?city=beijing&keyword=coffee HTTP/1.1\r\nHost: localhost\r\nUser-Agent: test\r\n\r\n";
+
+	for (size_t i = 0; i < input.size(); i++)
+		EXPECT_TRUE(connection.feed(&input[i], 1));
+
+	ASSERT_EQ(1, (int)m_methods.size());
+	EXPECT_EQ("GET", m_methods[0]);
+	EXPECT_EQ("/geocoding", m_uris[0]);
+	EXPECT_EQ("city=beijing&keyword=coffee", m_queryStrings[0]);
+	EXPECT_EQ("test", m_userAgents[0]);
+
+	std::string response = output(connection);
+	EXPECT_EQ(0u, response.find("HTTP/1.1 200 OK\r\n"));
+	EXPECT_NE(std::string::npos, response.find("\r\nContent-Type: text/plain\r\n"));
+	EXPECT_NE(std::string::npos, response.find("\r\nContent-Length: 5\r\n\r\nhello"));
+	EXPECT_FALSE(connection.closeAfterOutput());
+	EXPECT_TRUE(connection.isIdle());
+}
+
+TEST_F(HttpConnectionTest, pipelining)
+{
+	HttpConnection connection(this);
+	std::string input = "GET /a?r=1 HTTP/1.1\r\n\r\nGET /b?r=2 HTTP/1.1\r\n\r\nGET /c?r=3 HTTP/1.1\r\nConnection: close\r\n\r\n";
+	EXPECT_TRUE(connection.feed(input.data(), input.size()));
+
+	ASSERT_EQ(3, (int)m_uris.size());
+	EXPECT_EQ("/a", m_uris[0]);
+	EXPECT_EQ("/b", m_uris[1]);
+	EXPECT_EQ("/c", m_uris[2]);
+
+	std::string response = output(connection);
+	size_t first = response.find("HTTP/1.1 200 OK");
+	size_t second = response.find("HTTP/1.1 200 OK", first + 1);
+	size_t third = response.find("HTTP/1.1 200 OK", second + 1);
+	EXPECT_NE(std::string::npos, third);
+	EXPECT_NE(std::string::npos, response.find("Connection: close", third));
+	EXPECT_TRUE(connection.closeAfterOutput());
+}
+
+TEST_F(HttpConnectionTest, body)
+{
+	HttpConnection connection(this);
+	std::string input = "POST /a HTTP/1.1\r\nContent-Length: 5\r\n\r\nhello"
+		"POST /b HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n3\r\nwor\r\n2;ext=1\r\nld\r\n0\r\n\r\n";
+	EXPECT_TRUE(connection.feed(input.data(), 20));
+	EXPECT_TRUE(m_bodies.empty());
+	EXPECT_TRUE(connection.feed(input.data() + 20, input.size() - 20));
+
+	ASSERT_EQ(2, (int)m_bodies.size());
+	EXPECT_EQ("hello", m_bodies[0]);
+	EXPECT_EQ("world", m_bodies[1]);
+}
+
+TEST_F(HttpConnectionTest, status)
+{
+	m_response = "Status: 414 Request-URI Too Long\r\n\r\n";
+	HttpConnection connection(this);
+	std::string input = "HEAD / HTTP/1.0\r\nConnection: keep-alive\r\n\r\n";
+	EXPECT_TRUE(connection.feed(input.data(), input.size()));
+
+	std::string response = output(connection);
+	EXPECT_EQ(0u, response.find("HTTP/1.1 414 Request-URI Too Long\r\n"));
+	EXPECT_NE(std::string::npos, response.find("Connection: keep-alive\r\n"));
+	EXPECT_FALSE(connection.closeAfterOutput());
+}
+
+TEST_F(HttpConnectionTest, badRequest)
+{
+	HttpConnection connection(this);
+	std::string input = "GET /\r\n\r\n";
+	EXPECT_TRUE(connection.feed(input.data(), input.size()));
+
+	EXPECT_TRUE(m_uris.empty());
+	EXPECT_EQ(0u, output(connection).find("HTTP/1.1 400 Bad Request\r\n"));
+	EXPECT_TRUE(connection.closeAfterOutput());
+}
+
+TEST_F(HttpConnectionTest, chunkedWithContentLength)
+{
+	HttpConnection connection(this);
+	std::string input = "POST /a HTTP/1.1\r\nContent-Length: 4\r\nTransfer-Encoding: chunked\r\n\r\n"
+		"0\r\n\r\nGET /smuggled HTTP/1.1\r\n\r\n";
+	EXPECT_TRUE(connection.feed(input.data(), input.size()));
+
+	EXPECT_TRUE(m_uris.empty());
+	EXPECT_EQ(0u, output(connection).find("HTTP/1.1 400 Bad Request\r\n"));
+	EXPECT_TRUE(connection.closeAfterOutput());
+}
+
+#endif
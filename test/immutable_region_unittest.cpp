@@ -0,0 +1,86 @@
+#include "stdafx.h"
+#include "gtest.h"
+#include "ncserver/immutable_region.h"
+
+#include <vector>
+
+#ifndef WIN32
+
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+using namespace ncserver;
+
+struct RegionPoint
+{
+	RegionPoint(int x, int y) : x(x), y(y) {}
+	int x;
+	int y;
+};
+
+TEST(ImmutableRegion, allocate)
+{
+	ImmutableRegion region;
+	EXPECT_TRUE(region.allocate(1) == NULL);
+	ASSERT_TRUE(region.init(1000, ImmutableRegion::HugePages_none, true, true));
+	EXPECT_GE(region.capacity(), 1000u);
+
+	char* c = (char*)region.allocate(1);
+	double* d = (double*)region.allocate(sizeof(double), alignof(double));
+	ASSERT_TRUE(c != NULL && d != NULL);
+	EXPECT_EQ(0u, (size_t)d % alignof(double));
+	EXPECT_TRUE(region.contains(d));
+	EXPECT_FALSE(region.contains(&region));
+
+	RegionPoint* point = region.create<RegionPoint>(3, 4);
+	ASSERT_TRUE(point != NULL);
+	EXPECT_EQ(4, point->y);
+	EXPECT_TRUE(region.allocate(region.capacity()) == NULL);
+
+	typedef std::vector<int, RegionAllocator<int> > Ints;
+	Ints* ints = region.create<Ints>(RegionAllocator<int>(&region));
+	ints->reserve(100);
+	for (int i = 0; i < 100; i++)
+		ints->push_back(i);
+	EXPECT_TRUE(region.contains(&(*ints)[99]));
+
+	size_t used = region.used();
+	ASSERT_TRUE(region.seal());
+	EXPECT_TRUE(region.isSealed());
+	EXPECT_EQ(used, region.capacity());
+	EXPECT_TRUE(region.allocate(1) == NULL);
+	EXPECT_EQ(99, ints->back());
+	EXPECT_EQ(0u, region.hugePageBytes());
+}
+
+TEST(ImmutableRegion, writeAfterSeal)
+{
+	ImmutableRegion region;
+	ASSERT_TRUE(region.init(8 << 20));
+	int* value = region.create<int>(42);
+	ASSERT_TRUE(value != NULL);
+	ASSERT_TRUE(region.seal());
+	EXPECT_LE(region.hugePageBytes(), (size_t)(8 << 20));
+
+	// a worker may read it, but not write it
+	pid_t child = fork();
+	if (child == 0)
+		_exit(*value);
+	int status = 0;
+	ASSERT_EQ(child, waitpid(child, &status, 0));
+	EXPECT_TRUE(WIFEXITED(status));
+	EXPECT_EQ(42, WEXITSTATUS(status));
+
+	child = fork();
+	if (child == 0)
+	{
+		*value = 0;
+		_exit(0);
+	}
+	ASSERT_EQ(child, waitpid(child, &status, 0));
+	EXPECT_TRUE(WIFSIGNALED(status));
+	EXPECT_EQ(SIGSEGV, WTERMSIG(status));
+}
+
+#endif
@@ -0,0 +1,101 @@
+#include "stdafx.h"
+#include "gtest.h"
+#include "ncserver/live_dataset.h"
+
+#include <string>
+
+#ifndef WIN32
+#include <signal.h>
+#include <sys/wait.h>
+#endif
+
+using namespace ncserver;
+
+static std::string _text(const LiveDataset::View& view)
+{
+	return view.data() != NULL ? std::string((const char*)view.data(), view.size()) : std::string();
+}
+
+TEST(LiveDataset, publishAndAcquire)
+{
+	LiveDataset dataset;
+	ASSERT_TRUE(dataset.init(16, 2));
+	EXPECT_TRUE(dataset.acquire().data() == NULL);
+	EXPECT_FALSE(dataset.publish("more than sixteen bytes", 23));
+
+	ASSERT_TRUE(dataset.publish("v1", 2));
+	LiveDataset::View first = dataset.acquire();
+	EXPECT_EQ("v1", _text(first));
+	EXPECT_EQ(1u, first.version());
+
+	// a View keeps its version
+	ASSERT_TRUE(dataset.publish("v2", 2));
+	EXPECT_EQ("v1", _text(first));
+	{
+		LiveDataset::View second = dataset.acquire();
+		EXPECT_EQ("v2", _text(second));
+		EXPECT_EQ(2u, dataset.version());
+	}
+
+	// one buffer is the latest version, the other one is held
+	EXPECT_FALSE(dataset.publish("v3", 2));
+	first.release();
+	ASSERT_TRUE(dataset.publish("v3", 2));
+	EXPECT_EQ("v3", _text(dataset.acquire()));
+}
+
+#ifndef WIN32
+
+TEST(LiveDataset, acrossProcesses)
+{
+	LiveDataset dataset;
+	ASSERT_TRUE(dataset.init(16, 2));
+	ASSERT_TRUE(dataset.publish("v1", 2));
+
+	int toManager[2], toWorker[2];
+	ASSERT_EQ(0, pipe(toManager));
+	ASSERT_EQ(0, pipe(toWorker));
+	pid_t worker = fork();
+	if (worker == 0)
+	{
+		// holds v1 until it crashes
+		LiveDataset::View held = dataset.acquire();
+		char c = _text(held) == "v1" ? '1' : '0';
+		if (write(toManager[1], &c, 1) != 1 || read(toWorker[0], &c, 1) != 1)
+			_exit(1);
+
+		// sees what the manager publishes after the fork
+		std::string text = _text(dataset.acquire());
+		c = text == "v2" ? '2' : '0';
+		if (write(toManager[1], &c, 1) != 1)
+			_exit(1);
+		pause();
+		_exit(0);
+	}
+	ASSERT_GT(worker, 0);
+
+	char c = 0;
+	ASSERT_EQ(1, (int)read(toManager[0], &c, 1));
+	EXPECT_EQ('1', c);
+	ASSERT_TRUE(dataset.publish("v2", 2));
+	// the buffer of v1 is held by the worker
+	EXPECT_FALSE(dataset.publish("v3", 2));
+
+	ASSERT_EQ(1, (int)write(toWorker[1], "x", 1));
+	ASSERT_EQ(1, (int)read(toManager[0], &c, 1));
+	EXPECT_EQ('2', c);
+
+	// taken back once the worker is gone
+	kill(worker, SIGKILL);
+	waitpid(worker, NULL, 0);
+	ASSERT_TRUE(dataset.publish("v3", 2));
+	EXPECT_EQ("v3", _text(dataset.acquire()));
+
+	for (int i = 0; i < 2; i++)
+	{
+		close(toManager[i]);
+		close(toWorker[i]);
+	}
+}
+
+#endif
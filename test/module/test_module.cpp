@@ -0,0 +1,33 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include "ncserver/ncserver.h"
+#include "ncserver/handler_module.h"
+
+using namespace ncserver;
+
+/**
+	Loaded by handler_module_unittest.cpp, which passes its path.
+ */
+class TestModule : public HandlerModule
+{
+public:
+	virtual bool start(NcServer* server)
+	{
+		m_started = true;
+		return true;
+	}
+
+	virtual void query(ServiceIo* io, Request* request)
+	{
+		io->addHeaderField("Content-Type: text/plain");
+		io->endHeaderField();
+		io->print("module %s %s", m_started ? "started" : "idle", request->queryString());
+	}
+
+	virtual const char* version() { return "1.0"; }
+
+private:
+	bool m_started = false;
+};
+
+NCSERVER_HANDLER_MODULE(TestModule)
@@ -0,0 +1,60 @@
+#include "stdafx.h"
+#include "gtest.h"
+#include "src/placement.h"
+
+using namespace ncserver;
+
+TEST(Placement, parseIdList)
+{
+	std::vector<int> ids;
+	EXPECT_TRUE(parseIdList("0-3,8,10-11", &ids));
+	EXPECT_EQ("0-3,8,10-11", formatIdList(ids));
+	EXPECT_EQ(7, (int)ids.size());
+
+	// the format of sysfs, with a trailing newline
+	EXPECT_TRUE(parseIdList("2,0-1\n", &ids));
+	EXPECT_EQ("0-2", formatIdList(ids));
+
+	EXPECT_TRUE(parseIdList("5, 3, 5", &ids));
+	EXPECT_EQ("3,5", formatIdList(ids));
+
+	EXPECT_TRUE(parseIdList("", &ids));
+	EXPECT_TRUE(ids.empty());
+	EXPECT_EQ("", formatIdList(ids));
+
+	const char* malformed[] = { "1,", ",1", "3-1", "1-", "a", "1;2", "-1", "0-99999999" };
+	for (size_t i = 0; i < sizeof(malformed) / sizeof(malformed[0]); i++)
+	{
+		EXPECT_FALSE(parseIdList(malformed[i], &ids)) << malformed[i];
+		EXPECT_TRUE(ids.empty());
+	}
+}
+
+#ifndef WIN32
+
+TEST(Placement, placementOfWorker)
+{
+	NcServerConfig::PlacementConfig config;
+	EXPECT_EQ("cpus inherited, memory none", placementOfWorker(config, 0).description());
+
+	config.workerCpus.push_back("0");
+	config.workerCpus.push_back("1-2");
+	config.memoryPolicy = NcServerConfig::MemoryPolicy_bind;
+	EXPECT_EQ("0", formatIdList(placementOfWorker(config, 0).cpus));
+	EXPECT_EQ("1-2", formatIdList(placementOfWorker(config, 1).cpus));
+	EXPECT_EQ("0", formatIdList(placementOfWorker(config, 2).cpus));
+
+	// every machine has node 0 if it has NUMA at all
+	WorkerPlacement placement = placementOfWorker(config, 0);
+	if (!placement.nodes.empty())
+		EXPECT_EQ("cpus 0, memory bind 0", placement.description());
+	config.workerNodes.push_back(0);
+	placement = placementOfWorker(config, 3);
+	if (!placement.nodes.empty())
+	{
+		EXPECT_EQ("0", formatIdList(placement.nodes));
+		EXPECT_FALSE(placement.cpus.empty());
+	}
+}
+
+#endif
@@ -0,0 +1,65 @@
+#include "stdafx.h"
+#include "gtest.h"
+#include "src/process_memory.h"
+
+#ifndef WIN32
+
+#include <algorithm>
+#include <signal.h>
+#include <sys/wait.h>
+
+using namespace ncserver;
+
+TEST(ProcessMemory, memoryOfProcess)
+{
+	long long before = processMemoryKb(getpid());
+	EXPECT_GT(before, 0);
+
+	// touched pages count, whether they are measured as PSS or RSS
+	size_t size = 64 * 1024 * 1024;
+	char* block = (char*)malloc(size);
+	memset(block, 1, size);
+	EXPECT_GT(processMemoryKb(getpid()), before + 32 * 1024);
+	free(block);
+
+	EXPECT_EQ(-1, processMemoryKb(-1));
+}
+
+TEST(ProcessMemory, descendants)
+{
+	int fds[2];
+	ASSERT_EQ(0, pipe(fds));
+	pid_t child = fork();
+	if (child == 0)
+	{
+		// both wait for the pipe to be closed by the test
+		close(fds[1]);
+		pid_t grandchild = fork();
+		char c;
+		if (read(fds[0], &c, 1) < 0)
+			_exit(1);
+		if (grandchild > 0)
+			waitpid(grandchild, NULL, 0);
+		_exit(0);
+	}
+	ASSERT_GT(child, 0);
+
+	// the grandchild as well
+	std::vector<pid_t> descendants;
+	for (int i = 0; i < 100 && descendants.size() < 1; i++)
+	{
+		descendants = descendantProcesses(child);
+		usleep(10 * 1000);
+	}
+	EXPECT_EQ(1u, descendants.size());
+	EXPECT_GT(totalMemoryKb(descendants), 0);
+
+	descendants = descendantProcesses(getpid());
+	EXPECT_TRUE(std::find(descendants.begin(), descendants.end(), child) != descendants.end());
+
+	close(fds[1]);
+	close(fds[0]);
+	waitpid(child, NULL, 0);
+}
+
+#endif
@@ -13,3 +13,23 @@ TEST(Request, basic)
 	EXPECT_STREQ(request.parameterForName("age"), "27");
 	EXPECT_STREQ(request.parameterForName("gender"), "male");
 }
+
+TEST(Request, environment)
+{
+	char* envp[] = {
+		(char*)"REQUEST_METHOD=POST",
+		(char*)"DOCUMENT_URI=/echo",
+		(char*)"CONTENT_TYPE=",
+		(char*)"CONTENT_LENGTH=27",
+		NULL
+	};
+
+	Request request;
+	request.setEnvironment(envp);
+	EXPECT_STREQ(request.requestMethod(), "POST");
+	EXPECT_STREQ(request.documentUri(), "/echo");
+	EXPECT_STREQ(request.contentType(), "");
+	EXPECT_EQ(request.contentLength(), 27u);
+	EXPECT_TRUE(request.isPost());
+	EXPECT_TRUE(request.headerForName("HTTPS") == NULL);
+}
@@ -0,0 +1,190 @@
+#include "stdafx.h"
+#include "gtest.h"
+#include "ncserver/mutable_service_io.h"
+#include "ncserver/nc_log.h"
+#include "src/response_cache.h"
+
+#include <map>
+#include <string>
+
+using namespace ncserver;
+
+/**
+	Query answered into a MutableServiceIo.
+ */
+class RecordedQuery : public AsyncQuery
+{
+public:
+	RecordedQuery(Request* request) { m_request = request; m_finished = false; }
+	virtual ~RecordedQuery() {}
+
+	virtual ServiceIo* io() { return &m_io; }
+	virtual Request* request() { return m_request; }
+	virtual AsyncLoop* loop() { return NULL; }
+	virtual void finish() { m_finished = true; }
+	virtual bool isCancelled() { return false; }
+
+	std::string output() { return std::string((const char*)m_io.buffer(), m_io.bufferSize()); }
+	bool isFinished() { return m_finished; }
+
+private:
+	MutableServiceIo m_io;
+	Request* m_request;
+	bool m_finished;
+};
+
+static std::map<std::string, int> _routes()
+{
+	std::map<std::string, int> routes;
+	routes["/route"] = 60;
+	routes["/tiles/*"] = 30;
+	routes["/tiles/live/*"] = 1;
+	return routes;
+}
+
+TEST(ResponseCache, routesAndKeys)
+{
+	ResponseCache cache;
+	ASSERT_TRUE(cache.init(64 * 1024, 1024, _routes()));
+	EXPECT_EQ(60, cache.ttlForUri("/route"));
+	EXPECT_EQ(0, cache.ttlForUri("/route/more"));
+	EXPECT_EQ(30, cache.ttlForUri("/tiles/1/2/3"));
+	EXPECT_EQ(1, cache.ttlForUri("/tiles/live/1"));
+	EXPECT_EQ(0, cache.ttlForUri("/other"));
+	EXPECT_EQ(0, cache.ttlForUri(NULL));
+
+	char* envp[] = { (char*)"REQUEST_METHOD=GET", (char*)"DOCUMENT_URI=/route", NULL };
+	Request first, second, third;
+	first.setEnvironment(envp);
+	second.setEnvironment(envp);
+	third.setEnvironment(envp);
+	first.setQueryString("to=2&from=1");
+	second.setQueryString("from=1&to=2");
+	third.setQueryString("from=1&to=3");
+
+	// the same parameters in another order
+	EXPECT_EQ(ResponseCache::keyOf(&first), ResponseCache::keyOf(&second));
+	EXPECT_NE(ResponseCache::keyOf(&first), ResponseCache::keyOf(&third));
+	EXPECT_STREQ("2", first.parameterForName("to"));
+}
+
+TEST(ResponseCache, storeAndReplay)
+{
+	ResponseCache cache;
+	ASSERT_TRUE(cache.init(64 * 1024, 1024, _routes()));
+
+	char* envp[] = { (char*)"REQUEST_METHOD=GET", (char*)"DOCUMENT_URI=/route", NULL };
+	Request request;
+	request.setEnvironment(envp);
+	request.setQueryString("from=1&to=2");
+	std::string key = ResponseCache::keyOf(&request);
+
+	RecordedQuery missed(&request);
+	EXPECT_FALSE(cache.replay(key, missed.io()));
+	AsyncQuery* caching = new CachingQuery(&missed, &cache, key, 60, 0);
+	caching->io()->addHeaderField("Content-Type: %s", "text/plain");
+	caching->io()->endHeaderField();
+	caching->io()->print("from %s ", request.parameterForName("from"));
+	caching->io()->write((void*)"to 2", 4);
+	caching->finish();
+	EXPECT_TRUE(missed.isFinished());
+	EXPECT_EQ("Content-Type: text/plain\r\n\r\nfrom 1 to 2", missed.output());
+
+	// the same bytes, without query()
+	RecordedQuery replayed(&request);
+	EXPECT_TRUE(cache.replay(key, replayed.io()));
+	EXPECT_EQ(missed.output(), replayed.output());
+	cache.recordHit(10);
+
+	ResponseCacheStats stats = cache.stats();
+	EXPECT_EQ(1, stats.hits);
+	EXPECT_EQ(1, stats.misses);
+	EXPECT_EQ(1, stats.stores);
+	EXPECT_EQ(10, stats.hitMicros);
+	EXPECT_EQ(1, stats.entries);
+}
+
+TEST(ResponseCache, uncacheable)
+{
+	ResponseCache cache;
+	ASSERT_TRUE(cache.init(64 * 1024, 1024, _routes()));
+	char* envp[] = { (char*)"REQUEST_METHOD=GET", (char*)"DOCUMENT_URI=/route", NULL };
+	Request request;
+	request.setEnvironment(envp);
+
+	// an error
+	request.setQueryString("from=1");
+	std::string key = ResponseCache::keyOf(&request);
+	RecordedQuery failed(&request);
+	AsyncQuery* caching = new CachingQuery(&failed, &cache, key, 60, 0);
+	caching->io()->addHeaderField("Status: 404 Not Found");
+	caching->io()->endHeaderField();
+	caching->finish();
+	RecordedQuery output(&request);
+	EXPECT_FALSE(cache.replay(key, output.io()));
+
+	// larger than a slot
+	request.setQueryString("from=2");
+	key = ResponseCache::keyOf(&request);
+	RecordedQuery large(&request);
+	caching = new CachingQuery(&large, &cache, key, 60, 0);
+	caching->io()->addHeaderField("Status: 200 OK");
+	caching->io()->endHeaderField();
+	caching->io()->print("%s", std::string(2000, 'x').c_str());
+	caching->finish();
+	EXPECT_EQ(2000u + 18, large.output().size());
+	EXPECT_FALSE(cache.replay(key, output.io()));
+
+	// expired
+	request.setQueryString("from=3");
+	key = ResponseCache::keyOf(&request);
+	cache.store(key, "\r\nbody", 0);
+	EXPECT_FALSE(cache.replay(key, output.io()));
+	cache.store(key, "\r\nbody", 1);
+	EXPECT_TRUE(cache.replay(key, output.io()));
+	EXPECT_EQ("\r\nbody", output.output());
+
+	EXPECT_EQ(2, cache.stats().misses);
+	EXPECT_EQ(2, cache.stats().stores);
+}
+
+#ifndef WIN32
+
+TEST(ResponseCache, file)
+{
+	// the one of NcLogTest is gone
+	NcLog::instance().setDelegate(NULL);
+
+	char path[] = "/tmp/ncserver_responses_XXXXXX";
+	int fd = mkstemp(path);
+	ASSERT_GE(fd, 0);
+	close(fd);
+
+	char* envp[] = { (char*)"REQUEST_METHOD=GET", (char*)"DOCUMENT_URI=/route", NULL };
+	Request request;
+	request.setEnvironment(envp);
+	request.setQueryString("from=1");
+	std::string key = ResponseCache::keyOf(&request);
+	{
+		ResponseCache cache;
+		ASSERT_TRUE(cache.init(64 * 1024, 1024, _routes(), path));
+		ASSERT_TRUE(cache.setVersion("graph=v1\n"));
+		cache.store(key, "\r\nv1", 60);
+	}
+
+	// adopted by the next generation of the same data only
+	{
+		ResponseCache cache;
+		ASSERT_TRUE(cache.init(64 * 1024, 1024, _routes(), path));
+		RecordedQuery output(&request);
+		EXPECT_FALSE(cache.replay(key, output.io()));
+		ASSERT_TRUE(cache.setVersion("graph=v1\n"));
+		EXPECT_TRUE(cache.replay(key, output.io()));
+		EXPECT_EQ("\r\nv1", output.output());
+		ASSERT_TRUE(cache.setVersion("graph=v2\n"));
+		EXPECT_FALSE(cache.replay(key, output.io()));
+	}
+	unlink(path);
+}
+
+#endif
@@ -0,0 +1,295 @@
+#include "stdafx.h"
+#include "gtest.h"
+#include "ncserver/shared_cache.h"
+#include "ncserver/nc_log.h"
+
+#include <string>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/wait.h>
+#endif
+
+using namespace ncserver;
+
+TEST(SharedCache, putAndGet)
+{
+	SharedCache cache;
+	std::string value;
+	EXPECT_FALSE(cache.get("key", &value));
+	EXPECT_FALSE(cache.put("key", "value"));
+
+	ASSERT_TRUE(cache.init(64 * 1024, 128));
+	EXPECT_EQ(512u, cache.slotCount());
+	EXPECT_FALSE(cache.get("key", &value));
+	ASSERT_TRUE(cache.put("key", "value"));
+	EXPECT_TRUE(cache.get("key", &value));
+	EXPECT_EQ("value", value);
+
+	// replaces the entry of the same key
+	ASSERT_TRUE(cache.put("key", "another value"));
+	EXPECT_TRUE(cache.get("key", &value));
+	EXPECT_EQ("another value", value);
+
+	// an empty value is cached as well
+	ASSERT_TRUE(cache.put("empty", ""));
+	value = "x";
+	EXPECT_TRUE(cache.get("empty", &value));
+	EXPECT_EQ("", value);
+
+	cache.remove("key");
+	EXPECT_FALSE(cache.get("key", &value));
+	cache.remove("no such key");
+
+	// larger than a slot
+	EXPECT_FALSE(cache.put("large", std::string(cache.maxEntrySize(), 'x')));
+	EXPECT_TRUE(cache.put("large", std::string(cache.maxEntrySize() - 5, 'x')));
+
+	SharedCacheStats stats = cache.stats();
+	EXPECT_EQ(3, stats.hits);
+	EXPECT_EQ(2, stats.misses);
+	EXPECT_EQ(4, stats.insertions);
+	EXPECT_EQ(0, stats.evictions);
+	EXPECT_EQ(2, stats.entries);
+	EXPECT_EQ(512, stats.slots);
+}
+
+TEST(SharedCache, clockEviction)
+{
+	// a single bucket of 8 slots
+	SharedCache cache;
+	ASSERT_TRUE(cache.init(8 * 64, 64));
+	ASSERT_EQ(8u, cache.slotCount());
+
+	char key[16];
+	for (int i = 0; i < 8; i++)
+	{
+		sprintf(key, "key%d", i);
+		ASSERT_TRUE(cache.put(key, key));
+	}
+
+	// key0 has been used since, so key1 goes first
+	std::string value;
+	EXPECT_TRUE(cache.get("key0", &value));
+	ASSERT_TRUE(cache.put("key8", "key8"));
+	EXPECT_TRUE(cache.get("key0", &value));
+	EXPECT_FALSE(cache.get("key1", &value));
+	EXPECT_TRUE(cache.get("key8", &value));
+	EXPECT_EQ("key8", value);
+
+	SharedCacheStats stats = cache.stats();
+	EXPECT_EQ(1, stats.evictions);
+	EXPECT_EQ(8, stats.entries);
+}
+
+TEST(SharedCache, datasetVersions)
+{
+	SharedCache cache;
+	ASSERT_TRUE(cache.init(64 * 1024));
+	EXPECT_FALSE(cache.put("route", "a-b", "graph"));
+	ASSERT_TRUE(cache.setVersion("graph", "v1"));
+	ASSERT_TRUE(cache.put("route", "a-b", "graph"));
+	EXPECT_FALSE(cache.put("speed", "60", "speeds"));
+	ASSERT_TRUE(cache.setVersion("speeds", "v1"));
+	ASSERT_TRUE(cache.put("speed", "60", "speeds"));
+	ASSERT_TRUE(cache.put("name", "A"));
+
+	// the same version again keeps the entries
+	ASSERT_TRUE(cache.setVersion("graph", "v1"));
+	std::string value;
+	EXPECT_TRUE(cache.get("route", &value));
+	EXPECT_EQ("a-b", value);
+
+	// only those of the dataset which has changed are dropped
+	ASSERT_TRUE(cache.setVersion("graph", "v2"));
+	EXPECT_FALSE(cache.get("route", &value));
+	EXPECT_TRUE(cache.get("speed", &value));
+	EXPECT_TRUE(cache.get("name", &value));
+
+	// an unknown version matches nothing put before
+	ASSERT_TRUE(cache.setVersion("speeds", ""));
+	EXPECT_FALSE(cache.get("speed", &value));
+
+	SharedCacheStats stats = cache.stats();
+	EXPECT_EQ(2, stats.invalidations);
+	EXPECT_EQ(1, stats.entries);
+}
+
+#ifndef WIN32
+
+TEST(SharedCache, file)
+{
+	// the one of NcLogTest is gone
+	NcLog::instance().setDelegate(NULL);
+
+	char path[] = "/tmp/ncserver_cache_XXXXXX";
+	int fd = mkstemp(path);
+	ASSERT_GE(fd, 0);
+	close(fd);
+
+	{
+		// an empty file has another layout
+		SharedCache cache;
+		ASSERT_TRUE(cache.init(64 * 1024, 256, path));
+		ASSERT_TRUE(cache.setVersion("graph", "v1"));
+		ASSERT_TRUE(cache.setVersion("speeds", "v1"));
+		ASSERT_TRUE(cache.put("route", "a-b", "graph"));
+		ASSERT_TRUE(cache.put("speed", "60", "speeds"));
+		ASSERT_TRUE(cache.put("name", "A"));
+	}
+
+	// a restart of the same data
+	{
+		SharedCache cache;
+		ASSERT_TRUE(cache.init(64 * 1024, 256, path));
+		EXPECT_EQ(3, cache.stats().entries);
+		std::string value;
+		EXPECT_FALSE(cache.get("route", &value));
+		EXPECT_TRUE(cache.get("name", &value));
+		EXPECT_EQ("A", value);
+
+		ASSERT_TRUE(cache.setVersion("graph", "v1"));
+		ASSERT_TRUE(cache.setVersion("speeds", "v2"));
+		EXPECT_TRUE(cache.get("route", &value));
+		EXPECT_EQ("a-b", value);
+		EXPECT_FALSE(cache.get("speed", &value));
+		EXPECT_EQ(1, cache.stats().invalidations);
+	}
+
+	// another slot size
+	{
+		SharedCache cache;
+		ASSERT_TRUE(cache.init(64 * 1024, 512, path));
+		EXPECT_EQ(0, cache.stats().entries);
+		std::string value;
+		EXPECT_FALSE(cache.get("name", &value));
+	}
+	unlink(path);
+}
+
+TEST(SharedCache, staleLocksOfFile)
+{
+	NcLog::instance().setDelegate(NULL);
+
+	char path[] = "/tmp/ncserver_cache_XXXXXX";
+	int fd = mkstemp(path);
+	ASSERT_GE(fd, 0);
+	close(fd);
+
+	// 32 buckets of 8 slots
+	{
+		SharedCache cache;
+		ASSERT_TRUE(cache.init(64 * 1024, 256, path));
+		ASSERT_TRUE(cache.put("name", "A"));
+	}
+
+	// The locks of a run killed while writing, by thread ids which belong to
+	// a live process after the restart, this one. The buckets follow the
+	// header and the counters, a page each, in a cache line each.
+	fd = open(path, O_RDWR);
+	ASSERT_GE(fd, 0);
+	for (int i = 0; i < 32; i++)
+	{
+		unsigned int sequence = i == 0 ? 1 : 2;
+		long writer = (long)getpid();
+		ASSERT_EQ((ssize_t)sizeof(sequence), pwrite(fd, &sequence, sizeof(sequence), 8192 + i * 64));
+		ASSERT_EQ((ssize_t)sizeof(writer), pwrite(fd, &writer, sizeof(writer), 8192 + i * 64 + 8));
+	}
+	close(fd);
+
+	SharedCache cache;
+	ASSERT_TRUE(cache.init(64 * 1024, 256, path));
+	for (int i = 0; i < 64; i++)
+	{
+		std::string key = "key" + std::to_string(i);
+		ASSERT_TRUE(cache.put(key, "value"));
+		std::string value;
+		EXPECT_TRUE(cache.get(key, &value));
+	}
+	EXPECT_EQ(0, cache.stats().contentions);
+	unlink(path);
+}
+
+TEST(SharedCache, acrossProcesses)
+{
+	SharedCache cache;
+	ASSERT_TRUE(cache.init(256 * 1024));
+	ASSERT_TRUE(cache.put("manager", "before fork"));
+
+	pid_t worker = fork();
+	if (worker == 0)
+	{
+		std::string value;
+		bool ok = cache.get("manager", &value) && value == "before fork";
+		ok = cache.put("worker", "after fork") && ok;
+		_exit(ok ? 0 : 1);
+	}
+	ASSERT_GT(worker, 0);
+
+	int status = 0;
+	ASSERT_EQ(worker, waitpid(worker, &status, 0));
+	EXPECT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+	// written by the worker
+	std::string value;
+	EXPECT_TRUE(cache.get("worker", &value));
+	EXPECT_EQ("after fork", value);
+	EXPECT_EQ(2, cache.stats().hits);
+}
+
+TEST(SharedCache, concurrentWorkers)
+{
+	// few buckets, so that the workers write over each other
+	SharedCache cache;
+	ASSERT_TRUE(cache.init(4 * 8 * 256));
+
+	const int workerCount = 4;
+	pid_t workers[workerCount];
+	for (int w = 0; w < workerCount; w++)
+	{
+		workers[w] = fork();
+		if (workers[w] == 0)
+		{
+			// a value is its key repeated, so that a torn one is told apart
+			bool ok = true;
+			char key[16];
+			std::string value;
+			for (int i = 0; i < 20000; i++)
+			{
+				int k = (i * 7 + w) % 64;
+				sprintf(key, "key%d", k);
+				if (i % 3 == 0)
+				{
+					std::string expected;
+					for (int n = 0; n < k % 10 + 1; n++)
+						expected += key;
+					cache.put(key, expected);
+				}
+				else if (cache.get(key, &value))
+				{
+					std::string expected;
+					for (int n = 0; n < k % 10 + 1; n++)
+						expected += key;
+					ok = ok && value == expected;
+				}
+			}
+			_exit(ok ? 0 : 1);
+		}
+		ASSERT_GT(workers[w], 0);
+	}
+
+	for (int w = 0; w < workerCount; w++)
+	{
+		int status = 0;
+		ASSERT_EQ(workers[w], waitpid(workers[w], &status, 0));
+		EXPECT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+	}
+
+	SharedCacheStats stats = cache.stats();
+	EXPECT_GT(stats.hits, 0);
+	EXPECT_GT(stats.evictions, 0);
+	EXPECT_LE(stats.entries, stats.slots);
+}
+
+#endif
@@ -0,0 +1,605 @@
+#include "stdafx.h"
+#include "gtest.h"
+#include "ncserver/ncserver.h"
+#include "ncserver/dataset_registry.h"
+#include "ncserver/nc_log.h"
+#include "src/util.h"
+
+#ifndef WIN32
+
+#include <atomic>
+#include <fstream>
+#include <thread>
+#include <signal.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+using namespace ncserver;
+
+class SupervisedServer : public NcServer
+{
+public:
+	SupervisedServer() : m_watching(false), m_stopWatching(false) {}
+
+	virtual void query(ServiceIo* io, Request* request)
+	{
+		// keeps its worker busy, so that the manager adds one
+		if (strcmp(request->documentUri(), "/spin") == 0)
+		{
+			long long deadline = monotonicTimeMs() + 5000;
+			while (monotonicTimeMs() < deadline)
+				;
+		}
+		io->addHeaderField("Content-Type: text/plain");
+		io->endHeaderField();
+		io->print("ok");
+	}
+
+protected:
+	virtual bool prepareProcess()
+	{
+		// taken over by a zygote reload as long as they don't change
+		const char* files[] = { "a.bin", "b.bin" };
+		for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++)
+		{
+			if (access(files[i], R_OK) == 0 && datasets()->addFile(files[i], files[i]) < 0)
+				return false;
+		}
+		return true;
+	}
+
+	/**
+		Restart the workers whenever the file "restart" appears.
+	 */
+	virtual bool initUnforkableResources()
+	{
+		// a manager forked while the thread ran, which it doesn't have
+		if (m_watching)
+			writeFile("unclean");
+
+		// like most threads of an application, it leaves the signal mask alone
+		m_watching = true;
+		m_stopWatching = false;
+		std::thread([this]() {
+			while (!m_stopWatching)
+			{
+				if (unlink("restart") == 0)
+					reforkAllChildren();
+				usleep(10 * 1000);
+			}
+			m_watching = false;
+		}).detach();
+		return true;
+	}
+
+	virtual bool cleanupUnforkableResources()
+	{
+		m_stopWatching = true;
+		while (m_watching)
+			usleep(1000);
+		return true;
+	}
+
+	virtual bool startService()
+	{
+		// slow enough for the restart to be seen rolling
+		usleep(100 * 1000);
+		return true;
+	}
+
+private:
+	static void writeFile(const char* path)
+	{
+		FILE* file = fopen(path, "w");
+		if (file != NULL)
+			fclose(file);
+	}
+
+	std::atomic<bool> m_watching;
+	std::atomic<bool> m_stopWatching;
+};
+
+class SupervisionTest : public ::testing::Test
+{
+protected:
+	virtual void SetUp()
+	{
+		char dir[] = "/tmp/ncserver_supervision_XXXXXX";
+		ASSERT_TRUE(mkdtemp(dir) != NULL);
+		m_dir = dir;
+		write(".ncserver.yaml", "server:\n" + workerConfig() + serverConfig() + "listen:\n" + listenConfig());
+		prepareFiles();
+		write(".status", "0");
+
+		m_boss = fork();
+		if (m_boss == 0)
+		{
+			// a group of its own, so that the manager and the workers can be stopped together
+			setpgid(0, 0);
+			// the one of NcLogTest is gone
+			NcLog::instance().setDelegate(NULL);
+			if (chdir(m_dir.c_str()) == 0)
+			{
+				SupervisedServer server;
+				server.runAndFork(0);
+			}
+			_exit(0);
+		}
+		ASSERT_GT(m_boss, 0);
+		setpgid(m_boss, m_boss);
+	}
+
+	virtual void TearDown()
+	{
+		if (m_boss > 0)
+		{
+			kill(-m_boss, SIGTERM);
+			waitpid(m_boss, NULL, 0);
+			long long deadline = monotonicTimeMs() + 5000;
+			while (kill(-m_boss, 0) == 0 && monotonicTimeMs() < deadline)
+				usleep(10 * 1000);
+			kill(-m_boss, SIGKILL);
+		}
+		std::string command = "rm -rf " + m_dir;
+		EXPECT_EQ(0, system(command.c_str()));
+	}
+
+	virtual std::string workerConfig() { return "    workerCount: 2\n    engine: epoll\n    maxRestartingWorkers: 1\n"; }
+	virtual std::string serverConfig() { return ""; }
+	virtual std::string listenConfig() { return "    address: unix:" + m_dir + "/.ncserver.sock\n"; }
+	virtual void prepareFiles() {}
+
+	void write(const char* name, const std::string& content)
+	{
+		std::ofstream file((m_dir + "/" + name).c_str());
+		file << content;
+	}
+
+	std::string read(const char* name)
+	{
+		std::ifstream file((m_dir + "/" + name).c_str());
+		return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+	}
+
+	/**
+		The pids of .workers, which the manager writes whenever it forks.
+	 */
+	std::vector<pid_t> workers()
+	{
+		std::vector<pid_t> pids;
+		std::istringstream lines(read(".workers"));
+		std::string line;
+		while (std::getline(lines, line))
+		{
+			int index, pid;
+			if (line[0] != '#' && sscanf(line.c_str(), "%d %d", &index, &pid) == 2)
+				pids.push_back(pid);
+		}
+		return pids;
+	}
+
+	std::vector<pid_t> waitForWorkers(const std::vector<pid_t>& old)
+	{
+		long long deadline = monotonicTimeMs() + 5000;
+		for (;;)
+		{
+			std::vector<pid_t> pids = workers();
+			if (pids.size() == 2 && pids[0] > 0 && pids[1] > 0 && pids != old)
+				return pids;
+			if (monotonicTimeMs() > deadline)
+				return std::vector<pid_t>();
+			usleep(500);
+		}
+	}
+
+	/**
+		The line of the dataset @a name in .datasets, split by spaces.
+	 */
+	std::vector<std::string> dataset(const char* name)
+	{
+		std::istringstream lines(read(".datasets"));
+		std::string line;
+		while (std::getline(lines, line))
+		{
+			std::istringstream fields(line);
+			std::vector<std::string> result;
+			std::string field;
+			while (fields >> field)
+				result.push_back(field);
+			if (!result.empty() && result[0] == name)
+				return result;
+		}
+		return std::vector<std::string>();
+	}
+
+	static pid_t parentOf(pid_t pid)
+	{
+		std::ifstream file(("/proc/" + std::to_string(pid) + "/stat").c_str());
+		std::string stat((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+		size_t end = stat.rfind(')');
+		int parent = -1;
+		if (end != std::string::npos)
+			sscanf(stat.c_str() + end + 1, " %*c %d", &parent);
+		return parent;
+	}
+
+	int metric(const char* name)
+	{
+		std::istringstream lines(read(".metrics"));
+		std::string line;
+		while (std::getline(lines, line))
+		{
+			if (line.compare(0, strlen(name) + 1, std::string(name) + " ") == 0)
+				return atoi(line.c_str() + strlen(name) + 1);
+		}
+		return -1;
+	}
+
+	std::string m_dir;
+	pid_t m_boss;
+};
+
+TEST_F(SupervisionTest, respawnLatency)
+{
+	std::vector<pid_t> pids = waitForWorkers(std::vector<pid_t>());
+	ASSERT_EQ(2u, pids.size());
+
+	long long crashed = monotonicTimeMs();
+	ASSERT_EQ(0, kill(pids[0], SIGKILL));
+	std::vector<pid_t> respawned = waitForWorkers(pids);
+	long long latency = monotonicTimeMs() - crashed;
+	ASSERT_EQ(2u, respawned.size());
+	EXPECT_NE(pids[0], respawned[0]);
+	EXPECT_EQ(pids[1], respawned[1]);
+
+	// SIGCHLD wakes the manager up, it no longer polls once a second
+	EXPECT_LT(latency, 200);
+	printf("crash to respawn: %lld ms\n", latency);
+}
+
+TEST_F(SupervisionTest, reloadLatency)
+{
+	std::vector<pid_t> pids = waitForWorkers(std::vector<pid_t>());
+	ASSERT_EQ(2u, pids.size());
+
+	long long requested = monotonicTimeMs();
+	ASSERT_EQ(0, kill(m_boss, SIGUSR1));
+	long long deadline = requested + 5000;
+	while (read(".status") != "2" && monotonicTimeMs() < deadline)
+		usleep(500);
+	long long latency = monotonicTimeMs() - requested;
+	EXPECT_EQ("2", read(".status"));
+
+	// the new manager reports back with SIGUSR2, the old one stops on SIGTERM at once
+	EXPECT_LT(latency, 1000);
+	printf("reload: %lld ms\n", latency);
+
+	std::vector<pid_t> reloaded = waitForWorkers(pids);
+	ASSERT_EQ(2u, reloaded.size());
+	EXPECT_NE(pids[0], reloaded[0]);
+	EXPECT_NE(pids[1], reloaded[1]);
+}
+
+TEST_F(SupervisionTest, rollingRestart)
+{
+	std::vector<pid_t> pids = waitForWorkers(std::vector<pid_t>());
+	ASSERT_EQ(2u, pids.size());
+	long long deadline = monotonicTimeMs() + 5000;
+	while (metric("ncserver_workers_serving") != 2 && monotonicTimeMs() < deadline)
+		usleep(1000);
+
+	write("restart", "");
+
+	// one worker at a time, each old one serving until its replacement is ready
+	int minServing = 2;
+	int maxRestarting = 0;
+	std::vector<pid_t> restarted;
+	deadline = monotonicTimeMs() + 5000;
+	while (monotonicTimeMs() < deadline)
+	{
+		int serving = metric("ncserver_workers_serving");
+		int restarting = metric("ncserver_workers_restarting");
+		if (serving >= 0)
+			minServing = std::min(minServing, serving);
+		maxRestarting = std::max(maxRestarting, restarting);
+
+		restarted = workers();
+		if (restarted.size() == 2 && restarted[0] != pids[0] && restarted[1] != pids[1] && restarting == 0 && serving == 2)
+			break;
+		usleep(1000);
+	}
+
+	ASSERT_EQ(2u, restarted.size());
+	EXPECT_NE(pids[0], restarted[0]);
+	EXPECT_NE(pids[1], restarted[1]);
+	EXPECT_EQ(2, minServing);
+	EXPECT_EQ(1, maxRestarting);
+
+	// the predecessors have drained
+	deadline = monotonicTimeMs() + 2000;
+	while ((kill(pids[0], 0) == 0 || kill(pids[1], 0) == 0) && monotonicTimeMs() < deadline)
+		usleep(1000);
+	EXPECT_NE(0, kill(pids[0], 0));
+	EXPECT_NE(0, kill(pids[1], 0));
+}
+
+TEST_F(SupervisionTest, restartWorkersOnSighup)
+{
+	std::vector<pid_t> pids = waitForWorkers(std::vector<pid_t>());
+	ASSERT_EQ(2u, pids.size());
+	pid_t manager = parentOf(pids[0]);
+
+	// what `ncserverctl reload_handler` sends, passed on to the manager
+	ASSERT_EQ(0, kill(m_boss, SIGHUP));
+	std::vector<pid_t> restarted;
+	long long deadline = monotonicTimeMs() + 5000;
+	while (monotonicTimeMs() < deadline)
+	{
+		restarted = workers();
+		if (restarted.size() == 2 && restarted[0] != pids[0] && restarted[1] != pids[1])
+			break;
+		usleep(1000);
+	}
+	ASSERT_EQ(2u, restarted.size());
+	EXPECT_NE(pids[0], restarted[0]);
+	EXPECT_NE(pids[1], restarted[1]);
+	EXPECT_EQ(manager, parentOf(restarted[0]));
+	EXPECT_EQ(0, kill(manager, 0));
+}
+
+class ZygoteReloadTest : public SupervisionTest
+{
+protected:
+	virtual std::string serverConfig() { return "    zygoteReload: true\n"; }
+
+	virtual void prepareFiles()
+	{
+		write("a.bin", "aaaa");
+		write("b.bin", "bbbb");
+	}
+};
+
+TEST_F(ZygoteReloadTest, inheritUnchangedDatasets)
+{
+	std::vector<pid_t> pids = waitForWorkers(std::vector<pid_t>());
+	ASSERT_EQ(2u, pids.size());
+	pid_t manager = parentOf(pids[0]);
+	ASSERT_EQ(m_boss, parentOf(manager));
+
+	// name bytes nodes lookups remoteLookups version inherited
+	std::vector<std::string> a = dataset("a.bin");
+	std::vector<std::string> b = dataset("b.bin");
+	ASSERT_EQ(7u, a.size());
+	ASSERT_EQ(7u, b.size());
+	EXPECT_EQ("0", a[6]);
+	EXPECT_EQ("0", b[6]);
+
+	write("b.bin", "bbbbbb");
+	ASSERT_EQ(0, kill(m_boss, SIGUSR1));
+	long long deadline = monotonicTimeMs() + 5000;
+	while (read(".status") != "2" && monotonicTimeMs() < deadline)
+		usleep(1000);
+	ASSERT_EQ("2", read(".status"));
+
+	std::vector<pid_t> reloaded = waitForWorkers(pids);
+	ASSERT_EQ(2u, reloaded.size());
+	pid_t newManager = parentOf(reloaded[0]);
+	EXPECT_NE(manager, newManager);
+	// forked by the former manager, adopted by the boss when that one exited
+	EXPECT_EQ(m_boss, parentOf(newManager));
+
+	std::vector<std::string> a2 = dataset("a.bin");
+	std::vector<std::string> b2 = dataset("b.bin");
+	ASSERT_EQ(7u, a2.size());
+	ASSERT_EQ(7u, b2.size());
+	EXPECT_EQ(a[5], a2[5]);
+	EXPECT_EQ("1", a2[6]);
+	EXPECT_EQ("6", b2[1]);
+	EXPECT_NE(b[5], b2[5]);
+	EXPECT_EQ("0", b2[6]);
+
+	// the thread of initUnforkableResources() was stopped before the fork
+	EXPECT_NE(0, access((m_dir + "/unclean").c_str(), F_OK));
+}
+
+class StandbyTest : public SupervisionTest
+{
+protected:
+	virtual std::string serverConfig() { return "    standbyWorkerCount: 1\n"; }
+
+	/**
+		The pid of the standby worker in .workers, -1 if none.
+	 */
+	pid_t standby()
+	{
+		std::istringstream lines(read(".workers"));
+		std::string line;
+		while (std::getline(lines, line))
+		{
+			int pid;
+			if (sscanf(line.c_str(), "s0 %d", &pid) == 1)
+				return pid;
+		}
+		return -1;
+	}
+};
+
+TEST_F(StandbyTest, replaceCrashedWorker)
+{
+	std::vector<pid_t> pids = waitForWorkers(std::vector<pid_t>());
+	ASSERT_EQ(2u, pids.size());
+	long long deadline = monotonicTimeMs() + 5000;
+	while ((metric("ncserver_workers_standby") != 1 || metric("ncserver_workers_serving") != 2) && monotonicTimeMs() < deadline)
+		usleep(1000);
+	ASSERT_EQ(1, metric("ncserver_workers_standby"));
+	pid_t spare = standby();
+	ASSERT_GT(spare, 0);
+
+	long long crashed = monotonicTimeMs();
+	ASSERT_EQ(0, kill(pids[0], SIGKILL));
+	deadline = crashed + 5000;
+	// .workers is written before .metrics, which still counts the standby at first
+	while (workers()[0] != spare && monotonicTimeMs() < deadline)
+		usleep(500);
+	while (metric("ncserver_workers_standby") != 0 && monotonicTimeMs() < deadline)
+		usleep(500);
+	while (metric("ncserver_workers_serving") != 2 && monotonicTimeMs() < deadline)
+		usleep(500);
+	long long latency = monotonicTimeMs() - crashed;
+
+	// the standby has run startService() already, which takes 100ms
+	EXPECT_EQ(spare, workers()[0]);
+	EXPECT_EQ(2, metric("ncserver_workers_serving"));
+	EXPECT_LT(latency, 100);
+	printf("crash to serving again: %lld ms\n", latency);
+
+	// and is replaced in turn
+	deadline = monotonicTimeMs() + 5000;
+	while ((standby() == spare || metric("ncserver_workers_standby") != 1) && monotonicTimeMs() < deadline)
+		usleep(1000);
+	EXPECT_NE(spare, standby());
+	EXPECT_EQ(1, metric("ncserver_workers_standby"));
+}
+
+/**
+	A budget below a worker, so that a reload retires each former worker before a new one starts.
+ */
+class StagedReloadTest : public StandbyTest
+{
+protected:
+	virtual std::string serverConfig() { return "    standbyWorkerCount: 1\n    reloadMemoryBudget: 1\n"; }
+};
+
+TEST_F(StagedReloadTest, reloadWithStandby)
+{
+	std::vector<pid_t> pids = waitForWorkers(std::vector<pid_t>());
+	ASSERT_EQ(2u, pids.size());
+	long long deadline = monotonicTimeMs() + 5000;
+	while (metric("ncserver_workers_standby") != 1 && monotonicTimeMs() < deadline)
+		usleep(1000);
+	ASSERT_EQ(1, metric("ncserver_workers_standby"));
+
+	// done long before the former workers would have been given up on after drainTimeout
+	ASSERT_EQ(0, kill(m_boss, SIGUSR1));
+	deadline = monotonicTimeMs() + 10000;
+	while (read(".status").compare(0, 1, "2") != 0 && monotonicTimeMs() < deadline)
+		usleep(10 * 1000);
+	std::string status = read(".status");
+	EXPECT_EQ("2", status.substr(0, 1));
+	EXPECT_NE(std::string::npos, status.find("reload_memory_budget_kb 1024\n"));
+
+	std::vector<pid_t> reloaded = waitForWorkers(pids);
+	ASSERT_EQ(2u, reloaded.size());
+	EXPECT_NE(pids[0], reloaded[0]);
+	EXPECT_NE(pids[1], reloaded[1]);
+}
+
+/**
+	A socket of its own for each worker, whose count follows the load.
+ */
+class ReusePortStandbyTest : public StandbyTest
+{
+protected:
+	virtual void SetUp()
+	{
+		// a free port, which the server listens on next
+		int fd = socket(AF_INET, SOCK_STREAM, 0);
+		memset(&m_address, 0, sizeof(m_address));
+		m_address.sin_family = AF_INET;
+		m_address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		bind(fd, (struct sockaddr*)&m_address, sizeof(m_address));
+		socklen_t length = sizeof(m_address);
+		getsockname(fd, (struct sockaddr*)&m_address, &length);
+		close(fd);
+		StandbyTest::SetUp();
+	}
+
+	virtual std::string workerConfig()
+	{
+		return "    workerCount: 2\n    minWorkerCount: 1\n    maxWorkerCount: 2\n    scaleInterval: 1\n    engine: http\n";
+	}
+
+	virtual std::string listenConfig()
+	{
+		return "    address: 127.0.0.1:" + std::to_string(ntohs(m_address.sin_port)) + "\n    reusePort: true\n";
+	}
+
+	int connectTo(const char* input)
+	{
+		int fd = socket(AF_INET, SOCK_STREAM, 0);
+		EXPECT_EQ(0, connect(fd, (struct sockaddr*)&m_address, sizeof(m_address)));
+		EXPECT_EQ((ssize_t)strlen(input), ::write(fd, input, strlen(input)));
+		return fd;
+	}
+
+	/**
+		Whether every one of @a count connections at once is answered within @a timeoutMs,
+		which it isn't if SO_REUSEPORT gives it to a socket no worker accepts on.
+	 */
+	bool allAnswered(int count, int timeoutMs)
+	{
+		std::vector<int> fds;
+		for (int i = 0; i < count; i++)
+			fds.push_back(connectTo("GET / HTTP/1.1\r\nConnection: close\r\n\r\n"));
+
+		int answered = 0;
+		long long deadline = monotonicTimeMs() + timeoutMs;
+		for (int fd : fds)
+		{
+			struct pollfd pfd;
+			pfd.fd = fd;
+			pfd.events = POLLIN;
+			long long now = monotonicTimeMs();
+			char buffer[256];
+			if (now < deadline && poll(&pfd, 1, (int)(deadline - now)) == 1 && ::read(fd, buffer, sizeof(buffer)) > 0)
+				answered++;
+			close(fd);
+		}
+		return answered == count;
+	}
+
+	bool waitForMetrics(int workerCount, long long timeoutMs)
+	{
+		long long deadline = monotonicTimeMs() + timeoutMs;
+		while (metric("ncserver_workers") != workerCount || metric("ncserver_workers_serving") != workerCount
+			|| metric("ncserver_workers_standby") != 1)
+		{
+			if (monotonicTimeMs() > deadline)
+				return false;
+			usleep(10 * 1000);
+		}
+		return true;
+	}
+
+	struct sockaddr_in m_address;
+};
+
+TEST_F(ReusePortStandbyTest, promoteAfterScaling)
+{
+	// scaled down while idle, and the standby kept none of the retired sockets
+	ASSERT_TRUE(waitForMetrics(1, 10000));
+	EXPECT_TRUE(allAnswered(16, 3000));
+
+	// scaled up while busy, with the socket of the new slot opened after the standby forked
+	pid_t spare = standby();
+	ASSERT_GT(spare, 0);
+	int spinning = connectTo("GET /spin HTTP/1.1\r\nConnection: close\r\n\r\n");
+	long long deadline = monotonicTimeMs() + 5000;
+	while (metric("ncserver_workers") != 2 && monotonicTimeMs() < deadline)
+		usleep(10 * 1000);
+	ASSERT_EQ(2, metric("ncserver_workers"));
+	deadline = monotonicTimeMs() + 1000;
+	while (workers().size() < 2 && monotonicTimeMs() < deadline)
+		usleep(1000);
+	ASSERT_EQ(2u, workers().size());
+	EXPECT_EQ(spare, workers()[1]);
+
+	// those given to the spinning worker are answered once it is done
+	EXPECT_TRUE(allAnswered(16, 8000));
+	close(spinning);
+}
+
+#endif
@@ -0,0 +1,115 @@
+#include "stdafx.h"
+#include "gtest.h"
+#include "ncserver/task_pool.h"
+
+#include <set>
+#include <stdexcept>
+
+using namespace ncserver;
+
+TEST(TaskPool, parallelFor)
+{
+	TaskPool pool(4);
+	std::vector<int> values(100000, 1);
+	std::atomic<long long> sum(0);
+	std::atomic<int> chunks(0);
+
+	pool.parallelFor(0, values.size(), 1000, [&](size_t begin, size_t end) {
+		EXPECT_LE(end - begin, 1000u);
+		long long s = 0;
+		for (size_t i = begin; i < end; i++)
+			s += values[i];
+		sum += s;
+		chunks++;
+	});
+
+	EXPECT_EQ(100000, sum);
+	EXPECT_GE(chunks, 100);
+
+	// empty range
+	pool.parallelFor(5, 5, 1, [&](size_t begin, size_t end) { chunks = -1; });
+	EXPECT_NE(-1, chunks);
+}
+
+TEST(TaskPool, nestedJoin)
+{
+	TaskPool pool(2);
+	std::atomic<int> count(0);
+
+	TaskGroup group(&pool);
+	for (int i = 0; i < 8; i++)
+	{
+		group.spawn([&]() {
+			// more joins than threads, which help each other out
+			TaskGroup inner(&pool);
+			for (int j = 0; j < 8; j++)
+				inner.spawn([&]() { count++; });
+			inner.join();
+		});
+	}
+	group.join();
+
+	EXPECT_EQ(64, count);
+}
+
+TEST(TaskPool, noThread)
+{
+	TaskPool pool(0);
+	EXPECT_EQ(0, pool.threadCount());
+
+	std::thread::id caller = std::this_thread::get_id();
+	bool onCaller = true;
+	int count = 0;
+	{
+		TaskGroup group(&pool);
+		for (int i = 0; i < 10; i++)
+			group.spawn([&]() { onCaller = onCaller && std::this_thread::get_id() == caller; count++; });
+		// joined by the destructor
+	}
+
+	EXPECT_EQ(10, count);
+	EXPECT_TRUE(onCaller);
+}
+
+TEST(TaskPool, stealing)
+{
+	TaskPool pool(4);
+	std::mutex mutex;
+	std::set<std::thread::id> threads;
+
+	pool.parallelFor(0, 64, 1, [&](size_t begin, size_t end) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(2));
+		std::lock_guard<std::mutex> lock(mutex);
+		threads.insert(std::this_thread::get_id());
+	});
+
+	// the pieces spread over the pool rather than staying with the caller
+	EXPECT_GE((int)threads.size(), 3);
+}
+
+TEST(TaskPool, throwingTask)
+{
+	TaskPool pool(2);
+	std::atomic<int> count(0);
+
+	TaskGroup group(&pool);
+	for (int i = 0; i < 8; i++)
+	{
+		group.spawn([&count, i]() {
+			count++;
+			if (i % 2 == 1)
+				throw std::runtime_error("task");
+		});
+	}
+	EXPECT_THROW(group.join(), std::runtime_error);
+	EXPECT_EQ(8, count);
+
+	// the exception is gone with the join which has thrown it
+	group.spawn([&]() { count++; });
+	group.join();
+	EXPECT_EQ(9, count);
+
+	EXPECT_THROW(pool.parallelFor(0, 16, 1, [](size_t begin, size_t end) {
+		throw std::runtime_error("body");
+	}), std::runtime_error);
+}
@@ -0,0 +1,54 @@
+#include "stdafx.h"
+#include "gtest.h"
+#include "src/uring.h"
+
+#ifdef NC_HAS_IO_URING
+
+#include <sys/socket.h>
+
+using namespace ncserver;
+
+TEST(IoUring, receiveIntoBufferRing)
+{
+	IoUring ring;
+	if (!ring.init(8))
+		return;	// not supported by the kernel
+	ASSERT_TRUE(ring.setupBufferRing(0, 4, 16));
+
+	int fds[2];
+	ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+
+	struct io_uring_sqe* sqe = ring.getSqe();
+	ASSERT_TRUE(sqe != NULL);
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = fds[0];
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = 0;
+	sqe->user_data = 42;
+
+	// more than the 4 buffers, so they have to be recycled
+	const char* messages[] = { "hello", "ring", "buffer", "select", "multishot", "recv" };
+	for (size_t i = 0; i < sizeof(messages) / sizeof(messages[0]); i++)
+	{
+		ASSERT_EQ((ssize_t)strlen(messages[i]), write(fds[1], messages[i], strlen(messages[i])));
+		ring.submitAndWait(1000);
+
+		struct io_uring_cqe* cqe = ring.peekCqe();
+		ASSERT_TRUE(cqe != NULL);
+		EXPECT_EQ(42u, cqe->user_data);
+		ASSERT_EQ((int)strlen(messages[i]), cqe->res);
+		ASSERT_TRUE((cqe->flags & IORING_CQE_F_BUFFER) != 0);
+		EXPECT_TRUE((cqe->flags & IORING_CQE_F_MORE) != 0);
+
+		uint16_t bufferId = (uint16_t)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+		EXPECT_EQ(std::string(messages[i]), std::string(ring.buffer(bufferId), cqe->res));
+		ring.cqeSeen();
+		ring.recycleBuffer(bufferId);
+	}
+
+	close(fds[1]);
+	close(fds[0]);
+}
+
+#endif
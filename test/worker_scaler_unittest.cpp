@@ -0,0 +1,132 @@
+#include "stdafx.h"
+#include "gtest.h"
+#include "src/worker_scaler.h"
+
+#ifndef WIN32
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+using namespace ncserver;
+
+TEST(WorkerScaler, cgroupLimits)
+{
+	EXPECT_DOUBLE_EQ(2.0, parseCpuMax("200000 100000\n"));
+	EXPECT_DOUBLE_EQ(0.5, parseCpuMax("50000 100000"));
+	EXPECT_DOUBLE_EQ(0, parseCpuMax("max 100000\n"));
+	// cgroup v1 unlimited quota
+	EXPECT_DOUBLE_EQ(0, parseCpuMax("-1 100000"));
+
+	EXPECT_EQ(512LL << 20, parseMemoryMax("536870912\n"));
+	EXPECT_EQ(0, parseMemoryMax("max\n"));
+	EXPECT_EQ(0, parseMemoryMax("9223372036854771712"));
+
+	CgroupLimits limits;
+	limits.cpus = 0.5;
+	EXPECT_EQ(1, affordableWorkerCount(limits, 1, 0));
+	limits.cpus = 1000;
+	limits.memory = 3LL << 30;
+	EXPECT_EQ(1, affordableWorkerCount(limits, 1000, 0));
+	EXPECT_LE(affordableWorkerCount(limits, 1, 1LL << 30), 3);
+}
+
+TEST(WorkerScaler, resolveWorkerCounts)
+{
+	NcServerConfig::ServerConfig config;
+	resolveWorkerCounts(&config);
+	EXPECT_GE(config.workerCount, 1);
+	EXPECT_EQ(config.workerCount, config.minWorkerCount);
+	EXPECT_EQ(config.workerCount, config.maxWorkerCount);
+
+	config.workerCount = 20;
+	config.minWorkerCount = 2;
+	config.maxWorkerCount = 8;
+	resolveWorkerCounts(&config);
+	EXPECT_EQ(8, config.workerCount);
+}
+
+TEST(WorkerScaler, decide)
+{
+	NcServerConfig::ServerConfig config;
+	config.minWorkerCount = 2;
+	config.maxWorkerCount = 16;
+	config.scaleInterval = 10;
+	WorkerScaler scaler;
+	scaler.init(config);
+	EXPECT_TRUE(scaler.isElastic());
+
+	// 4 workers busy all the time over 10 seconds
+	for (int i = 0; i < 9; i++)
+	{
+		scaler.account(4000, 1000, 0);
+		EXPECT_EQ(4, scaler.decide(4));
+	}
+	scaler.account(4000, 1000, 0);
+	EXPECT_EQ(8, scaler.decide(4));
+	EXPECT_DOUBLE_EQ(1.0, scaler.busyRatio());
+	EXPECT_EQ(1, scaler.scaleUpCount());
+
+	// idle, but connections wait
+	scaler.account(0, 10000, 20);
+	EXPECT_EQ(9, scaler.decide(8));
+
+	// idle
+	scaler.account(0, 10000, 0);
+	EXPECT_EQ(8, scaler.decide(9));
+	EXPECT_EQ(1, scaler.scaleDownCount());
+
+	// in between
+	scaler.account(10000, 10000, 0);
+	EXPECT_EQ(2, scaler.decide(2));
+	EXPECT_DOUBLE_EQ(0.5, scaler.busyRatio());
+
+	// never below minWorkerCount
+	scaler.account(0, 10000, 0);
+	EXPECT_EQ(2, scaler.decide(2));
+}
+
+TEST(WorkerScaler, acceptQueueLength)
+{
+	int tcp = socket(AF_INET, SOCK_STREAM, 0);
+	struct sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	ASSERT_EQ(0, bind(tcp, (struct sockaddr*)&address, sizeof(address)));
+	ASSERT_EQ(0, listen(tcp, 16));
+	socklen_t length = sizeof(address);
+	getsockname(tcp, (struct sockaddr*)&address, &length);
+	EXPECT_EQ(0, acceptQueueLength(tcp));
+
+	int clients[2];
+	for (int i = 0; i < 2; i++)
+	{
+		clients[i] = socket(AF_INET, SOCK_STREAM, 0);
+		ASSERT_EQ(0, connect(clients[i], (struct sockaddr*)&address, sizeof(address)));
+	}
+	EXPECT_EQ(2, acceptQueueLength(tcp));
+	for (int i = 0; i < 2; i++)
+		close(clients[i]);
+	close(tcp);
+
+	int unixSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+	struct sockaddr_un unixAddress;
+	memset(&unixAddress, 0, sizeof(unixAddress));
+	unixAddress.sun_family = AF_UNIX;
+	// abstract, nothing to clean up
+	strcpy(unixAddress.sun_path + 1, "ncserver_test_accept_queue");
+	socklen_t unixLength = offsetof(struct sockaddr_un, sun_path) + 1 + strlen(unixAddress.sun_path + 1);
+	ASSERT_EQ(0, bind(unixSocket, (struct sockaddr*)&unixAddress, unixLength));
+	ASSERT_EQ(0, listen(unixSocket, 16));
+	int client = socket(AF_UNIX, SOCK_STREAM, 0);
+	ASSERT_EQ(0, connect(client, (struct sockaddr*)&unixAddress, unixLength));
+	EXPECT_EQ(1, acceptQueueLength(unixSocket));
+	close(client);
+	close(unixSocket);
+
+	EXPECT_EQ(-1, acceptQueueLength(-1));
+}
+
+#endif